@@ -11,7 +11,8 @@
 #include <esp_log.h>
 
 #include <esp_audio_mem.h>
-#include <basic_rb.h>
+#include <broadcast_rb.h>
+#include <latency_trace.h>
 #include <va_dsp.h>
 #include <common_dsp.h>
 
@@ -26,29 +27,41 @@
 #define PREROLL_LEN (32000 * 0.5)
 #define WAKE_WORD_LEN (32000 * 0.6)
 #define PREROLL_RB_SIZE (PREROLL_LEN + WAKE_WORD_LEN)   /* 32000 * (no.of sec) == (32000 is the number of bytes in 1 second of data) * (500ms of Preroll + 600ms of Alexa wakeword) */
+#define MIC_RB_READERS 2
+
+/* Both the WWE and the application read the same mic samples, each through
+ * its own reader: the WWE task only ever reads wwe_reader, and
+ * common_dsp_stream_audio() only capture_reader. The pre-roll is the
+ * PREROLL_RB_SIZE bytes the WWE reader keeps behind it, so the capture
+ * reader just starts that far behind the wake-word.
+ */
 
 static const char *TAG = "[common_dsp]";
 
 enum preroll_status {
     PREROLL_IDLE,
     PREROLL_PENDING,
-    PREROLL_SENT,
 };
 
 static struct dsp_data {
     int rb_size;
     int task_stack_size;
     bool detect_wakeword;
+    bool capture_active;
     bool ww_detected;
     bool mic_mute_enabled;
     enum preroll_status preroll_status;
     rb_handle_t mic_data;
-    rb_handle_t preroll_data;
+    brb_reader_t wwe_reader;
+    brb_reader_t capture_reader;
+    uint64_t ww_offset;
     QueueHandle_t va_queue;
     TaskHandle_t ww_detection_task_handle;
+    lt_point_t mic_lt;
+    lt_point_t *lt_source;
 } dd;
 
-int common_dsp_stream_audio(uint8_t *buffer, int size, int wait);
+static int common_dsp_read_traced(brb_reader_t reader, uint8_t *buffer, int size, int wait);
 
 static void common_dsp_wake_word_detected()
 {
@@ -60,15 +73,6 @@ static void common_dsp_wake_word_detected()
 }
 
 #ifdef ENABLE_ESP_WWE
-static void send_to_preroll(uint8_t *data, int data_len)
-{
-    int len = rb_available(dd.preroll_data);
-    if (len < data_len) {
-        rb_read(dd.preroll_data, NULL, (data_len - len), portMAX_DELAY);
-    }
-    rb_write(dd.preroll_data, data, data_len, portMAX_DELAY);
-}
-
 static void ww_detection_task(void *arg)
 {
     int frequency = esp_wwe_get_sample_rate();
@@ -81,11 +85,11 @@ static void ww_detection_task(void *arg)
     int priv_ms = 0;
     while(1) {
         if (dd.detect_wakeword) {
-            common_dsp_stream_audio((uint8_t *)buffer, buffer_size, portMAX_DELAY);
-            send_to_preroll((uint8_t *)buffer, buffer_size);
+            common_dsp_read_traced(dd.wwe_reader, (uint8_t *)buffer, buffer_size, portMAX_DELAY);
             dd.ww_detected = esp_wwe_detect(buffer);
             if (dd.ww_detected && dd.detect_wakeword) {
                 dd.ww_detected = false;
+                dd.ww_offset = brb_reader_get_offset(dd.wwe_reader);
                 dd.preroll_status = PREROLL_PENDING;
                 int new_ms = (chunks*audio_chunksize*1000)/frequency;
                 printf("%.2f: Neural network detection triggered output %d.\n", (float)new_ms/1000.0, dd.ww_detected);
@@ -112,32 +116,32 @@ int common_dsp_write_mic_data(void *data, int len, uint32_t wait)
         // vTaskDelay(200/portTICK_RATE_MS);
         return 0;
     }
-    return rb_write(dd.mic_data, (uint8_t *)data, len, wait);
+    int ret = brb_write(dd.mic_data, (uint8_t *)data, len, wait);
+    lt_point_in(&dd.mic_lt, ret, dd.lt_source, LT_STAGE_DSP_RESAMPLE);
+    return ret;
 }
 
-int common_dsp_stream_audio(uint8_t *buffer, int size, int wait)
+void common_dsp_set_trace_source(lt_point_t *source)
 {
-    int read_len = 0;
-    if (dd.detect_wakeword == false) {
-        /* Data is being sent to application. */
-        /* Send pre-roll data first */
-#ifdef ENABLE_ESP_WWE
-        if (dd.preroll_status == PREROLL_PENDING) {
-            read_len = rb_read(dd.preroll_data, buffer, size, 0);
-            if (read_len <= 0) {
-                dd.preroll_status = PREROLL_SENT;
-            }
-        }
-#endif
-        if (dd.preroll_status == PREROLL_IDLE || dd.preroll_status == PREROLL_SENT) {
-            read_len = rb_read(dd.mic_data, buffer, size, wait);
-        }
-    } else {
-        /* Data is being sent to WWE */
-        dd.preroll_status = PREROLL_IDLE;
-        read_len = rb_read(dd.mic_data, buffer, size, wait);
+    dd.lt_source = source;
+}
+
+/* Whichever reader is active is the consumer the capture latency is traced to */
+static int common_dsp_read_traced(brb_reader_t reader, uint8_t *buffer, int size, int wait)
+{
+    int ret = brb_read(reader, buffer, size, wait);
+    if (ret > 0 && (reader == dd.capture_reader) == dd.capture_active) {
+        lt_point_out_at(&dd.mic_lt, brb_reader_get_offset(reader), esp_timer_get_time());
     }
-    return read_len;
+    return ret;
+}
+
+int common_dsp_stream_audio(uint8_t *buffer, int size, int wait)
+{
+    /* Data is sent to the application, starting with the pre-roll if any. Its
+     * reader only holds back the mic writer while capturing.
+     */
+    return common_dsp_read_traced(dd.capture_reader, buffer, size, wait);
 }
 
 int common_dsp_get_ww_len()
@@ -146,13 +150,40 @@ int common_dsp_get_ww_len()
     return WAKE_WORD_LEN;
 }
 
+/* Only the reader currently consuming is allowed to hold back the mic writer */
+static void common_dsp_switch_reader(bool to_capture)
+{
+    if (to_capture == dd.capture_active) {
+        return;
+    }
+    if (to_capture) {
+        uint64_t start = brb_reader_get_offset(dd.wwe_reader);
+        if (dd.preroll_status == PREROLL_PENDING) {
+            /* Clamped to the oldest sample still in the buffer */
+            start = dd.ww_offset > (uint64_t)PREROLL_RB_SIZE ? dd.ww_offset - (uint64_t)PREROLL_RB_SIZE : 0;
+        }
+        brb_reader_seek(dd.capture_reader, start);
+        brb_reader_set_policy(dd.capture_reader, BRB_READER_BLOCK_WRITER);
+        brb_reader_set_policy(dd.wwe_reader, BRB_READER_OVERWRITE);
+    } else {
+        /* WWE carries on from where the application stopped */
+        brb_reader_seek(dd.wwe_reader, brb_reader_get_offset(dd.capture_reader));
+        brb_reader_set_policy(dd.wwe_reader, BRB_READER_BLOCK_WRITER);
+        brb_reader_set_policy(dd.capture_reader, BRB_READER_OVERWRITE);
+    }
+    dd.preroll_status = PREROLL_IDLE;
+    dd.capture_active = to_capture;
+}
+
 void common_dsp_stop_capture()
 {
+    common_dsp_switch_reader(false);
     dd.detect_wakeword = true;
 }
 
 void common_dsp_start_capture()
 {
+    common_dsp_switch_reader(true);
     dd.detect_wakeword = false;
 }
 
@@ -165,7 +196,7 @@ void common_dsp_mic_mute()
 void common_dsp_mic_unmute()
 {
     dd.mic_mute_enabled = false;
-    dd.detect_wakeword = true;
+    common_dsp_stop_capture();
 }
 
 void common_dsp_configure(common_dsp_config_t *cfg)
@@ -191,18 +222,30 @@ void common_dsp_init(QueueHandle_t queue)
         dd.task_stack_size = DEFAULT_WWE_TASK_STACK;
     }
 
-    dd.mic_data = rb_init("mic_data", dd.rb_size);
+    int history = 0;
+#ifdef ENABLE_ESP_WWE
+    history = PREROLL_RB_SIZE;
+#endif
+    dd.mic_data = brb_init("mic_data", dd.rb_size + history, MIC_RB_READERS);
     if (dd.mic_data == NULL) {
-        ESP_LOGE(TAG, "dd.mic_data rb_init failed!");
+        ESP_LOGE(TAG, "dd.mic_data brb_init failed!");
         return;
     }
+    brb_reader_cfg_t wwe_cfg = {
+        .name = "wwe",
+        .policy = BRB_READER_OVERWRITE,
+        .history = history,
+    };
+    brb_reader_cfg_t capture_cfg = {
+        .name = "capture",
+        .policy = BRB_READER_BLOCK_WRITER,
+    };
+    dd.wwe_reader = brb_reader_open(dd.mic_data, &wwe_cfg);
+    dd.capture_reader = brb_reader_open(dd.mic_data, &capture_cfg);
+    dd.capture_active = true;
+    lt_point_init(&dd.mic_lt, LT_STAGE_MIC_RB, LT_STAGE_CAPTURE_TOTAL, 0);
 
 #ifdef ENABLE_ESP_WWE
-    dd.preroll_data = rb_init("preroll", PREROLL_RB_SIZE);
-    if (dd.preroll_data == NULL) {
-        ESP_LOGE(TAG, "dd.preroll_data rb_init failed!");
-        return;
-    }
     dd.va_queue = queue;
 
     if (esp_wwe_init() != ESP_OK) {
@@ -211,8 +254,7 @@ void common_dsp_init(QueueHandle_t queue)
     }
 
     xTaskCreate(&ww_detection_task, "ww_detection", dd.task_stack_size, NULL, (CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT - 1), &dd.ww_detection_task_handle);
-    dd.preroll_status = PREROLL_IDLE;
-    dd.detect_wakeword = true;
+    common_dsp_stop_capture();
 #endif
 
     return;
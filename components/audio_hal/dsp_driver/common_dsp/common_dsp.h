@@ -19,3 +19,7 @@ void common_dsp_mic_unmute();
 void common_dsp_configure(common_dsp_config_t *cfg);
 void common_dsp_init(QueueHandle_t queue);
 int common_dsp_write_mic_data(void *data, int len, uint32_t wait);
+
+struct lt_point;
+/* The latency trace point the mic data comes out of before common_dsp_write_mic_data() */
+void common_dsp_set_trace_source(struct lt_point *source);
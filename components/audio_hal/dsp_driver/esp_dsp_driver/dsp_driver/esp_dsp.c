@@ -14,6 +14,7 @@
 #include <media_hal.h>
 #include <esp_audio_mem.h>
 #include <basic_rb.h>
+#include <latency_trace.h>
 #include <resampling.h>
 #include <va_dsp.h>
 #include <esp_dsp.h>
@@ -30,6 +31,7 @@ static const char *TAG = "[esp_dsp]";
 
 static struct dsp_data {
     rb_handle_t raw_mic_data;
+    lt_point_t raw_mic_lt;
     audio_resample_config_t resample;
     i2s_stream_t *read_i2s_stream;
     int16_t *data_buf;
@@ -58,6 +60,7 @@ static ssize_t dsp_write_cb(void *h, void *data, int len, uint32_t wait)
         return 0;
     }
     sent_len = rb_write(dd.raw_mic_data, data, len, wait);
+    lt_point_in(&dd.raw_mic_lt, sent_len, NULL, LT_STAGE_MAX);
     return sent_len;
 }
 
@@ -66,6 +69,7 @@ static void resample_rb_data_task(void *arg)
     size_t sent_len;
     while(1) {
         sent_len = rb_read(dd.raw_mic_data, (uint8_t *)dd.data_buf, dd.data_sample_size * 2, portMAX_DELAY);
+        lt_point_out(&dd.raw_mic_lt, (int)sent_len);
         sent_len = audio_resample((short *)dd.data_buf, (short *)dd.data_buf, dd.sample_rate, DETECT_SAMP_RATE,
                                     dd.data_sample_size, dd.data_sample_size, dd.channels, &dd.resample);
         if (dd.channels == 2) {
@@ -121,6 +125,8 @@ void esp_dsp_init()
         ESP_LOGE(TAG, "dd.raw_mic_data rb_init failed!");
         goto esp_dsp_init_error_exit;
     }
+    lt_point_init(&dd.raw_mic_lt, LT_STAGE_MIC_RAW_RB, LT_STAGE_MAX, 0);
+    common_dsp_set_trace_source(&dd.raw_mic_lt);
 
     i2s_stream_config_t i2s_cfg;
     memset(&i2s_cfg, 0, sizeof(i2s_cfg));
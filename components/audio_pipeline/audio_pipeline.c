@@ -93,6 +93,639 @@ static esp_err_t audio_pipe_event_cb(void *arg, int event, void *data)
     return ESP_OK;
 }
 
+static bool is_cooperative(audio_pipe_t *p)
+{
+    return p->exec_mode == AUDIO_PIPE_EXEC_COOPERATIVE;
+}
+
+/*
+ * Cooperative mode
+ *
+ * There are no stream or codec tasks: one pipeline task steps every block in turn. The codecs
+ * are written for blocking I/O, so when a block needs data that is not in its input ring yet it
+ * steps the block before it inline (and, symmetrically, steps the block after it when its output
+ * ring is full). This keeps the rings small and the data hot in cache.
+ */
+static void coop_codec_event(audio_codec_t *codec, audio_codec_event_t event)
+{
+    if (codec->event_func.func) {
+        codec->event_func.func(codec->event_func.arg, event, NULL);
+    }
+}
+
+/* Same sequence as the codec task, one codec_process() at a time */
+static audio_step_status_t coop_codec_step(audio_codec_t *codec)
+{
+    if (codec->state != CODEC_STATE_RUNNING) {
+        if (!codec->_run || codec->_destroy) {
+            return AUDIO_STEP_DONE;
+        }
+        if (codec->cfg.codec_open && codec->cfg.codec_open(codec) != ESP_OK) {
+            codec->_run = 0;
+            coop_codec_event(codec, CODEC_EVENT_FAILED);
+            return AUDIO_STEP_DONE;
+        }
+        codec->state = CODEC_STATE_RUNNING;
+        coop_codec_event(codec, CODEC_EVENT_STARTED);
+    }
+
+    if (codec->_run && !codec->_destroy) {
+        if (codec->cfg.codec_process(codec) == CODEC_OK) {
+            return AUDIO_STEP_PROGRESS;
+        }
+        codec->_run = 0;
+    }
+
+    /* Let the consumer know that there is no more data */
+    codec->codec_output.func(codec->codec_output.arg, NULL, 0, 0);
+    if (codec->cfg.codec_close) {
+        codec->cfg.codec_close(codec);
+    }
+    codec->state = CODEC_STATE_STOPPED;
+    coop_codec_event(codec, CODEC_EVENT_STOPPED);
+    return AUDIO_STEP_DONE;
+}
+
+static audio_step_status_t coop_block_step(audio_pipe_block_t *b)
+{
+    switch (b->btype) {
+    case STREAM_BLOCK:
+        return audio_stream_step(b->block_cfg);
+    case CODEC_BLOCK:
+        return coop_codec_step(b->block_cfg);
+    default:
+        /* Custom input callbacks are called by the codec */
+        return AUDIO_STEP_DONE;
+    }
+}
+
+/* Whether `b` should give up waiting on its neighbours: it was stopped, or the pipeline is going away */
+static bool coop_block_stopped(audio_pipe_block_t *b)
+{
+    if (b->coop_destroy) {
+        return true;
+    }
+    if (b->btype == STREAM_BLOCK) {
+        audio_stream_t *stream = (audio_stream_t *) b->block_cfg;
+        return !stream->_run || stream->_destroy;
+    } else if (b->btype == CODEC_BLOCK) {
+        audio_codec_t *codec = (audio_codec_t *) b->block_cfg;
+        return !codec->_run || codec->_destroy;
+    }
+    return false;
+}
+
+/* Input of the block after `arg`: reads its ring, stepping `arg` when empty unless wait is 0 */
+static ssize_t coop_rb_read_cb(void *arg, void *data, int len, uint32_t wait)
+{
+    audio_pipe_block_t *b = (audio_pipe_block_t *) arg;
+    int total = 0;
+
+    while (total < len) {
+        int filled = arb_get_filled(b->rb);
+        if (filled > 0) {
+            int ret = arb_read(b->rb, (uint8_t *) data + total, (filled < len - total) ? filled : len - total, 0);
+            if (ret < 0) {
+                return total ? total : ret;
+            }
+            total += ret;
+            continue;
+        }
+        if (b->rb_eos) {
+            return total ? total : RB_WRITER_FINISHED;
+        }
+        if (wait == 0) {
+            break;
+        }
+        audio_step_status_t status = coop_block_step(b);
+        if (status == AUDIO_STEP_DONE && !b->rb_eos) {
+            return total ? total : RB_FAIL;
+        } else if (status != AUDIO_STEP_PROGRESS) {
+            if (coop_block_stopped(STAILQ_NEXT(b, next))) {
+                return total ? total : RB_FAIL;
+            }
+            vTaskDelay(1);
+        }
+    }
+    return total;
+}
+
+/* Output of block `arg`: writes its ring, stepping the next block when full unless wait is 0 */
+static ssize_t coop_rb_write_cb(void *arg, void *data, int len, uint32_t wait)
+{
+    audio_pipe_block_t *b = (audio_pipe_block_t *) arg;
+    int total = 0;
+
+    if (len <= 0) {
+        b->rb_eos = 1;
+        arb_signal_writer_finished(b->rb);
+        return len;
+    }
+
+    while (total < len) {
+        int available = arb_get_available(b->rb);
+        if (available > 0) {
+            int ret = arb_write(b->rb, (uint8_t *) data + total, (available < len - total) ? available : len - total, 0);
+            if (ret < 0) {
+                return total ? total : ret;
+            }
+            total += ret;
+            continue;
+        }
+        if (wait == 0) {
+            break;
+        }
+        audio_step_status_t status = coop_block_step(STAILQ_NEXT(b, next));
+        if (status == AUDIO_STEP_DONE) {
+            return total ? total : RB_FAIL;
+        } else if (status != AUDIO_STEP_PROGRESS) {
+            if (coop_block_stopped(b)) {
+                return total ? total : RB_FAIL;
+            }
+            vTaskDelay(1);
+        }
+    }
+    return total;
+}
+
+static ssize_t coop_rb_acquire_cb(void *arg, void **data, int len, uint32_t wait)
+{
+    audio_pipe_block_t *b = (audio_pipe_block_t *) arg;
+    int contig_len;
+
+    /* Never wait, the ring is drained by this very task */
+    (void) wait;
+    if (arb_get_available(b->rb) == 0) {
+        return 0;
+    }
+    int ret = arb_write_acquire(b->rb, (uint8_t **) data, &contig_len, 0);
+    return (ret > len) ? len : ret;
+}
+
+static ssize_t coop_rb_commit_cb(void *arg, int len)
+{
+    audio_pipe_block_t *b = (audio_pipe_block_t *) arg;
+    return arb_write_commit(b->rb, len);
+}
+
+/* Point the I/O of every block at the rings of its neighbours */
+static void coop_wire_blocks(audio_pipe_t *p)
+{
+    audio_pipe_block_t *b, *prev = NULL;
+
+    STAILQ_FOREACH(b, &p->pb, next) {
+        audio_io_fn_arg_t input = { .func = coop_rb_read_cb, .arg = prev };
+        audio_io_fn_arg_t output = { .func = coop_rb_write_cb, .arg = b };
+        if (b->btype == STREAM_BLOCK) {
+            audio_stream_t *stream = (audio_stream_t *) b->block_cfg;
+            if (stream->type == STREAM_TYPE_READER) {
+                audio_io_window_fn_arg_t window = {
+                    .acquire = coop_rb_acquire_cb,
+                    .commit = coop_rb_commit_cb,
+                    .arg = b
+                };
+                stream->op.stream_output = output;
+                audio_stream_set_output_window(stream, &window);
+            } else {
+                stream->op.stream_input = input;
+            }
+        } else if (b->btype == CODEC_BLOCK) {
+            audio_codec_t *codec = (audio_codec_t *) b->block_cfg;
+            if (prev && prev->btype != CUSTOM_BLOCK) {
+                codec->codec_input = input;
+            }
+            codec->codec_output = output;
+        }
+        prev = b;
+    }
+}
+
+static void audio_pipe_coop_task(void *arg)
+{
+    audio_pipe_t *p = (audio_pipe_t *) arg;
+    audio_pipe_block_t *b;
+
+    while (1) {
+        xSemaphoreTake(p->coop_sem, portMAX_DELAY);
+        while (!p->coop_destroy) {
+            bool running = false, progress = false;
+            STAILQ_FOREACH(b, &p->pb, next) {
+                audio_step_status_t status = coop_block_step(b);
+                running |= (status != AUDIO_STEP_DONE);
+                progress |= (status == AUDIO_STEP_PROGRESS);
+            }
+            if (!running) {
+                break;
+            }
+            if (!progress) {
+                /* Everyone is waiting on I/O or paused; control calls wake us up early */
+                xSemaphoreTake(p->coop_sem, 1);
+            }
+        }
+        if (p->coop_destroy) {
+            break;
+        }
+    }
+    p->coop_task = NULL;
+    vTaskDelete(NULL);
+}
+
+static esp_err_t audio_pipe_coop_task_create(audio_pipe_t *p)
+{
+    uint32_t stack_size = 0;
+    int priority = 0;
+    audio_pipe_block_t *b;
+
+    STAILQ_FOREACH(b, &p->pb, next) {
+        if (b->btype == STREAM_BLOCK) {
+            audio_stream_t *stream = (audio_stream_t *) b->block_cfg;
+            stack_size = (stream->cfg.task_stack_size > stack_size) ? stream->cfg.task_stack_size : stack_size;
+            priority = (stream->cfg.task_priority > priority) ? stream->cfg.task_priority : priority;
+        } else if (b->btype == CODEC_BLOCK) {
+            audio_codec_t *codec = (audio_codec_t *) b->block_cfg;
+            stack_size = (codec->cfg.task_stack_size > stack_size) ? codec->cfg.task_stack_size : stack_size;
+            priority = (codec->cfg.task_priority > priority) ? codec->cfg.task_priority : priority;
+        }
+    }
+
+    p->coop_sem = xSemaphoreCreateBinary();
+    if (!p->coop_sem) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(audio_pipe_coop_task, p->name, stack_size, p, priority, &p->coop_task) != pdPASS) {
+        ap_e("Error creating pipeline task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void audio_pipe_coop_task_destroy(audio_pipe_t *p)
+{
+    if (p->coop_task) {
+        audio_pipe_block_t *b;
+        STAILQ_FOREACH(b, &p->pb, next) {
+            b->coop_destroy = 1;
+        }
+        p->coop_destroy = 1;
+        xSemaphoreGive(p->coop_sem);
+        while (p->coop_task) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+    }
+    if (p->coop_sem) {
+        vSemaphoreDelete(p->coop_sem);
+        p->coop_sem = NULL;
+    }
+}
+
+static void audio_pipe_coop_wakeup(audio_pipe_t *p)
+{
+    if (is_cooperative(p)) {
+        xSemaphoreGive(p->coop_sem);
+    }
+}
+
+static ssize_t rb_read_cb(void *h, void *data, int len, uint32_t wait)
+{
+    return arb_read((rb_handle_t) h, data, len, wait);
+}
+
+static ssize_t rb_write_cb(void *h, void *data, int len, uint32_t wait)
+{
+    if (len <= 0) {
+        arb_signal_writer_finished((rb_handle_t) h);
+        return len;
+    }
+    return arb_write((rb_handle_t) h, data, len, wait);
+}
+
+/*
+ * Adaptive ring sizing
+ *
+ * The producer of a ring measures it over windows of `window_ticks`: whether it found the ring
+ * full, and the peak fill. The consumer counts the reads that found it empty, and the lowest
+ * fill it saw. At the end of a window the producer picks the new size. A ring is resized by
+ * moving the producer to a new ring and finishing the old one, which the consumer drains before
+ * moving over: the rings themselves are never touched underneath their users.
+ */
+#define ADAPT_CALM_WINDOWS  8   /* Windows with a steady fill level before shrinking */
+
+#define ADAPT_LOAD(x)       __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ADAPT_STORE(x, v)   __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+struct audio_pipe_rb_adapt {
+    const char *rb_name;
+    abstract_rb_cfg_t rb_cfg;
+    audio_pipe_block_t *block;      /* The consumer reads `block->rb` */
+    size_t min_size;
+    size_t max_size;
+    TickType_t window_ticks;
+    rb_handle_t next_rb;            /* Resized ring, taken over by the consumer */
+    size_t next_size;
+    uint32_t window;
+    /* Producer side */
+    rb_handle_t wr_rb;
+    TickType_t window_start;
+    int max_write;
+    int peak_fill;
+    bool hit_full;
+    bool prev_hit_full;
+    uint32_t window_underruns;
+    int calm_windows;
+    /* Consumer side */
+    bool primed;
+    int low_water;
+    uint32_t rd_window;
+    audio_pipe_rb_adapt_stats_t stats;
+};
+
+static size_t adapt_clamp(size_t size, audio_pipe_rb_bounds_t *bounds)
+{
+    if (size < bounds->min_size) {
+        size = bounds->min_size;
+    }
+    if (bounds->max_size && size > bounds->max_size) {
+        size = bounds->max_size;
+    }
+    return size;
+}
+
+static struct audio_pipe_rb_adapt *adapt_alloc(const char *rb_name, rb_handle_t rb, size_t size,
+        audio_pipe_rb_bounds_t *bounds, uint32_t window_ms, abstract_rb_cfg_t *rb_cfg)
+{
+    struct audio_pipe_rb_adapt *a = calloc(1, sizeof(struct audio_pipe_rb_adapt));
+    if (!a) {
+        return NULL;
+    }
+    a->rb_name = rb_name;
+    a->rb_cfg = *rb_cfg;
+    a->min_size = bounds->min_size;
+    a->max_size = bounds->max_size ? bounds->max_size : size;
+    a->window_ticks = pdMS_TO_TICKS(window_ms ? window_ms : AUDIO_PIPE_ADAPT_DEFAULT_WINDOW_MS);
+    if (a->window_ticks == 0) {
+        a->window_ticks = 1;
+    }
+    a->wr_rb = rb;
+    a->stats.size = size;
+    return a;
+}
+
+static void adapt_free(audio_pipe_block_t *b)
+{
+    if (b->adapt->next_rb) {
+        arb_deinit(b->adapt->next_rb);
+    }
+    free(b->adapt);
+    b->adapt = NULL;
+}
+
+/* The ring is going away, keep the sizing state for the next one (see adapt_attach) */
+static void adapt_detach(audio_pipe_block_t *b)
+{
+    struct audio_pipe_rb_adapt *a = b->adapt;
+
+    if (a->next_rb) {
+        arb_deinit(a->next_rb);
+        a->next_rb = NULL;
+    }
+    a->wr_rb = NULL;
+}
+
+/* `b->rb` was recreated after adapt_detach() */
+static void adapt_attach(audio_pipe_block_t *b)
+{
+    b->adapt->wr_rb = b->rb;
+    b->adapt->stats.size = b->rb_size;
+}
+
+/* Pipeline (re)start: both ends are idle */
+static void adapt_restart(audio_pipe_block_t *b)
+{
+    struct audio_pipe_rb_adapt *a = b->adapt;
+
+    if (a->next_rb) {
+        arb_deinit(b->rb);
+        b->rb = a->next_rb;
+        b->rb_size = a->next_size;
+        a->next_rb = NULL;
+    }
+    arb_reset(b->rb);
+    a->wr_rb = b->rb;
+    a->stats.size = b->rb_size;
+    a->window_start = xTaskGetTickCount();
+    a->window_underruns = a->stats.underruns;
+    a->peak_fill = 0;
+    a->hit_full = a->prev_hit_full = false;
+    a->calm_windows = 0;
+    a->primed = false;
+}
+
+static void adapt_resize(struct audio_pipe_rb_adapt *a, size_t new_size)
+{
+    rb_handle_t rb = arb_init(a->rb_name, new_size, a->rb_cfg);
+    if (!rb) {
+        ap_e("%s: no memory to resize to %d bytes", a->rb_name, (int) new_size);
+        return;
+    }
+    ap_d("%s: resized %d -> %d bytes (underruns %d)", a->rb_name, (int) a->stats.size, (int) new_size,
+         a->stats.underruns);
+    if (new_size > a->stats.size) {
+        a->stats.grows++;
+    } else {
+        a->stats.shrinks++;
+    }
+    a->stats.size = new_size;
+    a->next_size = new_size;
+    /* Publish the new ring before the consumer can see the old one finished */
+    ADAPT_STORE(a->next_rb, rb);
+    arb_signal_writer_finished(a->wr_rb);
+    a->wr_rb = rb;
+}
+
+static void adapt_window_end(struct audio_pipe_rb_adapt *a)
+{
+    size_t size = a->stats.size, new_size = size;
+    uint32_t underruns = ADAPT_LOAD(a->stats.underruns);
+    bool consumer_seen = ADAPT_LOAD(a->rd_window) == a->window;
+
+    if (underruns != a->window_underruns && (a->hit_full || a->prev_hit_full)) {
+        /* A burst filled the ring, and then its consumer ran dry: more room would have absorbed it */
+        new_size = (size * 2 < a->max_size) ? size * 2 : a->max_size;
+        a->calm_windows = 0;
+    } else if (consumer_seen && a->peak_fill - ADAPT_LOAD(a->low_water) < (int)size / 4) {
+        /* Most of the ring is never used */
+        if (++a->calm_windows >= ADAPT_CALM_WINDOWS) {
+            new_size = size / 2;
+            if (new_size < (size_t)a->max_write * 2) {
+                new_size = a->max_write * 2;
+            }
+            if (new_size < a->min_size) {
+                new_size = a->min_size;
+            }
+            a->calm_windows = 0;
+        }
+    } else {
+        a->calm_windows = 0;
+    }
+
+    a->window_underruns = underruns;
+    a->prev_hit_full = a->hit_full;
+    a->hit_full = false;
+    a->peak_fill = 0;
+    ADAPT_STORE(a->window, a->window + 1);
+    /* One resize at a time: the consumer has to move over first */
+    if (new_size != size && ADAPT_LOAD(a->next_rb) == NULL) {
+        adapt_resize(a, new_size);
+    }
+}
+
+static ssize_t adapt_rb_write_cb(void *arg, void *data, int len, uint32_t wait)
+{
+    struct audio_pipe_rb_adapt *a = (struct audio_pipe_rb_adapt *) arg;
+
+    if (len <= 0) {
+        arb_signal_writer_finished(a->wr_rb);
+        return len;
+    }
+    if (len > a->max_write) {
+        a->max_write = len;
+    }
+    if (arb_get_available(a->wr_rb) < len) {
+        a->hit_full = true;
+    }
+    int ret = arb_write(a->wr_rb, data, len, wait);
+    int fill = arb_get_filled(a->wr_rb);
+    if (fill > a->peak_fill) {
+        a->peak_fill = fill;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    if (now - a->window_start >= a->window_ticks) {
+        adapt_window_end(a);
+        a->window_start = now;
+    }
+    return ret;
+}
+
+static ssize_t adapt_rb_read_cb(void *arg, void *data, int len, uint32_t wait)
+{
+    struct audio_pipe_rb_adapt *a = (struct audio_pipe_rb_adapt *) arg;
+    audio_pipe_block_t *b = a->block;
+
+    while (1) {
+        int filled = arb_get_filled(b->rb);
+        uint32_t window = ADAPT_LOAD(a->window);
+        if (a->rd_window != window) {
+            ADAPT_STORE(a->low_water, filled);
+            ADAPT_STORE(a->rd_window, window);
+        } else if (filled < a->low_water) {
+            ADAPT_STORE(a->low_water, filled);
+        }
+        if (filled == 0 && a->primed && ADAPT_LOAD(a->next_rb) == NULL) {
+            ADAPT_STORE(a->stats.underruns, a->stats.underruns + 1);
+        }
+
+        int ret = arb_read(b->rb, data, len, wait);
+        rb_handle_t next = ADAPT_LOAD(a->next_rb);
+        if (ret != RB_WRITER_FINISHED || next == NULL) {
+            if (ret > 0) {
+                a->primed = true;
+            }
+            return ret;
+        }
+        /* The producer moved to a resized ring, and everything in the old one has been read */
+        arb_deinit(b->rb);
+        b->rb = next;
+        b->rb_size = a->next_size;
+        ADAPT_STORE(a->next_rb, NULL);
+    }
+}
+
+static audio_io_fn_arg_t pipe_rb_writer(rb_handle_t rb, struct audio_pipe_rb_adapt *a)
+{
+    audio_io_fn_arg_t io = { .func = a ? adapt_rb_write_cb : rb_write_cb, .arg = a ? (void *) a : (void *) rb };
+    return io;
+}
+
+static audio_io_fn_arg_t pipe_rb_reader(rb_handle_t rb, struct audio_pipe_rb_adapt *a)
+{
+    audio_io_fn_arg_t io = { .func = a ? adapt_rb_read_cb : rb_read_cb, .arg = a ? (void *) a : (void *) rb };
+    return io;
+}
+
+static esp_err_t audio_pipe_stream_init(audio_pipe_t *p, audio_stream_t *stream, const char *label,
+                                        audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func)
+{
+    if (is_cooperative(p)) {
+        return audio_stream_init_cooperative(stream, label, stream_io, event_func);
+    }
+    return audio_stream_init(stream, label, stream_io, event_func);
+}
+
+static esp_err_t audio_pipe_codec_init(audio_pipe_t *p, audio_codec_t *codec, const char *label, audio_io_fn_arg_t *codec_input,
+                                       audio_io_fn_arg_t *codec_output, audio_event_fn_arg_t *event_func)
+{
+    if (!is_cooperative(p)) {
+        return audio_codec_init(codec, label, codec_input, codec_output, event_func);
+    }
+    if (codec == NULL || codec->cfg.codec_process == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* The codec base task is not used, the pipeline task calls the derived hooks */
+    codec->label = label;
+    codec->codec_input = *codec_input;
+    codec->codec_output = *codec_output;
+    codec->event_func = *event_func;
+    codec->thread = NULL;
+    codec->ctrl_sem = NULL;
+    codec->state = CODEC_STATE_STOPPED;
+    codec->_run = 0;
+    codec->_pause = 0;
+    codec->_destroy = 0;
+    return ESP_OK;
+}
+
+static void audio_pipe_codec_start(audio_pipe_t *p, audio_codec_t *codec)
+{
+    if (is_cooperative(p)) {
+        codec->_run = 1;
+    } else {
+        audio_codec_start(codec);
+    }
+}
+
+static void audio_pipe_codec_stop(audio_pipe_t *p, audio_codec_t *codec)
+{
+    if (is_cooperative(p)) {
+        codec->_run = 0;
+    } else {
+        audio_codec_stop(codec);
+    }
+}
+
+static void audio_pipe_codec_modify_input_cb(audio_pipe_t *p, audio_codec_t *codec, audio_io_fn_arg_t *io_cb)
+{
+    if (is_cooperative(p)) {
+        codec->codec_input = *io_cb;
+    } else {
+        audio_codec_modify_input_cb(codec, io_cb);
+    }
+}
+
+static void audio_pipe_codec_destroy(audio_pipe_t *p, audio_codec_t *codec)
+{
+    if (!is_cooperative(p)) {
+        audio_codec_destroy(codec);
+        return;
+    }
+    codec->_destroy = 1;
+    coop_codec_event(codec, CODEC_EVENT_DESTROYED);
+    if (codec->state == CODEC_STATE_RUNNING && codec->cfg.codec_close) {
+        codec->cfg.codec_close(codec);
+    }
+    codec->state = CODEC_STATE_DESTROYED;
+}
+
 static audio_pipe_t *audio_pipe_alloc(const char *name)
 {
     if (!name) {
@@ -111,7 +744,8 @@ static audio_pipe_t *audio_pipe_alloc(const char *name)
     return p;
 }
 
-static void _create_insert_block(audio_pipe_t *p, void *cfg, block_type_t type, rb_handle_t rb, size_t rb_size, bool head)
+static audio_pipe_block_t *_create_insert_block(audio_pipe_t *p, void *cfg, block_type_t type, rb_handle_t rb, size_t rb_size,
+        bool head)
 {
     audio_pipe_block_t *b = calloc(1, sizeof(audio_pipe_block_t));
     assert(b);
@@ -130,7 +764,7 @@ static void _create_insert_block(audio_pipe_t *p, void *cfg, block_type_t type,
     p->cnt++;
     unlock(p->lock);
 
-    return;
+    return b;
 }
 
 static esp_err_t audio_pipe_replace_stream(audio_pipe_t *p, audio_pipe_block_t *b, audio_stream_t *new_stream)
@@ -149,7 +783,7 @@ static esp_err_t audio_pipe_replace_stream(audio_pipe_t *p, audio_pipe_block_t *
     }
 
     // Initialize new stream
-    if (audio_stream_init((audio_stream_t *) new_stream, "rstream", &stream_io, &old_stream->event_func) != ESP_OK) {
+    if (audio_pipe_stream_init(p, (audio_stream_t *) new_stream, "rstream", &stream_io, &old_stream->event_func) != ESP_OK) {
         ap_d("Error initializing audio stream");
         unlock(p->lock);
         return ESP_FAIL;
@@ -159,6 +793,9 @@ static esp_err_t audio_pipe_replace_stream(audio_pipe_t *p, audio_pipe_block_t *
 
     lock(p->lock);
     b->block_cfg = new_stream;
+    if (is_cooperative(p)) {
+        coop_wire_blocks(p);
+    }
     unlock(p->lock);
 
     return ESP_OK;
@@ -172,14 +809,14 @@ static esp_err_t audio_pipe_replace_codec(audio_pipe_t *p, audio_pipe_block_t *b
     }
 
     // Initialize new codec with old configuration
-    if (audio_codec_init((audio_codec_t *) new_codec, "rcodec", &old_codec->codec_input, &old_codec->codec_output,
-                         &old_codec->event_func) != ESP_OK) {
+    if (audio_pipe_codec_init(p, (audio_codec_t *) new_codec, "rcodec", &old_codec->codec_input, &old_codec->codec_output,
+                              &old_codec->event_func) != ESP_OK) {
         ap_d("Error initializing audio codec");
         unlock(p->lock);
         return ESP_FAIL;
     }
     // Destroy old codec
-    audio_codec_destroy(old_codec);
+    audio_pipe_codec_destroy(p, old_codec);
     lock(p->lock);
     b->block_cfg = new_codec;
     unlock(p->lock);
@@ -197,10 +834,11 @@ static int _audio_pipe_stop(audio_pipe_t *p)
             audio_stream_stop(b->block_cfg);
             break;
         } else if (b->btype == CODEC_BLOCK) {
-            audio_codec_stop(b->block_cfg);
+            audio_pipe_codec_stop(p, b->block_cfg);
             break;
         }
     }
+    audio_pipe_coop_wakeup(p);
     return ESP_OK;
 }
 
@@ -209,15 +847,19 @@ static int _audio_pipe_start(audio_pipe_t *p)
     audio_pipe_block_t *b;
 
     STAILQ_FOREACH(b, &p->pb, next) {
-        if (b->rb) {
-            rb_reset(b->rb);
+        if (b->adapt && b->rb) {
+            adapt_restart(b);
+        } else if (b->rb) {
+            arb_reset(b->rb);
         }
+        b->rb_eos = 0;
         if (b->btype == STREAM_BLOCK) {
             audio_stream_start(b->block_cfg);
         } else if (b->btype == CODEC_BLOCK) {
-            audio_codec_start(b->block_cfg);
+            audio_pipe_codec_start(p, b->block_cfg);
         }
     }
+    audio_pipe_coop_wakeup(p);
     return ESP_OK;
 }
 
@@ -240,6 +882,7 @@ static int _audio_pipe_resume(audio_pipe_t *p)
     b = STAILQ_LAST(&p->pb, audio_pipe_block, next);
     if (b) {
         audio_stream_resume(b->block_cfg);
+        audio_pipe_coop_wakeup(p);
         return ESP_OK;
     }
     return ESP_FAIL;
@@ -296,15 +939,22 @@ esp_err_t audio_pipe_destroy(audio_pipe_t *p)
     lock(p->lock);
     unlock(p->lock);
 
+    if (is_cooperative(p)) {
+        audio_pipe_coop_task_destroy(p);
+    }
+
     audio_pipe_block_t *b, *save;
     STAILQ_FOREACH_SAFE(b, &p->pb, next, save) {
+        if (b->adapt) {
+            adapt_free(b);
+        }
         if (b->rb) {
-            rb_cleanup(b->rb);
+            arb_deinit(b->rb);
         }
         if (b->btype == STREAM_BLOCK) {
             audio_stream_destroy(b->block_cfg);
         } else if (b->btype == CODEC_BLOCK) {
-            audio_codec_destroy(b->block_cfg);
+            audio_pipe_codec_destroy(p, b->block_cfg);
         }
         free(b);
     }
@@ -359,25 +1009,14 @@ esp_err_t audio_pipe_stop(audio_pipe_t *p)
     return ret;
 }
 
-static ssize_t rb_read_cb(void *h, void *data, int len, uint32_t wait)
-{
-    return rb_read((rb_handle_t) h, data, len, wait);
-}
-
-static ssize_t rb_write_cb(void *h, void *data, int len, uint32_t wait)
-{
-    if (len <= 0) {
-        rb_signal_writer_finished((rb_handle_t) h);
-        return len;
-    }
-    return rb_write((rb_handle_t) h, data, len, wait);
-}
-
 audio_pipe_t *_audio_pipe_create(const char *name, audio_stream_t *istream, size_t rb1_size,
                                  audio_io_fn_arg_t *io_cb, audio_codec_t *codec, size_t rb2_size,
-                                 audio_stream_t *ostream)
+                                 audio_stream_t *ostream, abstract_rb_cfg_t *rb_cfg, audio_pipe_exec_mode_t exec_mode,
+                                 audio_pipe_adaptive_cfg_t *adapt_cfg)
 {
     rb_handle_t rb1 = NULL, rb2 = NULL;
+    struct audio_pipe_rb_adapt *adapt1 = NULL, *adapt2 = NULL;
+    audio_pipe_block_t *b;
     audio_io_fn_arg_t stream_io;
     audio_io_fn_arg_t codec_input, codec_output;
 
@@ -386,6 +1025,8 @@ audio_pipe_t *_audio_pipe_create(const char *name, audio_stream_t *istream, size
         ap_e("failed to create audio pipe");
         return NULL;
     }
+    pipe->rb_cfg = *rb_cfg;
+    pipe->exec_mode = exec_mode;
 
     audio_event_fn_arg_t event_func = {
         .func = audio_pipe_event_cb,
@@ -393,22 +1034,30 @@ audio_pipe_t *_audio_pipe_create(const char *name, audio_stream_t *istream, size
     };
 
     if (istream != NULL) {
-        rb1 = rb_init("rb1", rb1_size);
+        rb1 = arb_init("rb1", rb1_size, pipe->rb_cfg);
         if (!rb1) {
             ap_e("Error creating ring buffer");
             goto err;
         }
+        if (adapt_cfg) {
+            adapt1 = adapt_alloc("rb1", rb1, rb1_size, &adapt_cfg->rb1, adapt_cfg->window_ms, &pipe->rb_cfg);
+            if (!adapt1) {
+                goto err;
+            }
+        }
 
         // Add input stream to pipeline
-        stream_io.func = rb_write_cb;
-        stream_io.arg = rb1;
-        if (audio_stream_init(istream, "ipstream", &stream_io, &event_func) != ESP_OK) {
+        stream_io = pipe_rb_writer(rb1, adapt1);
+        if (audio_pipe_stream_init(pipe, istream, "ipstream", &stream_io, &event_func) != ESP_OK) {
             ap_d("Error initializing audio stream");
             goto err;
         }
-        _create_insert_block(pipe, istream, STREAM_BLOCK, rb1, rb1_size, true);
-        codec_input.func = rb_read_cb;
-        codec_input.arg = rb1;
+        b = _create_insert_block(pipe, istream, STREAM_BLOCK, rb1, rb1_size, true);
+        if (adapt1) {
+            adapt1->block = b;
+            b->adapt = adapt1;
+        }
+        codec_input = pipe_rb_reader(rb1, adapt1);
     } else {
         // Add input callback to pipeline
         codec_input.func = io_cb->func;
@@ -418,35 +1067,56 @@ audio_pipe_t *_audio_pipe_create(const char *name, audio_stream_t *istream, size
 
     // Add codec to audio pipeline
     if (codec != NULL) {
-        rb2 = rb_init("rb2", rb2_size);
+        rb2 = arb_init("rb2", rb2_size, pipe->rb_cfg);
         if (!rb2) {
             ap_e("Error creating ring buffer");
             goto err;
         }
+        if (adapt_cfg) {
+            adapt2 = adapt_alloc("rb2", rb2, rb2_size, &adapt_cfg->rb2, adapt_cfg->window_ms, &pipe->rb_cfg);
+            if (!adapt2) {
+                goto err;
+            }
+        }
 
-        codec_output.func = rb_write_cb;
-        codec_output.arg = rb2;
-        if (audio_codec_init(codec, "codec", &codec_input, &codec_output, &event_func) != ESP_OK) {
+        codec_output = pipe_rb_writer(rb2, adapt2);
+        if (audio_pipe_codec_init(pipe, codec, "codec", &codec_input, &codec_output, &event_func) != ESP_OK) {
             ap_d("Error initializing audio codec");
             goto err;
         }
-        _create_insert_block(pipe, codec, CODEC_BLOCK, rb2, rb2_size, false);
-        stream_io.func = rb_read_cb;
-        stream_io.arg = rb2;
+        b = _create_insert_block(pipe, codec, CODEC_BLOCK, rb2, rb2_size, false);
+        if (adapt2) {
+            adapt2->block = b;
+            b->adapt = adapt2;
+        }
+        stream_io = pipe_rb_reader(rb2, adapt2);
     } else {
-        stream_io.func = rb_read_cb;
-        stream_io.arg = rb1;
+        stream_io = pipe_rb_reader(rb1, adapt1);
     }
 
     // Add output stream to pipeline
-    if (audio_stream_init(ostream, "opstream", &stream_io, &event_func) != ESP_OK) {
+    if (audio_pipe_stream_init(pipe, ostream, "opstream", &stream_io, &event_func) != ESP_OK) {
         ap_d("Error initializing audio stream");
         goto err;
     }
     _create_insert_block(pipe, ostream, STREAM_BLOCK, NULL, 0, false);
 
+    if (is_cooperative(pipe)) {
+        coop_wire_blocks(pipe);
+        if (audio_pipe_coop_task_create(pipe) != ESP_OK) {
+            goto err;
+        }
+    }
+
     return pipe;
 err:
+    /* Sizing state not attached to a block yet */
+    if (adapt1 && !adapt1->block) {
+        free(adapt1);
+    }
+    if (adapt2 && !adapt2->block) {
+        free(adapt2);
+    }
     audio_pipe_destroy(pipe);
     return NULL;
 }
@@ -459,7 +1129,71 @@ audio_pipe_t *audio_pipe_create(const char *name, audio_stream_t *istream, size_
         return NULL;
     }
 
-    return _audio_pipe_create(name, istream, rb1_size, NULL, codec, rb2_size, ostream);
+    abstract_rb_cfg_t rb_cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    return _audio_pipe_create(name, istream, rb1_size, NULL, codec, rb2_size, ostream, &rb_cfg, AUDIO_PIPE_EXEC_THREADED,
+                              NULL);
+}
+
+audio_pipe_t *audio_pipe_create_with_rb_cfg(const char *name, audio_stream_t *istream, size_t rb1_size,
+        audio_codec_t *codec, size_t rb2_size, audio_stream_t *ostream, abstract_rb_cfg_t *rb_cfg)
+{
+    if (name == NULL || istream == NULL || rb1_size == 0 || ostream == NULL || rb_cfg == NULL) {
+        ap_e("Invalid argument/s");
+        return NULL;
+    }
+
+    return _audio_pipe_create(name, istream, rb1_size, NULL, codec, rb2_size, ostream, rb_cfg, AUDIO_PIPE_EXEC_THREADED,
+                              NULL);
+}
+
+audio_pipe_t *audio_pipe_create_adaptive(const char *name, audio_stream_t *istream, audio_codec_t *codec,
+        audio_stream_t *ostream, abstract_rb_cfg_t *rb_cfg, audio_pipe_adaptive_cfg_t *adapt_cfg)
+{
+    if (name == NULL || istream == NULL || ostream == NULL || adapt_cfg == NULL) {
+        ap_e("Invalid argument/s");
+        return NULL;
+    }
+
+    abstract_rb_cfg_t basic_cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    size_t rb1_size = adapt_clamp(RINGBUF1_DEFAULT_SIZE, &adapt_cfg->rb1);
+    size_t rb2_size = adapt_clamp(RINGBUF2_DEFAULT_SIZE, &adapt_cfg->rb2);
+    return _audio_pipe_create(name, istream, rb1_size, NULL, codec, rb2_size, ostream, rb_cfg ? rb_cfg : &basic_cfg,
+                              AUDIO_PIPE_EXEC_THREADED, adapt_cfg);
+}
+
+esp_err_t audio_pipe_get_rb_adapt_stats(audio_pipe_t *p, const char *rb_name, audio_pipe_rb_adapt_stats_t *stats)
+{
+    if (p == NULL || rb_name == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    audio_pipe_block_t *b;
+    lock(p->lock);
+    STAILQ_FOREACH(b, &p->pb, next) {
+        if (b->adapt && strcmp(b->adapt->rb_name, rb_name) == 0) {
+            *stats = b->adapt->stats;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    unlock(p->lock);
+    return ret;
+}
+
+audio_pipe_t *audio_pipe_create_cooperative(const char *name, audio_stream_t *istream, size_t rb1_size,
+        audio_codec_t *codec, size_t rb2_size, audio_stream_t *ostream)
+{
+    if (name == NULL || istream == NULL || ostream == NULL) {
+        ap_e("Invalid argument/s");
+        return NULL;
+    }
+
+    /* Producer and consumer share the pipeline task: the lock-free ring is enough */
+    abstract_rb_cfg_t rb_cfg = DEFAULT_RB_TYPE_LOCKFREE_FUNC();
+    return _audio_pipe_create(name, istream, rb1_size ? rb1_size : RINGBUF_COOP_DEFAULT_SIZE, NULL, codec,
+                              rb2_size ? rb2_size : RINGBUF_COOP_DEFAULT_SIZE, ostream, &rb_cfg, AUDIO_PIPE_EXEC_COOPERATIVE,
+                              NULL);
 }
 
 audio_pipe_t *audio_pipe_create_with_input_cb(const char *name, audio_io_fn_arg_t *io_cb,
@@ -470,7 +1204,9 @@ audio_pipe_t *audio_pipe_create_with_input_cb(const char *name, audio_io_fn_arg_
         return NULL;
     }
 
-    return _audio_pipe_create(name, NULL, RINGBUF1_DEFAULT_SIZE, io_cb, codec, rb2_size, ostream);
+    abstract_rb_cfg_t rb_cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    return _audio_pipe_create(name, NULL, RINGBUF1_DEFAULT_SIZE, io_cb, codec, rb2_size, ostream, &rb_cfg,
+                              AUDIO_PIPE_EXEC_THREADED, NULL);
 }
 
 static audio_pipe_block_t *get_input_block(audio_pipe_t *p)
@@ -545,32 +1281,39 @@ esp_err_t audio_pipe_set_input_stream(audio_pipe_t *p, audio_stream_t *new_strea
             return ret;
         }
     } else {
-        b->rb = rb_init("rb1", b->rb_size);
+        b->rb = arb_init("rb1", b->rb_size, p->rb_cfg);
         if (!b->rb) {
             ap_e("Error creating ring buffer");
             return ESP_ERR_NO_MEM;
         }
+        if (b->adapt) {
+            adapt_attach(b);
+        }
 
         audio_event_fn_arg_t event_func = {
             .func = audio_pipe_event_cb,
             .arg = p
         };
 
-        audio_io_fn_arg_t stream_io;
         // Add input stream to pipeline
-        stream_io.func = rb_write_cb;
-        stream_io.arg = b->rb;
-        if (audio_stream_init(new_stream, "ipstream", &stream_io, &event_func) != ESP_OK) {
+        audio_io_fn_arg_t stream_io = pipe_rb_writer(b->rb, b->adapt);
+        if (audio_pipe_stream_init(p, new_stream, "ipstream", &stream_io, &event_func) != ESP_OK) {
             ap_d("Error initializing audio stream");
             return ESP_FAIL;
         }
         b->block_cfg = new_stream;
         b->btype = STREAM_BLOCK;
-        audio_io_fn_arg_t io_cb = { .func = rb_read_cb, .arg = b->rb };
+        audio_io_fn_arg_t io_cb = pipe_rb_reader(b->rb, b->adapt);
         b = get_codec_block(p);
         if (b != NULL) {
-            audio_codec_modify_input_cb(b->block_cfg, &io_cb);
+            audio_pipe_codec_modify_input_cb(p, b->block_cfg, &io_cb);
         }
+        if (is_cooperative(p)) {
+            lock(p->lock);
+            coop_wire_blocks(p);
+            unlock(p->lock);
+        }
+        ret = ESP_OK;
     }
     return ret;
 }
@@ -612,7 +1355,10 @@ esp_err_t audio_pipe_set_input_cb(audio_pipe_t *p, audio_io_fn_arg_t *io_cb)
     audio_pipe_block_t *b = get_input_block(p);
     if (b->btype == STREAM_BLOCK) {
         audio_stream_destroy(b->block_cfg);
-        rb_cleanup(b->rb);
+        if (b->adapt) {
+            adapt_detach(b);
+        }
+        arb_deinit(b->rb);
         b->block_cfg = NULL;
         b->rb = NULL;
         b->btype = CUSTOM_BLOCK;
@@ -620,7 +1366,7 @@ esp_err_t audio_pipe_set_input_cb(audio_pipe_t *p, audio_io_fn_arg_t *io_cb)
 
     b = get_codec_block(p);
     if (b != NULL) {
-        audio_codec_modify_input_cb(b->block_cfg, io_cb);
+        audio_pipe_codec_modify_input_cb(p, b->block_cfg, io_cb);
     }
     return ESP_OK;
 }
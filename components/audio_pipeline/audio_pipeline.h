@@ -34,7 +34,7 @@
 #include <audio_stream.h>
 #include <audio_codec.h>
 #include <audio_common.h>
-#include <basic_rb.h>
+#include <abstract_rb.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,6 +44,36 @@ extern "C" {
 #define RINGBUF1_DEFAULT_SIZE (8 * 1024)
 #define RINGBUF2_DEFAULT_SIZE (8 * 1024)
 
+/** Default rinbuffer size for cooperative pipelines */
+#define RINGBUF_COOP_DEFAULT_SIZE (2 * 1024)
+
+/** Default window over which adaptive rings are measured */
+#define AUDIO_PIPE_ADAPT_DEFAULT_WINDOW_MS 500
+
+typedef enum {
+    AUDIO_PIPE_EXEC_THREADED = 0,   /* Every stream and codec runs its own task */
+    AUDIO_PIPE_EXEC_COOPERATIVE,    /* All the blocks are stepped round-robin by one pipeline task */
+} audio_pipe_exec_mode_t;
+
+/** Size bounds of an adaptive ring buffer */
+typedef struct {
+    size_t min_size;
+    size_t max_size;
+} audio_pipe_rb_bounds_t;
+
+typedef struct {
+    audio_pipe_rb_bounds_t rb1;     /* Ring after the input stream */
+    audio_pipe_rb_bounds_t rb2;     /* Ring after the codec */
+    uint32_t window_ms;             /* 0 for AUDIO_PIPE_ADAPT_DEFAULT_WINDOW_MS */
+} audio_pipe_adaptive_cfg_t;
+
+typedef struct {
+    size_t size;                    /* Size the producer is writing into */
+    uint32_t grows;
+    uint32_t shrinks;
+    uint32_t underruns;             /* Reads that found the ring empty */
+} audio_pipe_rb_adapt_stats_t;
+
 /** Private members */
 typedef enum {
     AUDIO_PIPE_INITED = 1,
@@ -67,6 +97,9 @@ typedef struct audio_pipe_block {
     void *block_cfg;
     rb_handle_t rb;
     size_t rb_size;
+    uint8_t rb_eos: 1;  /* Cooperative mode: no more data will be written to `rb` */
+    uint8_t coop_destroy: 1;    /* Cooperative mode: the pipeline is going away, stop waiting on neighbours */
+    struct audio_pipe_rb_adapt *adapt;  /* Adaptive pipelines: sizing state of `rb` */
     STAILQ_ENTRY(audio_pipe_block) next;
 } audio_pipe_block_t;
 
@@ -76,8 +109,14 @@ typedef struct {
     audio_pipe_state_t old_state;
     int cnt;
     audio_event_fn_arg_t event_func;
+    abstract_rb_cfg_t rb_cfg;
     xSemaphoreHandle lock;
     STAILQ_HEAD( , audio_pipe_block) pb;
+    audio_pipe_exec_mode_t exec_mode;
+    /* Cooperative mode only */
+    TaskHandle_t coop_task;
+    xSemaphoreHandle coop_sem;
+    uint8_t coop_destroy: 1;
 } audio_pipe_t;
 
 #define lock(x) \
@@ -99,6 +138,46 @@ esp_err_t audio_pipe_destroy(audio_pipe_t *p);
 audio_pipe_t *audio_pipe_create(const char *name, audio_stream_t *istream, size_t rb1_size,
                                 audio_codec_t *codec, size_t rb2_size, audio_stream_t *ostream);
 
+/** Create audio player with given ring buffer type
+ *
+ * Same as \ref audio_pipe_create, but the ring buffers between blocks are created
+ * with `rb_cfg` (e.g. `DEFAULT_RB_TYPE_LOCKFREE_FUNC()`) instead of the basic type.
+ */
+audio_pipe_t *audio_pipe_create_with_rb_cfg(const char *name, audio_stream_t *istream, size_t rb1_size,
+        audio_codec_t *codec, size_t rb2_size, audio_stream_t *ostream, abstract_rb_cfg_t *rb_cfg);
+
+/** Create audio player running in a single task
+ *
+ * Same as \ref audio_pipe_create, but instead of a task per stream and codec, one pipeline task
+ * steps all the blocks round-robin (see \ref audio_stream_step). A block that runs out of input
+ * (or output space) in the middle of a step runs the block before (or after) it inline, so the
+ * ring buffers between the blocks can be small: a size of 0 picks RINGBUF_COOP_DEFAULT_SIZE.
+ *
+ * @note The pipeline task uses the largest stack size and priority of its blocks.
+ */
+audio_pipe_t *audio_pipe_create_cooperative(const char *name, audio_stream_t *istream, size_t rb1_size,
+        audio_codec_t *codec, size_t rb2_size, audio_stream_t *ostream);
+
+/** Create audio player with adaptive ring buffers
+ *
+ * Same as \ref audio_pipe_create_with_rb_cfg (`rb_cfg` may be NULL for the basic type), but the
+ * ring buffers start at their default size clamped to `adapt_cfg`, and are resized within their
+ * bounds as the pipeline runs. A ring doubles when its consumer found it empty shortly after
+ * its producer found it full (a burst it could not absorb), and halves when its fill level
+ * barely moved for several windows.
+ *
+ * The producer moves to a new ring of the new size, and the consumer to it once the old one is
+ * drained, so no data is dropped. Anchors are not carried over.
+ */
+audio_pipe_t *audio_pipe_create_adaptive(const char *name, audio_stream_t *istream, audio_codec_t *codec,
+        audio_stream_t *ostream, abstract_rb_cfg_t *rb_cfg, audio_pipe_adaptive_cfg_t *adapt_cfg);
+
+/** Get the sizing counters of an adaptive ring buffer ("rb1" or "rb2")
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the pipeline has no such adaptive ring
+ */
+esp_err_t audio_pipe_get_rb_adapt_stats(audio_pipe_t *p, const char *rb_name, audio_pipe_rb_adapt_stats_t *stats);
+
 /** Create audio player with input callback
  *
  * Create audio pipeline with input callback (user defined).
@@ -0,0 +1,176 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-in for the audio_codec base class, which only ships as part of
+ * the prebuilt libcodecs.a. It drives a derived codec the same way
+ * audio_stream drives a derived stream: one task, started/stopped through
+ * `ctrl_sem`, calling `codec_process` until it is done.
+ */
+
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <audio_codec.h>
+
+static const char *TAG = "[codec_host]";
+
+void audio_codec_generate_event(audio_codec_t *codec, audio_codec_event_t event, void *data)
+{
+    if (codec->event_func.func) {
+        codec->event_func.func(codec->event_func.arg, event, data);
+    }
+}
+
+static void audio_codec_task(void *arg)
+{
+    audio_codec_t *codec = (audio_codec_t *) arg;
+
+    while (1) {
+        codec->state = CODEC_STATE_STOPPED;
+        xSemaphoreTake(codec->ctrl_sem, portMAX_DELAY);
+        if (codec->_destroy) {
+            break;
+        }
+        if (!codec->_run) {
+            continue;
+        }
+        if (!codec->_pause && codec->cfg.codec_open && codec->cfg.codec_open(codec) != ESP_OK) {
+            audio_codec_generate_event(codec, CODEC_EVENT_FAILED, NULL);
+            continue;
+        }
+        codec->_pause = 0;
+        codec->state = CODEC_STATE_RUNNING;
+        audio_codec_generate_event(codec, CODEC_EVENT_STARTED, NULL);
+        while (codec->_run && !codec->_pause && !codec->_destroy) {
+            if (codec->cfg.codec_process(codec) != CODEC_OK) {
+                codec->_run = 0;
+            }
+        }
+        if (codec->_destroy) {
+            break;
+        }
+        if (codec->_pause) {
+            codec->state = CODEC_STATE_PAUSED;
+            audio_codec_generate_event(codec, CODEC_EVENT_PAUSED, NULL);
+            continue;
+        }
+        /* Let the consumer know that there is no more data */
+        codec->codec_output.func(codec->codec_output.arg, NULL, 0, codec->cfg.output_wait_ticks);
+        if (codec->cfg.codec_close) {
+            codec->cfg.codec_close(codec);
+        }
+        audio_codec_generate_event(codec, CODEC_EVENT_STOPPED, NULL);
+    }
+
+    audio_codec_generate_event(codec, CODEC_EVENT_DESTROYED, NULL);
+    codec->thread = NULL;
+    codec->state = CODEC_STATE_DESTROYED;
+    vTaskDelete(NULL);
+}
+
+esp_err_t audio_codec_init(audio_codec_t *codec, const char *label, audio_io_fn_arg_t *codec_input,
+                           audio_io_fn_arg_t *codec_output, audio_event_fn_arg_t *event_func)
+{
+    if (codec == NULL || codec_input == NULL || codec_output == NULL || codec->cfg.codec_process == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    codec->label = label;
+    memcpy(&codec->codec_input, codec_input, sizeof(audio_io_fn_arg_t));
+    memcpy(&codec->codec_output, codec_output, sizeof(audio_io_fn_arg_t));
+    if (event_func) {
+        memcpy(&codec->event_func, event_func, sizeof(audio_event_fn_arg_t));
+    }
+    codec->ctrl_sem = xSemaphoreCreateCounting(1, 0);
+    configASSERT(codec->ctrl_sem);
+    codec->state = CODEC_STATE_INIT;
+    codec->_run = 0;
+    codec->_pause = 0;
+    codec->_destroy = 0;
+
+    if (xTaskCreate(audio_codec_task, label, codec->cfg.task_stack_size, codec,
+                    codec->cfg.task_priority, &codec->thread) != pdPASS) {
+        ESP_LOGE(TAG, "Error in creating codec task");
+        vSemaphoreDelete(codec->ctrl_sem);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_modify_input_cb(audio_codec_t *codec, audio_io_fn_arg_t *codec_input)
+{
+    if (codec == NULL || codec_input == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(&codec->codec_input, codec_input, sizeof(audio_io_fn_arg_t));
+    return ESP_OK;
+}
+
+audio_codec_type_t audio_codec_get_identifier(audio_codec_t *codec)
+{
+    return codec ? codec->identifier : (audio_codec_type_t) -1;
+}
+
+esp_err_t audio_codec_start(audio_codec_t *codec)
+{
+    codec->_run = 1;
+    codec->_pause = 0;
+    xSemaphoreGive(codec->ctrl_sem);
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_stop(audio_codec_t *codec)
+{
+    codec->_run = 0;
+    codec->_pause = 0;
+    xSemaphoreGive(codec->ctrl_sem);
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_pause(audio_codec_t *codec)
+{
+    codec->_pause = 1;
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_resume(audio_codec_t *codec)
+{
+    codec->_pause = 0;
+    xSemaphoreGive(codec->ctrl_sem);
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_destroy(audio_codec_t *codec)
+{
+    if (codec == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    codec->_destroy = 1;
+    xSemaphoreGive(codec->ctrl_sem);
+    while (codec->state != CODEC_STATE_DESTROYED) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    vSemaphoreDelete(codec->ctrl_sem);
+    codec->ctrl_sem = NULL;
+    return ESP_OK;
+}
+
+esp_err_t audio_codec_set_offset(audio_codec_t *codec, int offset_in_ms)
+{
+    if (codec == NULL || codec->cfg.codec_set_offset == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return codec->cfg.codec_set_offset(codec, offset_in_ms);
+}
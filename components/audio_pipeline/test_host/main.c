@@ -0,0 +1,631 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* fs_stream -> rb -> [pass-through codec -> rb] -> hollow_stream, on host, threaded and cooperative */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <audio_pipeline.h>
+#include <fs_stream.h>
+#include <hollow_stream.h>
+
+#define BENCH_FILE_SIZE     (16 * 1024 * 1024)
+#define TEST_FILE_SIZE      (512 * 1024 + 77)
+#define BENCH_RB_SIZE       (8 * 1024)
+#define MAX_BLOCKS          (BENCH_FILE_SIZE / 256 + 2)
+
+/* Simulated network into a sink playing out at a fixed rate */
+#define JITTER_FILE_SIZE    (1024 * 1024)
+#define JITTER_SINK_RATE    (1024 * 1024)       /* Bytes per second */
+#define JITTER_CHUNK        1024
+#define JITTER_STALL_EVERY  (128 * 1024)        /* Source bytes between two network stalls */
+#define JITTER_STALL_MS     30
+#define JITTER_SLACK_NS     (10 * 1000000ULL)   /* A chunk later than that is an underrun, above host scheduling noise */
+
+struct pipe_mode {
+    const char *exec;
+    const char *rb_type;
+    abstract_rb_cfg_t rb_cfg;
+    bool cooperative;   /* audio_pipe_create_cooperative(), which picks its own rings */
+};
+
+static struct pipe_mode modes[] = {
+    { "threaded", "basic", DEFAULT_RB_TYPE_BASIC_FUNC(), false },
+    { "threaded", "lockfree", DEFAULT_RB_TYPE_LOCKFREE_FUNC(), false },
+    { "cooperative", "lockfree", DEFAULT_RB_TYPE_LOCKFREE_FUNC(), true },
+};
+
+static const int block_sizes[] = { 512, 2048, 8192 };
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t context_switches()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/* Pass-through codec: copies its input to its output in blocks */
+typedef struct {
+    audio_codec_t base;
+    uint8_t *buf;
+    int buf_size;
+} passthrough_codec_t;
+
+static esp_err_t passthrough_process(audio_codec_t *codec)
+{
+    passthrough_codec_t *pt = (passthrough_codec_t *) codec;
+
+    ssize_t len = codec->codec_input.func(codec->codec_input.arg, pt->buf, pt->buf_size, codec->cfg.input_wait_ticks);
+    if (len <= 0) {
+        return CODEC_DONE;
+    }
+    if (codec->codec_output.func(codec->codec_output.arg, pt->buf, len, codec->cfg.output_wait_ticks) < 0) {
+        return CODEC_FAIL;
+    }
+    return CODEC_OK;
+}
+
+static passthrough_codec_t *passthrough_codec_create(int buf_size)
+{
+    passthrough_codec_t *pt = calloc(1, sizeof(passthrough_codec_t));
+    assert(pt);
+    pt->buf = malloc(buf_size);
+    assert(pt->buf);
+    pt->buf_size = buf_size;
+    pt->base.cfg.task_stack_size = 4096;
+    pt->base.cfg.task_priority = 5;
+    pt->base.cfg.codec_process = passthrough_process;
+    pt->base.cfg.input_wait_ticks = portMAX_DELAY;
+    pt->base.cfg.output_wait_ticks = portMAX_DELAY;
+    pt->base.identifier = CODEC_TYPE_WAV_DECODER;
+    return pt;
+}
+
+static void passthrough_codec_destroy(passthrough_codec_t *pt)
+{
+    free(pt->buf);
+    free(pt);
+}
+
+/* Per-block latency: the source side records when each block was read from
+ * the file, the sink side when the last byte of that block came out.
+ */
+struct block_mark {
+    uint64_t end_offset;
+    uint64_t read_ns;
+};
+
+static struct bench_run {
+    ssize_t (*fs_read)(void *stream, void *buf, ssize_t len);
+    struct block_mark *marks;
+    uint64_t *latencies;
+    int max_marks;
+    int nr_marks;
+    int nr_latencies;
+    uint64_t src_bytes;
+    uint64_t sink_bytes;
+    uint64_t total_bytes;
+    const uint8_t *expected;    /* Compare the output against this, if set */
+    int mismatch;
+    SemaphoreHandle_t done;
+} run;
+
+static ssize_t bench_source_read(void *stream, void *buf, ssize_t len)
+{
+    ssize_t ret = run.fs_read(stream, buf, len);
+    if (ret > 0) {
+        run.src_bytes += ret;
+        int n = run.nr_marks;
+        if (n == run.max_marks) {
+            /* Short reads (a window at the end of a ring): fold into the last block */
+            run.marks[n - 1].end_offset = run.src_bytes;
+            return ret;
+        }
+        run.marks[n].end_offset = run.src_bytes;
+        run.marks[n].read_ns = now_ns();
+        __atomic_store_n(&run.nr_marks, n + 1, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+static ssize_t bench_sink_write(void *stream, void *buf, ssize_t len)
+{
+    (void) stream;
+    uint64_t now = now_ns();
+
+    if (run.expected && memcmp(buf, run.expected + run.sink_bytes, len) != 0) {
+        run.mismatch = 1;
+    }
+    run.sink_bytes += len;
+
+    int nr_marks = __atomic_load_n(&run.nr_marks, __ATOMIC_ACQUIRE);
+    while (run.nr_latencies < nr_marks && run.marks[run.nr_latencies].end_offset <= run.sink_bytes) {
+        run.latencies[run.nr_latencies] = now - run.marks[run.nr_latencies].read_ns;
+        run.nr_latencies++;
+    }
+    if (run.sink_bytes == run.total_bytes) {
+        xSemaphoreGive(run.done);
+    }
+    return len;
+}
+
+struct bench_result {
+    double mbps;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint64_t ctx_switches;
+    uint64_t blocking_waits;
+    size_t rb_bytes;
+};
+
+static int run_pipeline(const char *path, uint64_t file_size, struct pipe_mode *mode, bool with_codec,
+                        int block_size, const uint8_t *expected, struct bench_result *res)
+{
+    fs_stream_config_t fs_cfg = {0};
+    snprintf(fs_cfg.file_path, sizeof(fs_cfg.file_path), "%s", path);
+    fs_stream_t *fs = fs_reader_stream_create(&fs_cfg);
+    fs->base.cfg.buf_size = block_size;
+    fs->base.cfg.task_stack_size = 4096;
+
+    hollow_stream_config_t hollow_cfg = {
+        .hollow_stream_write_cb = bench_sink_write,
+        .hollow_stream_stack_sz = 4096,
+        .hollow_stream_task_priority = 5,
+        .hollow_stream_buf_size = block_size,
+    };
+    hollow_stream_t *hollow = hollow_stream_create(&hollow_cfg);
+    passthrough_codec_t *codec = with_codec ? passthrough_codec_create(block_size) : NULL;
+
+    memset(&run, 0, sizeof(run));
+    run.fs_read = fs->base.cfg.derived_read;
+    fs->base.cfg.derived_read = bench_source_read;
+    run.max_marks = 2 * (file_size / block_size + 2);
+    run.marks = calloc(run.max_marks, sizeof(struct block_mark));
+    run.latencies = calloc(run.max_marks, sizeof(uint64_t));
+    assert(run.marks && run.latencies);
+    run.total_bytes = file_size;
+    run.expected = expected;
+    run.done = xSemaphoreCreateBinary();
+
+    audio_pipe_t *pipe;
+    if (mode->cooperative) {
+        pipe = audio_pipe_create_cooperative("bench", &fs->base, 0, codec ? &codec->base : NULL, 0, &hollow->base);
+    } else {
+        pipe = audio_pipe_create_with_rb_cfg("bench", &fs->base, BENCH_RB_SIZE,
+                                             codec ? &codec->base : NULL, BENCH_RB_SIZE, &hollow->base, &mode->rb_cfg);
+    }
+    if (pipe == NULL) {
+        return -1;
+    }
+    audio_pipe_block_t *b;
+    res->rb_bytes = 0;
+    STAILQ_FOREACH(b, &pipe->pb, next) {
+        res->rb_bytes += b->rb ? b->rb_size : 0;
+    }
+
+    uint64_t csw = context_switches();
+    uint64_t waits = host_task_get_block_count();
+    uint64_t start = now_ns();
+    audio_pipe_start(pipe);
+    BaseType_t finished = xSemaphoreTake(run.done, 30000 / portTICK_PERIOD_MS);
+    uint64_t elapsed = now_ns() - start;
+    res->ctx_switches = context_switches() - csw;
+    res->blocking_waits = host_task_get_block_count() - waits;
+
+    /* The streams stop by themselves at the end of the file */
+    while (audio_stream_get_state(&hollow->base) == STREAM_STATE_RUNNING) {
+        vTaskDelay(1);
+    }
+    audio_pipe_destroy(pipe);
+    fs_stream_destroy(fs);
+    hollow_stream_destroy(hollow);
+    free(hollow);
+    if (codec) {
+        passthrough_codec_destroy(codec);
+    }
+    vSemaphoreDelete(run.done);
+
+    int ret = 0;
+    if (finished != pdTRUE || run.mismatch || run.nr_latencies == 0) {
+        ret = -1;
+    } else {
+        qsort(run.latencies, run.nr_latencies, sizeof(uint64_t), cmp_u64);
+        res->mbps = (double)file_size / (1024 * 1024) / (elapsed / 1e9);
+        res->p50_ns = run.latencies[run.nr_latencies / 2];
+        res->p99_ns = run.latencies[(run.nr_latencies * 99) / 100];
+        res->max_ns = run.latencies[run.nr_latencies - 1];
+    }
+    free(run.marks);
+    free(run.latencies);
+    return ret;
+}
+
+/* Source with optional network stalls, sink consuming at JITTER_SINK_RATE */
+static struct jitter_run {
+    ssize_t (*fs_read)(void *stream, void *buf, ssize_t len);
+    bool stalls;
+    uint64_t src_bytes;
+    uint64_t next_stall;
+    uint64_t sink_bytes;
+    uint64_t total_bytes;
+    const uint8_t *expected;
+    int mismatch;
+    uint64_t next_due_ns;
+    int underruns;
+    audio_pipe_t *pipe;
+    uint64_t rb_bytes_sum;
+    uint64_t samples;
+    SemaphoreHandle_t done;
+} jrun;
+
+struct jitter_result {
+    double mean_rb_bytes;
+    int underruns;
+    uint32_t grows;
+    uint32_t shrinks;
+};
+
+static ssize_t jitter_source_read(void *stream, void *buf, ssize_t len)
+{
+    if (jrun.stalls && jrun.src_bytes >= jrun.next_stall) {
+        usleep(JITTER_STALL_MS * 1000);
+        jrun.next_stall += JITTER_STALL_EVERY;
+    }
+    ssize_t ret = jrun.fs_read(stream, buf, len);
+    if (ret > 0) {
+        jrun.src_bytes += ret;
+    }
+    return ret;
+}
+
+static ssize_t jitter_sink_write(void *stream, void *buf, ssize_t len)
+{
+    (void) stream;
+    uint64_t now = now_ns();
+
+    if (memcmp(buf, jrun.expected + jrun.sink_bytes, len) != 0) {
+        jrun.mismatch = 1;
+    }
+    jrun.sink_bytes += len;
+
+    if (jrun.next_due_ns == 0) {
+        jrun.next_due_ns = now;
+    } else if (now > jrun.next_due_ns + JITTER_SLACK_NS) {
+        /* The previous chunk played out before this one came */
+        jrun.underruns++;
+        jrun.next_due_ns = now;
+    }
+    jrun.next_due_ns += (uint64_t)len * 1000000000ULL / JITTER_SINK_RATE;
+
+    audio_pipe_block_t *b;
+    STAILQ_FOREACH(b, &jrun.pipe->pb, next) {
+        jrun.rb_bytes_sum += b->rb ? b->rb_size : 0;
+    }
+    jrun.samples++;
+
+    now = now_ns();
+    if (jrun.sink_bytes == jrun.total_bytes) {
+        xSemaphoreGive(jrun.done);
+    } else if (jrun.next_due_ns > now) {
+        usleep((jrun.next_due_ns - now) / 1000);
+    }
+    return len;
+}
+
+static ssize_t no_input_read(void *arg, void *data, int len, uint32_t wait)
+{
+    (void) arg;
+    (void) data;
+    (void) len;
+    (void) wait;
+    return -1;
+}
+
+/* With `swap_input`, a codec reads the input, whose stream is swapped for a callback and back before starting */
+static int run_jitter(const char *path, const uint8_t *expected, bool stalls, bool adaptive, bool swap_input,
+                      struct jitter_result *res)
+{
+    fs_stream_config_t fs_cfg = {0};
+    snprintf(fs_cfg.file_path, sizeof(fs_cfg.file_path), "%s", path);
+    fs_stream_t *fs = fs_reader_stream_create(&fs_cfg);
+    fs->base.cfg.buf_size = JITTER_CHUNK;
+    fs->base.cfg.task_stack_size = 4096;
+
+    hollow_stream_config_t hollow_cfg = {
+        .hollow_stream_write_cb = jitter_sink_write,
+        .hollow_stream_stack_sz = 4096,
+        .hollow_stream_task_priority = 5,
+        .hollow_stream_buf_size = JITTER_CHUNK,
+    };
+    hollow_stream_t *hollow = hollow_stream_create(&hollow_cfg);
+    passthrough_codec_t *codec = swap_input ? passthrough_codec_create(JITTER_CHUNK) : NULL;
+
+    memset(&jrun, 0, sizeof(jrun));
+    jrun.fs_read = fs->base.cfg.derived_read;
+    fs->base.cfg.derived_read = jitter_source_read;
+    jrun.stalls = stalls;
+    jrun.next_stall = JITTER_STALL_EVERY;
+    jrun.total_bytes = JITTER_FILE_SIZE;
+    jrun.expected = expected;
+    jrun.done = xSemaphoreCreateBinary();
+
+    abstract_rb_cfg_t rb_cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    if (adaptive) {
+        audio_pipe_adaptive_cfg_t adapt_cfg = {
+            .rb1 = { .min_size = 2 * 1024, .max_size = 64 * 1024 },
+            .window_ms = 20,
+        };
+        jrun.pipe = audio_pipe_create_adaptive("jitter", &fs->base, codec ? &codec->base : NULL, &hollow->base,
+                                               &rb_cfg, &adapt_cfg);
+    } else {
+        jrun.pipe = audio_pipe_create_with_rb_cfg("jitter", &fs->base, RINGBUF1_DEFAULT_SIZE, codec ? &codec->base : NULL,
+                    codec ? RINGBUF2_DEFAULT_SIZE : 0, &hollow->base, &rb_cfg);
+    }
+    if (jrun.pipe == NULL) {
+        return -1;
+    }
+    if (swap_input) {
+        audio_io_fn_arg_t no_input = { .func = no_input_read };
+        if (audio_pipe_set_input_cb(jrun.pipe, &no_input) != ESP_OK) {
+            return -1;
+        }
+        /* Destroying the stream dropped its file */
+        fs_stream_set_config(fs, &fs_cfg);
+        if (audio_pipe_set_input_stream(jrun.pipe, &fs->base) != ESP_OK) {
+            return -1;
+        }
+    }
+
+    audio_pipe_start(jrun.pipe);
+    BaseType_t finished = xSemaphoreTake(jrun.done, 30000 / portTICK_PERIOD_MS);
+    while (audio_stream_get_state(&hollow->base) == STREAM_STATE_RUNNING) {
+        vTaskDelay(1);
+    }
+
+    audio_pipe_rb_adapt_stats_t stats = {0};
+    audio_pipe_get_rb_adapt_stats(jrun.pipe, "rb1", &stats);
+    res->mean_rb_bytes = jrun.samples ? (double)jrun.rb_bytes_sum / jrun.samples : 0;
+    res->underruns = jrun.underruns;
+    res->grows = stats.grows;
+    res->shrinks = stats.shrinks;
+
+    audio_pipe_destroy(jrun.pipe);
+    fs_stream_destroy(fs);
+    hollow_stream_destroy(hollow);
+    free(hollow);
+    if (codec) {
+        passthrough_codec_destroy(codec);
+    }
+    vSemaphoreDelete(jrun.done);
+    return (finished == pdTRUE && !jrun.mismatch) ? 0 : -1;
+}
+
+/* Cooperative pipeline destroyed while its sink is paused, with the codec waiting for room */
+static struct paused_run {
+    uint64_t sink_bytes;
+    SemaphoreHandle_t destroyed;
+} prun;
+
+static ssize_t paused_sink_write(void *stream, void *buf, ssize_t len)
+{
+    (void) stream;
+    (void) buf;
+    __atomic_add_fetch(&prun.sink_bytes, len, __ATOMIC_RELAXED);
+    /* Slow enough for the pipeline to still be playing when paused */
+    usleep(1000);
+    return len;
+}
+
+static void paused_destroy_task(void *arg)
+{
+    audio_pipe_destroy((audio_pipe_t *) arg);
+    xSemaphoreGive(prun.destroyed);
+    vTaskDelete(NULL);
+}
+
+static int run_paused_destroy(const char *path)
+{
+    fs_stream_config_t fs_cfg = {0};
+    snprintf(fs_cfg.file_path, sizeof(fs_cfg.file_path), "%s", path);
+    fs_stream_t *fs = fs_reader_stream_create(&fs_cfg);
+    fs->base.cfg.buf_size = 1000;
+    fs->base.cfg.task_stack_size = 4096;
+
+    hollow_stream_config_t hollow_cfg = {
+        .hollow_stream_write_cb = paused_sink_write,
+        .hollow_stream_stack_sz = 4096,
+        .hollow_stream_task_priority = 5,
+        .hollow_stream_buf_size = 1000,
+    };
+    hollow_stream_t *hollow = hollow_stream_create(&hollow_cfg);
+    passthrough_codec_t *codec = passthrough_codec_create(1000);
+
+    memset(&prun, 0, sizeof(prun));
+    prun.destroyed = xSemaphoreCreateBinary();
+    audio_pipe_t *pipe = audio_pipe_create_cooperative("paused", &fs->base, 0, &codec->base, 0, &hollow->base);
+    if (pipe == NULL) {
+        return -1;
+    }
+    audio_pipe_start(pipe);
+    while (__atomic_load_n(&prun.sink_bytes, __ATOMIC_RELAXED) == 0) {
+        vTaskDelay(1);
+    }
+    audio_pipe_pause(pipe);
+    while (audio_stream_get_state(&hollow->base) != STREAM_STATE_PAUSED) {
+        vTaskDelay(1);
+    }
+    /* Let the codec fill its output ring and wait on the paused sink */
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+
+    xTaskCreate(paused_destroy_task, "destroy", 4096, pipe, 5, NULL);
+    if (xSemaphoreTake(prun.destroyed, 5000 / portTICK_PERIOD_MS) != pdTRUE) {
+        /* The pipeline task is stuck, nothing can be freed */
+        return -1;
+    }
+    fs_stream_destroy(fs);
+    hollow_stream_destroy(hollow);
+    free(hollow);
+    passthrough_codec_destroy(codec);
+    vSemaphoreDelete(prun.destroyed);
+    return 0;
+}
+
+static uint8_t *make_file(const char *path, uint64_t size)
+{
+    uint8_t *data = malloc(size);
+    assert(data);
+    for (uint64_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL || fwrite(data, 1, size, f) != size) {
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/pipe_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+
+    int ret = 0;
+    struct bench_result res;
+    uint8_t *data = make_file(path, TEST_FILE_SIZE);
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) && data; m++) {
+        for (int with_codec = 0; with_codec <= 1; with_codec++) {
+            printf("test: %s %s pipeline%s ....", modes[m].exec, modes[m].rb_type, with_codec ? " with codec" : "");
+            if (run_pipeline(path, TEST_FILE_SIZE, &modes[m], with_codec, 1000, data, &res) != 0) {
+                printf("Fail, output %llu of %d bytes%s\n", (unsigned long long)run.sink_bytes, TEST_FILE_SIZE,
+                       run.mismatch ? ", corrupted" : "");
+                ret = 1;
+            } else {
+                printf("Success\n");
+            }
+        }
+    }
+    if (data) {
+        printf("test: cooperative pipeline destroyed while paused ....");
+        if (run_paused_destroy(path) != 0) {
+            printf("Fail, destroy didn't return\n");
+            ret = 1;
+        } else {
+            printf("Success\n");
+        }
+    }
+    free(data);
+
+    /* [steady, stalls][fixed, adaptive] */
+    struct jitter_result jitter[2][2];
+    data = ret ? NULL : make_file(path, JITTER_FILE_SIZE);
+    if (data) {
+        printf("test: adaptive rb sizing ....");
+        for (int stalls = 0; stalls <= 1 && !ret; stalls++) {
+            for (int adaptive = 0; adaptive <= 1 && !ret; adaptive++) {
+                if (run_jitter(path, data, stalls, adaptive, false, &jitter[stalls][adaptive]) != 0) {
+                    printf("Fail, output %llu of %d bytes%s\n", (unsigned long long)jrun.sink_bytes,
+                           JITTER_FILE_SIZE, jrun.mismatch ? ", corrupted" : "");
+                    ret = 1;
+                }
+            }
+        }
+        if (!ret && jitter[0][1].shrinks == 0) {
+            printf("Fail, no shrink on a steady network, %.0f bytes of rings\n", jitter[0][1].mean_rb_bytes);
+            ret = 1;
+        } else if (!ret && jitter[1][1].underruns > jitter[1][0].underruns) {
+            printf("Fail, %d underruns with stalls, fixed %d\n", jitter[1][1].underruns, jitter[1][0].underruns);
+            ret = 1;
+        } else if (!ret) {
+            printf("Success\n");
+        }
+
+        struct jitter_result swapped;
+        printf("test: adaptive rb sizing after an input swap ....");
+        if (ret) {
+            printf("Skipped\n");
+        } else if (run_jitter(path, data, false, true, true, &swapped) != 0) {
+            printf("Fail, output %llu of %d bytes%s\n", (unsigned long long)jrun.sink_bytes,
+                   JITTER_FILE_SIZE, jrun.mismatch ? ", corrupted" : "");
+            ret = 1;
+        } else if (swapped.shrinks == 0) {
+            printf("Fail, no shrink on a steady network, %.0f bytes of rings\n", swapped.mean_rb_bytes);
+            ret = 1;
+        } else {
+            printf("Success\n");
+        }
+        free(data);
+    }
+    if (data == NULL || ret || (argc >= 2 && strcmp(argv[1], "TEST") == 0)) {
+        unlink(path);
+        return (data == NULL || ret) ? 1 : 0;
+    }
+
+    printf("# network,rings,mean_rb_bytes,underruns,grows,shrinks\n");
+    for (int stalls = 0; stalls <= 1; stalls++) {
+        for (int adaptive = 0; adaptive <= 1; adaptive++) {
+            struct jitter_result *j = &jitter[stalls][adaptive];
+            printf("%s,%s,%.0f,%d,%u,%u\n", stalls ? "stalls" : "steady", adaptive ? "adaptive" : "fixed",
+                   j->mean_rb_bytes, j->underruns, j->grows, j->shrinks);
+        }
+    }
+
+    data = make_file(path, BENCH_FILE_SIZE);
+    free(data);
+    printf("# pipeline,exec,rb_type,rb_bytes,block_bytes,mb_per_s,block_latency_p50_us,block_latency_p99_us,"
+           "block_latency_max_us,context_switches,blocking_waits\n");
+    for (int with_codec = 0; with_codec <= 1; with_codec++) {
+        for (size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+                if (run_pipeline(path, BENCH_FILE_SIZE, &modes[m], with_codec, block_sizes[b], NULL, &res) != 0) {
+                    unlink(path);
+                    return 1;
+                }
+                printf("%s,%s,%s,%zu,%d,%.1f,%.1f,%.1f,%.1f,%llu,%llu\n", with_codec ? "fs-codec-hollow" : "fs-hollow",
+                       modes[m].exec, modes[m].rb_type, res.rb_bytes, block_sizes[b], res.mbps, res.p50_ns / 1000.0,
+                       res.p99_ns / 1000.0, res.max_ns / 1000.0, (unsigned long long)res.ctx_switches,
+                       (unsigned long long)res.blocking_waits);
+            }
+        }
+    }
+    unlink(path);
+    return 0;
+}
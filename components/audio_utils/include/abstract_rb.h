@@ -28,6 +28,7 @@
 #include <common_rb.h>
 #include <basic_rb.h>
 #include <special_rb.h>
+#include <lockfree_rb.h>
 
 #define DEFAULT_RB_TYPE_BASIC_FUNC() {                           \
     .func.init = rb_init,                                        \
@@ -54,7 +55,7 @@
 
 #define DEFAULT_RB_TYPE_SPECIAL_FUNC() {                         \
     .func.init = srb_init,                                       \
-    .func.deinit = NULL,                                         \
+    .func.deinit = srb_cleanup,                                  \
     .func.read = srb_read,                                       \
     .func.write = srb_write,                                     \
     .func.drain = srb_drain,                                     \
@@ -67,7 +68,7 @@
     .func.get_read_offset = srb_get_read_offset,                 \
     .func.get_write_offset = srb_get_write_offset,               \
     .func.reset_read_offset = srb_reset_read_offset,             \
-    .func.print_stats = NULL,                                    \
+    .func.print_stats = srb_stat,                                \
     .func.wakeup_reader = srb_wakeup_reader,                     \
     .func.signal_writer_finished = srb_signal_writer_finished,   \
     .func.put_anchor = srb_put_anchor,                           \
@@ -75,6 +76,34 @@
     .func.put_anchor_at_current = srb_put_anchor_at_current,     \
 }
 
+/* Single reader and single writer only. See lockfree_rb.h */
+#define DEFAULT_RB_TYPE_LOCKFREE_FUNC() {                        \
+    .func.init = lfrb_init,                                      \
+    .func.deinit = lfrb_cleanup,                                 \
+    .func.read = lfrb_read,                                      \
+    .func.write = lfrb_write,                                    \
+    .func.drain = NULL,                                          \
+    .func.reset = lfrb_reset,                                    \
+    .func.abort = lfrb_abort,                                    \
+    .func.abort_read = lfrb_abort_read,                          \
+    .func.abort_write = lfrb_abort_write,                        \
+    .func.get_filled = lfrb_filled,                              \
+    .func.get_available = lfrb_available,                        \
+    .func.get_read_offset = NULL,                                \
+    .func.get_write_offset = NULL,                               \
+    .func.reset_read_offset = NULL,                              \
+    .func.print_stats = lfrb_stat,                               \
+    .func.wakeup_reader = lfrb_wakeup_reader,                    \
+    .func.signal_writer_finished = lfrb_signal_writer_finished,  \
+    .func.put_anchor = NULL,                                     \
+    .func.get_anchor = NULL,                                     \
+    .func.put_anchor_at_current = NULL,                          \
+}
+
+/**
+ * Libraries built against this layout pass it to arb_init(), so it must not change. Operations
+ * added since are found from the type of the rb being wrapped, see abstract_rb.c.
+ */
 struct rb_func {
     rb_handle_t (*init)(const char *rb_name, uint32_t size);
     void (*deinit)(rb_handle_t handle);
@@ -104,6 +133,8 @@ typedef struct abstract_rb_cfg {
 
 rb_handle_t arb_init(const char *rb_name, uint32_t size, abstract_rb_cfg_t arb_cfg);
 void arb_deinit(rb_handle_t handle);
+/* Type of the rb the abstract rb wraps, RB_TYPE_MAX if it isn't one of the types above */
+rb_type_t arb_get_rb_type(rb_handle_t handle);
 
 int arb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
 int arb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
@@ -127,5 +158,18 @@ void arb_signal_writer_finished(rb_handle_t handle);
 int arb_put_anchor(rb_handle_t handle, rb_anchor_t *anchor);
 int arb_get_anchor(rb_handle_t handle, rb_anchor_t *anchor);
 int arb_put_anchor_at_current(rb_handle_t handle, rb_anchor_t *anchor);
+/* Anchors whose payload is copied into the rb's anchor pool */
+int arb_put_anchor_data(rb_handle_t handle, uint64_t offset, const void *data, uint32_t datalen);
+int arb_put_anchor_data_at_current(rb_handle_t handle, const void *data, uint32_t datalen);
+int arb_get_anchor_data(rb_handle_t handle, uint64_t *offset, void *data, uint32_t datalen);
+
+/* Zero-copy access. See rb_write_acquire() and rb_read_peek() in basic_rb.h */
+int arb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+int arb_write_commit(rb_handle_t handle, int len);
+int arb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+int arb_read_release(rb_handle_t handle, int len);
+
+/* 1 once the writer signalled it finished, 0 if not, -1 if the rb type can't tell. Never blocks. */
+int arb_is_writer_finished(rb_handle_t handle);
 
 #endif /* _ABSTRACT_RB_H_ */
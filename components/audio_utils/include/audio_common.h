@@ -35,9 +35,30 @@ typedef struct {
     void *arg;
 } audio_io_fn_arg_t;
 
+/* Zero-copy I/O: `acquire` hands out a window of the consumer's memory (up to `len`
+ * bytes) and `commit` publishes the bytes that were actually filled in.
+ */
+typedef ssize_t (*audio_io_acquire_fn)(void *arg, void **data, int len, uint32_t wait_ticks);
+typedef ssize_t (*audio_io_commit_fn)(void *arg, int len);
+
+typedef struct {
+    audio_io_acquire_fn acquire;
+    audio_io_commit_fn commit;
+    void *arg;
+} audio_io_window_fn_arg_t;
+
 typedef struct {
     audio_event_fn func;
     void *arg;
 } audio_event_fn_arg_t;
 
+/* Result of one non-blocking step of a pipeline block, see audio_stream_step() */
+typedef enum {
+    AUDIO_STEP_PROGRESS = 0,    /* Some data was moved */
+    AUDIO_STEP_NEEDS_INPUT,     /* Nothing to consume right now */
+    AUDIO_STEP_OUTPUT_FULL,     /* No room in the output right now */
+    AUDIO_STEP_IDLE,            /* Paused */
+    AUDIO_STEP_DONE,            /* Stopped, or never started */
+} audio_step_status_t;
+
 #endif /* _AUDIO_COMMON_H_ */
@@ -28,6 +28,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <common_rb.h>
+#include <rb_stats.h>
 
 
 /**
@@ -95,14 +96,14 @@ void rb_stat(rb_handle_t handle);
  *
  * @param[in]  rb ringbuffer handle
  */
-ssize_t rb_filled(rb_handle_t handle);
+int rb_filled(rb_handle_t handle);
 
 /**
  * @brief Return rb available size.
  *
  * @param[in]  rb ringbuffer handle
  */
-ssize_t rb_available(rb_handle_t handle);
+int rb_available(rb_handle_t handle);
 
 /**
  * @brief Read from ring buffer
@@ -134,6 +135,69 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
  */
 int rb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
 
+/**
+ * @brief Get a contiguous writable window inside the ring buffer.
+ *
+ * The producer fills the window in place and then calls `rb_write_commit`,
+ * which avoids copying through an intermediate buffer. The window never
+ * wraps around the end of the buffer, so it may be shorter than the free
+ * space: acquire again after the commit to get the rest.
+ *
+ * @param[in]  rb Ringbuffer handle
+ * @param[out] ptr Start of the writable window
+ * @param[out] contig_len Length of the writable window
+ * @param[in]  ticks_to_wait Max wait ticks if no space available in rb
+ *
+ * @return
+ *     - Length of the window (same as `contig_len`)
+ *     - 0 on timeout
+ *     - -ve value indicating error (aborted or writer finished).
+ *
+ * @note Only one window may be outstanding, and only the writer task may use it.
+ *       A reset, abort or `rb_write` in the meantime invalidates it.
+ */
+int rb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Publish `len` bytes of the window returned by `rb_write_acquire`.
+ *
+ * @return
+ *     - `len` on success
+ *     - RB_FAIL if `len` exceeds the window or the window was invalidated.
+ */
+int rb_write_commit(rb_handle_t handle, int len);
+
+/**
+ * @brief Get a contiguous readable window inside the ring buffer.
+ *
+ * The consumer processes the data in place and then calls `rb_read_release`.
+ * Blocking and return codes are the same as `rb_read`. The window never
+ * wraps around the end of the buffer.
+ *
+ * @param[in]  rb Ringbuffer handle
+ * @param[out] ptr Start of the readable window
+ * @param[out] contig_len Length of the readable window
+ * @param[in]  ticks_to_wait Max wait ticks if data not available
+ *
+ * @return
+ *     - Length of the window (same as `contig_len`)
+ *     - 0 on timeout
+ *     - -ve value indicating error, wake-up or end of data.
+ *
+ * @note Only one window may be outstanding, and only the reader task may use it.
+ *       A reset or `rb_read` in the meantime invalidates it.
+ */
+int rb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Consume `len` bytes of the window returned by `rb_read_peek`.
+ *
+ * @return
+ *     - `len` on success
+ *     - RB_FAIL if `len` exceeds the window or the window was invalidated.
+ */
+int rb_read_release(rb_handle_t handle, int len);
+
 /**
  * @brief Tell ringbuffer that no more writes will be done.
  *
@@ -155,4 +219,15 @@ void rb_wakeup_reader(rb_handle_t handle);
  */
 int rb_is_writer_finished(rb_handle_t handle);
 
+/**
+ * @brief Get the telemetry counters of the ringbuffer.
+ *
+ * The counters stay registered under the name passed to `rb_init` until
+ * `rb_cleanup`. Ringbuffers layered on top of this one (e.g. special rb)
+ * share them.
+ *
+ * @param[in]  rb ringbuffer handle
+ */
+rb_stats_t *rb_get_stats(rb_handle_t handle);
+
 #endif
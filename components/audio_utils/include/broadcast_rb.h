@@ -0,0 +1,187 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <common_rb.h>
+
+/* Broadcast Ring Buffer: One writer, many readers.
+ *
+ * Every byte is written once and each reader has its own read cursor
+ * into the same storage, so N consumers of the same stream don't need N
+ * copies of it. Cursors are absolute byte offsets since init/reset.
+ *
+ * Each reader picks what happens when it falls behind:
+ *  - BRB_READER_BLOCK_WRITER: the writer waits (like `rb_write` on a full
+ *    basic rb) until this reader has consumed enough data.
+ *  - BRB_READER_OVERWRITE: the writer never waits for this reader. If the
+ *    reader gets lapped, it skips ahead to the oldest data still in the
+ *    buffer and the skipped bytes are counted as overruns.
+ *
+ * A blocking reader can also ask the writer to keep `history` bytes of
+ * what it has already read. Another reader can then be positioned in that
+ * history with `brb_reader_seek`, e.g. a pre-roll reader starting a few
+ * hundred ms behind the wake-word reader.
+ *
+ * Reads block with the same semantics as `rb_read`, independently per
+ * reader. A reader handle must only be used by one task at a time.
+ */
+
+typedef enum brb_reader_policy {
+    BRB_READER_BLOCK_WRITER,
+    BRB_READER_OVERWRITE,
+} brb_reader_policy_t;
+
+typedef struct brb_reader_cfg {
+    /* Name of the reader, for stats */
+    const char *name;
+    brb_reader_policy_t policy;
+    /* Bytes behind this reader that the writer must not overwrite.
+     * Only honoured while the policy is BRB_READER_BLOCK_WRITER.
+     */
+    uint32_t history;
+} brb_reader_cfg_t;
+
+typedef void *brb_reader_t;
+
+/**
+ * @brief Create and initialize broadcast ringbuffer.
+ *
+ * @param[in]  rb_name Name of the ringbuffer
+ * @param[in]  size size of the ringbuffer
+ * @param[in]  max_readers number of reader slots, allocated upfront
+ * @return
+ *     - ringbuffer handle
+ *     - NULL if failed.
+ */
+rb_handle_t brb_init(const char *rb_name, uint32_t size, int max_readers);
+
+/**
+ * @brief Cleanup and destroy ringbuffer, along with all its readers.
+ *
+ * @note The writer and all the readers must not be using the ringbuffer anymore.
+ */
+void brb_cleanup(rb_handle_t handle);
+
+/**
+ * @brief Add a reader. It starts at the current write offset.
+ *
+ * @return
+ *     - reader handle
+ *     - NULL if all the reader slots are in use.
+ */
+brb_reader_t brb_reader_open(rb_handle_t handle, const brb_reader_cfg_t *cfg);
+
+/**
+ * @brief Remove a reader. The reader must not be blocked in `brb_read`.
+ */
+void brb_reader_close(brb_reader_t reader);
+
+/**
+ * @brief Change the policy of a reader.
+ *
+ * Switching to BRB_READER_BLOCK_WRITER makes the writer wait for this
+ * reader from now on. A reader that isn't consuming for a while (e.g. the
+ * wake-word reader during a capture) should be switched to
+ * BRB_READER_OVERWRITE so that it doesn't stall the writer.
+ */
+void brb_reader_set_policy(brb_reader_t reader, brb_reader_policy_t policy);
+
+/**
+ * @brief Move the read cursor of a reader.
+ *
+ * The offset is clamped to the data still in the buffer, i.e. between the
+ * oldest byte not yet overwritten and the write offset.
+ *
+ * @return The new read offset of the reader.
+ */
+uint64_t brb_reader_seek(brb_reader_t reader, uint64_t offset);
+
+/**
+ * @brief Get the read offset of a reader.
+ */
+uint64_t brb_reader_get_offset(brb_reader_t reader);
+
+/**
+ * @brief Return the bytes available to this reader.
+ */
+int brb_reader_filled(brb_reader_t reader);
+
+/**
+ * @brief Read from ring buffer with the given reader.
+ *
+ * Same semantics as `rb_read`.
+ *
+ * @note If `buf` is NULL, `len` bytes are simply discarded.
+ */
+int brb_read(brb_reader_t reader, uint8_t *buf, int len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Wake up from current brb_read operation of this reader.
+ */
+void brb_reader_wakeup(brb_reader_t reader);
+
+/**
+ * @brief Write to ring buffer
+ *
+ * Same semantics as `rb_write`. Only readers with BRB_READER_BLOCK_WRITER
+ * policy can make the writer wait.
+ */
+int brb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Return the bytes that can be written without waiting.
+ */
+int brb_available(rb_handle_t handle);
+
+/**
+ * @brief Get the total bytes written since init/reset.
+ */
+uint64_t brb_get_write_offset(rb_handle_t handle);
+
+/**
+ * @brief Reset the ringbuffer. All the readers go back to offset 0.
+ */
+void brb_reset(rb_handle_t handle);
+
+/**
+ * @brief Abort all the reads and the write on ringbuffer.
+ *
+ * @note `brb_reset` should be called on this `rb` to make it usable again.
+ */
+void brb_abort(rb_handle_t handle);
+
+/**
+ * @brief Tell ringbuffer that no more writes will be done.
+ */
+void brb_signal_writer_finished(rb_handle_t handle);
+
+/**
+ * @brief Print buffer stats, including per reader overruns.
+ */
+void brb_stat(rb_handle_t handle);
@@ -53,6 +53,8 @@ typedef enum rb_type {
     RB_TYPE_BASIC,
     RB_TYPE_SPECIAL,
     RB_TYPE_ABSTRACT,
+    RB_TYPE_LOCKFREE,
+    RB_TYPE_BROADCAST,
     RB_TYPE_MAX,
 } rb_type_t;
 
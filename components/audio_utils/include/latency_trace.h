@@ -0,0 +1,199 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_timer.h>
+
+/* Audio latency tracing.
+ *
+ * A trace point (`lt_point_t`) is a place where audio is buffered, typically a
+ * ring buffer. Its producer reports the bytes it puts in, its consumer the
+ * bytes it takes out. Every `interval` bytes the producer leaves a mark (the
+ * byte offset and the time), and when the consumer gets past that offset the
+ * time the mark spent in the point is added to the point's stage histogram.
+ *
+ * A mark also carries the time its audio entered the path. A producer which
+ * got its data out of another point passes that point as `from`, so the time
+ * is carried along, and the last point of the path records the end-to-end
+ * latency. The processing in between two points (e.g. decoding) is recorded
+ * as a stage of its own.
+ *
+ * Tracing is off by default. The byte counters are always kept, so that the
+ * marks line up as soon as it is turned on.
+ */
+
+typedef enum {
+    /* Playback: http_playback_stream -> codec -> sys_playback -> I2S */
+    LT_STAGE_HTTP_OUTPUT_RB = 0,
+    LT_STAGE_CODEC,
+    LT_STAGE_CODEC_OUTPUT_RB,
+    LT_STAGE_PLAYBACK_MIX,
+    LT_STAGE_DOWNMIX_RB,
+    LT_STAGE_I2S_DMA,
+    LT_STAGE_PLAYBACK_TOTAL,
+    /* Capture: i2s_stream_read -> esp_dsp resampling -> common_dsp_stream_audio */
+    LT_STAGE_MIC_RAW_RB,
+    LT_STAGE_DSP_RESAMPLE,
+    LT_STAGE_MIC_RB,
+    LT_STAGE_CAPTURE_TOTAL,
+    LT_STAGE_MAX,
+} lt_stage_t;
+
+/* Bucket i counts the samples below (LT_HIST_BASE_US << i), the last one all the others */
+#define LT_HIST_BUCKETS     16
+#define LT_HIST_BASE_US     128
+
+#define LT_POINT_MARKS      8
+#define LT_DEFAULT_INTERVAL 4096
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[LT_HIST_BUCKETS];
+} lt_hist_t;
+
+typedef struct {
+    uint64_t offset;        /**< Producer byte count when the mark was left */
+    int64_t in_us;          /**< When the marked byte entered this point */
+    int64_t origin_us;      /**< When it entered the path */
+    uint32_t epoch;
+} lt_mark_t;
+
+typedef struct lt_point {
+    lt_stage_t stage;       /**< Time spent in this point */
+    lt_stage_t total_stage; /**< End-to-end, if this is the last point of a path. Else LT_STAGE_MAX */
+    uint32_t interval;
+    /* Producer side */
+    uint64_t bytes_in;
+    uint64_t next_mark;
+    uint32_t marks_in;
+    int64_t in_origin_us;   /**< Origin of the last mark out of `from` */
+    uint32_t in_epoch;
+    /* Consumer side */
+    uint64_t bytes_out;
+    uint32_t marks_out;
+    lt_mark_t marks[LT_POINT_MARKS];
+    /* Last mark out, for the producer of the next point */
+    int64_t out_us;
+    int64_t out_origin_us;
+    uint32_t out_epoch;
+    bool out_pending;
+} lt_point_t;
+
+/**
+ * @brief Initialize a trace point.
+ *
+ * @param stage       Stage the time spent in the point is recorded as
+ * @param total_stage Stage the end-to-end time is recorded as when a mark
+ *                    leaves the point, LT_STAGE_MAX if not the end of a path
+ * @param interval    Bytes between two marks, 0 for LT_DEFAULT_INTERVAL
+ */
+void lt_point_init(lt_point_t *pt, lt_stage_t stage, lt_stage_t total_stage, uint32_t interval);
+
+/**
+ * @brief Forget the marks and byte counts. Both ends must be idle, e.g. with the ring reset.
+ */
+void lt_point_reset(lt_point_t *pt);
+
+/**
+ * @brief Producer: `len` bytes were put into the point.
+ *
+ * @param from       The point the bytes were taken out of, if any. Its last
+ *                   mark gives the time the bytes entered the path.
+ * @param from_stage Stage the time since they left `from` is recorded as
+ *                   (the processing in between), LT_STAGE_MAX for none.
+ */
+void lt_point_in(lt_point_t *pt, int len, lt_point_t *from, lt_stage_t from_stage);
+
+/**
+ * @brief Consumer: the bytes up to `offset` (in producer byte count) left the point at `now_us`.
+ *
+ * For consumers which may skip data, or which have been told where the data
+ * will actually leave in the future (e.g. a DMA queue).
+ */
+void lt_point_out_at(lt_point_t *pt, uint64_t offset, int64_t now_us);
+
+/**
+ * @brief Consumer: `len` bytes were taken out of the point.
+ */
+static inline void lt_point_out(lt_point_t *pt, int len)
+{
+    if (len > 0) {
+        lt_point_out_at(pt, pt->bytes_out + len, esp_timer_get_time());
+    }
+}
+
+/**
+ * @brief Play-out clock of a device consuming `bytes_per_sec`: returns when
+ *        `len` bytes written now will have left it. Used for the I2S DMA.
+ */
+typedef struct {
+    int64_t drained_us;
+} lt_playout_t;
+
+int64_t lt_playout_add(lt_playout_t *clk, int len, int bytes_per_sec);
+
+/**
+ * @brief Turn tracing on or off. Turning it on starts new histograms.
+ */
+void lt_set_enabled(bool enable);
+
+bool lt_is_enabled(void);
+
+/**
+ * @brief Add a sample to a stage histogram. Done by the trace points; exposed
+ *        for stages which are timed directly.
+ */
+void lt_record(lt_stage_t stage, int64_t us);
+
+/**
+ * @brief Copy a stage histogram.
+ */
+void lt_get_hist(lt_stage_t stage, lt_hist_t *out);
+
+const char *lt_stage_name(lt_stage_t stage);
+
+void lt_reset_all(void);
+
+/**
+ * @brief Print the stage histograms, one line each.
+ */
+void lt_print_all(void);
+
+/**
+ * @brief Export the stage histograms as JSON.
+ *
+ * The output looks like:
+ *   {"enabled":true,"hist_base_us":128,"stages":[{"name":"http_output_rb","count":..,
+ *    "mean_us":..,"max_us":..,"p50_us":..,"p99_us":..,"hist":[..]},...]}
+ * Percentiles are the upper bound of the bucket they fall in.
+ *
+ * @return Same as snprintf(): the length of the full JSON string, which may
+ *         be more than `buf_len - 1` if `buf` was too small.
+ */
+int lt_to_json(char *buf, size_t buf_len);
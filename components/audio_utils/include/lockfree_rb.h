@@ -0,0 +1,155 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <common_rb.h>
+
+/* Lock-free Ring Buffer: A single-producer/single-consumer ring buffer.
+ *
+ * The read and write indices are owned by the reader and the writer
+ * respectively and are published with atomic loads/stores, so the
+ * data path takes no lock. A task only blocks when the buffer is
+ * actually empty (reader) or full (writer), and is woken up with a
+ * direct-to-task notification from the other side.
+ *
+ * Exactly one task may write and exactly one task may read at a time.
+ * Since blocking uses the task notification value, the reader and the
+ * writer tasks should not wait on task notifications for anything else
+ * while they are blocked on this ring buffer.
+ */
+
+/**
+ * @brief Create and initialize lock-free ringbuffer.
+ *
+ * @param[in]  rb_name Name of the ringbuffer
+ * @param[in]  size size of the ringbuffer
+ * @return
+ *     - ringbuffer handle
+ *     - NULL if failed.
+ */
+rb_handle_t lfrb_init(const char *rb_name, uint32_t size);
+
+/**
+ * @brief Cleanup and destroy ringbuffer.
+ *
+ * @note Reader and writer must not be using the ringbuffer anymore.
+ */
+void lfrb_cleanup(rb_handle_t handle);
+
+/**
+ * @brief Read from ring buffer
+ *
+ * Same semantics as `rb_read`: blocks until `len` bytes are read, the
+ * wait times out, or the read is aborted/unblocked/writer finishes.
+ *
+ * @note If `buf` is NULL, `len` bytes are simply discarded.
+ */
+int lfrb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Write to ring buffer
+ *
+ * Same semantics as `rb_write`.
+ */
+int lfrb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Get a contiguous writable window. See `rb_write_acquire`.
+ */
+int lfrb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Publish `len` bytes of the acquired window. See `rb_write_commit`.
+ */
+int lfrb_write_commit(rb_handle_t handle, int len);
+
+/**
+ * @brief Get a contiguous readable window. See `rb_read_peek`.
+ */
+int lfrb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+
+/**
+ * @brief Consume `len` bytes of the peeked window. See `rb_read_release`.
+ */
+int lfrb_read_release(rb_handle_t handle, int len);
+
+/**
+ * @brief Reset the ringbuffer.
+ *
+ * @note Unlike `rb_reset`, this does not serialise against an ongoing
+ *       read or write. It must only be called once the reader and the
+ *       writer have been stopped (or aborted and returned).
+ */
+void lfrb_reset(rb_handle_t handle);
+
+/**
+ * @brief Abort both read and write operations on ringbuffer.
+ *
+ * @note `lfrb_reset` should be called on this `rb` to make it usable again.
+ */
+void lfrb_abort(rb_handle_t handle);
+
+/**
+ * @brief Abort reads on ringbuffer.
+ */
+void lfrb_abort_read(rb_handle_t handle);
+
+/**
+ * @brief Abort writes on ringbuffer.
+ */
+void lfrb_abort_write(rb_handle_t handle);
+
+/**
+ * @brief Return rb filled size.
+ */
+int lfrb_filled(rb_handle_t handle);
+
+/**
+ * @brief Return rb available size.
+ */
+int lfrb_available(rb_handle_t handle);
+
+/**
+ * @brief Print buffer stats.
+ */
+void lfrb_stat(rb_handle_t handle);
+
+/**
+ * @brief Tell ringbuffer that no more writes will be done.
+ */
+void lfrb_signal_writer_finished(rb_handle_t handle);
+
+/**
+ * @brief Check if write operations are finished.
+ */
+int lfrb_is_writer_finished(rb_handle_t handle);
+
+/**
+ * @brief Wake up from current lfrb_read operation.
+ */
+void lfrb_wakeup_reader(rb_handle_t handle);
@@ -0,0 +1,132 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_timer.h>
+#include <common_rb.h>
+
+/* Ring buffer telemetry.
+ *
+ * Every ring buffer carries an `rb_stats_t`, which is linked into a global
+ * registry from init till cleanup. The counters are plain (non-atomic)
+ * fields, updated by the side that owns them: the data counters under the
+ * ring's own lock (or by the single reader/writer for the lock-free ring),
+ * and the blocking time only when a task actually goes to sleep. A reset
+ * racing with traffic may therefore lose an update, which is fine for
+ * diagnostics.
+ */
+
+#define RB_STATS_NAME_LEN   16
+
+typedef struct rb_stats {
+    char name[RB_STATS_NAME_LEN];   /**< `rb_name` passed at init, truncated */
+    rb_type_t type;
+    uint32_t size;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t peak_fill;
+    uint32_t blocked_reads;         /**< Reads that had to wait for data */
+    uint64_t blocked_read_us;
+    uint32_t blocked_writes;        /**< Writes that had to wait for space */
+    uint64_t blocked_write_us;
+    uint32_t aborts;
+    uint32_t wakeups;
+    /* For internal use */
+    struct rb_stats *next;
+} rb_stats_t;
+
+/* Passed to the blocked-time helpers until the first wait of a call */
+#define RB_STATS_NOT_BLOCKED    (-1)
+
+/**
+ * @brief Add a ring buffer's counters to the registry. Called at rb init.
+ */
+void rb_stats_register(rb_stats_t *stats, const char *rb_name, rb_type_t type, uint32_t size);
+
+/**
+ * @brief Remove a ring buffer's counters from the registry. Called at rb cleanup.
+ */
+void rb_stats_unregister(rb_stats_t *stats);
+
+/**
+ * @brief Copy the counters of the ring buffer registered as `rb_name`.
+ *
+ * @return
+ *     - 0 on success
+ *     - -1 if there is no such ring buffer
+ */
+int rb_stats_get(const char *rb_name, rb_stats_t *out);
+
+/**
+ * @brief Clear the counters of all the registered ring buffers.
+ */
+void rb_stats_reset_all(void);
+
+/**
+ * @brief Print the counters of all the registered ring buffers, one line each.
+ */
+void rb_stats_print_all(void);
+
+/**
+ * @brief Export the counters of all the registered ring buffers as JSON.
+ *
+ * The output looks like:
+ *   {"rings":[{"name":"...","type":"basic","size":1024,"bytes_in":...},...]}
+ *
+ * @return Same as snprintf(): the length of the full JSON string, which
+ *         may be more than `buf_len - 1` if `buf` was too small.
+ */
+int rb_stats_to_json(char *buf, size_t buf_len);
+
+static inline void rb_stats_update_fill(rb_stats_t *stats, uint32_t fill)
+{
+    if (fill > stats->peak_fill) {
+        stats->peak_fill = fill;
+    }
+}
+
+/* Add the time since `wait_start` to the time blocked in the current call */
+static inline void rb_stats_add_wait(int64_t *blocked_us, int64_t wait_start)
+{
+    int64_t waited = esp_timer_get_time() - wait_start;
+    *blocked_us = (*blocked_us == RB_STATS_NOT_BLOCKED) ? waited : *blocked_us + waited;
+}
+
+static inline void rb_stats_read_done(rb_stats_t *stats, int64_t blocked_us)
+{
+    if (blocked_us != RB_STATS_NOT_BLOCKED) {
+        stats->blocked_reads++;
+        stats->blocked_read_us += blocked_us;
+    }
+}
+
+static inline void rb_stats_write_done(rb_stats_t *stats, int64_t blocked_us)
+{
+    if (blocked_us != RB_STATS_NOT_BLOCKED) {
+        stats->blocked_writes++;
+        stats->blocked_write_us += blocked_us;
+    }
+}
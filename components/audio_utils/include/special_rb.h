@@ -11,8 +11,41 @@
  * can be fetched by the reader whenever it stumbles about it.
  */
 
+/* Anchors and their payloads live in a pool that is allocated along with
+ * the srb, so putting and getting anchors doesn't allocate. When all of them
+ * are in use, another block of as many is added to the pool, up to
+ * SRB_MAX_ANCHOR_BLOCKS blocks. These are the pool dimensions used by
+ * srb_init().
+ */
+#ifndef SRB_DEFAULT_MAX_ANCHORS
+#define SRB_DEFAULT_MAX_ANCHORS         32
+#endif
+#ifndef SRB_DEFAULT_ANCHOR_PAYLOAD_SIZE
+#define SRB_DEFAULT_ANCHOR_PAYLOAD_SIZE 64
+#endif
+#ifndef SRB_MAX_ANCHOR_BLOCKS
+#define SRB_MAX_ANCHOR_BLOCKS           8
+#endif
+
+typedef struct srb_anchor_stats {
+    uint32_t puts;              /* Anchors successfully put */
+    uint32_t gets;              /* Anchors fetched */
+    uint32_t out_of_order;      /* Anchors put before an already queued one */
+    uint32_t pool_grows;        /* Blocks of anchors added to the pool */
+    uint32_t pool_exhausted;    /* Puts rejected because the pool couldn't grow */
+    uint32_t payload_overflows; /* Payloads larger than the inline slot, allocated instead */
+    uint32_t max_in_use;        /* High watermark of queued anchors */
+} srb_anchor_stats_t;
+
 /* Initialise the srb */
 rb_handle_t srb_init(const char *rb_name, uint32_t size);
+/* Initialise the srb with room for `max_anchors` anchors, each with up to
+ * `payload_size` bytes of inline payload for srb_put_anchor_data(). The pool
+ * grows by `max_anchors` at a time when they are all in use.
+ */
+rb_handle_t srb_init_with_anchor_pool(const char *rb_name, uint32_t size, uint16_t max_anchors, uint16_t payload_size);
+/* Destroy the srb, along with any anchor still queued */
+void srb_cleanup(rb_handle_t handle);
 /* Write to an srb */
 int srb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
 /* Read from an srb. If you are at an anchor, an error
@@ -21,21 +54,43 @@ int srb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait)
  * read further
  */
 int srb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait);
-/* Put an anchor in the data stream at a particular offset */
+/* Zero-copy variants of srb_write(). These go straight to the underlying rb */
+int srb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+int srb_write_commit(rb_handle_t handle, int len);
+/* Zero-copy variants of srb_read(). The window stops at the next anchor, and
+ * RB_FETCH_ANCHOR is returned once the read offset reaches it, as for srb_read().
+ */
+int srb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+int srb_read_release(rb_handle_t handle, int len);
+/* Put an anchor in the data stream at a particular offset. Returns -1 if
+ * the anchor pool is full and couldn't grow.
+ */
 int srb_put_anchor(rb_handle_t handle, rb_anchor_t *anchor);
-/* Read the current anchor */
+/* Read the current anchor. The caller owns anchor->data. For an anchor put
+ * with srb_put_anchor_data(), that is a copy of the payload allocated here
+ * (NULL for an empty one): prefer srb_get_anchor_data() for those.
+ */
 int srb_get_anchor(rb_handle_t handle, rb_anchor_t *anchor);
 /* This puts the anchor at the current 'write' location. The value of
  * anchor->offset is ignored and overwritten with wherever the marker
  * was actually placed.
  */
 int srb_put_anchor_at_current(rb_handle_t handle, rb_anchor_t *anchor);
+/* Same as above, but `data` is copied into the anchor's payload slot */
+int srb_put_anchor_data(rb_handle_t handle, uint64_t offset, const void *data, uint32_t datalen);
+int srb_put_anchor_data_at_current(rb_handle_t handle, const void *data, uint32_t datalen);
+/* Read the current anchor, copying up to `datalen` bytes of its payload into `data` */
+int srb_get_anchor_data(rb_handle_t handle, uint64_t *offset, void *data, uint32_t datalen);
+void srb_get_anchor_stats(rb_handle_t handle, srb_anchor_stats_t *stats);
+void srb_reset_anchor_stats(rb_handle_t handle);
+void srb_stat(rb_handle_t handle);
 int srb_drain(rb_handle_t handle, uint64_t drain_upto);
 int srb_get_read_offset(rb_handle_t handle);
 int srb_get_write_offset(rb_handle_t handle);
 int srb_get_filled(rb_handle_t handle);
 void srb_wakeup_reader(rb_handle_t handle);
 void srb_signal_writer_finished(rb_handle_t handle);
+int srb_is_writer_finished(rb_handle_t handle);
 void srb_reset(rb_handle_t handle);
 void srb_abort(rb_handle_t handle);
 void srb_reset_read_offset(rb_handle_t handle);
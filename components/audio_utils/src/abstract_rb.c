@@ -29,13 +29,68 @@
 
 static const char *TAG = "[abstract_rb]";
 
+/* Operations added after struct rb_func was frozen, per type of the wrapped rb */
+struct rb_ext_func {
+    int (*write_acquire)(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+    int (*write_commit)(rb_handle_t handle, int len);
+    int (*read_peek)(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait);
+    int (*read_release)(rb_handle_t handle, int len);
+    int (*put_anchor_data)(rb_handle_t handle, uint64_t offset, const void *data, uint32_t datalen);
+    int (*put_anchor_data_at_current)(rb_handle_t handle, const void *data, uint32_t datalen);
+    int (*get_anchor_data)(rb_handle_t handle, uint64_t *offset, void *data, uint32_t datalen);
+    int (*is_writer_finished)(rb_handle_t handle);
+};
+
+static const struct rb_ext_func rb_ext_funcs[RB_TYPE_MAX] = {
+    [RB_TYPE_BASIC] = {
+        .write_acquire = rb_write_acquire,
+        .write_commit = rb_write_commit,
+        .read_peek = rb_read_peek,
+        .read_release = rb_read_release,
+        .is_writer_finished = rb_is_writer_finished,
+    },
+    [RB_TYPE_SPECIAL] = {
+        .write_acquire = srb_write_acquire,
+        .write_commit = srb_write_commit,
+        .read_peek = srb_read_peek,
+        .read_release = srb_read_release,
+        .put_anchor_data = srb_put_anchor_data,
+        .put_anchor_data_at_current = srb_put_anchor_data_at_current,
+        .get_anchor_data = srb_get_anchor_data,
+        .is_writer_finished = srb_is_writer_finished,
+    },
+    [RB_TYPE_LOCKFREE] = {
+        .write_acquire = lfrb_write_acquire,
+        .write_commit = lfrb_write_commit,
+        .read_peek = lfrb_read_peek,
+        .read_release = lfrb_read_release,
+        .is_writer_finished = lfrb_is_writer_finished,
+    },
+};
+
+static const struct rb_ext_func rb_ext_none;
+
 typedef struct abstract_rb {
     /* Keep rb_type_t first */
     rb_type_t type;
     struct rb_func func;
     rb_handle_t rb;
+    const struct rb_ext_func *ext;
 } abstract_rb_t;
 
+/* Every rb type keeps its rb_type_t first, whichever rb_func table created it */
+static rb_type_t arb_wrapped_type(rb_handle_t rb)
+{
+    rb_type_t type = *(rb_type_t *)rb;
+    return ((unsigned) type < RB_TYPE_MAX) ? type : RB_TYPE_MAX;
+}
+
+static const struct rb_ext_func *arb_lookup_ext_func(rb_handle_t rb)
+{
+    rb_type_t type = arb_wrapped_type(rb);
+    return (type == RB_TYPE_MAX) ? &rb_ext_none : &rb_ext_funcs[type];
+}
+
 rb_handle_t arb_init(const char *rb_name, uint32_t size, abstract_rb_cfg_t arb_cfg)
 {
     abstract_rb_t *arb = (abstract_rb_t *)esp_audio_mem_malloc(sizeof(abstract_rb_t));
@@ -59,6 +114,7 @@ rb_handle_t arb_init(const char *rb_name, uint32_t size, abstract_rb_cfg_t arb_c
         arb_deinit((rb_handle_t)arb);
         return NULL;
     }
+    arb->ext = arb_lookup_ext_func(arb->rb);
 
     return (rb_handle_t)arb;
 }
@@ -89,6 +145,20 @@ void arb_deinit(rb_handle_t handle)
     esp_audio_mem_free(arb);
 }
 
+rb_type_t arb_get_rb_type(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return RB_TYPE_MAX;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return RB_TYPE_MAX;
+    }
+    return arb_wrapped_type(arb->rb);
+}
+
 int arb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait)
 {
     if (handle == NULL) {
@@ -429,3 +499,154 @@ int arb_put_anchor_at_current(rb_handle_t handle, rb_anchor_t *anchor)
 
     return arb->func.put_anchor_at_current(arb->rb, anchor);
 }
+
+int arb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return 0;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return 0;
+    }
+    if (!arb->ext->write_acquire) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return 0;
+    }
+
+    return arb->ext->write_acquire(arb->rb, ptr, contig_len, ticks_to_wait);
+}
+
+int arb_write_commit(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return 0;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return 0;
+    }
+    if (!arb->ext->write_commit) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return 0;
+    }
+
+    return arb->ext->write_commit(arb->rb, len);
+}
+
+int arb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return 0;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return 0;
+    }
+    if (!arb->ext->read_peek) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return 0;
+    }
+
+    return arb->ext->read_peek(arb->rb, ptr, contig_len, ticks_to_wait);
+}
+
+int arb_read_release(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return 0;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return 0;
+    }
+    if (!arb->ext->read_release) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return 0;
+    }
+
+    return arb->ext->read_release(arb->rb, len);
+}
+
+int arb_put_anchor_data(rb_handle_t handle, uint64_t offset, const void *data, uint32_t datalen)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return -1;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return -1;
+    }
+    if (!arb->ext->put_anchor_data) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return -1;
+    }
+
+    return arb->ext->put_anchor_data(arb->rb, offset, data, datalen);
+}
+
+int arb_put_anchor_data_at_current(rb_handle_t handle, const void *data, uint32_t datalen)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return -1;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return -1;
+    }
+    if (!arb->ext->put_anchor_data_at_current) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return -1;
+    }
+
+    return arb->ext->put_anchor_data_at_current(arb->rb, data, datalen);
+}
+
+int arb_get_anchor_data(rb_handle_t handle, uint64_t *offset, void *data, uint32_t datalen)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return -1;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return -1;
+    }
+    if (!arb->ext->get_anchor_data) {
+        ESP_LOGE(TAG, "rb function not defined");
+        return -1;
+    }
+
+    return arb->ext->get_anchor_data(arb->rb, offset, data, datalen);
+}
+
+int arb_is_writer_finished(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is NULL");
+        return -1;
+    }
+    abstract_rb_t *arb = (abstract_rb_t *)handle;
+    if (arb->type != RB_TYPE_ABSTRACT) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", arb->type);
+        return -1;
+    }
+    if (!arb->ext->is_writer_finished) {
+        return -1;
+    }
+
+    return arb->ext->is_writer_finished(arb->rb);
+}
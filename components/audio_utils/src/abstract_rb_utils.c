@@ -27,8 +27,16 @@
 #include <abstract_rb_utils.h>
 #include <string.h>
 
+/* Special rbs copy the payloads into their anchor pool, see srb_put_anchor_data(). This goes by the
+ * type of the rb rather than the rb_func table, which callers built before the pool don't have.
+ * Other rb types get a copy allocated here, freed by arb_utils_get_anchor().
+ */
 int arb_utils_put_anchor(rb_handle_t rb, int offset, void *data, uint32_t datalen)
 {
+    if (arb_get_rb_type(rb) == RB_TYPE_SPECIAL) {
+        return arb_put_anchor_data(rb, offset, data, datalen) == 0 ? 0 : -1;
+    }
+
     rb_anchor_t anchor;
     anchor.offset = offset;
     anchor.data = esp_audio_mem_malloc(datalen);
@@ -42,6 +50,15 @@ int arb_utils_put_anchor(rb_handle_t rb, int offset, void *data, uint32_t datale
 
 int arb_utils_get_anchor(rb_handle_t rb, int *offset, void *data, uint32_t datalen)
 {
+    if (arb_get_rb_type(rb) == RB_TYPE_SPECIAL) {
+        uint64_t anchor_offset;
+        if (arb_get_anchor_data(rb, &anchor_offset, data, datalen) == 0) {
+            *offset = anchor_offset;
+            return 0;
+        }
+        return -1;
+    }
+
     rb_anchor_t anchor;
     if (arb_get_anchor(rb, &anchor) == 0) {
         *offset = anchor.offset;
@@ -54,6 +71,10 @@ int arb_utils_get_anchor(rb_handle_t rb, int *offset, void *data, uint32_t datal
 
 int arb_utils_put_anchor_at_current(rb_handle_t rb, void *data, uint32_t datalen)
 {
+    if (arb_get_rb_type(rb) == RB_TYPE_SPECIAL) {
+        return arb_put_anchor_data_at_current(rb, data, datalen) == 0 ? 0 : -1;
+    }
+
     rb_anchor_t anchor;
     anchor.data = esp_audio_mem_malloc(datalen);
     if (anchor.data) {
@@ -63,4 +84,3 @@ int arb_utils_put_anchor_at_current(rb_handle_t rb, void *data, uint32_t datalen
     }
     return -1;
 }
-
@@ -32,6 +32,7 @@
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 #include <basic_rb.h>
+#include <rb_stats.h>
 #include "esp_log.h"
 #include "esp_err.h"
 #include <esp_audio_mem.h>
@@ -55,6 +56,9 @@ typedef struct ringbuf {
     int abort_write;
     int writer_finished;  //to prevent infinite blocking for buffer read
     int reader_unblock;
+    ssize_t write_reserved; /**< Bytes handed out by rb_write_acquire, not yet committed */
+    ssize_t read_reserved;  /**< Bytes handed out by rb_read_peek, not yet released */
+    rb_stats_t stats;
 } ringbuf_t;
 
 rb_handle_t rb_init(const char *name, uint32_t size)
@@ -88,6 +92,9 @@ rb_handle_t rb_init(const char *name, uint32_t size)
     r->abort_write = 0;
     r->writer_finished = 0;
     r->reader_unblock = 0;
+    r->write_reserved = 0;
+    r->read_reserved = 0;
+    rb_stats_register(&r->stats, name, RB_TYPE_BASIC, size);
 
     return (rb_handle_t)r;
 }
@@ -104,6 +111,7 @@ void rb_cleanup(rb_handle_t handle)
         return;
     }
 
+    rb_stats_unregister(&rb->stats);
     free(rb->base);
     rb->base = NULL;
     vSemaphoreDelete(rb->can_read);
@@ -118,7 +126,7 @@ void rb_cleanup(rb_handle_t handle)
 /*
  * @brief: get the number of filled bytes in the buffer
  */
-ssize_t rb_filled(rb_handle_t handle)
+int rb_filled(rb_handle_t handle)
 {
     if (handle == NULL) {
         ESP_LOGE(TAG, "handle is NULL");
@@ -136,7 +144,7 @@ ssize_t rb_filled(rb_handle_t handle)
 /*
  * @brief: get the number of empty bytes available in the buffer
  */
-ssize_t rb_available(rb_handle_t handle)
+int rb_available(rb_handle_t handle)
 {
     if (handle == NULL) {
         ESP_LOGE(TAG, "handle is NULL");
@@ -166,6 +174,7 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
 
     int read_size;
     int total_read_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
 
     /**
      * In case where we are able to read buf_len in one go,
@@ -178,6 +187,8 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
     }
 
     xSemaphoreTake(rb->lock, portMAX_DELAY);
+    /* A copying read invalidates any window handed out by rb_read_peek */
+    rb->read_reserved = 0;
 
     while (buf_len) {
         if (rb->fill_cnt < buf_len) {
@@ -203,6 +214,7 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
         buf_len -= read_size;
         rb->fill_cnt -= read_size;
         total_read_size += read_size;
+        rb->stats.bytes_out += read_size;
         if (buf) {
             buf += read_size;
         }
@@ -215,7 +227,10 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
 
         xSemaphoreGive(rb->lock);
         if (!rb->writer_finished && !rb->abort_read && !rb->reader_unblock) {
-            if (xSemaphoreTake(rb->can_read, ticks_to_wait) != pdTRUE) {
+            int64_t wait_start = esp_timer_get_time();
+            BaseType_t got_data = xSemaphoreTake(rb->can_read, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (got_data != pdTRUE) {
                 /* Small delay to avoid WDT triggering when the ticks_to_wait is set to 0 */
                 vTaskDelay(1);
                 goto out;
@@ -225,7 +240,8 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
             total_read_size = RB_ABORT;
             goto out;
         }
-        if (rb->writer_finished == 1) {
+        /* The writer may have written its last bytes just before finishing */
+        if (rb->writer_finished == 1 && rb->fill_cnt == 0) {
             goto out;
         }
         if (rb->reader_unblock == 1) {
@@ -240,6 +256,7 @@ int rb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wai
 
     xSemaphoreGive(rb->lock);
 out:
+    rb_stats_read_done(&rb->stats, blocked_us);
     if (rb->writer_finished == 1 && total_read_size == 0) {
         total_read_size = RB_WRITER_FINISHED;
     }
@@ -261,6 +278,7 @@ int rb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wa
 
     int write_size;
     int total_write_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
 
     /**
      * In case where we are able to write buf_len in one go,
@@ -273,6 +291,8 @@ int rb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wa
     }
 
     xSemaphoreTake(rb->lock, portMAX_DELAY);
+    /* A copying write invalidates any window handed out by rb_write_acquire */
+    rb->write_reserved = 0;
 
     while (buf_len) {
         if ((rb->size - rb->fill_cnt) < buf_len) {
@@ -295,6 +315,8 @@ int rb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wa
         rb->fill_cnt += write_size;
         total_write_size += write_size;
         buf += write_size;
+        rb->stats.bytes_in += write_size;
+        rb_stats_update_fill(&rb->stats, rb->fill_cnt);
 
         xSemaphoreGive(rb->can_read);
 
@@ -304,9 +326,13 @@ int rb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wa
 
         xSemaphoreGive(rb->lock);
         if (rb->writer_finished) {
+            rb_stats_write_done(&rb->stats, blocked_us);
             return write_size > 0 ? write_size : RB_WRITER_FINISHED;
         }
-        if (xSemaphoreTake(rb->can_write, ticks_to_wait) != pdTRUE) {
+        int64_t wait_start = esp_timer_get_time();
+        BaseType_t got_space = xSemaphoreTake(rb->can_write, ticks_to_wait);
+        rb_stats_add_wait(&blocked_us, wait_start);
+        if (got_space != pdTRUE) {
             goto out;
         }
         if (rb->abort_write == 1) {
@@ -317,9 +343,198 @@ int rb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wa
 
     xSemaphoreGive(rb->lock);
 out:
+    rb_stats_write_done(&rb->stats, blocked_us);
     return total_write_size;
 }
 
+int rb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    ringbuf_t *rb = (ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_BASIC) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (ptr == NULL || contig_len == NULL || rb->abort_write == 1) {
+        return RB_FAIL;
+    }
+    *contig_len = 0;
+
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    int ret;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    while (rb->fill_cnt == rb->size) {
+        xSemaphoreGive(rb->lock);
+        if (rb->writer_finished) {
+            ret = RB_WRITER_FINISHED;
+            goto out;
+        }
+        int64_t wait_start = esp_timer_get_time();
+        BaseType_t got_space = xSemaphoreTake(rb->can_write, ticks_to_wait);
+        rb_stats_add_wait(&blocked_us, wait_start);
+        if (got_space != pdTRUE) {
+            ret = 0;
+            goto out;
+        }
+        if (rb->abort_write == 1) {
+            ret = RB_FAIL;
+            goto out;
+        }
+        xSemaphoreTake(rb->lock, portMAX_DELAY);
+    }
+
+    if (rb->writeptr == rb->base + rb->size) {
+        rb->writeptr = rb->base;
+    }
+    int len = rb->base + rb->size - rb->writeptr;
+    if (len > rb->size - rb->fill_cnt) {
+        len = rb->size - rb->fill_cnt;
+    }
+    rb->write_reserved = len;
+    *ptr = rb->writeptr;
+    *contig_len = len;
+    xSemaphoreGive(rb->lock);
+    ret = len;
+out:
+    rb_stats_write_done(&rb->stats, blocked_us);
+    return ret;
+}
+
+int rb_write_commit(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    ringbuf_t *rb = (ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_BASIC) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    if (rb->abort_write == 1 || len < 0 || len > rb->write_reserved) {
+        /* The window was invalidated by a reset/abort in the meantime, or overrun */
+        rb->write_reserved = 0;
+        xSemaphoreGive(rb->lock);
+        return RB_FAIL;
+    }
+    rb->writeptr += len;
+    if (rb->writeptr == rb->base + rb->size) {
+        rb->writeptr = rb->base;
+    }
+    rb->fill_cnt += len;
+    rb->write_reserved = 0;
+    rb->stats.bytes_in += len;
+    rb_stats_update_fill(&rb->stats, rb->fill_cnt);
+    if (len) {
+        xSemaphoreGive(rb->can_read);
+    }
+    xSemaphoreGive(rb->lock);
+    return len;
+}
+
+int rb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    ringbuf_t *rb = (ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_BASIC) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (ptr == NULL || contig_len == NULL || rb->abort_read == 1) {
+        return ESP_FAIL;
+    }
+    *contig_len = 0;
+
+    int ret = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    while (rb->fill_cnt == 0) {
+        xSemaphoreGive(rb->lock);
+        if (!rb->writer_finished && !rb->abort_read && !rb->reader_unblock) {
+            int64_t wait_start = esp_timer_get_time();
+            BaseType_t got_data = xSemaphoreTake(rb->can_read, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (got_data != pdTRUE) {
+                /* Small delay to avoid WDT triggering when the ticks_to_wait is set to 0 */
+                vTaskDelay(1);
+                goto out;
+            }
+        }
+        if (rb->abort_read == 1) {
+            ret = RB_ABORT;
+            goto out;
+        }
+        if (rb->writer_finished == 1 && rb->fill_cnt == 0) {
+            ret = RB_WRITER_FINISHED;
+            goto out;
+        }
+        if (rb->reader_unblock == 1) {
+            ret = RB_READER_UNBLOCK;
+            goto out;
+        }
+        xSemaphoreTake(rb->lock, portMAX_DELAY);
+    }
+
+    if (rb->readptr == rb->base + rb->size) {
+        rb->readptr = rb->base;
+    }
+    ret = rb->base + rb->size - rb->readptr;
+    if (ret > rb->fill_cnt) {
+        ret = rb->fill_cnt;
+    }
+    rb->read_reserved = ret;
+    *ptr = rb->readptr;
+    *contig_len = ret;
+    xSemaphoreGive(rb->lock);
+out:
+    rb_stats_read_done(&rb->stats, blocked_us);
+    rb->reader_unblock = 0; /* We are anyway unblocking reader */
+    return ret;
+}
+
+int rb_read_release(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    ringbuf_t *rb = (ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_BASIC) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    if (len < 0 || len > rb->read_reserved) {
+        /* The window was invalidated by a reset/read in the meantime, or overrun */
+        rb->read_reserved = 0;
+        xSemaphoreGive(rb->lock);
+        return RB_FAIL;
+    }
+    rb->readptr += len;
+    if (rb->readptr == rb->base + rb->size) {
+        rb->readptr = rb->base;
+    }
+    rb->fill_cnt -= len;
+    rb->read_reserved = 0;
+    rb->stats.bytes_out += len;
+    if (len) {
+        xSemaphoreGive(rb->can_write);
+    }
+    xSemaphoreGive(rb->lock);
+    return len;
+}
+
 /**
  * abort and set abort_read and abort_write to asked values.
  */
@@ -340,6 +555,8 @@ static void _rb_reset(rb_handle_t handle, int abort_read, int abort_write)
     rb->fill_cnt = 0;
     rb->writer_finished = 0;
     rb->reader_unblock = 0;
+    rb->write_reserved = 0;
+    rb->read_reserved = 0;
     rb->abort_read = abort_read;
     rb->abort_write = abort_write;
     xSemaphoreGive(rb->lock);
@@ -373,6 +590,7 @@ void rb_abort_read(rb_handle_t handle)
     }
 
     rb->abort_read = 1;
+    rb->stats.aborts++;
     xSemaphoreGive(rb->can_read);
     xSemaphoreGive(rb->lock);
 }
@@ -390,6 +608,7 @@ void rb_abort_write(rb_handle_t handle)
     }
 
     rb->abort_write = 1;
+    rb->stats.aborts++;
     xSemaphoreGive(rb->can_write);
     xSemaphoreGive(rb->lock);
 }
@@ -408,6 +627,7 @@ void rb_abort(rb_handle_t handle)
 
     rb->abort_read = 1;
     rb->abort_write = 1;
+    rb->stats.aborts++;
     xSemaphoreGive(rb->can_read);
     xSemaphoreGive(rb->can_write);
     xSemaphoreGive(rb->lock);
@@ -431,6 +651,7 @@ void rb_reset_and_abort_write(rb_handle_t handle)
     }
 
     _rb_reset(rb, 0, 1);
+    rb->stats.aborts++;
     xSemaphoreGive(rb->can_write);
 }
 
@@ -478,9 +699,25 @@ void rb_wakeup_reader(rb_handle_t handle)
     }
 
     rb->reader_unblock = 1;
+    rb->stats.wakeups++;
     xSemaphoreGive(rb->can_read);
 }
 
+rb_stats_t *rb_get_stats(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return NULL;
+    }
+    ringbuf_t *rb = (ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_BASIC) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return NULL;
+    }
+
+    return &rb->stats;
+}
+
 void rb_stat(rb_handle_t handle)
 {
     if (handle == NULL) {
@@ -495,6 +732,11 @@ void rb_stat(rb_handle_t handle)
 
     xSemaphoreTake(rb->lock, portMAX_DELAY);
     ESP_LOGI(TAG, "filled: %d, base: %p, read_ptr: %p, write_ptr: %p, size: %d\n",
-                rb->fill_cnt, rb->base, rb->readptr, rb->writeptr, rb->size);
+                (int)rb->fill_cnt, rb->base, rb->readptr, rb->writeptr, (int)rb->size);
+    ESP_LOGI(TAG, "%s: in: %llu, out: %llu, peak fill: %u, blocked reads: %u (%llu us), blocked writes: %u (%llu us), aborts: %u, wakeups: %u",
+                rb->name, (unsigned long long)rb->stats.bytes_in, (unsigned long long)rb->stats.bytes_out,
+                rb->stats.peak_fill, rb->stats.blocked_reads, (unsigned long long)rb->stats.blocked_read_us,
+                rb->stats.blocked_writes, (unsigned long long)rb->stats.blocked_write_us, rb->stats.aborts,
+                rb->stats.wakeups);
     xSemaphoreGive(rb->lock);
 }
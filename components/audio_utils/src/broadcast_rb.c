@@ -0,0 +1,585 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+/**
+* \file
+*   Broadcast (single writer, multiple readers) Ring Buffer library
+*/
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <broadcast_rb.h>
+#include <rb_stats.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include <esp_audio_mem.h>
+
+static const char *TAG = "[broadcast_rb]";
+
+struct broadcast_rb;
+
+typedef struct brb_reader_slot {
+    struct broadcast_rb *rb;
+    const char *name;
+    bool in_use;
+    brb_reader_policy_t policy;
+    uint32_t history;
+    uint64_t offset;            /**< Absolute read offset */
+    xSemaphoreHandle can_read;
+    int reader_unblock;
+    uint64_t overrun_bytes;     /**< Bytes skipped after being lapped by the writer */
+    uint32_t overruns;
+} brb_reader_slot_t;
+
+typedef struct broadcast_rb {
+    /* Keep rb_type_t first */
+    rb_type_t type;
+    char *name;
+    uint8_t *base;
+    uint32_t size;
+    uint64_t write_offset;      /**< Absolute write offset */
+    xSemaphoreHandle can_write;
+    xSemaphoreHandle lock;
+    int abort_read;
+    int abort_write;
+    int writer_finished;
+    int max_readers;
+    brb_reader_slot_t *readers;
+    rb_stats_t stats;
+} broadcast_rb_t;
+
+static broadcast_rb_t *brb_get(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return NULL;
+    }
+    broadcast_rb_t *rb = (broadcast_rb_t *)handle;
+    if (rb->type != RB_TYPE_BROADCAST) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return NULL;
+    }
+    return rb;
+}
+
+static brb_reader_slot_t *brb_get_reader(brb_reader_t reader)
+{
+    if (reader == NULL) {
+        ESP_LOGE(TAG, "reader is NULL");
+        return NULL;
+    }
+    brb_reader_slot_t *r = (brb_reader_slot_t *)reader;
+    if (!r->in_use) {
+        ESP_LOGE(TAG, "reader is closed");
+        return NULL;
+    }
+    return r;
+}
+
+/* Oldest offset which hasn't been overwritten yet */
+static uint64_t brb_oldest_offset(broadcast_rb_t *rb)
+{
+    return rb->write_offset > rb->size ? rb->write_offset - rb->size : 0;
+}
+
+/* Must be called with the lock held */
+static uint32_t brb_write_space(broadcast_rb_t *rb)
+{
+    /* With no blocking reader, the oldest data is simply overwritten */
+    int64_t space = rb->size;
+
+    for (int i = 0; i < rb->max_readers; i++) {
+        brb_reader_slot_t *r = &rb->readers[i];
+        if (!r->in_use || r->policy != BRB_READER_BLOCK_WRITER) {
+            continue;
+        }
+        int64_t reader_space = (int64_t)rb->size - r->history - (int64_t)(rb->write_offset - r->offset);
+        if (reader_space < space) {
+            space = reader_space;
+        }
+    }
+    return space > 0 ? space : 0;
+}
+
+/* Must be called with the lock held */
+static uint32_t brb_max_fill(broadcast_rb_t *rb)
+{
+    uint64_t fill = 0;
+
+    for (int i = 0; i < rb->max_readers; i++) {
+        brb_reader_slot_t *r = &rb->readers[i];
+        if (r->in_use && rb->write_offset - r->offset > fill) {
+            fill = rb->write_offset - r->offset;
+        }
+    }
+    return fill > rb->size ? rb->size : fill;
+}
+
+/* Skip a reader lapped by the writer to the oldest data still in the buffer */
+static void brb_catch_up(brb_reader_slot_t *r)
+{
+    uint64_t oldest = brb_oldest_offset(r->rb);
+
+    if (r->offset < oldest) {
+        r->overrun_bytes += oldest - r->offset;
+        r->overruns++;
+        r->offset = oldest;
+    }
+}
+
+static void brb_wakeup_all_readers(broadcast_rb_t *rb)
+{
+    for (int i = 0; i < rb->max_readers; i++) {
+        if (rb->readers[i].in_use) {
+            xSemaphoreGive(rb->readers[i].can_read);
+        }
+    }
+}
+
+rb_handle_t brb_init(const char *name, uint32_t size, int max_readers)
+{
+    broadcast_rb_t *rb;
+
+    if (size < 2 || !name || max_readers <= 0) {
+        return NULL;
+    }
+
+    rb = calloc(1, sizeof(broadcast_rb_t));
+    assert(rb);
+    rb->base = esp_audio_mem_calloc(1, size);
+    assert(rb->base);
+    rb->readers = calloc(max_readers, sizeof(brb_reader_slot_t));
+    assert(rb->readers);
+
+    rb->type = RB_TYPE_BROADCAST;
+    rb->name = (char *) name;
+    rb->size = size;
+    rb->max_readers = max_readers;
+
+    vSemaphoreCreateBinary(rb->can_write);
+    assert(rb->can_write);
+    rb->lock = xSemaphoreCreateMutex();
+    assert(rb->lock);
+    for (int i = 0; i < max_readers; i++) {
+        rb->readers[i].rb = rb;
+        vSemaphoreCreateBinary(rb->readers[i].can_read);
+        assert(rb->readers[i].can_read);
+    }
+    rb_stats_register(&rb->stats, name, RB_TYPE_BROADCAST, size);
+
+    return (rb_handle_t)rb;
+}
+
+void brb_cleanup(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return;
+    }
+
+    rb_stats_unregister(&rb->stats);
+    for (int i = 0; i < rb->max_readers; i++) {
+        vSemaphoreDelete(rb->readers[i].can_read);
+    }
+    free(rb->readers);
+    free(rb->base);
+    vSemaphoreDelete(rb->can_write);
+    vSemaphoreDelete(rb->lock);
+    free(rb);
+}
+
+brb_reader_t brb_reader_open(rb_handle_t handle, const brb_reader_cfg_t *cfg)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL || cfg == NULL) {
+        return NULL;
+    }
+    if (cfg->history >= rb->size) {
+        ESP_LOGE(TAG, "%s: history %u doesn't fit in %u", rb->name, cfg->history, rb->size);
+        return NULL;
+    }
+
+    brb_reader_slot_t *r = NULL;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    for (int i = 0; i < rb->max_readers; i++) {
+        if (!rb->readers[i].in_use) {
+            r = &rb->readers[i];
+            break;
+        }
+    }
+    if (r) {
+        r->name = cfg->name ? cfg->name : "reader";
+        r->policy = cfg->policy;
+        r->history = cfg->history;
+        r->offset = rb->write_offset;
+        r->reader_unblock = 0;
+        r->overrun_bytes = 0;
+        r->overruns = 0;
+        r->in_use = true;
+    }
+    xSemaphoreGive(rb->lock);
+
+    if (r == NULL) {
+        ESP_LOGE(TAG, "%s: no free reader slot", rb->name);
+    }
+    return (brb_reader_t)r;
+}
+
+void brb_reader_close(brb_reader_t reader)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return;
+    }
+
+    broadcast_rb_t *rb = r->rb;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    r->in_use = false;
+    xSemaphoreGive(rb->lock);
+    /* The writer may have been waiting for this reader */
+    xSemaphoreGive(rb->can_write);
+}
+
+void brb_reader_set_policy(brb_reader_t reader, brb_reader_policy_t policy)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return;
+    }
+
+    broadcast_rb_t *rb = r->rb;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    brb_catch_up(r);
+    r->policy = policy;
+    xSemaphoreGive(rb->lock);
+    xSemaphoreGive(rb->can_write);
+}
+
+uint64_t brb_reader_seek(brb_reader_t reader, uint64_t offset)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return 0;
+    }
+
+    broadcast_rb_t *rb = r->rb;
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    uint64_t oldest = brb_oldest_offset(rb);
+    if (offset < oldest) {
+        offset = oldest;
+    } else if (offset > rb->write_offset) {
+        offset = rb->write_offset;
+    }
+    r->offset = offset;
+    xSemaphoreGive(rb->lock);
+    xSemaphoreGive(rb->can_write);
+    return offset;
+}
+
+uint64_t brb_reader_get_offset(brb_reader_t reader)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(r->rb->lock, portMAX_DELAY);
+    uint64_t offset = r->offset;
+    xSemaphoreGive(r->rb->lock);
+    return offset;
+}
+
+int brb_reader_filled(brb_reader_t reader)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return -1;
+    }
+
+    xSemaphoreTake(r->rb->lock, portMAX_DELAY);
+    brb_catch_up(r);
+    int filled = r->rb->write_offset - r->offset;
+    xSemaphoreGive(r->rb->lock);
+    return filled;
+}
+
+int brb_read(brb_reader_t reader, uint8_t *buf, int buf_len, uint32_t ticks_to_wait)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return 0;
+    }
+    broadcast_rb_t *rb = r->rb;
+
+    int total_read_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+
+    if (rb->abort_read == 1) {
+        return RB_FAIL;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    while (buf_len) {
+        brb_catch_up(r);
+        int read_size = rb->write_offset - r->offset;
+        if (read_size > buf_len) {
+            read_size = buf_len;
+        }
+        if (buf && read_size) {
+            uint32_t pos = r->offset % rb->size;
+            int rlen1 = rb->size - pos;
+            if (rlen1 >= read_size) {
+                memcpy(buf, rb->base + pos, read_size);
+            } else {
+                memcpy(buf, rb->base + pos, rlen1);
+                memcpy(buf + rlen1, rb->base, read_size - rlen1);
+            }
+            buf += read_size;
+        }
+        r->offset += read_size;
+        buf_len -= read_size;
+        total_read_size += read_size;
+        rb->stats.bytes_out += read_size;
+
+        if (read_size && r->policy == BRB_READER_BLOCK_WRITER) {
+            xSemaphoreGive(rb->can_write);
+        }
+
+        if (buf_len == 0) {
+            break;
+        }
+
+        xSemaphoreGive(rb->lock);
+        if (!rb->writer_finished && !rb->abort_read && !r->reader_unblock) {
+            int64_t wait_start = esp_timer_get_time();
+            BaseType_t got_data = xSemaphoreTake(r->can_read, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (got_data != pdTRUE) {
+                /* Small delay to avoid WDT triggering when the ticks_to_wait is set to 0 */
+                vTaskDelay(1);
+                goto out;
+            }
+        }
+        if (rb->abort_read == 1) {
+            total_read_size = RB_ABORT;
+            goto out;
+        }
+        /* The writer may have written its last bytes just before finishing */
+        if (rb->writer_finished == 1 && r->offset == rb->write_offset) {
+            goto out;
+        }
+        if (r->reader_unblock == 1) {
+            if (total_read_size == 0) {
+                total_read_size = RB_READER_UNBLOCK;
+            }
+            goto out;
+        }
+
+        xSemaphoreTake(rb->lock, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(rb->lock);
+out:
+    rb_stats_read_done(&rb->stats, blocked_us);
+    if (rb->writer_finished == 1 && total_read_size == 0) {
+        total_read_size = RB_WRITER_FINISHED;
+    }
+    r->reader_unblock = 0; /* We are anyway unblocking reader */
+    return total_read_size;
+}
+
+void brb_reader_wakeup(brb_reader_t reader)
+{
+    brb_reader_slot_t *r = brb_get_reader(reader);
+    if (r == NULL) {
+        return;
+    }
+
+    r->reader_unblock = 1;
+    r->rb->stats.wakeups++;
+    xSemaphoreGive(r->can_read);
+}
+
+int brb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wait)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return 0;
+    }
+
+    int total_write_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+
+    if (buf == NULL || rb->abort_write == 1) {
+        return RB_FAIL;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    while (buf_len) {
+        int write_size = brb_write_space(rb);
+        if (write_size > buf_len) {
+            write_size = buf_len;
+        }
+        if (write_size) {
+            uint32_t pos = rb->write_offset % rb->size;
+            int wlen1 = rb->size - pos;
+            if (wlen1 >= write_size) {
+                memcpy(rb->base + pos, buf, write_size);
+            } else {
+                memcpy(rb->base + pos, buf, wlen1);
+                memcpy(rb->base, buf + wlen1, write_size - wlen1);
+            }
+            rb->write_offset += write_size;
+            buf += write_size;
+            buf_len -= write_size;
+            total_write_size += write_size;
+            rb->stats.bytes_in += write_size;
+            rb_stats_update_fill(&rb->stats, brb_max_fill(rb));
+            brb_wakeup_all_readers(rb);
+        }
+
+        if (buf_len == 0) {
+            break;
+        }
+
+        xSemaphoreGive(rb->lock);
+        if (rb->writer_finished) {
+            rb_stats_write_done(&rb->stats, blocked_us);
+            return total_write_size > 0 ? total_write_size : RB_WRITER_FINISHED;
+        }
+        int64_t wait_start = esp_timer_get_time();
+        BaseType_t got_space = xSemaphoreTake(rb->can_write, ticks_to_wait);
+        rb_stats_add_wait(&blocked_us, wait_start);
+        if (got_space != pdTRUE) {
+            goto out;
+        }
+        if (rb->abort_write == 1) {
+            goto out;
+        }
+        xSemaphoreTake(rb->lock, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(rb->lock);
+out:
+    rb_stats_write_done(&rb->stats, blocked_us);
+    return total_write_size;
+}
+
+int brb_available(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return -1;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    int available = brb_write_space(rb);
+    xSemaphoreGive(rb->lock);
+    return available;
+}
+
+uint64_t brb_get_write_offset(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    uint64_t offset = rb->write_offset;
+    xSemaphoreGive(rb->lock);
+    return offset;
+}
+
+void brb_reset(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    rb->write_offset = 0;
+    for (int i = 0; i < rb->max_readers; i++) {
+        rb->readers[i].offset = 0;
+        rb->readers[i].reader_unblock = 0;
+    }
+    rb->abort_read = 0;
+    rb->abort_write = 0;
+    rb->writer_finished = 0;
+    xSemaphoreGive(rb->lock);
+}
+
+void brb_abort(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return;
+    }
+
+    rb->abort_read = 1;
+    rb->abort_write = 1;
+    rb->stats.aborts++;
+    brb_wakeup_all_readers(rb);
+    xSemaphoreGive(rb->can_write);
+}
+
+void brb_signal_writer_finished(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return;
+    }
+
+    rb->writer_finished = 1;
+    brb_wakeup_all_readers(rb);
+}
+
+void brb_stat(rb_handle_t handle)
+{
+    broadcast_rb_t *rb = brb_get(handle);
+    if (rb == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(rb->lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "%s: size: %u, write offset: %llu, available: %u", rb->name, rb->size,
+             (unsigned long long)rb->write_offset, brb_write_space(rb));
+    ESP_LOGI(TAG, "%s: in: %llu, out: %llu, peak fill: %u, blocked reads: %u (%llu us), blocked writes: %u (%llu us), aborts: %u, wakeups: %u",
+             rb->name, (unsigned long long)rb->stats.bytes_in, (unsigned long long)rb->stats.bytes_out,
+             rb->stats.peak_fill, rb->stats.blocked_reads, (unsigned long long)rb->stats.blocked_read_us,
+             rb->stats.blocked_writes, (unsigned long long)rb->stats.blocked_write_us, rb->stats.aborts,
+             rb->stats.wakeups);
+    for (int i = 0; i < rb->max_readers; i++) {
+        brb_reader_slot_t *r = &rb->readers[i];
+        if (!r->in_use) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s/%s: %s, offset: %llu, history: %u, overruns: %u (%llu bytes)", rb->name, r->name,
+                 r->policy == BRB_READER_BLOCK_WRITER ? "block" : "overwrite", (unsigned long long)r->offset,
+                 r->history, r->overruns, (unsigned long long)r->overrun_bytes);
+    }
+    xSemaphoreGive(rb->lock);
+}
@@ -31,6 +31,10 @@
 #include <freertos/task.h>
 #include <esp_audio_mem.h>
 #include <esp_timer.h>
+#include <rb_stats.h>
+#include <latency_trace.h>
+#include <httpc.h>
+#include <tls_handshake_stats.h>
 #include "lwip/sockets.h"
 
 #include <string.h>
@@ -226,6 +230,109 @@ static int heap_trace_cli_handler(int argc, char *argv[])
     return 0;
 }
 
+static int rb_stats_cli_handler(int argc, char *argv[])
+{
+    /* Just to go to the next line */
+    printf("\n");
+    if (argc < 2) {
+        rb_stats_print_all();
+    } else if (strcmp(argv[1], "reset") == 0) {
+        rb_stats_reset_all();
+        printf("%s: Ring buffer stats cleared\n", TAG);
+    } else if (strcmp(argv[1], "json") == 0) {
+        int len = rb_stats_to_json(NULL, 0);
+        if (len < 0) {
+            return 0;
+        }
+        /* Leave some room for rings created in the meantime */
+        len += 256;
+        char *buf = esp_audio_mem_calloc(1, len);
+        if (!buf) {
+            ESP_LOGE(TAG, "Memory not allocated for rb stats.");
+            return 0;
+        }
+        rb_stats_to_json(buf, len);
+        printf("%s\n", buf);
+        esp_audio_mem_free(buf);
+    } else {
+        printf("%s: Invalid argument:%s:\n", TAG, argv[1]);
+    }
+    return 0;
+}
+
+static int lat_trace_cli_handler(int argc, char *argv[])
+{
+    /* Just to go to the next line */
+    printf("\n");
+    if (argc < 2) {
+        lt_print_all();
+    } else if (strcmp(argv[1], "on") == 0) {
+        lt_set_enabled(true);
+        printf("%s: Latency tracing enabled\n", TAG);
+    } else if (strcmp(argv[1], "off") == 0) {
+        lt_set_enabled(false);
+        printf("%s: Latency tracing disabled\n", TAG);
+    } else if (strcmp(argv[1], "reset") == 0) {
+        lt_reset_all();
+        printf("%s: Latency histograms cleared\n", TAG);
+    } else if (strcmp(argv[1], "json") == 0) {
+        int len = lt_to_json(NULL, 0);
+        if (len < 0) {
+            return 0;
+        }
+        /* Counts may grow in the meantime */
+        len += 256;
+        char *buf = esp_audio_mem_calloc(1, len);
+        if (!buf) {
+            ESP_LOGE(TAG, "Memory not allocated for latency trace.");
+            return 0;
+        }
+        lt_to_json(buf, len);
+        printf("%s\n", buf);
+        esp_audio_mem_free(buf);
+    } else {
+        printf("%s: Invalid argument:%s:\n", TAG, argv[1]);
+    }
+    return 0;
+}
+
+static int http_pool_cli_handler(int argc, char *argv[])
+{
+    /* Just to go to the next line */
+    printf("\n");
+    if (argc < 2) {
+        httpc_pool_stats_t stats;
+        http_connection_pool_get_stats(&stats);
+        printf("%s: HTTP connection pool: idle %u, hits %u, misses %u, TLS handshakes avoided %u, "
+               "stale %u, expired %u, evicted %u\n", TAG, stats.idle, stats.hits, stats.misses,
+               stats.tls_handshakes_avoided, stats.stale, stats.expired, stats.evicted);
+    } else if (strcmp(argv[1], "flush") == 0) {
+        http_connection_pool_flush();
+        printf("%s: Idle HTTP connections closed\n", TAG);
+    } else {
+        printf("%s: Invalid argument:%s:\n", TAG, argv[1]);
+    }
+    return 0;
+}
+
+static int tls_handshakes_cli_handler(int argc, char *argv[])
+{
+    /* Just to go to the next line */
+    printf("\n");
+    if (argc < 2) {
+        tls_handshake_stats_t stats;
+        tls_handshake_get_stats(&stats);
+        printf("%s: TLS handshakes: %u (avg %llu ms, max %u ms), failed %u\n", TAG, stats.completed,
+               stats.completed ? stats.completed_us / stats.completed / 1000 : 0, stats.max_us / 1000, stats.failed);
+    } else if (strcmp(argv[1], "reset") == 0) {
+        tls_handshake_reset_stats();
+        printf("%s: TLS handshake statistics cleared\n", TAG);
+    } else {
+        printf("%s: Invalid argument:%s:\n", TAG, argv[1]);
+    }
+    return 0;
+}
+
 static esp_console_cmd_t diag_cmds[] = {
     {
         .command = "up-time",
@@ -257,6 +364,26 @@ static esp_console_cmd_t diag_cmds[] = {
         .help = "<start|stop> [trace-buf-size]",
         .func = heap_trace_cli_handler,
     },
+    {
+        .command = "rb-stats",
+        .help = "[reset|json]",
+        .func = rb_stats_cli_handler,
+    },
+    {
+        .command = "lat-trace",
+        .help = "[on|off|reset|json]",
+        .func = lat_trace_cli_handler,
+    },
+    {
+        .command = "http-pool",
+        .help = "[flush]",
+        .func = http_pool_cli_handler,
+    },
+    {
+        .command = "tls-handshakes",
+        .help = "[reset]",
+        .func = tls_handshakes_cli_handler,
+    },
 };
 
 int diag_register_cli()
@@ -0,0 +1,270 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+/**
+* \file
+*   Audio latency tracing
+*/
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <latency_trace.h>
+
+static const char *lt_stage_names[LT_STAGE_MAX] = {
+    [LT_STAGE_HTTP_OUTPUT_RB] = "http_output_rb",
+    [LT_STAGE_CODEC] = "codec",
+    [LT_STAGE_CODEC_OUTPUT_RB] = "codec_output_rb",
+    [LT_STAGE_PLAYBACK_MIX] = "playback_mix",
+    [LT_STAGE_DOWNMIX_RB] = "downmix_rb",
+    [LT_STAGE_I2S_DMA] = "i2s_dma",
+    [LT_STAGE_PLAYBACK_TOTAL] = "playback_total",
+    [LT_STAGE_MIC_RAW_RB] = "mic_raw_rb",
+    [LT_STAGE_DSP_RESAMPLE] = "dsp_resample",
+    [LT_STAGE_MIC_RB] = "mic_rb",
+    [LT_STAGE_CAPTURE_TOTAL] = "capture_total",
+};
+
+static lt_hist_t lt_hists[LT_STAGE_MAX];
+static portMUX_TYPE lt_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool lt_enabled;
+/* Marks left before tracing was last turned on are dropped */
+static volatile uint32_t lt_epoch;
+
+#define LT_LOAD(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define LT_STORE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+const char *lt_stage_name(lt_stage_t stage)
+{
+    return (stage < LT_STAGE_MAX) ? lt_stage_names[stage] : "unknown";
+}
+
+void lt_point_init(lt_point_t *pt, lt_stage_t stage, lt_stage_t total_stage, uint32_t interval)
+{
+    memset(pt, 0, sizeof(*pt));
+    pt->stage = stage;
+    pt->total_stage = total_stage;
+    pt->interval = interval ? interval : LT_DEFAULT_INTERVAL;
+}
+
+void lt_point_reset(lt_point_t *pt)
+{
+    lt_point_init(pt, pt->stage, pt->total_stage, pt->interval);
+}
+
+void lt_point_in(lt_point_t *pt, int len, lt_point_t *from, lt_stage_t from_stage)
+{
+    if (len <= 0) {
+        return;
+    }
+    pt->bytes_in += len;
+    if (!lt_enabled) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t epoch = lt_epoch;
+    if (from && from->out_pending) {
+        /* First bytes made out of a mark that left `from` */
+        from->out_pending = false;
+        if (from->out_epoch == epoch) {
+            if (from_stage < LT_STAGE_MAX) {
+                lt_record(from_stage, now - from->out_us);
+            }
+            pt->in_origin_us = from->out_origin_us;
+            pt->in_epoch = epoch;
+        }
+    }
+    if (pt->bytes_in < pt->next_mark) {
+        return;
+    }
+    if (pt->marks_in - LT_LOAD(pt->marks_out) >= LT_POINT_MARKS) {
+        /* The consumer is far behind, try again with the next bytes */
+        return;
+    }
+
+    lt_mark_t *m = &pt->marks[pt->marks_in % LT_POINT_MARKS];
+    m->offset = pt->bytes_in;
+    m->in_us = now;
+    /* The path starts here, unless the bytes came out of another point */
+    m->origin_us = (from && pt->in_epoch == epoch) ? pt->in_origin_us : now;
+    m->epoch = epoch;
+    LT_STORE(pt->marks_in, pt->marks_in + 1);
+    pt->next_mark = pt->bytes_in + pt->interval;
+}
+
+void lt_point_out_at(lt_point_t *pt, uint64_t offset, int64_t now_us)
+{
+    if (offset > pt->bytes_out) {
+        pt->bytes_out = offset;
+    }
+
+    uint32_t marks_out = pt->marks_out;
+    while ((int32_t)(LT_LOAD(pt->marks_in) - marks_out) > 0) {
+        lt_mark_t *m = &pt->marks[marks_out % LT_POINT_MARKS];
+        if (m->offset > pt->bytes_out) {
+            break;
+        }
+        if (lt_enabled && m->epoch == lt_epoch) {
+            lt_record(pt->stage, now_us - m->in_us);
+            if (pt->total_stage < LT_STAGE_MAX) {
+                lt_record(pt->total_stage, now_us - m->origin_us);
+            }
+            pt->out_us = now_us;
+            pt->out_origin_us = m->origin_us;
+            pt->out_epoch = m->epoch;
+            pt->out_pending = true;
+        }
+        marks_out++;
+    }
+    LT_STORE(pt->marks_out, marks_out);
+}
+
+int64_t lt_playout_add(lt_playout_t *clk, int len, int bytes_per_sec)
+{
+    int64_t now = esp_timer_get_time();
+    if (clk->drained_us < now) {
+        /* Underrun, the device played out everything */
+        clk->drained_us = now;
+    }
+    if (len > 0 && bytes_per_sec > 0) {
+        clk->drained_us += (int64_t)len * 1000000 / bytes_per_sec;
+    }
+    return clk->drained_us;
+}
+
+void lt_record(lt_stage_t stage, int64_t us)
+{
+    if (stage >= LT_STAGE_MAX || us < 0) {
+        return;
+    }
+    int b = 0;
+    while (b < LT_HIST_BUCKETS - 1 && us >= ((int64_t)LT_HIST_BASE_US << b)) {
+        b++;
+    }
+
+    portENTER_CRITICAL(&lt_mux);
+    lt_hist_t *h = &lt_hists[stage];
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) {
+        h->max_us = (us > UINT32_MAX) ? UINT32_MAX : us;
+    }
+    h->buckets[b]++;
+    portEXIT_CRITICAL(&lt_mux);
+}
+
+void lt_get_hist(lt_stage_t stage, lt_hist_t *out)
+{
+    if (stage >= LT_STAGE_MAX) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&lt_mux);
+    *out = lt_hists[stage];
+    portEXIT_CRITICAL(&lt_mux);
+}
+
+void lt_reset_all(void)
+{
+    portENTER_CRITICAL(&lt_mux);
+    memset(lt_hists, 0, sizeof(lt_hists));
+    portEXIT_CRITICAL(&lt_mux);
+}
+
+void lt_set_enabled(bool enable)
+{
+    if (enable && !lt_enabled) {
+        lt_reset_all();
+        lt_epoch++;
+    }
+    lt_enabled = enable;
+}
+
+bool lt_is_enabled(void)
+{
+    return lt_enabled;
+}
+
+/* Upper bound of the bucket holding the `pct` percentile */
+static uint32_t lt_hist_percentile(const lt_hist_t *h, int pct)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (h->count * pct + 99) / 100, seen = 0;
+    for (int b = 0; b < LT_HIST_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            return LT_HIST_BASE_US << b;
+        }
+    }
+    return h->max_us;
+}
+
+void lt_print_all(void)
+{
+    printf("Latency tracing is %s\n", lt_enabled ? "on" : "off");
+    printf("%16s %10s %10s %10s %10s %10s\n", "Stage", "Count", "MeanUs", "P50Us", "P99Us", "MaxUs");
+    for (int s = 0; s < LT_STAGE_MAX; s++) {
+        lt_hist_t h;
+        lt_get_hist(s, &h);
+        printf("%16s %10llu %10llu %10u %10u %10u\n", lt_stage_name(s), (unsigned long long)h.count,
+               (unsigned long long)(h.count ? h.sum_us / h.count : 0), lt_hist_percentile(&h, 50),
+               lt_hist_percentile(&h, 99), h.max_us);
+    }
+}
+
+/* snprintf() into what is left of the buffer, but keep counting past its end */
+#define JSON_APPEND(...) do {                                                   \
+        int _n = snprintf(buf_len > (size_t)len ? buf + len : NULL,             \
+                          buf_len > (size_t)len ? buf_len - len : 0,            \
+                          __VA_ARGS__);                                         \
+        if (_n > 0) {                                                           \
+            len += _n;                                                          \
+        }                                                                       \
+    } while (0)
+
+int lt_to_json(char *buf, size_t buf_len)
+{
+    int len = 0;
+    if (buf == NULL) {
+        buf_len = 0;
+    }
+
+    JSON_APPEND("{\"enabled\":%s,\"hist_base_us\":%d,\"stages\":[", lt_enabled ? "true" : "false", LT_HIST_BASE_US);
+    for (int s = 0; s < LT_STAGE_MAX; s++) {
+        lt_hist_t h;
+        lt_get_hist(s, &h);
+        JSON_APPEND("%s{\"name\":\"%s\",\"count\":%llu,\"mean_us\":%llu,\"max_us\":%u,\"p50_us\":%u,\"p99_us\":%u,\"hist\":[",
+                    s ? "," : "", lt_stage_name(s), (unsigned long long)h.count,
+                    (unsigned long long)(h.count ? h.sum_us / h.count : 0), h.max_us,
+                    lt_hist_percentile(&h, 50), lt_hist_percentile(&h, 99));
+        for (int b = 0; b < LT_HIST_BUCKETS; b++) {
+            JSON_APPEND("%s%u", b ? "," : "", h.buckets[b]);
+        }
+        JSON_APPEND("]}");
+    }
+    JSON_APPEND("]}");
+    return len;
+}
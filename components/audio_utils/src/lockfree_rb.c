@@ -0,0 +1,652 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+/**
+* \file
+*   Lock-free single-producer/single-consumer Ring Buffer library
+*/
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <lockfree_rb.h>
+#include <rb_stats.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include <esp_audio_mem.h>
+
+static const char *TAG = "[lockfree_rb]";
+
+/* Indices run over [0, 2 * size) so that a full buffer (write - read == size)
+ * can be told apart from an empty one (write == read) without wasting a byte.
+ */
+typedef struct lockfree_ringbuf {
+    /* Keep rb_type_t first */
+    rb_type_t type;
+    char *name;
+    uint8_t *base;
+    uint32_t size;
+    uint32_t read_idx;          /**< Only written by the reader */
+    uint32_t write_idx;         /**< Only written by the writer */
+    TaskHandle_t waiting_reader; /**< Set while the reader sleeps on an empty buffer */
+    TaskHandle_t waiting_writer; /**< Set while the writer sleeps on a full buffer */
+    int abort_read;
+    int abort_write;
+    int writer_finished;
+    int reader_unblock;
+    uint32_t write_reserved;    /**< Window handed out by lfrb_write_acquire. Writer only */
+    uint32_t read_reserved;     /**< Window handed out by lfrb_read_peek. Reader only */
+    rb_stats_t stats;           /**< Read counters are owned by the reader, write counters by the writer */
+} lockfree_ringbuf_t;
+
+#define LFRB_LOAD(x)        __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define LFRB_STORE(x, v)    __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+
+static inline uint32_t lfrb_idx_distance(lockfree_ringbuf_t *rb, uint32_t from, uint32_t to)
+{
+    return (to >= from) ? (to - from) : (to + 2 * rb->size - from);
+}
+
+static inline uint32_t lfrb_idx_advance(lockfree_ringbuf_t *rb, uint32_t idx, uint32_t len)
+{
+    idx += len;
+    return (idx >= 2 * rb->size) ? (idx - 2 * rb->size) : idx;
+}
+
+static inline uint8_t *lfrb_idx_to_ptr(lockfree_ringbuf_t *rb, uint32_t idx)
+{
+    return rb->base + ((idx >= rb->size) ? (idx - rb->size) : idx);
+}
+
+/* Wake up a task waiting on the other end, but only if there is one. */
+static inline void lfrb_notify(TaskHandle_t *waiter)
+{
+    if (LFRB_LOAD(*waiter) == NULL) {
+        return;
+    }
+    TaskHandle_t task = __atomic_exchange_n(waiter, NULL, __ATOMIC_SEQ_CST);
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+rb_handle_t lfrb_init(const char *name, uint32_t size)
+{
+    lockfree_ringbuf_t *r;
+
+    if (size < 2 || size > (UINT32_MAX / 2) || !name) {
+        return NULL;
+    }
+
+    r = esp_audio_mem_calloc(1, sizeof(lockfree_ringbuf_t));
+    if (!r) {
+        ESP_LOGE(TAG, "Failed to allocate lfrb: %s", name);
+        return NULL;
+    }
+    r->base = esp_audio_mem_calloc(1, size);
+    if (!r->base) {
+        ESP_LOGE(TAG, "Failed to allocate buffer for lfrb: %s", name);
+        esp_audio_mem_free(r);
+        return NULL;
+    }
+
+    r->type = RB_TYPE_LOCKFREE;
+    r->name = (char *) name;
+    r->size = size;
+    rb_stats_register(&r->stats, name, RB_TYPE_LOCKFREE, size);
+
+    return (rb_handle_t)r;
+}
+
+void lfrb_cleanup(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    rb_stats_unregister(&rb->stats);
+    esp_audio_mem_free(rb->base);
+    rb->base = NULL;
+    esp_audio_mem_free(rb);
+}
+
+int lfrb_filled(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return -1;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return -1;
+    }
+
+    return lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), LFRB_LOAD(rb->write_idx));
+}
+
+int lfrb_available(rb_handle_t handle)
+{
+    int filled = lfrb_filled(handle);
+    if (filled < 0) {
+        return filled;
+    }
+    return ((lockfree_ringbuf_t *)handle)->size - filled;
+}
+
+int lfrb_read(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (rb->abort_read == 1) {
+        return ESP_FAIL;
+    }
+
+    int total_read_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    uint32_t read_idx = rb->read_idx;
+    rb->read_reserved = 0;
+
+    while (buf_len) {
+        uint32_t filled = lfrb_idx_distance(rb, read_idx, LFRB_LOAD(rb->write_idx));
+        if (filled) {
+            int read_size = (filled < (uint32_t) buf_len) ? (int) filled : buf_len;
+            uint8_t *readptr = lfrb_idx_to_ptr(rb, read_idx);
+            int rlen1 = rb->base + rb->size - readptr;
+            if (buf) {
+                if (read_size > rlen1) {
+                    memcpy(buf, readptr, rlen1);
+                    memcpy(buf + rlen1, rb->base, read_size - rlen1);
+                } else {
+                    memcpy(buf, readptr, read_size);
+                }
+                buf += read_size;
+            }
+            read_idx = lfrb_idx_advance(rb, read_idx, read_size);
+            LFRB_STORE(rb->read_idx, read_idx);
+            lfrb_notify(&rb->waiting_writer);
+
+            buf_len -= read_size;
+            total_read_size += read_size;
+            rb->stats.bytes_out += read_size;
+            continue;
+        }
+
+        /* Buffer is empty: register as waiter, then re-check everything
+         * the writer (or an aborting task) could have changed before it
+         * saw us waiting.
+         */
+        LFRB_STORE(rb->waiting_reader, xTaskGetCurrentTaskHandle());
+        if (rb->abort_read == 1) {
+            total_read_size = RB_ABORT;
+            break;
+        }
+        if (rb->reader_unblock == 1) {
+            if (total_read_size == 0) {
+                total_read_size = RB_READER_UNBLOCK;
+            }
+            break;
+        }
+        /* Load writer_finished before the write index: the writer may have
+         * written its last bytes just before finishing.
+         */
+        int writer_finished = LFRB_LOAD(rb->writer_finished);
+        if (lfrb_idx_distance(rb, read_idx, LFRB_LOAD(rb->write_idx)) == 0) {
+            if (writer_finished == 1) {
+                break;
+            }
+            int64_t wait_start = esp_timer_get_time();
+            uint32_t notified = ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (notified == 0) {
+                /* Small delay to avoid WDT triggering when the ticks_to_wait is set to 0 */
+                vTaskDelay(1);
+                break;
+            }
+        }
+        LFRB_STORE(rb->waiting_reader, NULL);
+    }
+
+    LFRB_STORE(rb->waiting_reader, NULL);
+    rb_stats_read_done(&rb->stats, blocked_us);
+    if (rb->writer_finished == 1 && total_read_size == 0) {
+        total_read_size = RB_WRITER_FINISHED;
+    }
+    rb->reader_unblock = 0; /* We are anyway unblocking reader */
+    return total_read_size;
+}
+
+int lfrb_write(rb_handle_t handle, uint8_t *buf, int buf_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (buf == NULL || rb->abort_write == 1) {
+        return RB_FAIL;
+    }
+
+    int total_write_size = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    uint32_t write_idx = rb->write_idx;
+    rb->write_reserved = 0;
+
+    while (buf_len) {
+        uint32_t available = rb->size - lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), write_idx);
+        if (available) {
+            int write_size = (available < (uint32_t) buf_len) ? (int) available : buf_len;
+            uint8_t *writeptr = lfrb_idx_to_ptr(rb, write_idx);
+            int wlen1 = rb->base + rb->size - writeptr;
+            if (write_size > wlen1) {
+                memcpy(writeptr, buf, wlen1);
+                memcpy(rb->base, buf + wlen1, write_size - wlen1);
+            } else {
+                memcpy(writeptr, buf, write_size);
+            }
+            write_idx = lfrb_idx_advance(rb, write_idx, write_size);
+            LFRB_STORE(rb->write_idx, write_idx);
+            lfrb_notify(&rb->waiting_reader);
+            rb->stats.bytes_in += write_size;
+            rb_stats_update_fill(&rb->stats, rb->size - available + write_size);
+
+            buf += write_size;
+            buf_len -= write_size;
+            total_write_size += write_size;
+            continue;
+        }
+
+        if (rb->writer_finished) {
+            rb_stats_write_done(&rb->stats, blocked_us);
+            return total_write_size > 0 ? total_write_size : RB_WRITER_FINISHED;
+        }
+
+        /* Buffer is full */
+        LFRB_STORE(rb->waiting_writer, xTaskGetCurrentTaskHandle());
+        if (rb->abort_write == 1) {
+            break;
+        }
+        if (lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), write_idx) == rb->size) {
+            int64_t wait_start = esp_timer_get_time();
+            uint32_t notified = ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (notified == 0) {
+                break;
+            }
+            if (rb->abort_write == 1) {
+                break;
+            }
+        }
+        LFRB_STORE(rb->waiting_writer, NULL);
+    }
+
+    LFRB_STORE(rb->waiting_writer, NULL);
+    rb_stats_write_done(&rb->stats, blocked_us);
+    return total_write_size;
+}
+
+int lfrb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (ptr == NULL || contig_len == NULL || rb->abort_write == 1) {
+        return RB_FAIL;
+    }
+    *contig_len = 0;
+
+    int ret = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    uint32_t write_idx = rb->write_idx;
+    while (1) {
+        uint32_t available = rb->size - lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), write_idx);
+        if (available) {
+            uint8_t *writeptr = lfrb_idx_to_ptr(rb, write_idx);
+            uint32_t wlen1 = rb->base + rb->size - writeptr;
+            ret = (available < wlen1) ? available : wlen1;
+            rb->write_reserved = ret;
+            *ptr = writeptr;
+            *contig_len = ret;
+            break;
+        }
+        if (rb->writer_finished) {
+            ret = RB_WRITER_FINISHED;
+            break;
+        }
+
+        /* Buffer is full */
+        LFRB_STORE(rb->waiting_writer, xTaskGetCurrentTaskHandle());
+        if (rb->abort_write == 1) {
+            ret = RB_FAIL;
+            break;
+        }
+        if (lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), write_idx) == rb->size) {
+            int64_t wait_start = esp_timer_get_time();
+            uint32_t notified = ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (notified == 0) {
+                break;
+            }
+            if (rb->abort_write == 1) {
+                ret = RB_FAIL;
+                break;
+            }
+        }
+        LFRB_STORE(rb->waiting_writer, NULL);
+    }
+
+    LFRB_STORE(rb->waiting_writer, NULL);
+    rb_stats_write_done(&rb->stats, blocked_us);
+    return ret;
+}
+
+int lfrb_write_commit(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (rb->abort_write == 1 || len < 0 || (uint32_t) len > rb->write_reserved) {
+        rb->write_reserved = 0;
+        return RB_FAIL;
+    }
+    rb->write_reserved = 0;
+    if (len) {
+        uint32_t write_idx = lfrb_idx_advance(rb, rb->write_idx, len);
+        LFRB_STORE(rb->write_idx, write_idx);
+        lfrb_notify(&rb->waiting_reader);
+        rb->stats.bytes_in += len;
+        rb_stats_update_fill(&rb->stats, lfrb_idx_distance(rb, LFRB_LOAD(rb->read_idx), write_idx));
+    }
+    return len;
+}
+
+int lfrb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (ptr == NULL || contig_len == NULL || rb->abort_read == 1) {
+        return ESP_FAIL;
+    }
+    *contig_len = 0;
+
+    int ret = 0;
+    int64_t blocked_us = RB_STATS_NOT_BLOCKED;
+    uint32_t read_idx = rb->read_idx;
+    while (1) {
+        uint32_t filled = lfrb_idx_distance(rb, read_idx, LFRB_LOAD(rb->write_idx));
+        if (filled) {
+            uint8_t *readptr = lfrb_idx_to_ptr(rb, read_idx);
+            uint32_t rlen1 = rb->base + rb->size - readptr;
+            ret = (filled < rlen1) ? filled : rlen1;
+            rb->read_reserved = ret;
+            *ptr = readptr;
+            *contig_len = ret;
+            break;
+        }
+
+        /* Buffer is empty. Same sequence as lfrb_read() */
+        LFRB_STORE(rb->waiting_reader, xTaskGetCurrentTaskHandle());
+        if (rb->abort_read == 1) {
+            ret = RB_ABORT;
+            break;
+        }
+        if (rb->reader_unblock == 1) {
+            ret = RB_READER_UNBLOCK;
+            break;
+        }
+        int writer_finished = LFRB_LOAD(rb->writer_finished);
+        if (lfrb_idx_distance(rb, read_idx, LFRB_LOAD(rb->write_idx)) == 0) {
+            if (writer_finished == 1) {
+                ret = RB_WRITER_FINISHED;
+                break;
+            }
+            int64_t wait_start = esp_timer_get_time();
+            uint32_t notified = ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+            rb_stats_add_wait(&blocked_us, wait_start);
+            if (notified == 0) {
+                /* Small delay to avoid WDT triggering when the ticks_to_wait is set to 0 */
+                vTaskDelay(1);
+                break;
+            }
+        }
+        LFRB_STORE(rb->waiting_reader, NULL);
+    }
+
+    LFRB_STORE(rb->waiting_reader, NULL);
+    rb_stats_read_done(&rb->stats, blocked_us);
+    rb->reader_unblock = 0; /* We are anyway unblocking reader */
+    return ret;
+}
+
+int lfrb_read_release(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return 0;
+    }
+
+    if (len < 0 || (uint32_t) len > rb->read_reserved) {
+        rb->read_reserved = 0;
+        return RB_FAIL;
+    }
+    rb->read_reserved = 0;
+    if (len) {
+        LFRB_STORE(rb->read_idx, lfrb_idx_advance(rb, rb->read_idx, len));
+        lfrb_notify(&rb->waiting_writer);
+        rb->stats.bytes_out += len;
+    }
+    return len;
+}
+
+void lfrb_reset(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->read_idx, 0);
+    LFRB_STORE(rb->write_idx, 0);
+    rb->writer_finished = 0;
+    rb->reader_unblock = 0;
+    rb->write_reserved = 0;
+    rb->read_reserved = 0;
+    rb->abort_read = 0;
+    rb->abort_write = 0;
+}
+
+void lfrb_abort_read(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->abort_read, 1);
+    rb->stats.aborts++;
+    lfrb_notify(&rb->waiting_reader);
+}
+
+void lfrb_abort_write(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->abort_write, 1);
+    rb->stats.aborts++;
+    lfrb_notify(&rb->waiting_writer);
+}
+
+void lfrb_abort(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->abort_read, 1);
+    LFRB_STORE(rb->abort_write, 1);
+    rb->stats.aborts++;
+    lfrb_notify(&rb->waiting_reader);
+    lfrb_notify(&rb->waiting_writer);
+}
+
+void lfrb_signal_writer_finished(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->writer_finished, 1);
+    lfrb_notify(&rb->waiting_reader);
+}
+
+int lfrb_is_writer_finished(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return -1;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return -1;
+    }
+
+    return LFRB_LOAD(rb->writer_finished);
+}
+
+void lfrb_wakeup_reader(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    LFRB_STORE(rb->reader_unblock, 1);
+    rb->stats.wakeups++;
+    lfrb_notify(&rb->waiting_reader);
+}
+
+void lfrb_stat(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    lockfree_ringbuf_t *rb = (lockfree_ringbuf_t *)handle;
+    if (rb->type != RB_TYPE_LOCKFREE) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", rb->type);
+        return;
+    }
+
+    uint32_t read_idx = LFRB_LOAD(rb->read_idx);
+    uint32_t write_idx = LFRB_LOAD(rb->write_idx);
+    ESP_LOGI(TAG, "%s: filled: %d, base: %p, read_ptr: %p, write_ptr: %p, size: %d\n", rb->name,
+                lfrb_idx_distance(rb, read_idx, write_idx), rb->base,
+                lfrb_idx_to_ptr(rb, read_idx), lfrb_idx_to_ptr(rb, write_idx), rb->size);
+    ESP_LOGI(TAG, "%s: in: %llu, out: %llu, peak fill: %u, blocked reads: %u (%llu us), blocked writes: %u (%llu us), aborts: %u, wakeups: %u",
+                rb->name, (unsigned long long)rb->stats.bytes_in, (unsigned long long)rb->stats.bytes_out,
+                rb->stats.peak_fill, rb->stats.blocked_reads, (unsigned long long)rb->stats.blocked_read_us,
+                rb->stats.blocked_writes, (unsigned long long)rb->stats.blocked_write_us, rb->stats.aborts,
+                rb->stats.wakeups);
+}
@@ -0,0 +1,228 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2018 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on all ESPRESSIF SYSTEMS products, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+/**
+* \file
+*   Ring Buffer telemetry registry
+*/
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <rb_stats.h>
+#include "esp_log.h"
+#include <esp_audio_mem.h>
+
+static const char *TAG = "[rb_stats]";
+
+/* Registered rings. The list is only ever held for short copies, never
+ * while printing, so a spinlock is enough.
+ */
+static rb_stats_t *rb_stats_list;
+static portMUX_TYPE rb_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *rb_stats_type_str(rb_type_t type)
+{
+    switch (type) {
+    case RB_TYPE_BASIC:
+        return "basic";
+    case RB_TYPE_SPECIAL:
+        return "special";
+    case RB_TYPE_LOCKFREE:
+        return "lockfree";
+    case RB_TYPE_BROADCAST:
+        return "broadcast";
+    default:
+        return "unknown";
+    }
+}
+
+static void rb_stats_clear(rb_stats_t *stats)
+{
+    stats->bytes_in = 0;
+    stats->bytes_out = 0;
+    stats->peak_fill = 0;
+    stats->blocked_reads = 0;
+    stats->blocked_read_us = 0;
+    stats->blocked_writes = 0;
+    stats->blocked_write_us = 0;
+    stats->aborts = 0;
+    stats->wakeups = 0;
+}
+
+void rb_stats_register(rb_stats_t *stats, const char *rb_name, rb_type_t type, uint32_t size)
+{
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->name, sizeof(stats->name), "%s", rb_name);
+    stats->type = type;
+    stats->size = size;
+
+    portENTER_CRITICAL(&rb_stats_mux);
+    stats->next = rb_stats_list;
+    rb_stats_list = stats;
+    portEXIT_CRITICAL(&rb_stats_mux);
+}
+
+void rb_stats_unregister(rb_stats_t *stats)
+{
+    portENTER_CRITICAL(&rb_stats_mux);
+    rb_stats_t **pp = &rb_stats_list;
+    while (*pp && *pp != stats) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = stats->next;
+    }
+    portEXIT_CRITICAL(&rb_stats_mux);
+    stats->next = NULL;
+}
+
+int rb_stats_get(const char *rb_name, rb_stats_t *out)
+{
+    int ret = -1;
+
+    portENTER_CRITICAL(&rb_stats_mux);
+    for (rb_stats_t *s = rb_stats_list; s; s = s->next) {
+        if (strncmp(s->name, rb_name, sizeof(s->name) - 1) == 0) {
+            *out = *s;
+            out->next = NULL;
+            ret = 0;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&rb_stats_mux);
+    return ret;
+}
+
+void rb_stats_reset_all(void)
+{
+    portENTER_CRITICAL(&rb_stats_mux);
+    for (rb_stats_t *s = rb_stats_list; s; s = s->next) {
+        rb_stats_clear(s);
+    }
+    portEXIT_CRITICAL(&rb_stats_mux);
+}
+
+/* Copy the registry, so that it can be formatted without holding the lock.
+ * Returns the number of entries in `*snapshot`, to be freed by the caller.
+ */
+static int rb_stats_snapshot(rb_stats_t **snapshot)
+{
+    int cnt = 0;
+
+    *snapshot = NULL;
+    portENTER_CRITICAL(&rb_stats_mux);
+    for (rb_stats_t *s = rb_stats_list; s; s = s->next) {
+        cnt++;
+    }
+    portEXIT_CRITICAL(&rb_stats_mux);
+    if (cnt == 0) {
+        return 0;
+    }
+
+    /* Rings created meanwhile are left out */
+    rb_stats_t *copy = esp_audio_mem_calloc(cnt, sizeof(rb_stats_t));
+    if (!copy) {
+        ESP_LOGE(TAG, "Failed to allocate snapshot of %d rings", cnt);
+        return -1;
+    }
+    int i = 0;
+    portENTER_CRITICAL(&rb_stats_mux);
+    for (rb_stats_t *s = rb_stats_list; s && i < cnt; s = s->next) {
+        copy[i] = *s;
+        copy[i++].next = NULL;
+    }
+    portEXIT_CRITICAL(&rb_stats_mux);
+    *snapshot = copy;
+    return i;
+}
+
+void rb_stats_print_all(void)
+{
+    rb_stats_t *snapshot;
+    int cnt = rb_stats_snapshot(&snapshot);
+    if (cnt < 0) {
+        return;
+    }
+
+    printf("%16s %8s %8s %12s %12s %8s %8s %12s %8s %12s %6s %8s\n", "Name", "Type", "Size",
+           "BytesIn", "BytesOut", "PeakFill", "RdBlock", "RdBlockUs", "WrBlock", "WrBlockUs", "Aborts", "Wakeups");
+    for (int i = 0; i < cnt; i++) {
+        rb_stats_t *s = &snapshot[i];
+        printf("%16s %8s %8u %12llu %12llu %8u %8u %12llu %8u %12llu %6u %8u\n", s->name,
+               rb_stats_type_str(s->type), s->size,
+               (unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out, s->peak_fill,
+               s->blocked_reads, (unsigned long long)s->blocked_read_us,
+               s->blocked_writes, (unsigned long long)s->blocked_write_us, s->aborts, s->wakeups);
+    }
+    esp_audio_mem_free(snapshot);
+}
+
+/* snprintf() into what is left of the buffer, but keep counting past its end */
+#define JSON_APPEND(...) do {                                                   \
+        int _n = snprintf(buf_len > (size_t)len ? buf + len : NULL,             \
+                          buf_len > (size_t)len ? buf_len - len : 0,            \
+                          __VA_ARGS__);                                         \
+        if (_n > 0) {                                                           \
+            len += _n;                                                          \
+        }                                                                       \
+    } while (0)
+
+int rb_stats_to_json(char *buf, size_t buf_len)
+{
+    rb_stats_t *snapshot;
+    int len = 0;
+    int cnt = rb_stats_snapshot(&snapshot);
+    if (cnt < 0) {
+        return -1;
+    }
+    if (buf == NULL) {
+        buf_len = 0;
+    }
+
+    JSON_APPEND("{\"rings\":[");
+    for (int i = 0; i < cnt; i++) {
+        rb_stats_t *s = &snapshot[i];
+        JSON_APPEND("%s{\"name\":\"", i ? "," : "");
+        /* Names are plain identifiers in practice, but keep the JSON valid regardless */
+        for (const char *c = s->name; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                JSON_APPEND("\\%c", *c);
+            } else if ((unsigned char)*c < 0x20) {
+                JSON_APPEND("\\u%04x", *c);
+            } else {
+                JSON_APPEND("%c", *c);
+            }
+        }
+        JSON_APPEND("\",\"type\":\"%s\",\"size\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu,\"peak_fill\":%u,"
+                    "\"blocked_reads\":%u,\"blocked_read_us\":%llu,\"blocked_writes\":%u,\"blocked_write_us\":%llu,"
+                    "\"aborts\":%u,\"wakeups\":%u}",
+                    rb_stats_type_str(s->type), s->size,
+                    (unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out, s->peak_fill,
+                    s->blocked_reads, (unsigned long long)s->blocked_read_us,
+                    s->blocked_writes, (unsigned long long)s->blocked_write_us, s->aborts, s->wakeups);
+    }
+    JSON_APPEND("]}");
+    esp_audio_mem_free(snapshot);
+    return len;
+}
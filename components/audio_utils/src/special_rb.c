@@ -12,9 +12,20 @@ static const char *TAG = "[srb]";
 
 // #define DEBUG_ANCHORS 1
 
-struct srb_anchor_node {
+struct srb_anchor_slot {
     rb_anchor_t anchor;
-    struct srb_anchor_node *next;
+    uint32_t seq;           /* Put order, so that anchors at the same offset come out in order */
+    uint32_t payload_len;
+    bool copied;            /* Put with srb_put_anchor_data(): the payload belongs to the srb */
+    bool heap_payload;      /* The payload didn't fit the inline slot */
+};
+
+/* The pool starts with one block of anchors, and another is chained when they
+ * are all in use. Slots never move, so the payloads they point to stay put.
+ */
+struct srb_anchor_block {
+    struct srb_anchor_slot *slots;
+    uint8_t *payloads;
 };
 
 typedef struct {
@@ -25,15 +36,97 @@ typedef struct {
     /* The amount of data that has already been read from the above
      * ring buffer */
     uint64_t read_offset;
-    /* Sorted list of anchors. For convenience of operations, the first node is empty */
-    struct srb_anchor_node list;
+    /* Anchor pool: slots and their inline payloads, allocated a block at a time */
+    struct srb_anchor_block blocks[SRB_MAX_ANCHOR_BLOCKS];
+    uint16_t block_cnt;
+    uint16_t block_size;    /* Anchors per block */
+    uint16_t max_anchors;   /* Anchors in all the blocks */
+    uint16_t payload_size;
+    uint16_t *free_slots;   /* Stack of unused slot indices */
+    uint16_t free_cnt;
+    /* Anchors arrive in increasing offset order in practice, and are simply
+     * appended to a circular queue. The odd out-of-order one goes to a
+     * min-heap instead. The next anchor is the smaller of the two heads.
+     */
+    uint16_t *queue;
+    uint16_t queue_head;
+    uint16_t queue_cnt;
+    uint16_t *heap;
+    uint16_t heap_cnt;
+    uint32_t next_seq;
+    srb_anchor_stats_t stats;
     /* The lock that protects this data structure*/
     xSemaphoreHandle lock;
     xSemaphoreHandle read_lock;
 } s_ringbuf_t;
 
-rb_handle_t srb_init(const char *rb_name, uint32_t size)
+static inline struct srb_anchor_slot *srb_slot(s_ringbuf_t *srb, uint16_t idx)
+{
+    if (idx < srb->block_size) {
+        return &srb->blocks[0].slots[idx];
+    }
+    return &srb->blocks[idx / srb->block_size].slots[idx % srb->block_size];
+}
+
+static inline uint8_t *srb_slot_payload(s_ringbuf_t *srb, uint16_t idx)
+{
+    return srb->blocks[idx / srb->block_size].payloads + (idx % srb->block_size) * srb->payload_size;
+}
+
+/* Chain another block of anchors to the pool. The index arrays grow along,
+ * the queue starting over at 0. Assumes lock is taken outside, if any.
+ */
+static int srb_anchor_pool_grow(s_ringbuf_t *srb)
+{
+    if (srb->block_cnt == SRB_MAX_ANCHOR_BLOCKS || srb->max_anchors + srb->block_size > UINT16_MAX) {
+        return -1;
+    }
+    struct srb_anchor_block *block = &srb->blocks[srb->block_cnt];
+    uint16_t max_anchors = srb->max_anchors + srb->block_size;
+    block->slots = esp_audio_mem_calloc(srb->block_size, sizeof(struct srb_anchor_slot));
+    if (srb->payload_size) {
+        block->payloads = esp_audio_mem_calloc(srb->block_size, srb->payload_size);
+    }
+    /* free_slots, queue and heap, in one go */
+    uint16_t *free_slots = esp_audio_mem_calloc(3 * max_anchors, sizeof(uint16_t));
+    if (!block->slots || (srb->payload_size && !block->payloads) || !free_slots) {
+        esp_audio_mem_free(block->slots);
+        esp_audio_mem_free(block->payloads);
+        esp_audio_mem_free(free_slots);
+        block->slots = NULL;
+        block->payloads = NULL;
+        return -1;
+    }
+    uint16_t *queue = free_slots + max_anchors;
+    uint16_t *heap = queue + max_anchors;
+    for (int i = 0; i < srb->queue_cnt; i++) {
+        queue[i] = srb->queue[(srb->queue_head + i) % srb->max_anchors];
+    }
+    if (srb->free_slots) {
+        memcpy(heap, srb->heap, srb->heap_cnt * sizeof(uint16_t));
+        memcpy(free_slots, srb->free_slots, srb->free_cnt * sizeof(uint16_t));
+    }
+    /* The new slots, the first one on top */
+    for (int i = srb->block_size - 1; i >= 0; i--) {
+        free_slots[srb->free_cnt++] = srb->max_anchors + i;
+    }
+    esp_audio_mem_free(srb->free_slots);
+    srb->free_slots = free_slots;
+    srb->queue = queue;
+    srb->queue_head = 0;
+    srb->heap = heap;
+    srb->max_anchors = max_anchors;
+    srb->block_cnt++;
+    return 0;
+}
+
+rb_handle_t srb_init_with_anchor_pool(const char *rb_name, uint32_t size, uint16_t max_anchors, uint16_t payload_size)
 {
+    if (max_anchors == 0) {
+        ESP_LOGE(TAG, "Need room for at least one anchor");
+        return NULL;
+    }
+
     s_ringbuf_t *sr = esp_audio_mem_calloc(1, sizeof(*sr));
     if (!sr) {
         ESP_LOGE(TAG, "Failed to allocate SRB");
@@ -48,6 +141,15 @@ rb_handle_t srb_init(const char *rb_name, uint32_t size)
         ESP_LOGE(TAG, "Failed to allocate ring buffer");
         goto error;
     }
+    /* The data path telemetry is that of the underlying rb, listed under our type */
+    rb_get_stats(sr->rb)->type = RB_TYPE_SPECIAL;
+
+    sr->block_size = max_anchors;
+    sr->payload_size = payload_size;
+    if (srb_anchor_pool_grow(sr) != 0) {
+        ESP_LOGE(TAG, "Failed to allocate anchor pool");
+        goto error;
+    }
 
     sr->lock = xSemaphoreCreateMutex();
     if (!sr->lock) {
@@ -67,55 +169,150 @@ rb_handle_t srb_init(const char *rb_name, uint32_t size)
         if (sr->rb) {
             rb_cleanup(sr->rb);
         }
+        if (sr->lock) {
+            vSemaphoreDelete(sr->lock);
+        }
+        for (int i = 0; i < sr->block_cnt; i++) {
+            esp_audio_mem_free(sr->blocks[i].slots);
+            esp_audio_mem_free(sr->blocks[i].payloads);
+        }
+        esp_audio_mem_free(sr->free_slots);
         esp_audio_mem_free(sr);
     }
     return NULL;
 }
 
-static struct srb_anchor_node *srb_node_new(rb_anchor_t *anchor)
+rb_handle_t srb_init(const char *rb_name, uint32_t size)
 {
-    struct srb_anchor_node *n = esp_audio_mem_calloc(1, sizeof(*n));
-    if (n) {
-        n->anchor = *anchor;
-        n->next = NULL;
-    }
-    return n;
+    return srb_init_with_anchor_pool(rb_name, size, SRB_DEFAULT_MAX_ANCHORS, SRB_DEFAULT_ANCHOR_PAYLOAD_SIZE);
 }
 
-static void srb_node_free(struct srb_anchor_node * n)
+static inline bool srb_slot_before(s_ringbuf_t *srb, uint16_t a, uint16_t b)
 {
-    esp_audio_mem_free(n);
+    struct srb_anchor_slot *sa = srb_slot(srb, a), *sb = srb_slot(srb, b);
+    if (sa->anchor.offset != sb->anchor.offset) {
+        return sa->anchor.offset < sb->anchor.offset;
+    }
+    return (int32_t)(sa->seq - sb->seq) < 0;
 }
 
-static int srb_node_insert(rb_handle_t handle, rb_anchor_t *anchor)
+static void srb_heap_push(s_ringbuf_t *srb, uint16_t idx)
 {
-    if (handle == NULL) {
-        ESP_LOGE(TAG, "handle is NULL");
-        return -1;
+    int pos = srb->heap_cnt++;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!srb_slot_before(srb, idx, srb->heap[parent])) {
+            break;
+        }
+        srb->heap[pos] = srb->heap[parent];
+        pos = parent;
     }
-    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
-    if (srb->type != RB_TYPE_SPECIAL) {
-        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
-        return -1;
+    srb->heap[pos] = idx;
+}
+
+static void srb_heap_pop(s_ringbuf_t *srb)
+{
+    uint16_t last = srb->heap[--srb->heap_cnt];
+    int pos = 0;
+    while (1) {
+        int child = 2 * pos + 1;
+        if (child >= srb->heap_cnt) {
+            break;
+        }
+        if (child + 1 < srb->heap_cnt && srb_slot_before(srb, srb->heap[child + 1], srb->heap[child])) {
+            child++;
+        }
+        if (!srb_slot_before(srb, srb->heap[child], last)) {
+            break;
+        }
+        srb->heap[pos] = srb->heap[child];
+        pos = child;
     }
+    srb->heap[pos] = last;
+}
 
-    struct srb_anchor_node *n = srb_node_new(anchor);
-    if (!n) {
-        ESP_LOGE(TAG, "Couldn't allocate node");
-        return -1;
+/* The anchor with the smallest offset, or NULL. Assumes lock is taken outside */
+static struct srb_anchor_slot *srb_anchor_first(s_ringbuf_t *srb)
+{
+    if (srb->heap_cnt && (!srb->queue_cnt || srb_slot_before(srb, srb->heap[0], srb->queue[srb->queue_head]))) {
+        return srb_slot(srb, srb->heap[0]);
     }
-    struct srb_anchor_node *current = &srb->list;
-    while (current) {
-        /* This will ensure that if we have 2 anchors at the same
-         * offset, the one that came later is added later
-         */
-        if ((current->next == NULL) || current->next->anchor.offset > n->anchor.offset) {
-            struct srb_anchor_node *next = current->next;
-            current->next = n;
-            n->next = next;
-            break;
+    if (srb->queue_cnt) {
+        return srb_slot(srb, srb->queue[srb->queue_head]);
+    }
+    return NULL;
+}
+
+/* Remove the anchor returned by srb_anchor_first() and give its slot back to
+ * the pool. The payload (if allocated) is left to the caller.
+ */
+static void srb_anchor_remove_first(s_ringbuf_t *srb)
+{
+    uint16_t idx;
+    if (srb->heap_cnt && (!srb->queue_cnt || srb_slot_before(srb, srb->heap[0], srb->queue[srb->queue_head]))) {
+        idx = srb->heap[0];
+        srb_heap_pop(srb);
+    } else {
+        idx = srb->queue[srb->queue_head];
+        srb->queue_head = (srb->queue_head + 1) % srb->max_anchors;
+        srb->queue_cnt--;
+    }
+    srb->free_slots[srb->free_cnt++] = idx;
+    srb->stats.gets++;
+}
+
+static int srb_anchor_insert(s_ringbuf_t *srb, rb_anchor_t *anchor, const void *data, uint32_t datalen, bool copy)
+{
+    if (srb->free_cnt == 0) {
+        if (srb_anchor_pool_grow(srb) != 0) {
+            srb->stats.pool_exhausted++;
+            ESP_LOGE(TAG, "Anchor pool can't grow past %d anchors, anchor at %lld not put", srb->max_anchors,
+                     (long long)anchor->offset);
+            return -1;
+        }
+        srb->stats.pool_grows++;
+        ESP_LOGI(TAG, "Anchor pool grown to %d anchors", srb->max_anchors);
+    }
+    uint16_t idx = srb->free_slots[srb->free_cnt - 1];
+    struct srb_anchor_slot *slot = srb_slot(srb, idx);
+
+    slot->anchor = *anchor;
+    slot->payload_len = 0;
+    slot->copied = copy;
+    slot->heap_payload = false;
+    if (copy) {
+        if (datalen <= srb->payload_size) {
+            slot->anchor.data = srb_slot_payload(srb, idx);
+        } else {
+            slot->anchor.data = esp_audio_mem_malloc(datalen);
+            if (!slot->anchor.data) {
+                ESP_LOGE(TAG, "Couldn't allocate anchor payload of %d bytes", datalen);
+                return -1;
+            }
+            slot->heap_payload = true;
+            srb->stats.payload_overflows++;
+        }
+        if (datalen) {
+            memcpy(slot->anchor.data, data, datalen);
         }
-        current = current->next;
+        slot->payload_len = datalen;
+    }
+    slot->seq = srb->next_seq++;
+    srb->free_cnt--;
+
+    if (srb->queue_cnt == 0 ||
+            anchor->offset >= srb_slot(srb, srb->queue[(srb->queue_head + srb->queue_cnt - 1) % srb->max_anchors])->anchor.offset) {
+        srb->queue[(srb->queue_head + srb->queue_cnt) % srb->max_anchors] = idx;
+        srb->queue_cnt++;
+    } else {
+        srb_heap_push(srb, idx);
+        srb->stats.out_of_order++;
+    }
+
+    srb->stats.puts++;
+    uint32_t in_use = srb->max_anchors - srb->free_cnt;
+    if (in_use > srb->stats.max_in_use) {
+        srb->stats.max_in_use = in_use;
     }
     return 0;
 }
@@ -134,9 +331,10 @@ int srb_read(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait)
 
     xSemaphoreTake(srb->read_lock, portMAX_DELAY);
     xSemaphoreTake(srb->lock, portMAX_DELAY);
-    if (srb->list.next) {
+    struct srb_anchor_slot *first = srb_anchor_first(srb);
+    if (first) {
         /* If an anchor exists */
-        int64_t anchor_distance = srb->list.next->anchor.offset - srb->read_offset;
+        int64_t anchor_distance = first->anchor.offset - srb->read_offset;
         if (anchor_distance <= 0) {
             /* We are at the anchor, this needs to be fetched first */
             xSemaphoreGive(srb->lock);
@@ -178,7 +376,7 @@ int srb_write(rb_handle_t handle, uint8_t *buf, int len, uint32_t ticks_to_wait)
     return rb_write(srb->rb, buf, len, ticks_to_wait);
 }
 
-int srb_get_anchor(rb_handle_t handle, rb_anchor_t *anchor)
+int srb_write_acquire(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
 {
     if (handle == NULL) {
         ESP_LOGE(TAG, "handle is NULL");
@@ -190,40 +388,161 @@ int srb_get_anchor(rb_handle_t handle, rb_anchor_t *anchor)
         return 0;
     }
 
-    int rc = 0;
+    return rb_write_acquire(srb->rb, ptr, contig_len, ticks_to_wait);
+}
+
+int srb_write_commit(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
+
+    return rb_write_commit(srb->rb, len);
+}
+
+int srb_read_peek(rb_handle_t handle, uint8_t **ptr, int *contig_len, uint32_t ticks_to_wait)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
+
+    int64_t anchor_distance = -1;
+    xSemaphoreTake(srb->read_lock, portMAX_DELAY);
     xSemaphoreTake(srb->lock, portMAX_DELAY);
+    struct srb_anchor_slot *first = srb_anchor_first(srb);
+    if (first) {
+        anchor_distance = first->anchor.offset - srb->read_offset;
+        if (anchor_distance <= 0) {
+            /* We are at the anchor, this needs to be fetched first */
+            xSemaphoreGive(srb->lock);
+            xSemaphoreGive(srb->read_lock);
+            return RB_FETCH_ANCHOR;
+        }
+    }
+    xSemaphoreGive(srb->lock);
+
+    /* Same as srb_read(): an anchor put before the read offset while we wait is returned on the next call */
+    int ret = rb_read_peek(srb->rb, ptr, contig_len, ticks_to_wait);
+    if (ret > 0 && anchor_distance > 0 && ret > anchor_distance) {
+        /* Only hand out the data up to the anchor */
+        ret = anchor_distance;
+        *contig_len = ret;
+    }
+    xSemaphoreGive(srb->read_lock);
+    return ret;
+}
+
+int srb_read_release(rb_handle_t handle, int len)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
+
+    xSemaphoreTake(srb->read_lock, portMAX_DELAY);
+    int ret = rb_read_release(srb->rb, len);
+
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    if (ret > 0) {
+        srb->read_offset += ret;
+    }
+    xSemaphoreGive(srb->lock);
+    xSemaphoreGive(srb->read_lock);
+    return ret;
+}
+
+/* Pops the anchor at the current read offset. Assumes lock is taken outside */
+static int __srb_get_anchor(s_ringbuf_t *srb, struct srb_anchor_slot *out)
+{
 #ifdef DEBUG_ANCHORS
     printf("%s: Debug list:\n", TAG);
-    struct srb_anchor_node *current = srb->list.next;
-    while (current) {
-        printf("   [%lld %p]\n", current->anchor.offset, current->anchor.data);
-        current = current->next;
+    for (int i = 0; i < srb->queue_cnt; i++) {
+        struct srb_anchor_slot *slot = srb_slot(srb, srb->queue[(srb->queue_head + i) % srb->max_anchors]);
+        printf("   [%lld %p]\n", slot->anchor.offset, slot->anchor.data);
+    }
+    for (int i = 0; i < srb->heap_cnt; i++) {
+        struct srb_anchor_slot *slot = srb_slot(srb, srb->heap[i]);
+        printf("   out-of-order [%lld %p]\n", slot->anchor.offset, slot->anchor.data);
     }
 #endif
-    if (! srb->list.next) {
-        rc = RB_NO_ANCHORS;
-        goto err_return;
+    struct srb_anchor_slot *first = srb_anchor_first(srb);
+    if (!first) {
+        return RB_NO_ANCHORS;
     }
 
-    int64_t anchor_distance = srb->list.next->anchor.offset - srb->read_offset;
+    int64_t anchor_distance = first->anchor.offset - srb->read_offset;
     if (anchor_distance > 0) {
         ESP_LOGE(TAG, "No anchor at this point");
-        rc = RB_NO_ANCHORS;
-        goto err_return;
+        return RB_NO_ANCHORS;
     }
 
-    struct srb_anchor_node *n = srb->list.next;
-    *anchor = n->anchor;
-    srb->list.next = n->next;
-    srb_node_free(n);
+    *out = *first;
+    srb_anchor_remove_first(srb);
+    return 0;
+}
+
+int srb_get_anchor(rb_handle_t handle, rb_anchor_t *anchor)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
 
- err_return:
+    struct srb_anchor_slot slot;
+    void *copy = NULL;
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    struct srb_anchor_slot *first = srb_anchor_first(srb);
+    if (first && first->copied && !first->heap_payload && first->payload_len) {
+        /* The caller owns anchor->data, while an inline payload is reused by the next put: hand
+         * over a copy. Allocated before the anchor is taken, so that it isn't lost if this fails.
+         */
+        copy = esp_audio_mem_malloc(first->payload_len);
+        if (!copy) {
+            xSemaphoreGive(srb->lock);
+            ESP_LOGE(TAG, "Couldn't allocate anchor payload of %d bytes", first->payload_len);
+            return RB_FAIL;
+        }
+    }
+    int rc = __srb_get_anchor(srb, &slot);
+    if (rc == 0 && slot.copied && !slot.heap_payload) {
+        if (copy) {
+            memcpy(copy, slot.anchor.data, slot.payload_len);
+        }
+        slot.anchor.data = copy;
+        copy = NULL;
+    }
     xSemaphoreGive(srb->lock);
+    esp_audio_mem_free(copy);
+    if (rc == 0) {
+        /* The payload is handed over to the caller along with the anchor */
+        *anchor = slot.anchor;
+    }
     return rc;
 }
 
-/* Assumes lock is taken outside */
-int __srb_put_anchor(rb_handle_t handle, rb_anchor_t *anchor)
+int srb_get_anchor_data(rb_handle_t handle, uint64_t *offset, void *data, uint32_t datalen)
 {
     if (handle == NULL) {
         ESP_LOGE(TAG, "handle is NULL");
@@ -235,13 +554,39 @@ int __srb_put_anchor(rb_handle_t handle, rb_anchor_t *anchor)
         return 0;
     }
 
-    int rc = 0;
-    if (srb->read_offset >= anchor->offset) {
+    struct srb_anchor_slot slot;
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    int rc = __srb_get_anchor(srb, &slot);
+    if (rc == 0) {
+        if (offset) {
+            *offset = slot.anchor.offset;
+        }
+        /* Copy under the lock: the inline payload slot is free for the next put */
+        if (slot.copied) {
+            if (slot.payload_len) {
+                memcpy(data, slot.anchor.data, datalen < slot.payload_len ? datalen : slot.payload_len);
+            }
+        } else if (slot.anchor.data && datalen) {
+            /* Put with srb_put_anchor(): the payload still belongs to whoever put it */
+            memcpy(data, slot.anchor.data, datalen);
+        }
+    }
+    xSemaphoreGive(srb->lock);
+    if (rc == 0 && slot.heap_payload) {
+        esp_audio_mem_free(slot.anchor.data);
+    }
+    return rc;
+}
+
+/* Assumes lock is taken outside */
+static int __srb_put_anchor(s_ringbuf_t *srb, rb_anchor_t *anchor, const void *data, uint32_t datalen, bool copy)
+{
+    int rc = srb_anchor_insert(srb, anchor, data, datalen, copy);
+    if (rc == 0 && srb->read_offset >= anchor->offset) {
         /* If a reader was sleeping on rb_read() at this point, ideally the put_anchor() should wake that reader as well. */
         ESP_LOGD(TAG, "Setting anchor at current or at a point that is already read.");
         rb_wakeup_reader(srb->rb);
     }
-    rc = srb_node_insert(srb, anchor);
     return rc;
 }
 
@@ -259,7 +604,49 @@ int srb_put_anchor(rb_handle_t handle, rb_anchor_t *anchor)
 
     int rc = 0;
     xSemaphoreTake(srb->lock, portMAX_DELAY);
-    rc = __srb_put_anchor(srb, anchor);
+    rc = __srb_put_anchor(srb, anchor, NULL, 0, false);
+    xSemaphoreGive(srb->lock);
+    return rc;
+}
+
+int srb_put_anchor_data(rb_handle_t handle, uint64_t offset, const void *data, uint32_t datalen)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
+
+    int rc = 0;
+    rb_anchor_t anchor = { .offset = offset };
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    rc = __srb_put_anchor(srb, &anchor, data, datalen, true);
+    xSemaphoreGive(srb->lock);
+    return rc;
+}
+
+int srb_put_anchor_data_at_current(rb_handle_t handle, const void *data, uint32_t datalen)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return 0;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return 0;
+    }
+
+    int rc = 0;
+    rb_anchor_t anchor = { 0 };
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    /* Calculate the current write offset */
+    anchor.offset = srb->read_offset + rb_filled(srb->rb);
+    rc = __srb_put_anchor(srb, &anchor, data, datalen, true);
     xSemaphoreGive(srb->lock);
     return rc;
 }
@@ -280,7 +667,7 @@ int srb_put_anchor_at_current(rb_handle_t handle, rb_anchor_t *anchor)
     xSemaphoreTake(srb->lock, portMAX_DELAY);
     /* Calculate the current write offset */
     anchor->offset = srb->read_offset + rb_filled(srb->rb);
-    rc = __srb_put_anchor(srb, anchor);
+    rc = __srb_put_anchor(srb, anchor, NULL, 0, false);
     xSemaphoreGive(srb->lock);
     return rc;
 }
@@ -313,7 +700,8 @@ int srb_drain(rb_handle_t handle, uint64_t drain_upto)
         xSemaphoreTake(srb->lock, portMAX_DELAY);
         if (ret >= 0) {
             srb->read_offset += ret;
-            ESP_LOGI(TAG, "srb_drain: drain_upto: %lld, current_offset: %lld, drained_data: %d", drain_upto, srb->read_offset, ret);
+            ESP_LOGI(TAG, "srb_drain: drain_upto: %lld, current_offset: %lld, drained_data: %d", (long long)drain_upto,
+                     (long long)srb->read_offset, ret);
         }
     }
     ret = srb->read_offset;
@@ -456,6 +844,21 @@ void srb_signal_writer_finished(rb_handle_t handle)
     return;
 }
 
+int srb_is_writer_finished(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return -1;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return -1;
+    }
+
+    return rb_is_writer_finished(srb->rb);
+}
+
 void srb_wakeup_reader(rb_handle_t handle)
 {
     if (handle == NULL) {
@@ -473,3 +876,89 @@ void srb_wakeup_reader(rb_handle_t handle)
     xSemaphoreGive(srb->lock);
     return;
 }
+
+void srb_get_anchor_stats(rb_handle_t handle, srb_anchor_stats_t *stats)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return;
+    }
+
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    *stats = srb->stats;
+    xSemaphoreGive(srb->lock);
+}
+
+void srb_reset_anchor_stats(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return;
+    }
+
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    memset(&srb->stats, 0, sizeof(srb->stats));
+    xSemaphoreGive(srb->lock);
+}
+
+void srb_stat(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return;
+    }
+
+    rb_stat(srb->rb);
+    xSemaphoreTake(srb->lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "read_offset: %lld, anchors: %d/%d (%d out-of-order), puts: %u, gets: %u, max in use: %u, pool grows: %u, pool exhausted: %u, payload overflows: %u",
+                (long long)srb->read_offset, srb->max_anchors - srb->free_cnt, srb->max_anchors, srb->heap_cnt,
+                srb->stats.puts, srb->stats.gets, srb->stats.max_in_use, srb->stats.pool_grows, srb->stats.pool_exhausted,
+                srb->stats.payload_overflows);
+    xSemaphoreGive(srb->lock);
+}
+
+void srb_cleanup(rb_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "handle is NULL");
+        return;
+    }
+    s_ringbuf_t *srb = (s_ringbuf_t *)handle;
+    if (srb->type != RB_TYPE_SPECIAL) {
+        ESP_LOGE(TAG, "Incorrect rb_type: %d", srb->type);
+        return;
+    }
+
+    /* Payloads that didn't fit their slot were allocated */
+    struct srb_anchor_slot *first;
+    while ((first = srb_anchor_first(srb)) != NULL) {
+        if (first->heap_payload) {
+            esp_audio_mem_free(first->anchor.data);
+        }
+        srb_anchor_remove_first(srb);
+    }
+    rb_cleanup(srb->rb);
+    vSemaphoreDelete(srb->lock);
+    vSemaphoreDelete(srb->read_lock);
+    for (int i = 0; i < srb->block_cnt; i++) {
+        esp_audio_mem_free(srb->blocks[i].slots);
+        esp_audio_mem_free(srb->blocks[i].payloads);
+    }
+    esp_audio_mem_free(srb->free_slots);
+    esp_audio_mem_free(srb);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+
+#ifndef HOST_LOG_VERBOSE
+#define HOST_LOG_VERBOSE 0
+#endif
+
+#define ESP_LOGE(TAG, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", TAG, ##__VA_ARGS__)
+#define ESP_LOGW(TAG, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", TAG, ##__VA_ARGS__)
+#define ESP_LOGI(TAG, fmt, ...) do { if (HOST_LOG_VERBOSE) fprintf(stderr, "I %s: " fmt "\n", TAG, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(TAG, fmt, ...) do { } while (0)
+#define ESP_LOGV(TAG, fmt, ...) do { } while (0)
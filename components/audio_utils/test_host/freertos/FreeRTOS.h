@@ -0,0 +1,35 @@
+#pragma once
+
+/* Minimal FreeRTOS API on top of pthreads, enough to run the audio
+ * ring buffers and their users on a Linux host. One tick is one ms.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sdkconfig.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef TickType_t portTickType;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       ((TickType_t) 0xffffffffUL)
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS    portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define tskNO_AFFINITY      0x7FFFFFFF
+#define configASSERT(x)     assert(x)
+
+#define portMUX_INITIALIZER_UNLOCKED 0
+typedef int portMUX_TYPE;
+#define portENTER_CRITICAL(mux)     do { (void)(mux); host_enter_critical(); } while (0)
+#define portEXIT_CRITICAL(mux)      do { (void)(mux); host_exit_critical(); } while (0)
+
+void host_enter_critical(void);
+void host_exit_critical(void);
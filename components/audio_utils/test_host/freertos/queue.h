@@ -0,0 +1,26 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+typedef struct host_queue *QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+
+enum host_queue_kind {
+    HOST_QUEUE_QUEUE,
+    HOST_QUEUE_SEMAPHORE,
+    HOST_QUEUE_MUTEX,
+};
+
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size, enum host_queue_kind kind);
+QueueHandle_t host_queue_create_counting(UBaseType_t max, UBaseType_t initial);
+
+#define xQueueCreate(length, item_size) host_queue_create(length, item_size, HOST_QUEUE_QUEUE)
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReset(QueueHandle_t q);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+void vQueueDelete(QueueHandle_t q);
+
+#define xQueueSendToBack(q, item, ticks) xQueueSend(q, item, ticks)
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+
+#define xSemaphoreCreateMutex()             host_queue_create(1, 0, HOST_QUEUE_MUTEX)
+#define xSemaphoreCreateRecursiveMutex()    host_queue_create(1, 0, HOST_QUEUE_MUTEX)
+#define xSemaphoreCreateBinary()            host_queue_create(1, 0, HOST_QUEUE_SEMAPHORE)
+#define xSemaphoreCreateCounting(max, init) host_queue_create_counting(max, init)
+#define vSemaphoreCreateBinary(sem)         do { (sem) = xSemaphoreCreateBinary(); if (sem) xSemaphoreGive(sem); } while (0)
+#define xSemaphoreTake(sem, ticks)          xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)                 xQueueSend(sem, NULL, 0)
+#define xSemaphoreTakeRecursive(sem, ticks) xSemaphoreTake(sem, ticks)
+#define xSemaphoreGiveRecursive(sem)        xSemaphoreGive(sem)
+#define vSemaphoreDelete(sem)               vQueueDelete(sem)
@@ -0,0 +1,417 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* pthread based implementation of the FreeRTOS subset in ./freertos */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_value;
+    bool notify_pending;
+};
+
+struct host_queue {
+    enum host_queue_kind kind;
+    pthread_mutex_t lock;
+    pthread_cond_t can_recv;
+    pthread_cond_t can_send;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    TaskHandle_t owner;
+    uint8_t *items;
+};
+
+static __thread struct host_task *current_task;
+static pthread_mutex_t critical_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t block_count;
+
+void host_enter_critical(void)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void host_exit_critical(void)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+uint64_t host_task_get_block_count(void)
+{
+    return __atomic_load_n(&block_count, __ATOMIC_RELAXED);
+}
+
+static void host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void host_deadline(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ticks / 1000;
+    ts->tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Returns false on timeout. Caller holds `lock` and re-checks its condition. */
+static bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0) {
+        return false;
+    }
+    __atomic_add_fetch(&block_count, 1, __ATOMIC_RELAXED);
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct host_task *host_task_new(TaskFunction_t fn, void *arg)
+{
+    struct host_task *t = calloc(1, sizeof(*t));
+    assert(t);
+    t->fn = fn;
+    t->arg = arg;
+    pthread_mutex_init(&t->lock, NULL);
+    host_cond_init(&t->cond);
+    return t;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!current_task) {
+        /* Threads not created through xTaskCreate (e.g. main) */
+        current_task = host_task_new(NULL, NULL);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+static void *host_task_entry(void *arg)
+{
+    current_task = arg;
+    current_task->fn(current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    /* Threads have no name, stack size or priority here */
+    (void) name;
+    (void) stack_depth;
+    (void) priority;
+    struct host_task *t = host_task_new(fn, arg);
+    if (pthread_create(&t->thread, NULL, host_task_entry, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+    (void) core_id;
+    return xTaskCreate(fn, name, stack_depth, arg, priority, handle);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                               UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buf)
+{
+    (void) stack;
+    (void) task_buf;
+    TaskHandle_t handle = NULL;
+    xTaskCreate(fn, name, stack_depth, arg, priority, &handle);
+    return handle;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    (void) task;
+    return 0;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task) {
+        /* The task struct is leaked on purpose: other tasks may still hold the handle */
+        pthread_exit(NULL);
+    }
+    /* Deleting another task is not supported on host */
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep(ticks * 1000 * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t t, uint32_t value, eNotifyAction action)
+{
+    BaseType_t ret = pdPASS;
+    pthread_mutex_lock(&t->lock);
+    switch (action) {
+    case eSetBits:
+        t->notify_value |= value;
+        break;
+    case eIncrement:
+        t->notify_value++;
+        break;
+    case eSetValueWithOverwrite:
+        t->notify_value = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (t->notify_pending) {
+            ret = pdFAIL;
+        } else {
+            t->notify_value = value;
+        }
+        break;
+    default:
+        break;
+    }
+    t->notify_pending = true;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    return ret;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t t)
+{
+    return xTaskNotify(t, 0, eIncrement);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_task *t = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    host_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->notify_value == 0) {
+        if (!host_cond_wait(&t->cond, &t->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    uint32_t value = t->notify_value;
+    if (value) {
+        t->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    t->notify_pending = false;
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks_to_wait)
+{
+    struct host_task *t = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    host_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&t->lock);
+    if (!t->notify_pending) {
+        t->notify_value &= ~clear_on_entry;
+    }
+    while (!t->notify_pending) {
+        if (!host_cond_wait(&t->cond, &t->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    BaseType_t ret = t->notify_pending ? pdTRUE : pdFALSE;
+    if (value) {
+        *value = t->notify_value;
+    }
+    if (ret) {
+        t->notify_value &= ~clear_on_exit;
+    }
+    t->notify_pending = false;
+    pthread_mutex_unlock(&t->lock);
+    return ret;
+}
+
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size, enum host_queue_kind kind)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (!q) {
+        return NULL;
+    }
+    q->kind = kind;
+    q->length = length;
+    q->item_size = item_size;
+    if (item_size) {
+        q->items = calloc(length, item_size);
+        if (!q->items) {
+            free(q);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    host_cond_init(&q->can_recv);
+    host_cond_init(&q->can_send);
+    /* A mutex is created available */
+    q->count = (kind == HOST_QUEUE_MUTEX) ? 1 : 0;
+    return q;
+}
+
+QueueHandle_t host_queue_create_counting(UBaseType_t max, UBaseType_t initial)
+{
+    struct host_queue *q = host_queue_create(max, 0, HOST_QUEUE_SEMAPHORE);
+    if (q) {
+        q->count = initial;
+    }
+    return q;
+}
+
+static BaseType_t host_queue_send(QueueHandle_t q, const void *item, TickType_t ticks_to_wait, bool front)
+{
+    struct timespec deadline;
+    host_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->kind == HOST_QUEUE_MUTEX && q->count == 0 && q->owner != xTaskGetCurrentTaskHandle()) {
+        /* Only the holder can give a mutex back */
+        pthread_mutex_unlock(&q->lock);
+        return pdFAIL;
+    }
+    while (q->count == q->length) {
+        if (!host_cond_wait(&q->can_send, &q->lock, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFAIL;
+        }
+    }
+    if (q->item_size) {
+        UBaseType_t slot;
+        if (front) {
+            q->head = (q->head + q->length - 1) % q->length;
+            slot = q->head;
+        } else {
+            slot = (q->head + q->count) % q->length;
+        }
+        memcpy(q->items + slot * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    q->owner = NULL;
+    pthread_cond_signal(&q->can_recv);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks_to_wait)
+{
+    return host_queue_send(q, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks_to_wait)
+{
+    return host_queue_send(q, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    host_deadline(&deadline, ticks_to_wait);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (!host_cond_wait(&q->can_recv, &q->lock, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFAIL;
+        }
+    }
+    if (q->item_size) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+    }
+    q->count--;
+    if (q->kind == HOST_QUEUE_MUTEX) {
+        q->owner = xTaskGetCurrentTaskHandle();
+    }
+    pthread_cond_signal(&q->can_send);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->count = 0;
+    q->head = 0;
+    pthread_cond_broadcast(&q->can_send);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (!q) {
+        return;
+    }
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->can_recv);
+    pthread_cond_destroy(&q->can_send);
+    free(q->items);
+    free(q);
+}
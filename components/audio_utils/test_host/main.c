@@ -0,0 +1,867 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <abstract_rb.h>
+#include <abstract_rb_utils.h>
+#include <broadcast_rb.h>
+#include <latency_trace.h>
+
+#define BENCH_RB_SIZE       (16 * 1024)
+#define BENCH_TOTAL_BYTES   (32 * 1024 * 1024)
+#define BENCH_PING_ITERS    2000
+#define MAX_CHUNK           (8 * 1024)
+
+struct rb_type_desc {
+    const char *name;
+    abstract_rb_cfg_t cfg;
+    bool zero_copy;     /* Benchmark with acquire/commit and peek/release */
+};
+
+static struct rb_type_desc rb_types[] = {
+    { "basic", DEFAULT_RB_TYPE_BASIC_FUNC(), false },
+    { "basic_zc", DEFAULT_RB_TYPE_BASIC_FUNC(), true },
+    { "lockfree", DEFAULT_RB_TYPE_LOCKFREE_FUNC(), false },
+    { "lockfree_zc", DEFAULT_RB_TYPE_LOCKFREE_FUNC(), true },
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+struct bench_ctx {
+    rb_handle_t rb;
+    rb_handle_t rb_back;
+    int chunk;
+    bool zero_copy;
+    volatile int done;
+};
+
+static void writer_task(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    uint8_t buf[MAX_CHUNK];
+    uint32_t seq = 0;
+    size_t written = 0;
+
+    while (ctx->zero_copy && written < BENCH_TOTAL_BYTES) {
+        uint8_t *ptr;
+        int len;
+        int ret = arb_write_acquire(ctx->rb, &ptr, &len, portMAX_DELAY);
+        if (ret <= 0) {
+            printf("Fail: write_acquire returned %d\n", ret);
+            break;
+        }
+        if (len > ctx->chunk) {
+            len = ctx->chunk;
+        }
+        for (int i = 0; i < len; i++) {
+            ptr[i] = (uint8_t)(seq++);
+        }
+        written += arb_write_commit(ctx->rb, len);
+    }
+    while (written < BENCH_TOTAL_BYTES) {
+        for (int i = 0; i < ctx->chunk; i++) {
+            buf[i] = (uint8_t)(seq++);
+        }
+        int ret = arb_write(ctx->rb, buf, ctx->chunk, portMAX_DELAY);
+        if (ret != ctx->chunk) {
+            printf("Fail: short write %d\n", ret);
+            break;
+        }
+        written += ret;
+    }
+    arb_signal_writer_finished(ctx->rb);
+    ctx->done = 1;
+    vTaskDelete(NULL);
+}
+
+/* Throughput, with data integrity check. Returns MB/s, or -1 on corruption. */
+static double bench_throughput(abstract_rb_cfg_t cfg, bool zero_copy, int chunk, uint64_t *blocks)
+{
+    struct bench_ctx ctx = { .chunk = chunk, .zero_copy = zero_copy };
+    uint8_t buf[MAX_CHUNK];
+    uint8_t expected = 0;
+    size_t total = 0;
+
+    ctx.rb = arb_init("bench", BENCH_RB_SIZE, cfg);
+    uint64_t start_blocks = host_task_get_block_count();
+    uint64_t start = now_ns();
+    xTaskCreate(writer_task, "writer", 4096, &ctx, 5, NULL);
+    while (1) {
+        uint8_t *data = buf;
+        int len;
+        int ret;
+        if (zero_copy) {
+            ret = arb_read_peek(ctx.rb, &data, &len, portMAX_DELAY);
+            if (ret > chunk) {
+                ret = chunk;
+            }
+        } else {
+            ret = arb_read(ctx.rb, buf, chunk, portMAX_DELAY);
+        }
+        if (ret <= 0) {
+            break;
+        }
+        for (int i = 0; i < ret; i++) {
+            if (data[i] != expected++) {
+                printf("Fail: data mismatch at offset %zu\n", total + i);
+                arb_deinit(ctx.rb);
+                return -1;
+            }
+        }
+        if (zero_copy) {
+            arb_read_release(ctx.rb, ret);
+        }
+        total += ret;
+    }
+    uint64_t elapsed = now_ns() - start;
+    *blocks = host_task_get_block_count() - start_blocks;
+    while (!ctx.done) {
+        vTaskDelay(1);
+    }
+    arb_deinit(ctx.rb);
+    if (total != BENCH_TOTAL_BYTES) {
+        printf("Fail: read %zu bytes, expected %d\n", total, BENCH_TOTAL_BYTES);
+        return -1;
+    }
+    return (double)total / (1024 * 1024) / ((double)elapsed / 1e9);
+}
+
+static void echo_task(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    uint8_t buf[MAX_CHUNK];
+
+    while (1) {
+        int ret = arb_read(ctx->rb, buf, ctx->chunk, portMAX_DELAY);
+        if (ret != ctx->chunk) {
+            break;
+        }
+        arb_write(ctx->rb_back, buf, ret, portMAX_DELAY);
+    }
+    ctx->done = 1;
+    vTaskDelete(NULL);
+}
+
+/* Wake-up latency: half of the round trip through two empty ring buffers,
+ * where both the echo task and the main task are sleeping on an empty rb.
+ */
+static void bench_wakeup_latency(abstract_rb_cfg_t cfg, int chunk, uint64_t *p50, uint64_t *p99)
+{
+    static uint64_t samples[BENCH_PING_ITERS];
+    struct bench_ctx ctx = { .chunk = chunk };
+    uint8_t buf[MAX_CHUNK] = {0};
+
+    ctx.rb = arb_init("ping", BENCH_RB_SIZE, cfg);
+    ctx.rb_back = arb_init("pong", BENCH_RB_SIZE, cfg);
+    xTaskCreate(echo_task, "echo", 4096, &ctx, 5, NULL);
+    for (int i = 0; i < BENCH_PING_ITERS; i++) {
+        uint64_t start = now_ns();
+        arb_write(ctx.rb, buf, chunk, portMAX_DELAY);
+        arb_read(ctx.rb_back, buf, chunk, portMAX_DELAY);
+        samples[i] = (now_ns() - start) / 2;
+    }
+    arb_signal_writer_finished(ctx.rb);
+    while (!ctx.done) {
+        vTaskDelay(1);
+    }
+    arb_deinit(ctx.rb);
+    arb_deinit(ctx.rb_back);
+
+    qsort(samples, BENCH_PING_ITERS, sizeof(samples[0]), cmp_u64);
+    *p50 = samples[BENCH_PING_ITERS / 2];
+    *p99 = samples[BENCH_PING_ITERS * 99 / 100];
+}
+
+static int test_rb_semantics(abstract_rb_cfg_t cfg, const char *name)
+{
+    uint8_t buf[64];
+    int ret;
+
+    printf("test: %s rb semantics ....", name);
+    rb_handle_t rb = arb_init("test", 32, cfg);
+    memset(buf, 0xa5, sizeof(buf));
+    if ((ret = arb_write(rb, buf, 48, 10)) != 32) {
+        printf("Fail, write into full rb returned %d\n", ret);
+        return -1;
+    }
+    if (arb_get_filled(rb) != 32 || arb_get_available(rb) != 0) {
+        printf("Fail, filled %d available %d\n", arb_get_filled(rb), arb_get_available(rb));
+        return -1;
+    }
+    if ((ret = arb_read(rb, buf, 20, 10)) != 20 || (ret = arb_read(rb, buf, 20, 10)) != 12) {
+        printf("Fail, read returned %d\n", ret);
+        return -1;
+    }
+    arb_wakeup_reader(rb);
+    if ((ret = arb_read(rb, buf, 20, portMAX_DELAY)) != RB_READER_UNBLOCK) {
+        printf("Fail, wakeup_reader returned %d\n", ret);
+        return -1;
+    }
+    /* Wrap around the end of the buffer */
+    arb_write(rb, buf, 30, 10);
+    if ((ret = arb_is_writer_finished(rb)) != 0) {
+        printf("Fail, is_writer_finished before the signal returned %d\n", ret);
+        return -1;
+    }
+    arb_signal_writer_finished(rb);
+    if ((ret = arb_is_writer_finished(rb)) != 1) {
+        printf("Fail, is_writer_finished returned %d\n", ret);
+        return -1;
+    }
+    if ((ret = arb_read(rb, buf, 64, portMAX_DELAY)) != 30) {
+        printf("Fail, read after writer finished returned %d\n", ret);
+        return -1;
+    }
+    if ((ret = arb_read(rb, buf, 64, portMAX_DELAY)) != RB_WRITER_FINISHED) {
+        printf("Fail, read on finished rb returned %d\n", ret);
+        return -1;
+    }
+    arb_reset(rb);
+    arb_abort(rb);
+    if ((ret = arb_read(rb, buf, 1, portMAX_DELAY)) >= 0) {
+        printf("Fail, read on aborted rb returned %d\n", ret);
+        return -1;
+    }
+    arb_deinit(rb);
+    printf("Success\n");
+    return 0;
+}
+
+static int test_rb_zero_copy(abstract_rb_cfg_t cfg, const char *name)
+{
+    uint8_t buf[64];
+    uint8_t *ptr;
+    int len, ret;
+
+    printf("test: %s rb zero-copy ....", name);
+    rb_handle_t rb = arb_init("test", 32, cfg);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = i;
+    }
+    /* Move the indices close to the end, so that windows get split */
+    arb_write(rb, buf, 20, 10);
+    arb_read(rb, buf + 32, 20, 10);
+    if ((ret = arb_write_acquire(rb, &ptr, &len, 10)) != 12 || len != 12) {
+        printf("Fail, write_acquire returned %d, len %d\n", ret, len);
+        return -1;
+    }
+    memcpy(ptr, buf, 12);
+    if (arb_write_commit(rb, 12) != 12) {
+        printf("Fail, write_commit\n");
+        return -1;
+    }
+    /* The free space now starts at the beginning of the buffer */
+    if ((ret = arb_write_acquire(rb, &ptr, &len, 10)) != 20 || arb_write_commit(rb, 21) >= 0) {
+        printf("Fail, write_acquire after wrap returned %d or overlong commit accepted\n", ret);
+        return -1;
+    }
+    arb_write_acquire(rb, &ptr, &len, 10);
+    memcpy(ptr, buf + 12, 8);
+    arb_write_commit(rb, 8);
+    if (arb_get_filled(rb) != 20) {
+        printf("Fail, filled %d\n", arb_get_filled(rb));
+        return -1;
+    }
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != 12 || memcmp(ptr, buf, 12) != 0) {
+        printf("Fail, read_peek returned %d\n", ret);
+        return -1;
+    }
+    /* Partial release, the rest is peeked again */
+    arb_read_release(rb, 5);
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != 7 || memcmp(ptr, buf + 5, 7) != 0) {
+        printf("Fail, read_peek after partial release returned %d\n", ret);
+        return -1;
+    }
+    arb_read_release(rb, 7);
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != 8 || memcmp(ptr, buf + 12, 8) != 0) {
+        printf("Fail, read_peek after wrap returned %d\n", ret);
+        return -1;
+    }
+    /* A reset invalidates the window */
+    arb_reset(rb);
+    if (arb_read_release(rb, 8) >= 0) {
+        printf("Fail, release after reset accepted\n");
+        return -1;
+    }
+    arb_wakeup_reader(rb);
+    if ((ret = arb_read_peek(rb, &ptr, &len, portMAX_DELAY)) != RB_READER_UNBLOCK) {
+        printf("Fail, wakeup_reader returned %d\n", ret);
+        return -1;
+    }
+    arb_signal_writer_finished(rb);
+    if ((ret = arb_read_peek(rb, &ptr, &len, portMAX_DELAY)) != RB_WRITER_FINISHED) {
+        printf("Fail, read_peek on finished rb returned %d\n", ret);
+        return -1;
+    }
+    arb_reset(rb);
+    arb_abort(rb);
+    if ((ret = arb_write_acquire(rb, &ptr, &len, portMAX_DELAY)) >= 0) {
+        printf("Fail, write_acquire on aborted rb returned %d\n", ret);
+        return -1;
+    }
+    arb_deinit(rb);
+    printf("Success\n");
+    return 0;
+}
+
+/* Peeked windows must stop at anchors, like srb_read() */
+static int test_srb_anchor_peek()
+{
+    abstract_rb_cfg_t cfg = DEFAULT_RB_TYPE_SPECIAL_FUNC();
+    uint8_t buf[32] = {0};
+    uint8_t *ptr;
+    int len, ret;
+    rb_anchor_t anchor = { .offset = 10 };
+    rb_anchor_t out;
+
+    printf("test: special rb anchor peek ....");
+    rb_handle_t rb = arb_init("test", 32, cfg);
+    arb_write(rb, buf, 24, 10);
+    arb_put_anchor(rb, &anchor);
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != 10 || len != 10) {
+        printf("Fail, read_peek before anchor returned %d\n", ret);
+        return -1;
+    }
+    arb_read_release(rb, ret);
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != RB_FETCH_ANCHOR) {
+        printf("Fail, read_peek at anchor returned %d\n", ret);
+        return -1;
+    }
+    if (arb_get_anchor(rb, &out) != 0 || out.offset != 10) {
+        printf("Fail, get_anchor\n");
+        return -1;
+    }
+    if ((ret = arb_read_peek(rb, &ptr, &len, 10)) != 14 || arb_read_release(rb, ret) != 14 ||
+            arb_get_read_offset(rb) != 24) {
+        printf("Fail, read_peek after anchor returned %d\n", ret);
+        return -1;
+    }
+    arb_deinit(rb);
+    printf("Success\n");
+    return 0;
+}
+
+static int test_srb_anchor_queue()
+{
+    const uint64_t offsets[] = { 10, 20, 20, 5, 30, 15, 5 };
+    const uint64_t expected[] = { 5, 5, 10, 15, 20, 20, 30 };
+    const int n = sizeof(offsets) / sizeof(offsets[0]);
+    uint8_t big[100] = {0};
+    uint64_t offset;
+    int data;
+    srb_anchor_stats_t stats;
+
+    printf("test: special rb anchor queue ....");
+    rb_handle_t rb = srb_init_with_anchor_pool("test", 64, n, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        data = i;
+        if (srb_put_anchor_data(rb, offsets[i], &data, sizeof(data)) != 0) {
+            printf("Fail, put %d\n", i);
+            return -1;
+        }
+    }
+    /* The pool grows by another block */
+    data = n;
+    if (srb_put_anchor_data(rb, 40, &data, sizeof(data)) != 0) {
+        printf("Fail, put into full pool\n");
+        return -1;
+    }
+    /* Drain up to each anchor and check they come out sorted, FIFO for equal offsets */
+    uint8_t buf[64] = {0};
+    srb_write(rb, buf, 40, 10);
+    int prev_same_offset = -1;
+    for (int i = 0; i < n; i++) {
+        srb_drain(rb, expected[i]);
+        if (srb_get_anchor_data(rb, &offset, &data, sizeof(data)) != 0 || offset != expected[i] ||
+                offsets[data] != offset) {
+            printf("Fail, anchor %d: offset %llu\n", i, (unsigned long long)offset);
+            return -1;
+        }
+        if (i > 0 && expected[i] == expected[i - 1] && data < prev_same_offset) {
+            printf("Fail, anchors at %llu out of put order\n", (unsigned long long)offset);
+            return -1;
+        }
+        prev_same_offset = data;
+    }
+    srb_drain(rb, 40);
+    if (srb_get_anchor_data(rb, &offset, &data, sizeof(data)) != 0 || offset != 40 || data != n) {
+        printf("Fail, anchor put after the pool grew\n");
+        return -1;
+    }
+    /* Payloads that do not fit their slot still work */
+    big[99] = 0x5a;
+    srb_put_anchor_data_at_current(rb, big, sizeof(big));
+    srb_drain(rb, 40);
+    memset(big, 0, sizeof(big));
+    if (srb_get_anchor_data(rb, &offset, big, sizeof(big)) != 0 || offset != 40 || big[99] != 0x5a) {
+        printf("Fail, overflowing payload\n");
+        return -1;
+    }
+    srb_get_anchor_stats(rb, &stats);
+    if (stats.puts != n + 2 || stats.gets != n + 2 || stats.out_of_order != 3 || stats.pool_grows != 1 ||
+            stats.pool_exhausted != 0 || stats.payload_overflows != 1 || stats.max_in_use != n + 1) {
+        printf("Fail, stats: puts %u gets %u out_of_order %u grows %u exhausted %u overflows %u max %u\n",
+               stats.puts, stats.gets, stats.out_of_order, stats.pool_grows, stats.pool_exhausted,
+               stats.payload_overflows, stats.max_in_use);
+        return -1;
+    }
+    /* Fill all the blocks the pool can have: the anchors and their payloads
+     * survive the pool growing under them, and the put past them fails
+     */
+    const int max = n * SRB_MAX_ANCHOR_BLOCKS;
+    srb_reset_anchor_stats(rb);
+    for (data = 0; data < max; data++) {
+        if (srb_put_anchor_data_at_current(rb, &data, sizeof(data)) != 0) {
+            printf("Fail, put %d of %d\n", data, max);
+            return -1;
+        }
+    }
+    if (srb_put_anchor_data_at_current(rb, &data, sizeof(data)) == 0) {
+        printf("Fail, put past the largest pool\n");
+        return -1;
+    }
+    for (int i = 0; i < max; i++) {
+        if (srb_get_anchor_data(rb, &offset, &data, sizeof(data)) != 0 || data != i) {
+            printf("Fail, anchor %d of %d: %d\n", i, max, data);
+            return -1;
+        }
+    }
+    srb_get_anchor_stats(rb, &stats);
+    if (stats.pool_grows != SRB_MAX_ANCHOR_BLOCKS - 2 || stats.pool_exhausted != 1) {
+        printf("Fail, stats: grows %u exhausted %u\n", stats.pool_grows, stats.pool_exhausted);
+        return -1;
+    }
+    srb_cleanup(rb);
+    printf("Success\n");
+    return 0;
+}
+
+/* Pool payloads are never read past their length, nor handed out to be freed */
+static int test_srb_anchor_payload()
+{
+    uint8_t buf[16] = {0};
+    uint64_t offset;
+    int data = 7, other = 8;
+    rb_anchor_t anchor;
+
+    printf("test: special rb anchor payloads ....");
+    rb_handle_t rb = srb_init_with_anchor_pool("test", 32, 4, sizeof(int));
+    srb_put_anchor_data(rb, 0, NULL, 0);
+    memset(buf, 0x5a, sizeof(buf));
+    if (srb_get_anchor_data(rb, &offset, buf, sizeof(buf)) != 0 || buf[0] != 0x5a) {
+        printf("Fail, empty payload copied out\n");
+        return -1;
+    }
+    srb_put_anchor_data(rb, 0, &data, sizeof(data));
+    if (srb_get_anchor(rb, &anchor) != 0 || anchor.data == NULL) {
+        printf("Fail, get_anchor on a copied payload\n");
+        return -1;
+    }
+    /* The next put reuses the pool slot, the caller's copy stays */
+    srb_put_anchor_data(rb, 0, &other, sizeof(other));
+    if (*(int *)anchor.data != data) {
+        printf("Fail, payload handed out from the pool\n");
+        return -1;
+    }
+    free(anchor.data);
+    srb_cleanup(rb);
+    printf("Success\n");
+    return 0;
+}
+
+/* arb_utils goes by the rb's type, not by the rb_func table it was created with */
+static int test_arb_utils_anchor()
+{
+    abstract_rb_cfg_t cfg = DEFAULT_RB_TYPE_SPECIAL_FUNC();
+    uint8_t buf[32] = {0};
+    int data, offset, ret;
+
+    printf("test: special rb anchor utils ....");
+    rb_handle_t rb = arb_init("test", 32, cfg);
+    if (arb_get_rb_type(rb) != RB_TYPE_SPECIAL) {
+        printf("Fail, rb type %d\n", arb_get_rb_type(rb));
+        return -1;
+    }
+    data = 1;
+    arb_utils_put_anchor_at_current(rb, &data, sizeof(data));
+    data = 2;
+    arb_utils_put_anchor(rb, 8, &data, sizeof(data));
+    arb_write(rb, buf, 16, 10);
+    if ((ret = arb_read(rb, buf, 16, 10)) != RB_FETCH_ANCHOR ||
+            arb_utils_get_anchor(rb, &offset, &data, sizeof(data)) != 0 || offset != 0 || data != 1) {
+        printf("Fail, first anchor: read %d\n", ret);
+        return -1;
+    }
+    if ((ret = arb_read(rb, buf, 16, 10)) != 8 || arb_read(rb, buf, 16, 10) != RB_FETCH_ANCHOR ||
+            arb_utils_get_anchor(rb, &offset, &data, sizeof(data)) != 0 || offset != 8 || data != 2) {
+        printf("Fail, second anchor: read %d\n", ret);
+        return -1;
+    }
+    arb_deinit(rb);
+    printf("Success\n");
+    return 0;
+}
+
+static void late_writer_task(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    uint8_t buf[8] = {0};
+
+    vTaskDelay(20);
+    arb_write(ctx->rb, buf, sizeof(buf), portMAX_DELAY);
+    ctx->done = 1;
+    vTaskDelete(NULL);
+}
+
+static int test_rb_stats(abstract_rb_cfg_t cfg, const char *name)
+{
+    struct bench_ctx ctx = {0};
+    uint8_t buf[64] = {0};
+    rb_stats_t stats;
+    char json[512];
+
+    printf("test: %s rb stats ....", name);
+    rb_handle_t rb = arb_init("stats", 32, cfg);
+    ctx.rb = rb;
+    arb_write(rb, buf, 24, 10);
+    arb_read(rb, buf, 16, 10);
+    arb_write(rb, buf, 16, 10);
+    arb_read(rb, buf, 24, 10);
+    arb_wakeup_reader(rb);
+    arb_read(rb, buf, 8, portMAX_DELAY);
+    /* Blocks until the writer shows up */
+    xTaskCreate(late_writer_task, "late_writer", 4096, &ctx, 5, NULL);
+    arb_read(rb, buf, 8, portMAX_DELAY);
+    while (!ctx.done) {
+        vTaskDelay(1);
+    }
+    if (rb_stats_get("stats", &stats) != 0) {
+        printf("Fail, rb not registered\n");
+        return -1;
+    }
+    if (stats.bytes_in != 48 || stats.bytes_out != 48 || stats.peak_fill != 24 || stats.wakeups != 1 ||
+            stats.blocked_reads != 1 || stats.blocked_read_us < 10000 || stats.blocked_writes != 0) {
+        printf("Fail, in %llu out %llu peak %u wakeups %u blocked reads %u (%llu us) blocked writes %u\n",
+               (unsigned long long)stats.bytes_in, (unsigned long long)stats.bytes_out, stats.peak_fill,
+               stats.wakeups, stats.blocked_reads, (unsigned long long)stats.blocked_read_us, stats.blocked_writes);
+        return -1;
+    }
+    int len = rb_stats_to_json(NULL, 0);
+    if (len <= 0 || (size_t) len >= sizeof(json) || rb_stats_to_json(json, sizeof(json)) != len ||
+            strlen(json) != (size_t) len ||
+            strstr(json, "{\"name\":\"stats\",") == NULL || strstr(json, "\"bytes_in\":48,") == NULL) {
+        printf("Fail, json (%d): %s\n", len, json);
+        return -1;
+    }
+    /* Truncated output is still terminated */
+    if (rb_stats_to_json(json, 10) != len || strlen(json) != 9) {
+        printf("Fail, truncated json: %s\n", json);
+        return -1;
+    }
+    arb_abort(rb);
+    rb_stats_get("stats", &stats);
+    if (stats.aborts != 1) {
+        printf("Fail, aborts %u\n", stats.aborts);
+        return -1;
+    }
+    rb_stats_reset_all();
+    rb_stats_get("stats", &stats);
+    if (stats.bytes_in || stats.bytes_out || stats.peak_fill || stats.aborts || stats.size != 32) {
+        printf("Fail, reset\n");
+        return -1;
+    }
+    arb_deinit(rb);
+    if (rb_stats_get("stats", &stats) == 0) {
+        printf("Fail, rb still registered after deinit\n");
+        return -1;
+    }
+    printf("Success\n");
+    return 0;
+}
+
+static void fill_pattern(uint8_t *buf, int len, int start)
+{
+    for (int i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(start + i);
+    }
+}
+
+static int check_pattern(const uint8_t *buf, int len, int start)
+{
+    for (int i = 0; i < len; i++) {
+        if (buf[i] != (uint8_t)(start + i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int test_brb()
+{
+    brb_reader_cfg_t wwe_cfg = { .name = "wwe", .policy = BRB_READER_BLOCK_WRITER, .history = 16 };
+    brb_reader_cfg_t upload_cfg = { .name = "upload", .policy = BRB_READER_BLOCK_WRITER };
+    brb_reader_cfg_t preroll_cfg = { .name = "preroll", .policy = BRB_READER_OVERWRITE };
+    uint8_t in[128], out[128];
+    int ret;
+
+    printf("test: broadcast rb ....");
+    fill_pattern(in, sizeof(in), 0);
+    rb_handle_t rb = brb_init("bcast", 64, 3);
+    brb_reader_t wwe = brb_reader_open(rb, &wwe_cfg);
+    brb_reader_t upload = brb_reader_open(rb, &upload_cfg);
+    brb_reader_t preroll = brb_reader_open(rb, &preroll_cfg);
+    if (!wwe || !upload || !preroll || brb_reader_open(rb, &preroll_cfg) != NULL) {
+        printf("Fail, reader slots\n");
+        return -1;
+    }
+
+    /* Blocking readers hold the writer back, keeping `history` bytes */
+    if ((ret = brb_write(rb, in, 64, 0)) != 48 || brb_available(rb) != 0) {
+        printf("Fail, write with blocking readers returned %d\n", ret);
+        return -1;
+    }
+    if (brb_read(wwe, out, 40, 10) != 40 || check_pattern(out, 40, 0) ||
+            brb_read(upload, out, 48, 10) != 48 || check_pattern(out, 48, 0)) {
+        printf("Fail, readers don't see the same data\n");
+        return -1;
+    }
+    /* wwe is the slowest one: 8 unread + 16 history */
+    if (brb_available(rb) != 40 || brb_write(rb, in + 48, 40, 0) != 40) {
+        printf("Fail, available %d after reads\n", brb_available(rb));
+        return -1;
+    }
+    /* 80 bytes written into 64, the overwrite reader was lapped */
+    if (brb_read(preroll, out, 8, 10) != 8 || check_pattern(out, 8, 24)) {
+        printf("Fail, overwrite reader didn't skip to the oldest data\n");
+        return -1;
+    }
+
+    /* Position a reader in the history kept behind wwe */
+    brb_read(wwe, out, 48, 10);
+    uint64_t wwe_offset = brb_reader_get_offset(wwe);
+    if (wwe_offset != 88 || brb_reader_seek(preroll, wwe_offset - 16) != 72 ||
+            brb_read(preroll, out, 16, 10) != 16 || check_pattern(out, 16, 72)) {
+        printf("Fail, seek into history\n");
+        return -1;
+    }
+    /* Seeking too far back clamps to the oldest data */
+    if (brb_reader_seek(preroll, 0) != 24 || brb_reader_filled(preroll) != 64) {
+        printf("Fail, seek clamp\n");
+        return -1;
+    }
+
+    /* A reader switched to overwrite doesn't stall the writer anymore */
+    brb_reader_set_policy(upload, BRB_READER_OVERWRITE);
+    brb_reader_set_policy(wwe, BRB_READER_OVERWRITE);
+    if ((ret = brb_write(rb, in, 128, 0)) != 128 || brb_reader_filled(upload) != 64) {
+        printf("Fail, write with overwrite readers returned %d\n", ret);
+        return -1;
+    }
+
+    rb_stats_t stats;
+    if (rb_stats_get("bcast", &stats) != 0 || stats.bytes_in != 216 || stats.bytes_out != 160) {
+        printf("Fail, stats\n");
+        return -1;
+    }
+
+    brb_reader_close(preroll);
+    if (brb_reader_open(rb, &preroll_cfg) == NULL) {
+        printf("Fail, reader slot not freed\n");
+        return -1;
+    }
+    brb_signal_writer_finished(rb);
+    if (brb_read(upload, out, 128, 10) != 64 || brb_read(upload, out, 8, 10) != RB_WRITER_FINISHED) {
+        printf("Fail, writer finished\n");
+        return -1;
+    }
+    brb_cleanup(rb);
+    printf("Success\n");
+    return 0;
+}
+
+/* Cost of putting and then getting one anchor, with `depth` anchors queued */
+static int test_latency_trace()
+{
+    lt_point_t http, pcm;
+    lt_hist_t h, total;
+
+    printf("test: latency trace ....");
+    lt_point_init(&http, LT_STAGE_HTTP_OUTPUT_RB, LT_STAGE_MAX, 100);
+    lt_point_init(&pcm, LT_STAGE_CODEC_OUTPUT_RB, LT_STAGE_PLAYBACK_TOTAL, 100);
+
+    /* Bytes are counted while off, so that the marks line up later */
+    lt_point_in(&http, 50, NULL, LT_STAGE_MAX);
+    lt_set_enabled(true);
+    lt_point_in(&http, 100, NULL, LT_STAGE_MAX);
+    vTaskDelay(2);
+    lt_point_out(&http, 100);
+    lt_get_hist(LT_STAGE_HTTP_OUTPUT_RB, &h);
+    if (http.marks_in != 1 || h.count != 0) {
+        printf("Fail, mark left the point early\n");
+        return -1;
+    }
+    lt_point_out(&http, 50);
+    lt_get_hist(LT_STAGE_HTTP_OUTPUT_RB, &h);
+    if (h.count != 1 || h.max_us < 2000) {
+        printf("Fail, http stage %llu samples, max %u\n", (unsigned long long)h.count, h.max_us);
+        return -1;
+    }
+
+    /* Decoding happens in between the two points, the origin is carried along */
+    vTaskDelay(2);
+    lt_point_in(&pcm, 400, &http, LT_STAGE_CODEC);
+    int64_t played_out = esp_timer_get_time() + 1000000;
+    lt_point_out_at(&pcm, 400, played_out);
+    lt_get_hist(LT_STAGE_CODEC, &h);
+    lt_get_hist(LT_STAGE_PLAYBACK_TOTAL, &total);
+    if (h.count != 1 || h.max_us < 2000 || total.count != 1 ||
+            total.max_us < 1000000 + 4000 || total.max_us > 1000000 + 500000) {
+        printf("Fail, codec %u us, total %u us\n", h.max_us, total.max_us);
+        return -1;
+    }
+
+    /* A consumer far behind doesn't overflow the marks */
+    for (int i = 0; i < 2 * LT_POINT_MARKS; i++) {
+        lt_point_in(&pcm, 100, NULL, LT_STAGE_MAX);
+    }
+    if (pcm.marks_in - pcm.marks_out != LT_POINT_MARKS) {
+        printf("Fail, %u marks queued\n", pcm.marks_in - pcm.marks_out);
+        return -1;
+    }
+    /* Marks left before tracing was turned on again are dropped */
+    lt_set_enabled(false);
+    lt_set_enabled(true);
+    lt_point_out(&pcm, 2 * LT_POINT_MARKS * 100);
+    lt_get_hist(LT_STAGE_CODEC_OUTPUT_RB, &h);
+    if (h.count != 0 || pcm.marks_in != pcm.marks_out) {
+        printf("Fail, stale marks recorded\n");
+        return -1;
+    }
+
+    /* 1000 bytes/s: the second write plays out right after the first one */
+    lt_playout_t clk = { 0 };
+    int64_t first = lt_playout_add(&clk, 1000, 1000);
+    int64_t second = lt_playout_add(&clk, 500, 1000);
+    if (second - first != 500000 || first < esp_timer_get_time() + 900000) {
+        printf("Fail, playout clock\n");
+        return -1;
+    }
+
+    lt_record(LT_STAGE_I2S_DMA, 300);
+    int len = lt_to_json(NULL, 0);
+    char *buf = malloc(len + 1);
+    if (lt_to_json(buf, len + 1) != len || strlen(buf) != (size_t) len ||
+            strstr(buf, "{\"name\":\"i2s_dma\",\"count\":1,\"mean_us\":300,\"max_us\":300,\"p50_us\":512,") == NULL) {
+        printf("Fail, json %s\n", buf);
+        free(buf);
+        return -1;
+    }
+    free(buf);
+    lt_set_enabled(false);
+    printf("Success\n");
+    return 0;
+}
+
+static double bench_anchor(int depth, bool in_order)
+{
+    const int rounds = 20000;
+    uint8_t payload[32] = {0};
+    uint64_t offset;
+
+    /* Move the read offset past all the anchors, so that they can be fetched right away */
+    rb_handle_t rb = srb_init_with_anchor_pool("bench", depth + 1, depth, sizeof(payload));
+    for (int i = 0; i < depth; i++) {
+        srb_write(rb, payload, 1, 10);
+    }
+    srb_drain(rb, depth);
+
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < depth; i++) {
+            /* Out of order: every other anchor goes before the ones already queued */
+            uint64_t at = (in_order || (i & 1) == 0) ? i : depth - i;
+            srb_put_anchor_data(rb, at, payload, sizeof(payload));
+        }
+        for (int i = 0; i < depth; i++) {
+            srb_get_anchor_data(rb, &offset, payload, sizeof(payload));
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    srb_cleanup(rb);
+    return (double)elapsed / ((double)rounds * depth);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+
+    for (size_t t = 0; t < sizeof(rb_types) / sizeof(rb_types[0]); t++) {
+        if (rb_types[t].zero_copy) {
+            ret |= test_rb_zero_copy(rb_types[t].cfg, rb_types[t].name);
+        } else {
+            ret |= test_rb_semantics(rb_types[t].cfg, rb_types[t].name);
+        }
+    }
+    ret |= test_rb_zero_copy((abstract_rb_cfg_t)DEFAULT_RB_TYPE_SPECIAL_FUNC(), "special");
+    ret |= test_srb_anchor_peek();
+    ret |= test_srb_anchor_queue();
+    ret |= test_srb_anchor_payload();
+    ret |= test_arb_utils_anchor();
+    ret |= test_rb_stats((abstract_rb_cfg_t)DEFAULT_RB_TYPE_BASIC_FUNC(), "basic");
+    ret |= test_rb_stats((abstract_rb_cfg_t)DEFAULT_RB_TYPE_LOCKFREE_FUNC(), "lockfree");
+    ret |= test_rb_stats((abstract_rb_cfg_t)DEFAULT_RB_TYPE_SPECIAL_FUNC(), "special");
+    ret |= test_brb();
+    ret |= test_latency_trace();
+    if (ret || (argc >= 2 && strcmp(argv[1], "TEST") == 0)) {
+        return ret ? 1 : 0;
+    }
+
+    printf("# anchor_order,queued_anchors,ns_per_anchor\n");
+    for (int depth = 1; depth <= 256; depth *= 4) {
+        printf("in_order,%d,%.1f\n", depth, bench_anchor(depth, true));
+        printf("out_of_order,%d,%.1f\n", depth, bench_anchor(depth, false));
+    }
+
+    printf("# rb_type,chunk_bytes,mb_per_s,blocking_waits,wakeup_p50_us,wakeup_p99_us\n");
+    for (int chunk = 32; chunk <= MAX_CHUNK; chunk *= 2) {
+        for (size_t t = 0; t < sizeof(rb_types) / sizeof(rb_types[0]); t++) {
+            uint64_t blocks, p50, p99;
+            double mbps = bench_throughput(rb_types[t].cfg, rb_types[t].zero_copy, chunk, &blocks);
+            if (mbps < 0) {
+                return 1;
+            }
+            bench_wakeup_latency(rb_types[t].cfg, chunk, &p50, &p99);
+            printf("%s,%d,%.1f,%llu,%.1f,%.1f\n", rb_types[t].name, chunk, mbps,
+                   (unsigned long long)blocks, p50 / 1000.0, p99 / 1000.0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+/* Host build: no SPIRAM, everything comes from the system heap */
@@ -0,0 +1,18 @@
+#pragma once
+
+/* glibc's sys/queue.h lacks a few of the BSD macros that newlib has */
+#include_next <sys/queue.h>
+
+#ifndef STAILQ_FOREACH_SAFE
+#define STAILQ_FOREACH_SAFE(var, head, field, tvar)             \
+    for ((var) = STAILQ_FIRST((head));                          \
+         (var) && ((tvar) = STAILQ_NEXT((var), field), 1);      \
+         (var) = (tvar))
+#endif
+
+#ifndef STAILQ_LAST
+#define STAILQ_LAST(head, type, field)                          \
+    (STAILQ_EMPTY((head)) ? NULL :                              \
+     ((struct type *)(void *)((char *)((head)->stqh_last) -     \
+                              __builtin_offsetof(struct type, field))))
+#endif
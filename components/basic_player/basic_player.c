@@ -6,9 +6,11 @@
 #include <string.h>
 #include <esp_audio_mem.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <http_playback_stream.h>
 #include <esp_err.h>
 #include <abstract_rb_utils.h>
+#include <latency_trace.h>
 #include "basic_player.h"
 
 #define HTTP_PLAYBACK_STREAM_STACK_SIZE (21 * 1024)
@@ -18,7 +20,20 @@ static const char *TAG = "[basic_player]";
 struct basic_player {
     rb_handle_t codec_output_rb;
     rb_handle_t http_output_rb;
+    /* Latency trace points of the two rings */
+    lt_point_t codec_output_lt;
+    lt_point_t http_output_lt;
+    uint64_t codec_output_released;
+    /* Watermark flow control of the http stream */
+    uint32_t http_output_rb_size;
+    uint32_t http_output_high_wm;
+    uint32_t http_output_low_wm;
+    SemaphoreHandle_t http_output_low_sem;
+    volatile bool http_output_throttled;
+    volatile bool http_output_aborted;
+    basic_player_backpressure_stats_t http_backpressure;
     sys_playback_requester_t requester;
+    sys_playback_requester_ext_t requester_ext;
     struct audio_codec_list {
         audio_codec_t *base;
     } codec[CODEC_TYPE_DEC_MAX]; /* We do not need encoder types */
@@ -45,6 +60,22 @@ struct basic_player {
 
 static ssize_t basic_player_http_read_cb(void *arg, void *data, int len, unsigned int wait);
 
+static void basic_player_http_output_reset(struct basic_player *b)
+{
+    arb_reset(b->http_output_rb);
+    lt_point_reset(&b->http_output_lt);
+    b->http_output_aborted = false;
+    /* Drop a wake-up left over from the previous stream */
+    xSemaphoreTake(b->http_output_low_sem, 0);
+}
+
+static void basic_player_http_output_abort(struct basic_player *b)
+{
+    b->http_output_aborted = true;
+    arb_abort(b->http_output_rb);
+    xSemaphoreGive(b->http_output_low_sem);
+}
+
 sys_playback_requester_t *basic_player_get_playback_requester(basic_player_handle_t handle)
 {
     if (handle == NULL) {
@@ -75,6 +106,17 @@ int basic_player_get_codec_output_rb_filled(basic_player_handle_t handle)
     return arb_get_filled(b->codec_output_rb);
 }
 
+esp_err_t basic_player_get_backpressure_stats(basic_player_handle_t handle, basic_player_backpressure_stats_t *stats)
+{
+    if (handle == NULL || stats == NULL) {
+        ESP_LOGE(TAG, "Handle is null");
+        return ESP_FAIL;
+    }
+    struct basic_player *b = (struct basic_player *)handle;
+    *stats = b->http_backpressure;
+    return ESP_OK;
+}
+
 void basic_player_put_anchor(basic_player_handle_t handle, void *data, uint32_t datalen)
 {
     if (handle == NULL) {
@@ -121,9 +163,11 @@ static void basic_player_wait_for_stop_and_reset(void *arg)
     }
 
     if (b->play_method == PLAY_FROM_URL) {
-        arb_reset(b->http_output_rb);
+        basic_player_http_output_reset(b);
     }
     arb_reset(b->codec_output_rb);
+    lt_point_reset(&b->codec_output_lt);
+    b->codec_output_released = 0;
 
     b->is_playing = false;
 
@@ -159,6 +203,8 @@ esp_err_t basic_player_play(basic_player_handle_t handle, basic_player_play_conf
     b->is_playing = true;
 
     arb_reset(b->codec_output_rb);
+    lt_point_reset(&b->codec_output_lt);
+    b->codec_output_released = 0;
 
     if (b->play_method == PLAY_FROM_CB) {
         audio_codec_type_t codec_type = play_config->play_method_details.callback.decoder_type; // Add a check here.
@@ -172,7 +218,7 @@ esp_err_t basic_player_play(basic_player_handle_t handle, basic_player_play_conf
             return ESP_FAIL;
         }
     } else if (b->play_method == PLAY_FROM_URL) {
-        arb_reset(b->http_output_rb);
+        basic_player_http_output_reset(b);
         b->codec_read_cb = basic_player_http_read_cb;
         b->codec_read_cb_data = (void *)b;
         b->read_len_cb = play_config->play_method_details.http.read_len_cb;
@@ -200,7 +246,7 @@ esp_err_t basic_player_stop(basic_player_handle_t handle)
 
     if (b->play_method == PLAY_FROM_URL) {
         audio_stream_stop(&b->http_stream->base);
-        arb_abort(b->http_output_rb);
+        basic_player_http_output_abort(b);
     }
     /**
      * Aborting the output buffer should be just fine
@@ -340,6 +386,8 @@ static ssize_t basic_player_codec_write_cb(void *arg, void *data, int len, unsig
     struct basic_player *b = (struct basic_player *)arg;
     if (len > 0) {
         ret = arb_write(b->codec_output_rb, (uint8_t *)data, len, wait);
+        /* Time since the input left http_output_rb is the decoding */
+        lt_point_in(&b->codec_output_lt, ret, &b->http_output_lt, LT_STAGE_CODEC);
     }
     return ret;
 }
@@ -365,7 +413,7 @@ static esp_err_t basic_player_codec_event_cb(void *arg, int event, void *data)
                  *
                  * It doesn't hurt to abort the http buffer at this point anyway.
                  */
-                arb_abort(b->http_output_rb);
+                basic_player_http_output_abort(b);
             }
             break;
 
@@ -374,7 +422,7 @@ static esp_err_t basic_player_codec_event_cb(void *arg, int event, void *data)
             arb_signal_writer_finished(b->codec_output_rb);
             b->player_event_cb(b->player_event_cb_data, PLAYER_EVENT_FAILED);
             if (b->play_method == PLAY_FROM_URL) {
-                arb_abort(b->http_output_rb);
+                basic_player_http_output_abort(b);
             }
             break;
 
@@ -399,7 +447,40 @@ static esp_err_t basic_player_codec_event_cb(void *arg, int event, void *data)
 static ssize_t basic_player_http_read_cb(void *arg, void *data, int len, unsigned int wait)
 {
     struct basic_player *b = (struct basic_player *)arg;
-    return arb_read(b->http_output_rb, (uint8_t *)data, len, wait);
+    ssize_t ret = arb_read(b->http_output_rb, (uint8_t *)data, len, wait);
+    lt_point_out(&b->http_output_lt, ret);
+    if (ret > 0 && b->http_output_throttled && arb_get_filled(b->http_output_rb) <= b->http_output_low_wm) {
+        b->http_output_throttled = false;
+        xSemaphoreGive(b->http_output_low_sem);
+    }
+    return ret;
+}
+
+/**
+ * Hold the http stream back while writing `len` bytes would go above the high watermark, until
+ * the decoder drains the ring to the low watermark. The stream does not read the socket in the
+ * meantime, so the TCP receive window closes and the server is held back too.
+ */
+static void basic_player_http_wait_for_low_watermark(struct basic_player *b, int len, unsigned int wait)
+{
+    if (arb_get_filled(b->http_output_rb) + len <= b->http_output_high_wm) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    while (!b->http_output_aborted) {
+        /* Set before checking, so that the reader either sees it or we see its reads */
+        b->http_output_throttled = true;
+        if (arb_get_filled(b->http_output_rb) <= b->http_output_low_wm) {
+            break;
+        }
+        if (xSemaphoreTake(b->http_output_low_sem, wait) != pdTRUE) {
+            break;
+        }
+    }
+    b->http_output_throttled = false;
+    b->http_backpressure.throttles++;
+    b->http_backpressure.throttled_us += esp_timer_get_time() - start;
 }
 
 static ssize_t basic_player_http_write_cb(void *arg, void *data, int len, unsigned int wait)
@@ -407,10 +488,9 @@ static ssize_t basic_player_http_write_cb(void *arg, void *data, int len, unsign
     ssize_t ret = len;
     struct basic_player *b = (struct basic_player *)arg;
     if (len > 0) {
-        if (arb_get_filled(b->http_output_rb) > (200 * 1024)) {
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
+        basic_player_http_wait_for_low_watermark(b, len, wait);
         ret = arb_write(b->http_output_rb, data, len, wait);
+        lt_point_in(&b->http_output_lt, ret, NULL, LT_STAGE_MAX);
         if (b->read_len_cb) {
             b->read_len_cb(b->read_len_cb_data, len);
         }
@@ -418,6 +498,29 @@ static ssize_t basic_player_http_write_cb(void *arg, void *data, int len, unsign
     return ret;
 }
 
+static ssize_t basic_player_http_acquire_cb(void *arg, void **data, int len, unsigned int wait)
+{
+    int contig_len;
+    struct basic_player *b = (struct basic_player *)arg;
+    basic_player_http_wait_for_low_watermark(b, len, wait);
+    ssize_t ret = arb_write_acquire(b->http_output_rb, (uint8_t **)data, &contig_len, wait);
+    if (ret > len) {
+        ret = len;
+    }
+    return ret;
+}
+
+static ssize_t basic_player_http_commit_cb(void *arg, int len)
+{
+    struct basic_player *b = (struct basic_player *)arg;
+    ssize_t ret = arb_write_commit(b->http_output_rb, len);
+    lt_point_in(&b->http_output_lt, ret, NULL, LT_STAGE_MAX);
+    if (ret > 0 && b->read_len_cb) {
+        b->read_len_cb(b->read_len_cb_data, ret);
+    }
+    return ret;
+}
+
 static esp_err_t basic_player_http_event_cb(void *arg, int event, void *data)
 {
     esp_err_t ret = ESP_OK;
@@ -482,6 +585,40 @@ static int basic_player_i2s_read_cb(void *arg, void *data, int len, unsigned int
         basic_player_wait_for_stop_and_reset(arg);
     } else {
         /* Normal data */
+        lt_point_out(&b->codec_output_lt, ret);
+    }
+    return ret;
+}
+
+static int basic_player_i2s_peek_cb(void *arg, void **data, int len, unsigned int wait)
+{
+    int ret, contig_len;
+    struct basic_player *b = (struct basic_player *)arg;
+    ret = arb_read_peek(b->codec_output_rb, (uint8_t **)data, &contig_len, wait);
+    if (ret == RB_READER_UNBLOCK) {
+        /* Just a wake-up */
+    } else if (ret == RB_FETCH_ANCHOR) {
+        /* Process the anchor */
+        b->player_event_cb(b->player_event_cb_data, PLAYER_EVENT_FETCH_ANCHOR);
+    } else if (ret < 0) {
+        /* Stop the streams */
+        basic_player_wait_for_stop_and_reset(arg);
+    } else if (ret > len) {
+        ret = len;
+    }
+    if (ret > 0) {
+        /* The data leaves the ring as soon as sys_playback gets it, not once it is played */
+        lt_point_out_at(&b->codec_output_lt, b->codec_output_released + ret, esp_timer_get_time());
+    }
+    return ret;
+}
+
+static int basic_player_i2s_release_cb(void *arg, int len)
+{
+    struct basic_player *b = (struct basic_player *)arg;
+    int ret = arb_read_release(b->codec_output_rb, len);
+    if (ret > 0) {
+        b->codec_output_released += ret;
     }
     return ret;
 }
@@ -553,6 +690,12 @@ basic_player_handle_t basic_player_create(basic_player_cfg_t *basic_player_cfg)
     b->requester.read_cb = basic_player_i2s_read_cb;
     b->requester.wakeup_reader_cb = basic_player_i2s_wakeup_reader_cb;
     b->requester.cb_data = (void *)b;
+    lt_point_init(&b->codec_output_lt, LT_STAGE_CODEC_OUTPUT_RB, LT_STAGE_MAX, 0);
+    lt_point_init(&b->http_output_lt, LT_STAGE_HTTP_OUTPUT_RB, LT_STAGE_MAX, 0);
+    b->requester_ext.lt = &b->codec_output_lt;
+    if (sys_playback_requester_set_ext(&b->requester, &b->requester_ext) != 0) {
+        ESP_LOGW(TAG, "Playback latency won't be traced");
+    }
 
     if (basic_player_cfg->codec_output_rb_size == 0) {
         ESP_LOGW(TAG, "No codec output rb size provided. Setting default to %d KB.", DEFAULT_CODEC_OUTPUT_RB_SIZE / 1024);
@@ -579,6 +722,15 @@ basic_player_handle_t basic_player_create(basic_player_cfg_t *basic_player_cfg)
             goto error;
         }
 
+        b->http_output_rb_size = basic_player_cfg->http_output_rb_size;
+        b->http_output_high_wm = b->http_output_rb_size;
+        b->http_output_low_wm = b->http_output_high_wm / 4 * 3;
+        b->http_output_low_sem = xSemaphoreCreateBinary();
+        if (!b->http_output_low_sem) {
+            ESP_LOGE(TAG, "Error creating http output semaphore");
+            goto error;
+        }
+
         b->http_stream = http_playback_stream_create_reader(&b->hs_cfg);
         if (!b->http_stream) {
             ESP_LOGE(TAG, "http_stream_create failed");
@@ -597,6 +749,68 @@ error:
     return NULL;
 }
 
+esp_err_t basic_player_set_http_watermarks(basic_player_handle_t handle, uint32_t high, uint32_t low)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is null");
+        return ESP_FAIL;
+    }
+    struct basic_player *b = (struct basic_player *)handle;
+    if (!b->http_output_rb) {
+        ESP_LOGE(TAG, "Player created without http support");
+        return ESP_FAIL;
+    }
+    if (b->is_playing) {
+        ESP_LOGE(TAG, "Can't change the watermarks while playing");
+        return ESP_FAIL;
+    }
+
+    if (high == 0 || high > b->http_output_rb_size) {
+        high = b->http_output_rb_size;
+    }
+    if (low == 0 || low >= high) {
+        if (low) {
+            ESP_LOGW(TAG, "Low watermark %d not below high watermark %d, using the default", low, high);
+        }
+        low = high / 4 * 3;
+    }
+    b->http_output_high_wm = high;
+    b->http_output_low_wm = low;
+    return ESP_OK;
+}
+
+esp_err_t basic_player_enable_zero_copy(basic_player_handle_t handle)
+{
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "Handle is null");
+        return ESP_FAIL;
+    }
+    struct basic_player *b = (struct basic_player *)handle;
+    if (b->is_playing) {
+        ESP_LOGE(TAG, "Can't enable zero-copy while playing");
+        return ESP_FAIL;
+    }
+
+    /* sys_playback processes the decoded data in place */
+    b->requester_ext.peek_cb = basic_player_i2s_peek_cb;
+    b->requester_ext.release_cb = basic_player_i2s_release_cb;
+    if (sys_playback_requester_set_ext(&b->requester, &b->requester_ext) != 0) {
+        b->requester_ext.peek_cb = NULL;
+        b->requester_ext.release_cb = NULL;
+        return ESP_FAIL;
+    }
+    if (b->http_stream) {
+        /* Let http_response_recv() write straight into http_output_rb */
+        audio_io_window_fn_arg_t http_stream_window_fn = {
+            .acquire = basic_player_http_acquire_cb,
+            .commit = basic_player_http_commit_cb,
+            .arg = b,
+        };
+        audio_stream_set_output_window(&b->http_stream->base, &http_stream_window_fn);
+    }
+    return ESP_OK;
+}
+
 void basic_player_destroy(basic_player_handle_t handle)
 {
     if (handle == NULL) {
@@ -607,6 +821,7 @@ void basic_player_destroy(basic_player_handle_t handle)
     if (b->is_playing) {
         basic_player_stop((basic_player_handle_t) b);
     }
+    sys_playback_requester_clear_ext(&b->requester);
     if (b->codec_output_rb) {
         arb_deinit(b->codec_output_rb);
     }
@@ -620,6 +835,9 @@ void basic_player_destroy(basic_player_handle_t handle)
     if (b->lock) {
         vSemaphoreDelete(b->lock);
     }
+    if (b->http_output_low_sem) {
+        vSemaphoreDelete(b->http_output_low_sem);
+    }
 
     free(b);
 }
@@ -52,6 +52,14 @@ typedef struct basic_player_config {
     abstract_rb_cfg_t rb_cfg;
 } basic_player_cfg_t;
 
+/**
+ * @brief Time the http stream spent held back by the watermarks.
+ */
+typedef struct basic_player_backpressure_stats {
+    uint32_t throttles;     /* Times the high watermark was hit */
+    uint64_t throttled_us;
+} basic_player_backpressure_stats_t;
+
 enum basic_player_play_method {
     PLAY_FROM_CB,
     PLAY_FROM_URL,
@@ -112,6 +120,25 @@ esp_err_t basic_player_play(basic_player_handle_t handle, basic_player_play_conf
  */
 esp_err_t basic_player_stop(basic_player_handle_t handle);
 
+/**
+ * @brief Set the flow control watermarks of the http stream.
+ *
+ * Once a write would take `http_output_rb` above the high watermark, the http stream stops (and so
+ * stops reading the socket) until the decoder has drained the ring down to the low watermark.
+ * 0 for the defaults, which the player starts with: the ring size, and 3/4 of it.
+ * Call it while the player is stopped.
+ */
+esp_err_t basic_player_set_http_watermarks(basic_player_handle_t handle, uint32_t high, uint32_t low);
+
+/**
+ * @brief Let sys_playback and the http stream access the player's ring buffers in place.
+ *
+ * Opt-in, as the zero-copy callbacks need a ring type with acquire/commit and peek/release: the
+ * basic, special and lock-free types have them. Call it after `basic_player_create`, while the
+ * player is stopped.
+ */
+esp_err_t basic_player_enable_zero_copy(basic_player_handle_t handle);
+
 /**
  * @brief Destroy the player.
  *
@@ -141,6 +168,11 @@ uint32_t basic_player_get_current_offset(basic_player_handle_t handle);
  */
 int basic_player_get_codec_output_rb_filled(basic_player_handle_t handle);
 
+/**
+ * @brief Get the time the http stream spent in backpressure since the player was created.
+ */
+esp_err_t basic_player_get_backpressure_stats(basic_player_handle_t handle, basic_player_backpressure_stats_t *stats);
+
 /**
  * @brief put an anchor to player's input ringbuffer.
  */
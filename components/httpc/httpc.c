@@ -14,19 +14,57 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/select.h>
 #include "http_parser.h"
 #include "httpc.h"
+#include "tls_handshake_stats.h"
 
 #define REDIRECT_BUF_INITIAL_SIZE 512
 static const char *TAG = "httpc";
 #ifdef ESP_PLATFORM
 #include <esp_log.h>
+#include <esp_timer.h>
 #else
+#include <time.h>
 #include "mbedtls/esp_debug.h"
 #endif
 
+#ifdef ESP_PLATFORM
+#ifdef CONFIG_HTTP_CLIENT_POOL
+#define HTTPC_POOL_SIZE             CONFIG_HTTP_CLIENT_POOL_SIZE
+#define HTTPC_POOL_MAX_PER_HOST     CONFIG_HTTP_CLIENT_POOL_MAX_PER_HOST
+#define HTTPC_POOL_IDLE_TIMEOUT_SEC CONFIG_HTTP_CLIENT_POOL_IDLE_TIMEOUT
+#else
+#define HTTPC_POOL_SIZE             0
+#define HTTPC_POOL_MAX_PER_HOST     0
+#define HTTPC_POOL_IDLE_TIMEOUT_SEC 0
+#endif
+#define HTTPC_WRITE_BUF_SIZE        CONFIG_HTTP_CLIENT_WRITE_BUF_SIZE
+#else
+#define HTTPC_POOL_SIZE             4
+#define HTTPC_POOL_MAX_PER_HOST     2
+#define HTTPC_POOL_IDLE_TIMEOUT_SEC 15
+#define HTTPC_WRITE_BUF_SIZE        1024
+#endif
+
+/* A connection as allocated here, with what httpc_conn_t doesn't show */
+struct httpc_conn_priv {
+    httpc_conn_t conn;
+    tls_handshake_t tls_hs;     /* While the async handshake is in progress */
+};
+
+static inline tls_handshake_t *http_conn_tls_hs(httpc_conn_t *h)
+{
+    return &((struct httpc_conn_priv *) h)->tls_hs;
+}
+
 static int get_port(const char *url, struct http_parser_url *u)
 {
     if (u->field_data[UF_PORT].len) {
@@ -83,9 +121,127 @@ void http_connection_set_keepalive_and_recv_timeout(httpc_conn_t *httpc)
     setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 }
 
+/* Write all of `data`, which may take several esp_tls_conn_write() */
+static int http_write_all(httpc_conn_t *httpc, const char *data, size_t len)
+{
+    while (len) {
+        int ret = esp_tls_conn_write(httpc->tls, data, len);
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Write failed: %d", ret);
+            return -1;
+        }
+        httpc->wbuf.stats.writes++;
+        httpc->wbuf.stats.bytes += ret;
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+int http_request_flush(httpc_conn_t *httpc)
+{
+    if (httpc->wbuf.len == 0) {
+        return 0;
+    }
+    size_t len = httpc->wbuf.len;
+    httpc->wbuf.len = 0;
+    return http_write_all(httpc, httpc->wbuf.buf, len);
+}
+
+/**
+ * Buffer `data`. What doesn't fit fills the buffer up, which is written out,
+ * and the rest is written straight from `data` if it would fill the buffer
+ * again: one write for the framing and the start of a large payload, one
+ * for the rest of it.
+ */
+static int http_write(httpc_conn_t *httpc, const char *data, size_t len)
+{
+    struct write_buf *w = &httpc->wbuf;
+    if (!w->buf && HTTPC_WRITE_BUF_SIZE > 0) {
+        w->buf = malloc(HTTPC_WRITE_BUF_SIZE);
+    }
+    if (!w->buf) {
+        return http_write_all(httpc, data, len);
+    }
+    size_t room = HTTPC_WRITE_BUF_SIZE - w->len;
+    if (len > room) {
+        memcpy(w->buf + w->len, data, room);
+        w->len += room;
+        data += room;
+        len -= room;
+        if (http_request_flush(httpc) != 0) {
+            return -1;
+        }
+        if (len >= HTTPC_WRITE_BUF_SIZE) {
+            return http_write_all(httpc, data, len);
+        }
+    }
+    if (len) {
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+    }
+    return 0;
+}
+
+/* The data received along with the previous response comes first, see http_request_pipeline() */
+static int http_conn_read(httpc_conn_t *httpc, char *buf, size_t len)
+{
+    struct pipeline *p = &httpc->pipeline;
+    if (!p->carry) {
+        return esp_tls_conn_read(httpc->tls, buf, len);
+    }
+    size_t n = p->carry_len - p->carry_pos;
+    if (n > len) {
+        n = len;
+    }
+    memcpy(buf, p->carry + p->carry_pos, n);
+    p->carry_pos += n;
+    if (p->carry_pos == p->carry_len) {
+        free(p->carry);
+        p->carry = NULL;
+    }
+    return n;
+}
+
+/* Keep data received after the end of the response, for the next ones */
+static int http_conn_unread(httpc_conn_t *httpc, const char *data, size_t len)
+{
+    struct pipeline *p = &httpc->pipeline;
+    size_t left = p->carry ? p->carry_len - p->carry_pos : 0;
+    char *carry = malloc(len + left);
+    if (!carry) {
+        ESP_LOGE(TAG, "Could not allocate %zu bytes. Line = %d", len + left, __LINE__);
+        return -1;
+    }
+    memcpy(carry, data, len);
+    if (left) {
+        memcpy(carry + len, p->carry + p->carry_pos, left);
+    }
+    free(p->carry);
+    p->carry = carry;
+    p->carry_len = len + left;
+    p->carry_pos = 0;
+    return 0;
+}
+
+static void http_pipeline_clear(httpc_conn_t *httpc)
+{
+    struct pipeline *p = &httpc->pipeline;
+    for (int i = 0; i < p->count; i++) {
+        free(p->paths[i]);
+    }
+    p->count = 0;
+    free(p->carry);
+    p->carry = NULL;
+}
+
 static int http_response_read_and_parse(httpc_conn_t *httpc, char *buf, size_t buf_len,
                                         bool discard_buf)
 {
+    /* The end of the request may still be buffered */
+    if (http_request_flush(httpc) != 0) {
+        return -1;
+    }
     if (discard_buf == true) {
         httpc->request.out_buf = NULL;
         httpc->request.out_buf_len = 0;
@@ -96,7 +252,7 @@ static int http_response_read_and_parse(httpc_conn_t *httpc, char *buf, size_t b
         httpc->request.out_buf_index = 0;
     }
     /* Read data.*/
-    int data_read = esp_tls_conn_read(httpc->tls, buf, buf_len);
+    int data_read = http_conn_read(httpc, buf, buf_len);
     if (data_read < 0) {
         if ((httpc->is_tls && data_read == MBEDTLS_ERR_SSL_WANT_READ) || errno == EAGAIN) {
             /* Currently this is only supported if the timeout is set AFTER the headers are already parsed */
@@ -107,7 +263,11 @@ static int http_response_read_and_parse(httpc_conn_t *httpc, char *buf, size_t b
     /* Feed the parser */
     int parsed = http_parser_execute(&httpc->request.parser, &httpc->request.parser_settings,
                                      buf, data_read);
-    if (parsed != data_read) {
+    if (parsed != data_read && httpc->state == ESP_HTTP_RESP_BDY_RECEIVED && httpc->pipeline.count) {
+        /* The parser stopped at the end of the response: the rest is of the next ones */
+        http_parser_pause(&httpc->request.parser, 0);
+        return http_conn_unread(httpc, buf + parsed, data_read - parsed);
+    } else if (parsed != data_read) {
         ESP_LOGE(TAG, "Error in parsing parsed:%d data_read:%d\n", parsed, data_read);
         return -1 ;
     } else if (data_read == 0 && httpc->state < ESP_HTTP_RESP_BDY_RECEIVED) {
@@ -121,6 +281,40 @@ static int http_response_read_and_parse(httpc_conn_t *httpc, char *buf, size_t b
     return 0;
 }
 
+/* Read body data which needs no parsing: the socket data is the body */
+static int http_response_read_raw(httpc_conn_t *httpc, char *buf, size_t buf_len)
+{
+    if (httpc->request.body_left < buf_len) {
+        buf_len = httpc->request.body_left;
+    }
+    if (buf_len == 0) {
+        httpc->state = ESP_HTTP_RESP_BDY_RECEIVED;
+        return 0;
+    }
+    int data_read = http_conn_read(httpc, buf, buf_len);
+    if (data_read < 0) {
+        if ((httpc->is_tls && data_read == MBEDTLS_ERR_SSL_WANT_READ) || errno == EAGAIN) {
+            return -EAGAIN;
+        }
+        return data_read;
+    }
+    if (data_read == 0) {
+        if (httpc->request.body_left != ULLONG_MAX) {
+            ESP_LOGE(TAG, "Connection closed with %llu bytes of the body left", (unsigned long long) httpc->request.body_left);
+            return -1;
+        }
+        httpc->state = ESP_HTTP_RESP_BDY_RECEIVED;
+        return 0;
+    }
+    if (httpc->request.body_left != ULLONG_MAX) {
+        httpc->request.body_left -= data_read;
+        if (httpc->request.body_left == 0) {
+            httpc->state = ESP_HTTP_RESP_BDY_RECEIVED;
+        }
+    }
+    return data_read;
+}
+
 static int header_parser(httpc_conn_t *httpc, char *buf, size_t buf_len)
 {
     while (httpc->state < ESP_HTTP_RESP_HDR_RECEIVED) {
@@ -132,13 +326,278 @@ static int header_parser(httpc_conn_t *httpc, char *buf, size_t buf_len)
     return 0;
 }
 
+/* Keep-alive connection pool.
+ *
+ * Idle connections are kept in a small array along with the time they were
+ * released. Checkout takes the most recently released connection to the same
+ * host, port and scheme; release closes the oldest one of the same host when
+ * at the per host limit, else the oldest of all when the pool is full.
+ * Connections idle for longer than the timeout are closed on every pool
+ * operation, so that we don't hand out one the server already gave up on.
+ */
+typedef struct {
+    httpc_conn_t *conn;
+    int64_t idle_since_us;
+} httpc_pool_entry_t;
+
+static httpc_pool_entry_t pool[HTTPC_POOL_SIZE > 0 ? HTTPC_POOL_SIZE : 1];
+static httpc_pool_stats_t pool_stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t httpc_now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static bool pool_key_match(httpc_conn_t *h, const char *host, size_t host_len, int port, bool is_tls)
+{
+    return h->port == port && h->is_tls == is_tls &&
+           strlen(h->host) == host_len && strncasecmp(h->host, host, host_len) == 0;
+}
+
+static void pool_close_locked(int i)
+{
+    http_connection_delete(pool[i].conn);
+    pool[i].conn = NULL;
+    pool_stats.idle--;
+}
+
+static void pool_expire_locked(int64_t now)
+{
+    for (int i = 0; i < HTTPC_POOL_SIZE; i++) {
+        if (pool[i].conn && now - pool[i].idle_since_us > HTTPC_POOL_IDLE_TIMEOUT_SEC * 1000000LL) {
+            ESP_LOGD(TAG, "Closing idle connection to %s:%d", pool[i].conn->host, pool[i].conn->port);
+            pool_close_locked(i);
+            pool_stats.expired++;
+        }
+    }
+}
+
+/* An idle connection has nothing to read. EOF means the server closed it,
+ * data (e.g. a TLS close_notify alert) that it is about to.
+ */
+static bool pool_conn_is_healthy(httpc_conn_t *h)
+{
+    if (h->is_tls && mbedtls_ssl_get_bytes_avail(&h->tls->ssl) > 0) {
+        return false;
+    }
+    char c;
+    int ret = recv(h->tls->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* The previous user may have made the socket non-blocking, or changed its
+ * timeouts (e.g. a short SO_RCVTIMEO to poll with). Hand it out the way a new
+ * connection with `cfg` would be: blocking, with its timeouts.
+ */
+static void pool_conn_reset_sockopts(httpc_conn_t *h, const esp_tls_cfg_t *cfg)
+{
+    int fd = h->tls->sockfd;
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0 && (flags & O_NONBLOCK)) {
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    int timeout_ms = cfg && cfg->timeout_ms > 0 ? cfg->timeout_ms : 0;
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static httpc_conn_t *pool_checkout(const char *url, struct http_parser_url *u, const esp_tls_cfg_t *cfg)
+{
+    const char *host = &url[u->field_data[UF_HOST].off];
+    size_t host_len = u->field_data[UF_HOST].len;
+    int port = get_port(url, u);
+    bool is_tls = is_url_tls(url, u);
+    httpc_conn_t *h = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_expire_locked(httpc_now_us());
+    while (1) {
+        int best = -1;
+        for (int i = 0; i < HTTPC_POOL_SIZE; i++) {
+            if (pool[i].conn && pool_key_match(pool[i].conn, host, host_len, port, is_tls) &&
+                    (best < 0 || pool[i].idle_since_us > pool[best].idle_since_us)) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        h = pool[best].conn;
+        if (pool_conn_is_healthy(h)) {
+            pool[best].conn = NULL;
+            pool_stats.idle--;
+            break;
+        }
+        ESP_LOGI(TAG, "Pooled connection to %s:%d was closed by the server", h->host, h->port);
+        pool_close_locked(best);
+        pool_stats.stale++;
+        h = NULL;
+    }
+    if (h) {
+        pool_stats.hits++;
+        if (is_tls) {
+            pool_stats.tls_handshakes_avoided++;
+        }
+    } else {
+        pool_stats.misses++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (h) {
+        ESP_LOGD(TAG, "Reusing connection to %s:%d", h->host, h->port);
+        pool_conn_reset_sockopts(h, cfg);
+        h->state = ESP_HTTP_CONNECTION_DONE;
+    }
+    return h;
+}
+
+void http_connection_release(httpc_conn_t *httpc)
+{
+    if (!httpc) {
+        return;
+    }
+    bool reusable = httpc->host && !httpc->pipeline.count && !httpc->pipeline.carry &&
+                    (httpc->state == ESP_HTTP_CONNECTION_DONE ||
+                     (httpc->state == ESP_HTTP_RESP_BDY_RECEIVED &&
+                      http_should_keep_alive(&httpc->request.parser)));
+    if (HTTPC_POOL_SIZE == 0 || !reusable) {
+        http_connection_delete(httpc);
+        return;
+    }
+    /* The request was deleted, but not cleared: see http_request_delete() */
+    memset(&httpc->request, 0, sizeof(httpc->request));
+
+    pthread_mutex_lock(&pool_lock);
+    int64_t now = httpc_now_us();
+    pool_expire_locked(now);
+    int same_host = 0, oldest_same_host = -1, oldest = -1, free_slot = -1;
+    for (int i = 0; i < HTTPC_POOL_SIZE; i++) {
+        if (!pool[i].conn) {
+            free_slot = i;
+            continue;
+        }
+        if (oldest < 0 || pool[i].idle_since_us < pool[oldest].idle_since_us) {
+            oldest = i;
+        }
+        if (pool_key_match(pool[i].conn, httpc->host, strlen(httpc->host), httpc->port, httpc->is_tls)) {
+            same_host++;
+            if (oldest_same_host < 0 || pool[i].idle_since_us < pool[oldest_same_host].idle_since_us) {
+                oldest_same_host = i;
+            }
+        }
+    }
+    int victim = -1;
+    if (same_host >= HTTPC_POOL_MAX_PER_HOST) {
+        victim = oldest_same_host;
+    } else if (free_slot < 0) {
+        victim = oldest;
+    }
+    if (victim >= 0) {
+        pool_close_locked(victim);
+        pool_stats.evicted++;
+        free_slot = victim;
+    }
+    pool[free_slot].conn = httpc;
+    pool[free_slot].idle_since_us = now;
+    pool_stats.idle++;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void http_connection_pool_flush(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < HTTPC_POOL_SIZE; i++) {
+        if (pool[i].conn) {
+            pool_close_locked(i);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void http_connection_pool_get_stats(httpc_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool_lock);
+    *stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static ssize_t http_tcp_read(struct esp_tls *tls, char *data, size_t datalen)
+{
+    return recv(tls->sockfd, data, datalen, 0);
+}
+
+static ssize_t http_tcp_write(struct esp_tls *tls, const char *data, size_t datalen)
+{
+    return send(tls->sockfd, data, datalen, 0);
+}
+
+/**
+ * Hand a socket we connected to esp-tls. It has no API for this, but for
+ * TLS its connect state machine goes on from ESP_TLS_CONNECTING with the
+ * socket it finds there, and plain TCP only needs read() and write().
+ * The socket is set up the way esp-tls would have.
+ */
+static struct esp_tls *http_tls_from_socket(int fd, bool is_tls, const esp_tls_cfg_t *cfg, bool nonblocking)
+{
+    struct esp_tls *tls = (struct esp_tls *) calloc(1, sizeof(struct esp_tls));
+    if (!tls) {
+        ESP_LOGE(TAG, "Could not allocate esp_tls. Line = %d", __LINE__);
+        close(fd);
+        return NULL;
+    }
+    if (!nonblocking) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    if (cfg && cfg->timeout_ms > 0) {
+        struct timeval tv = {
+            .tv_sec = cfg->timeout_ms / 1000,
+            .tv_usec = (cfg->timeout_ms % 1000) * 1000,
+        };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    tls->sockfd = fd;
+    if (is_tls) {
+        tls->is_tls = true;
+        tls->conn_state = ESP_TLS_CONNECTING;
+        /* Waited on by the non-blocking connect */
+        FD_ZERO(&tls->rset);
+        FD_SET(fd, &tls->rset);
+        tls->wset = tls->rset;
+    } else {
+        tls->read = http_tcp_read;
+        tls->write = http_tcp_write;
+        tls->conn_state = ESP_TLS_DONE;
+    }
+    return tls;
+}
+
 httpc_conn_t *http_connection_new(const char *url, esp_tls_cfg_t *tls_cfg)
 {
     if (!url) {
         ESP_LOGE(TAG, "url is null. Line = %d", __LINE__);
         return NULL;
     }
-    httpc_conn_t *h = (httpc_conn_t *) calloc(1, sizeof(httpc_conn_t));
+    struct http_parser_url pu;
+    http_parser_url_init(&pu);
+    http_parser_parse_url(url, strlen(url), 0, &pu);
+    httpc_conn_t *h = pool_checkout(url, &pu, tls_cfg);
+    if (h) {
+        return h;
+    }
+    h = (httpc_conn_t *) calloc(1, sizeof(struct httpc_conn_priv));
     if (!h) {
         ESP_LOGE(TAG, "Could not allocate httpc_conn_t. Line = %d", __LINE__);
         return NULL;
@@ -150,24 +609,42 @@ httpc_conn_t *http_connection_new(const char *url, esp_tls_cfg_t *tls_cfg)
     http_parser_parse_url(url, strlen(url), 0, u);
 
     /* Connect to host */
-    struct esp_tls *tls;
+    struct esp_tls *tls = NULL;
     bool is_tls = is_url_tls(url, u);
-
-    tls = esp_tls_conn_new(&url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len,
-                           get_port(url, u), is_tls ? tls_cfg : NULL);
+    const char *host = &url[u->field_data[UF_HOST].off];
+    size_t host_len = u->field_data[UF_HOST].len;
+
+    httpc_connect_t *c = httpc_connect_start(host, host_len, get_port(url, u), tls_cfg ? tls_cfg->timeout_ms : 0);
+    int fd = c ? httpc_connect_poll(c, -1) : -1;
+    httpc_connect_delete(c);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to connect to %.*s", (int) host_len, host);
+        goto error;
+    }
+    tls = http_tls_from_socket(fd, is_tls, tls_cfg, tls_cfg && tls_cfg->non_block);
     if (!tls) {
-        ESP_LOGE(TAG, "Failed to create a new TLS connection");
         goto error;
     }
+    if (is_tls) {
+        tls_handshake_t hs;
+        tls_handshake_start(&hs, host, host_len);
+        int ret = esp_tls_conn_new_sync(host, host_len, get_port(url, u), tls_cfg, tls);
+        tls_handshake_done(&hs, ret == 1 ? tls : NULL);
+        if (ret != 1) {
+            ESP_LOGE(TAG, "Failed to create a new TLS connection");
+            goto error;
+        }
+    }
     h->tls = tls;
     h->is_tls = is_tls;
+    h->port = get_port(url, u);
 
-    h->host = (char *) calloc(1, u->field_data[UF_HOST].len + 1);
+    h->host = (char *) calloc(1, host_len + 1);
     if (!h->host) {
         ESP_LOGE(TAG, "Could not allocate host. Line = %d", __LINE__);
         goto error;
     }
-    strncpy((char *)h->host, &url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len);
+    strncpy((char *)h->host, host, host_len);
 
     h->state = ESP_HTTP_CONNECTION_DONE;
     return h;
@@ -195,7 +672,14 @@ int http_connection_new_async(const char *url, esp_tls_cfg_t *tls_cfg, httpc_con
         return -1;
     }
     if (!*hc) {
-        h = (httpc_conn_t *) calloc(1, sizeof(httpc_conn_t));
+        struct http_parser_url pu;
+        http_parser_url_init(&pu);
+        http_parser_parse_url(url, strlen(url), 0, &pu);
+        *hc = pool_checkout(url, &pu, tls_cfg);
+        if (*hc) {
+            return 1;
+        }
+        h = (httpc_conn_t *) calloc(1, sizeof(struct httpc_conn_priv));
         if (!h) {
             ESP_LOGE(TAG, "Could not allocate httpc_conn_t. Line = %d", __LINE__);
             return -1;
@@ -217,25 +701,55 @@ int http_connection_new_async(const char *url, esp_tls_cfg_t *tls_cfg, httpc_con
         http_parser_parse_url(url, strlen(url), 0, u);
 
         h->is_tls = is_url_tls(url, u);
-        h->tls = (struct esp_tls *) calloc(1, sizeof (struct esp_tls));
+        h->port = get_port(url, u);
+        /* Blocks to resolve the host, unless it is in the DNS cache */
+        h->connect = httpc_connect_start(&url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len,
+                                         h->port, tls_cfg ? tls_cfg->timeout_ms : 0);
+        if (!h->connect) {
+            break;
+        }
+        h->state = ESP_HTTP_TCP_CONNECT;
+
+    case ESP_HTTP_TCP_CONNECT: {
+        int fd = httpc_connect_poll(h->connect, 0);
+        if (fd == -EAGAIN) {
+            return 0;
+        }
+        httpc_connect_delete(h->connect);
+        h->connect = NULL;
+        if (fd < 0) {
+            break;
+        }
+        h->tls = http_tls_from_socket(fd, h->is_tls, tls_cfg, h->is_tls && tls_cfg && tls_cfg->non_block);
         if (!h->tls) {
             break;
         }
+        if (h->is_tls) {
+            tls_handshake_start(http_conn_tls_hs(h), &url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len);
+        }
         h->state = ESP_HTTP_TLS_CONNECT;
+    }
 
     case ESP_HTTP_TLS_CONNECT:
-        /* Create tls connection */
-        ret = esp_tls_conn_new_async(&url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len,
-                                     get_port(url, u), h->is_tls ? tls_cfg : NULL, h->tls);
-        if (ret == -1) {
-            break;
-        } else if (ret == 0) {
-            return 0;
+        if (h->is_tls) {
+            /* Handshake on the connected socket */
+            ret = esp_tls_conn_new_async(&url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len,
+                                         get_port(url, u), tls_cfg, h->tls);
+            if (ret == 0) {
+                return 0;
+            }
+            tls_handshake_done(http_conn_tls_hs(h), ret == -1 ? NULL : h->tls);
+            if (ret == -1) {
+                esp_tls_conn_delete(h->tls);
+                h->tls = NULL;
+                break;
+            }
         }
         h->host = (char *) calloc(1, u->field_data[UF_HOST].len + 1);
         if (!h->host) {
             ESP_LOGE(TAG, "Could not allocate host. Line = %d", __LINE__);
             esp_tls_conn_delete(h->tls);
+            h->tls = NULL;
             break;
         }
         memcpy((char *)h->host, &url[u->field_data[UF_HOST].off], u->field_data[UF_HOST].len);
@@ -248,15 +762,45 @@ int http_connection_new_async(const char *url, esp_tls_cfg_t *tls_cfg, httpc_con
     }
 
     if (h) {
-        if (h->tls) {
-            free (h->tls);
-        }
         free(h);
         *hc = NULL;
     }
     return -1;
 }
 
+void http_connection_wait_async(httpc_conn_t *h, int wait_ms)
+{
+    fd_set read_fds, write_fds;
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    int max_fd = -1;
+
+    if (h && h->connect) {
+        /* Racing TCP connects: until one is writable, or the next attempt is due */
+        int fds[HTTPC_CONNECT_MAX_ADDRS], next_ms;
+        int n = httpc_connect_fds(h->connect, fds, HTTPC_CONNECT_MAX_ADDRS, &next_ms);
+        for (int i = 0; i < n; i++) {
+            FD_SET(fds[i], &write_fds);
+            max_fd = fds[i] > max_fd ? fds[i] : max_fd;
+        }
+        if (next_ms < wait_ms) {
+            wait_ms = next_ms;
+        }
+    } else if (h && h->tls && h->state == ESP_HTTP_TLS_CONNECT) {
+        /* The handshake of a non-blocking TLS connection */
+        FD_SET(h->tls->sockfd, &read_fds);
+        max_fd = h->tls->sockfd;
+    }
+    if (max_fd < 0) {
+        return;
+    }
+    struct timeval tv = {
+        .tv_sec = wait_ms / 1000,
+        .tv_usec = (wait_ms % 1000) * 1000,
+    };
+    select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+}
+
 int http_connection_get_sockfd(httpc_conn_t *http_conn)
 {
     if (!http_conn || !http_conn->tls) {
@@ -275,7 +819,14 @@ void http_connection_delete(httpc_conn_t *httpc)
     if (httpc->host) {
         free(httpc->host);
     }
+    if (http_conn_tls_hs(httpc)->host) {
+        /* Deleted in the middle of an async handshake */
+        tls_handshake_done(http_conn_tls_hs(httpc), NULL);
+    }
+    httpc_connect_delete(httpc->connect);
     esp_tls_conn_delete(httpc->tls);
+    free(httpc->wbuf.buf);
+    http_pipeline_clear(httpc);
     free(httpc);
 }
 
@@ -310,13 +861,13 @@ int http_request_send_custom_hdr(httpc_conn_t *httpc, const char *user_hdr)
         return -1;
     }
     snprintf(hdr, hdr_len, req_template, httpc->request.url);
-    if (esp_tls_conn_write(httpc->tls, hdr, strlen(hdr)) < 0) {
+    if (http_write(httpc, hdr, strlen(hdr)) < 0) {
         free(hdr);
         return -1;
     }
     free(hdr);
-    /* Send the entire set of headers */
-    if (esp_tls_conn_write(httpc->tls, user_hdr, strlen(user_hdr)) < 0) {
+    /* Send the entire set of headers, with the body if it fits */
+    if (http_write(httpc, user_hdr, strlen(user_hdr)) < 0) {
         return -1;
     }
     httpc->state = ESP_HTTP_REQ_HDR_SENT;
@@ -326,34 +877,45 @@ int http_request_send_custom_hdr(httpc_conn_t *httpc, const char *user_hdr)
 #undef PUT_DATA_TEMPLATE
 }
 
-static int http_request_send_our_hdr(httpc_conn_t *httpc, size_t data_len)
+/* The headers of a GET of `path` from `offset`, allocated */
+static char *http_get_hdr_new(httpc_conn_t *httpc, const char *path, size_t offset, const char *accept_encoding)
 {
-    char *hdr;
-    switch (httpc->request.op) {
-    case ESP_HTTP_GET: {
 #define GET_DATA_TEMPLATE               \
 "GET %s HTTP/1.1\r\n"                   \
 "User-Agent: ESP32 HTTP Client/1.0\r\n" \
 "Host: %s\r\n"                          \
 "Range: bytes=%s-\r\n"                  \
+"%s"                                    \
 "\r\n"                                  \
 
 #define INT_TO_CHAR_SIZE 12 // Enough to store signed 32 bit number + `\0`
-        char range_str[INT_TO_CHAR_SIZE] = {0, };
-        snprintf(range_str, INT_TO_CHAR_SIZE, "%d", httpc->request.offset);
+    char range_str[INT_TO_CHAR_SIZE] = {0, };
+    snprintf(range_str, INT_TO_CHAR_SIZE, "%d", (int) offset);
 #undef INT_TO_CHAR_SIZE
 
-        int hdr_len = strlen(GET_DATA_TEMPLATE) + strlen(httpc->request.url) +
-                      strlen(httpc->host) + strlen(range_str) + 1;
+    int hdr_len = strlen(GET_DATA_TEMPLATE) + strlen(path) +
+                  strlen(httpc->host) + strlen(range_str) + strlen(accept_encoding) + 1;
 
-        hdr = (char *)calloc(1, hdr_len);
+    char *hdr = (char *)calloc(1, hdr_len);
+    if (!hdr) {
+        return NULL;
+    }
+    snprintf(hdr, hdr_len, GET_DATA_TEMPLATE, path, httpc->host, range_str, accept_encoding);
+    return hdr;
+#undef GET_DATA_TEMPLATE
+}
+
+static int http_request_send_our_hdr(httpc_conn_t *httpc, size_t data_len)
+{
+    char *hdr;
+    const char *accept_encoding = httpc->request.inflate.accept ? "Accept-Encoding: gzip, deflate\r\n" : "";
+    switch (httpc->request.op) {
+    case ESP_HTTP_GET:
+        hdr = http_get_hdr_new(httpc, httpc->request.url, httpc->request.offset, accept_encoding);
         if (!hdr) {
             return -1;
         }
-        snprintf(hdr, hdr_len, GET_DATA_TEMPLATE, httpc->request.url,
-                 httpc->host, range_str);
-    }
-    break;
+        break;
     case ESP_HTTP_PUT:
     case ESP_HTTP_NOTIFY:
     case ESP_HTTP_POST: {
@@ -361,7 +923,8 @@ static int http_request_send_our_hdr(httpc_conn_t *httpc, size_t data_len)
 "%s %s HTTP/1.1\r\n"                \
 "Host: %s\r\n"                      \
 "Content-Length: %zu\r\n"           \
-"Content-Type: %s\r\n\r\n"
+"Content-Type: %s\r\n"              \
+"%s\r\n"
 	const char *op;
 	if (httpc->request.op == ESP_HTTP_POST) {
 	    op = "POST";
@@ -372,13 +935,14 @@ static int http_request_send_our_hdr(httpc_conn_t *httpc, size_t data_len)
     }
         /* 10 bytes should be sufficient to encode the content-length */
         int hdr_len = strlen(op) + strlen(POST_DATA_TEMPLATE) + strlen(httpc->request.url) +
-                      strlen(httpc->host) + 10 + strlen(httpc->request.content_type) + 1;
+                      strlen(httpc->host) + 10 + strlen(httpc->request.content_type) +
+                      strlen(accept_encoding) + 1;
         hdr = (char *)calloc(1, hdr_len);
         if (!hdr) {
             return -1;
         }
         snprintf(hdr, hdr_len, POST_DATA_TEMPLATE, op, httpc->request.url,
-                 httpc->host, data_len, httpc->request.content_type);
+                 httpc->host, data_len, httpc->request.content_type, accept_encoding);
     }
     break;
     default:
@@ -388,7 +952,7 @@ static int http_request_send_our_hdr(httpc_conn_t *httpc, size_t data_len)
     /* hdr should be allocated and populated */
     ESP_LOGD(TAG, "Sending hdr: \n%s\n", hdr);
 
-    if (esp_tls_conn_write(httpc->tls, hdr, strlen(hdr)) < 0) {
+    if (http_write(httpc, hdr, strlen(hdr)) < 0) {
         free(hdr);
         return -1;
     }
@@ -405,11 +969,11 @@ int http_request_send(httpc_conn_t *httpc, const char *data, size_t data_len)
         }
     }
     if (data && data_len) {
-        if (esp_tls_conn_write(httpc->tls, data, data_len) < 0) {
+        if (http_write(httpc, data, data_len) < 0) {
             return -1;
         }
     }
-    return 0;
+    return http_request_flush(httpc);
 }
 
 void http_response_set_header_cb(httpc_conn_t *httpc, httpc_response_header_cb cb, void *arg)
@@ -418,8 +982,150 @@ void http_response_set_header_cb(httpc_conn_t *httpc, httpc_response_header_cb c
     httpc->request.parser_state.response_hdr_cb_arg = arg;
 }
 
+static void hdr_interest_free(struct hdr_interest *hi)
+{
+    for (int i = 0; i < hi->count; i++) {
+        free(hi->entries[i].value);
+        hi->entries[i].value = NULL;
+    }
+}
+
+static int hdr_interest_find(struct hdr_interest *hi, const char *name)
+{
+    for (int i = 0; i < hi->count; i++) {
+        if (!strcasecmp(hi->entries[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int http_response_set_header_interest(httpc_conn_t *httpc, const char *const *names, int count)
+{
+    /* httpc needs these for http_response_get_content_type(), redirects and decoding */
+    static const char *const builtin[] = {"Content-Type", "Location", "Content-Encoding"};
+    const int builtin_count = sizeof(builtin) / sizeof(builtin[0]);
+    struct hdr_interest *hi = &httpc->request.hdr_interest;
+
+    if (count < 0 || count > HTTPC_HDR_INTEREST_MAX - builtin_count) {
+        return -1;
+    }
+    hdr_interest_free(hi);
+    memset(hi, 0, sizeof(*hi));
+    for (int i = 0; i < builtin_count + count; i++) {
+        const char *name = i < builtin_count ? builtin[i] : names[i - builtin_count];
+        if (hdr_interest_find(hi, name) >= 0) {
+            continue;
+        }
+        hi->entries[hi->count].name = name;
+        hi->entries[hi->count].len = strlen(name);
+        hi->count++;
+    }
+    hi->current = -1;
+    return 0;
+}
+
+const char *http_response_get_header(httpc_conn_t *httpc, const char *name)
+{
+    int i = hdr_interest_find(&httpc->request.hdr_interest, name);
+    return i < 0 ? NULL : httpc->request.hdr_interest.entries[i].value;
+}
+
+/* A header of interest was received in full */
+static void process_hdr_interest(httpc_conn_t *httpc)
+{
+    struct hdr_interest *hi = &httpc->request.hdr_interest;
+    if (hi->current < 0) {
+        return;
+    }
+    struct hdr_interest_entry *e = &hi->entries[hi->current];
+    hi->current = -1;
+
+    if (!strcasecmp(e->name, "Content-Type")) {
+        memset(httpc->request.response_content_type, 0, sizeof(httpc->request.response_content_type));
+        strncpy(httpc->request.response_content_type, e->value, sizeof(httpc->request.response_content_type) - 1);
+    } else if (!strcasecmp(e->name, "Location")) {
+        free(httpc->request.location.uri);
+        httpc->request.location.uri = strdup(e->value);
+        httpc->request.location.buf_size = e->value_len + 1;
+        if (!httpc->request.location.uri) {
+            ESP_LOGE(TAG, "malloc failed! Line: %d", __LINE__);
+        }
+    } else if (!strcasecmp(e->name, "Content-Encoding")) {
+        httpc->request.inflate.coding = httpc_inflate_coding(e->value);
+    }
+    if (httpc->request.parser_state.response_hdr_cb) {
+        (* httpc->request.parser_state.response_hdr_cb)(e->name, e->value,
+            httpc->request.parser_state.response_hdr_cb_arg);
+    }
+}
+
+/* Match the header name against the headers of interest, as it comes in */
+static void hdr_interest_field(httpc_conn_t *h, const char *p, size_t len)
+{
+    struct hdr_interest *hi = &h->request.hdr_interest;
+    if (!h->request.parser_state.last_was_hdr) {
+        /* A new header: the previous value is complete */
+        process_hdr_interest(h);
+        hi->candidates = (1u << hi->count) - 1;
+        hi->name_len = 0;
+    }
+    for (int i = 0; hi->candidates && i < hi->count; i++) {
+        struct hdr_interest_entry *e = &hi->entries[i];
+        if ((hi->candidates & (1u << i)) &&
+                (hi->name_len + len > e->len || strncasecmp(e->name + hi->name_len, p, len))) {
+            hi->candidates &= ~(1u << i);
+        }
+    }
+    hi->name_len += len;
+    h->request.parser_state.last_was_hdr = true;
+}
+
+/* Keep the value of a header of interest, skip the others */
+static int hdr_interest_value(httpc_conn_t *h, const char *p, size_t len)
+{
+    struct hdr_interest *hi = &h->request.hdr_interest;
+    if (h->request.parser_state.last_was_hdr) {
+        /* The name is complete */
+        h->request.parser_state.last_was_hdr = false;
+        for (int i = 0; hi->candidates && i < hi->count; i++) {
+            if ((hi->candidates & (1u << i)) && hi->entries[i].len == hi->name_len) {
+                /* If the header is repeated, the last value is kept */
+                hi->current = i;
+                hi->entries[i].value_len = 0;
+                break;
+            }
+        }
+    }
+    if (hi->current < 0) {
+        return 0;
+    }
+    struct hdr_interest_entry *e = &hi->entries[hi->current];
+    if (e->value_len + len + 1 > e->value_size) {
+        size_t size = e->value_size ? e->value_size : 64;
+        while (size < e->value_len + len + 1) {
+            size *= 2;
+        }
+        char *value = realloc(e->value, size);
+        if (!value) {
+            ESP_LOGE(TAG, "realloc failed! Line: %d", __LINE__);
+            return -1;
+        }
+        e->value = value;
+        e->value_size = size;
+    }
+    memcpy(e->value + e->value_len, p, len);
+    e->value_len += len;
+    e->value[e->value_len] = '\0';
+    return 0;
+}
+
 static void process_hdr_value_pair(httpc_conn_t *httpc)
 {
+    if (httpc->request.hdr_interest.count) {
+        process_hdr_interest(httpc);
+        return;
+    }
     if (httpc->request.parser_state.hdr_buf[0] == '\0') {
         /* If the header is null, this is probably the first call, ignore it */
         return;
@@ -434,6 +1140,8 @@ static void process_hdr_value_pair(httpc_conn_t *httpc)
         memset(httpc->request.response_content_type, 0, sizeof(httpc->request.response_content_type));
         strncpy(httpc->request.response_content_type,
                 httpc->request.parser_state.val_buf, sizeof(httpc->request.response_content_type) - 1);
+    } else if (!strcasecmp(httpc->request.parser_state.hdr_buf, "Content-Encoding")) {
+        httpc->request.inflate.coding = httpc_inflate_coding(httpc->request.parser_state.val_buf);
     }
 
     //Uncomment below to print response header
@@ -443,6 +1151,10 @@ static void process_hdr_value_pair(httpc_conn_t *httpc)
 static int http_get_hdr_field(http_parser *parser, const char *p, size_t len)
 {
     httpc_conn_t *h = parser->data;
+    if (h->request.hdr_interest.count) {
+        hdr_interest_field(h, p, len);
+        return 0;
+    }
     if (!h->request.parser_state.last_was_hdr) {
         /* This is a new header. First process any value from the previous
          * header-value pair
@@ -470,6 +1182,9 @@ static int http_get_hdr_field(http_parser *parser, const char *p, size_t len)
 static int http_get_hdr_value(http_parser *parser, const char *p, size_t len)
 {
     httpc_conn_t *h = parser->data;
+    if (h->request.hdr_interest.count) {
+        return hdr_interest_value(h, p, len);
+    }
 
     if (h->request.parser_state.last_was_hdr) {
         /* This is a new value.
@@ -529,7 +1244,13 @@ static int http_get_body(http_parser *parser, const char *p, size_t len)
         ESP_LOGE(TAG, "ASSERT: This shouldn't happen\n");
         return -1;
     }
-    memcpy(h->request.out_buf + h->request.out_buf_index, p, len);
+    /* The data was read into the user's buffer: `p` is either in place
+     * already, or after the headers or chunk headers we are skipping.
+     */
+    char *dst = h->request.out_buf + h->request.out_buf_index;
+    if (dst != p) {
+        memmove(dst, p, len);
+    }
     h->request.out_buf_index += len;
 
     return 0;
@@ -548,6 +1269,15 @@ static int http_hdr_complete(http_parser *parser)
              http_response_get_content_len(h));
     process_hdr_value_pair(parser->data);
 
+    if (h->request.inflate.accept && h->request.inflate.coding != HTTPC_CODING_IDENTITY) {
+        if (h->request.inflate.coding == HTTPC_CODING_UNSUPPORTED) {
+            ESP_LOGW(TAG, "Unsupported Content-Encoding, the body is passed as is");
+            h->request.inflate.coding = HTTPC_CODING_IDENTITY;
+        } else {
+            /* Of the compressed body */
+            h->request.content_length = 0;
+        }
+    }
     return 0;
 }
 
@@ -555,6 +1285,10 @@ static int http_message_complete(http_parser *parser)
 {
     httpc_conn_t *h = parser->data;
     h->state = ESP_HTTP_RESP_BDY_RECEIVED;
+    if (h->pipeline.count) {
+        /* Don't parse on into the responses to the requests sent ahead */
+        http_parser_pause(parser, 1);
+    }
     return 0;
 }
 
@@ -587,13 +1321,9 @@ static char *http_get_correct_path(const char *url, struct http_parser_url *u)
     }
 }
 
-int http_request_new(httpc_conn_t *httpc, httpc_ops_t op, const char *url)
+/* Read what is left of the response, if anything */
+static int http_response_drain(httpc_conn_t *httpc)
 {
-    if (httpc->state < ESP_HTTP_CONNECTION_DONE) {
-        ESP_LOGE(TAG, "Connection to host not done yet!");
-        return -1;
-    }
-
     if (httpc->state > ESP_HTTP_REQ_NEW) {
         /* There may be left-over data in here from the previous request on
          * the same socket, flush it out so that the next request works
@@ -601,7 +1331,12 @@ int http_request_new(httpc_conn_t *httpc, httpc_ops_t op, const char *url)
          */
         char buf[50];
         while (httpc->state < ESP_HTTP_RESP_BDY_RECEIVED) {
-            int status = http_response_read_and_parse(httpc, buf, sizeof(buf), true);
+            int status;
+            if (httpc->request.body_raw) {
+                status = http_response_read_raw(httpc, buf, sizeof(buf));
+            } else {
+                status = http_response_read_and_parse(httpc, buf, sizeof(buf), true);
+            }
             if (status == -EAGAIN) {
                 continue;
             }
@@ -610,12 +1345,14 @@ int http_request_new(httpc_conn_t *httpc, httpc_ops_t op, const char *url)
             }
         }
     }
+    return 0;
+}
+
+static void http_request_init(httpc_conn_t *httpc, httpc_ops_t op, char *path)
+{
     memset(&httpc->request, 0, sizeof(httpc->request));
     httpc->request.op = op;
-    httpc->request.url = http_get_correct_path(url, &httpc->u);
-    if (! httpc->request.url) {
-        return -1;
-    }
+    httpc->request.url = path;
     httpc->request.content_type = DEFAULT_CONTENT_TYPE;
     httpc->state = ESP_HTTP_REQ_NEW;
     http_parser_init(&httpc->request.parser, HTTP_RESPONSE);
@@ -625,6 +1362,81 @@ int http_request_new(httpc_conn_t *httpc, httpc_ops_t op, const char *url)
     httpc->request.parser_settings.on_message_complete = http_message_complete;
     httpc->request.parser_settings.on_header_field = http_get_hdr_field;
     httpc->request.parser_settings.on_header_value = http_get_hdr_value;
+}
+
+int http_request_new(httpc_conn_t *httpc, httpc_ops_t op, const char *url)
+{
+    if (httpc->state < ESP_HTTP_CONNECTION_DONE || httpc->state == ESP_HTTP_TCP_CONNECT) {
+        ESP_LOGE(TAG, "Connection to host not done yet!");
+        return -1;
+    }
+
+    char *path = http_get_correct_path(url, &httpc->u);
+    if (!path) {
+        return -1;
+    }
+    struct pipeline *p = &httpc->pipeline;
+    bool dropping = false;
+    while (1) {
+        int status = http_response_drain(httpc);
+        if (dropping) {
+            http_request_delete(httpc);
+        }
+        if (status < 0) {
+            free(path);
+            return status;
+        }
+        if (!p->count) {
+            break;
+        }
+        if (httpc->state == ESP_HTTP_RESP_BDY_RECEIVED && !http_should_keep_alive(&httpc->request.parser)) {
+            ESP_LOGW(TAG, "The server closes the connection, %d requests sent ahead are lost", p->count);
+            http_pipeline_clear(httpc);
+            free(path);
+            return -ENOTCONN;
+        }
+        /* The response to the oldest request sent ahead is next */
+        char *next = p->paths[0];
+        memmove(&p->paths[0], &p->paths[1], --p->count * sizeof(p->paths[0]));
+        http_request_init(httpc, ESP_HTTP_GET, next);
+        httpc->request.pipelined = true;
+        httpc->state = ESP_HTTP_REQ_HDR_SENT;
+        if (op == ESP_HTTP_GET && strcmp(next, path) == 0) {
+            free(path);
+            return 0;
+        }
+        ESP_LOGW(TAG, "Dropping the response to %s, sent ahead", next);
+        dropping = true;
+    }
+    http_request_init(httpc, op, path);
+    return 0;
+}
+
+int http_request_pipeline(httpc_conn_t *httpc, const char *url)
+{
+    struct pipeline *p = &httpc->pipeline;
+    if (httpc->request.op != ESP_HTTP_GET || httpc->state < ESP_HTTP_REQ_HDR_SENT) {
+        ESP_LOGE(TAG, "Requests can only be sent ahead of a GET in progress");
+        return -1;
+    }
+    if (p->count == HTTPC_PIPELINE_MAX) {
+        ESP_LOGE(TAG, "Already %d requests sent ahead", p->count);
+        return -1;
+    }
+    struct http_parser_url u;
+    char *path = http_get_correct_path(url, &u);
+    char *hdr = path ? http_get_hdr_new(httpc, path, 0, "") : NULL;
+    if (!hdr) {
+        free(path);
+        return -1;
+    }
+    int ret = http_write(httpc, hdr, strlen(hdr));
+    free(hdr);
+    if (ret != 0 || http_request_flush(httpc) != 0) {
+        free(path);
+        return -1;
+    }
+    p->paths[p->count++] = path;
     return 0;
 }
 
@@ -656,34 +1468,19 @@ void http_request_delete(httpc_conn_t *httpc)
         free(httpc->request.location.uri);
         httpc->request.location.uri = NULL;
     }
+    hdr_interest_free(&httpc->request.hdr_interest);
+    httpc_inflate_delete(httpc->request.inflate.inf);
+    httpc->request.inflate.inf = NULL;
+    free(httpc->request.inflate.in);
+    httpc->request.inflate.in = NULL;
     /* We don't memset to 0 in here, since there could be data not fetched from
      * the buffer. We fetch and discard that lazily in the next new()
      */
 }
 
-int http_response_recv(httpc_conn_t *httpc, char *buf, size_t buf_len)
+/* The body as received, after the headers were parsed */
+static int http_response_recv_body(httpc_conn_t *httpc, char *buf, size_t buf_len)
 {
-    /* This could either be called AFTER a header parsing API, or immediately
-     * after sending the request. If the headers aren't parsed, we need to parse
-     * them in here.
-     */
-    if (httpc->state < ESP_HTTP_RESP_STARTED) {
-        httpc->state = ESP_HTTP_RESP_STARTED;
-    }
-    if ( httpc->state < ESP_HTTP_RESP_HDR_RECEIVED ) {
-        int status = header_parser(httpc, buf, buf_len);
-        if (status < 0) {
-            return status;
-        }
-        /* At this point it is likely that the on-body received was already called
-         * and some data was copied into the user buffers. If that is the case,
-         * just return the data right from here.
-         */
-        if (httpc->request.out_buf_index) {
-            return httpc->request.out_buf_index;
-        }
-    }
-
     /* If httpc->request.body_read_in_header is set as true it implies that
      * http_header_fetch() API call was made before http_response_recv() API call
      * and there is dynamically allocated buffer which contains some bits of the
@@ -705,6 +1502,19 @@ int http_response_recv(httpc_conn_t *httpc, char *buf, size_t buf_len)
         httpc->request.byte_count += copy_len;
         return copy_len;
     }
+    if (!httpc->request.body_raw && httpc->state == ESP_HTTP_RESP_HDR_RECEIVED &&
+            !(httpc->request.parser.flags & F_CHUNKED)) {
+        /* The parser keeps count of what it consumed of the body so far */
+        httpc->request.body_raw = true;
+        httpc->request.body_left = httpc->request.parser.content_length;
+    }
+    if (httpc->request.body_raw) {
+        int data_read = http_response_read_raw(httpc, buf, buf_len);
+        if (data_read > 0) {
+            httpc->request.byte_count += data_read;
+        }
+        return data_read;
+    }
     while (1) {
         if (httpc->state < ESP_HTTP_RESP_BDY_RECEIVED) {
             int status  = http_response_read_and_parse(httpc, buf, buf_len, false);
@@ -730,6 +1540,143 @@ int http_response_recv(httpc_conn_t *httpc, char *buf, size_t buf_len)
     return 0;
 }
 
+void http_request_set_accept_encoding(httpc_conn_t *httpc, size_t max_len)
+{
+    httpc->request.inflate.accept = true;
+    httpc->request.inflate.max_len = max_len;
+}
+
+static bool http_response_is_encoded(httpc_conn_t *httpc)
+{
+    return httpc->request.inflate.accept && httpc->request.inflate.coding != HTTPC_CODING_IDENTITY;
+}
+
+#define HTTPC_INFLATE_IN_SIZE 1024
+
+/* Start decoding, with the first `len` bytes of the body in `data` */
+static int http_response_inflate_start(httpc_conn_t *httpc, const char *data, size_t len)
+{
+    struct body_inflate *z = &httpc->request.inflate;
+    int err = httpc_inflate_new(z->coding, &z->inf);
+    if (err == -ENOTSUP) {
+        ESP_LOGE(TAG, "No decoder for content coding %d", z->coding);
+        return -1;
+    }
+    z->in_size = len > HTTPC_INFLATE_IN_SIZE ? len : HTTPC_INFLATE_IN_SIZE;
+    z->in = malloc(z->in_size);
+    if (err || !z->in) {
+        ESP_LOGE(TAG, "Could not allocate the decoder. Line = %d", __LINE__);
+        return -1;
+    }
+    if (len) {
+        memcpy(z->in, data, len);
+    }
+    z->in_len = len;
+    return 0;
+}
+
+/* Decode the body into the caller's buffer, reading it as needed */
+static int http_response_inflate(httpc_conn_t *httpc, char *buf, size_t buf_len)
+{
+    struct body_inflate *z = &httpc->request.inflate;
+    if (buf_len == 0) {
+        return 0;
+    }
+    if (!z->in && http_response_inflate_start(httpc, NULL, 0) != 0) {
+        return -1;
+    }
+    if (!z->inf) {
+        return -1;
+    }
+    while (1) {
+        size_t consumed;
+        int64_t start = httpc_now_us();
+        int len = httpc_inflate_run(z->inf, z->in + z->in_pos, z->in_len - z->in_pos, &consumed, buf, buf_len);
+        z->stats.decode_us += httpc_now_us() - start;
+        if (len < 0) {
+            return -1;
+        }
+        z->in_pos += consumed;
+        z->stats.in_bytes += consumed;
+        if (len > 0) {
+            z->stats.out_bytes += len;
+            if (z->max_len && z->stats.out_bytes > z->max_len) {
+                ESP_LOGE(TAG, "Decoded body longer than %zu bytes", z->max_len);
+                return -1;
+            }
+            return len;
+        }
+        if (httpc_inflate_done(z->inf)) {
+            /* Read whatever is left, so that the connection can be reused */
+            int n;
+            while ((n = http_response_recv_body(httpc, z->in, z->in_size)) > 0) {
+            }
+            if (n < 0) {
+                return n;
+            }
+            if (!z->in_eof) {
+                z->in_eof = true;
+                ESP_LOGD(TAG, "Decoded %zu bytes out of %zu in %u us", z->stats.out_bytes,
+                         z->stats.in_bytes, (unsigned) z->stats.decode_us);
+            }
+            return 0;
+        }
+        if (z->in_eof) {
+            if (z->stats.in_bytes == 0 && z->in_len == 0) {
+                /* No body at all, e.g. 304 */
+                return 0;
+            }
+            ESP_LOGE(TAG, "Compressed body cut short");
+            return -1;
+        }
+        /* Read more after what is left */
+        memmove(z->in, z->in + z->in_pos, z->in_len - z->in_pos);
+        z->in_len -= z->in_pos;
+        z->in_pos = 0;
+        int n = http_response_recv_body(httpc, z->in + z->in_len, z->in_size - z->in_len);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            z->in_eof = true;
+        }
+        z->in_len += n;
+    }
+}
+
+int http_response_recv(httpc_conn_t *httpc, char *buf, size_t buf_len)
+{
+    /* This could either be called AFTER a header parsing API, or immediately
+     * after sending the request. If the headers aren't parsed, we need to parse
+     * them in here.
+     */
+    if (httpc->state < ESP_HTTP_RESP_STARTED) {
+        httpc->state = ESP_HTTP_RESP_STARTED;
+    }
+    if ( httpc->state < ESP_HTTP_RESP_HDR_RECEIVED ) {
+        int status = header_parser(httpc, buf, buf_len);
+        if (status < 0) {
+            return status;
+        }
+        /* At this point it is likely that the on-body received was already called
+         * and some data was copied into the user buffers. If that is the case,
+         * just return the data right from here, unless it has to be decoded.
+         */
+        if (httpc->request.out_buf_index) {
+            if (!http_response_is_encoded(httpc)) {
+                return httpc->request.out_buf_index;
+            }
+            if (http_response_inflate_start(httpc, buf, httpc->request.out_buf_index) != 0) {
+                return -1;
+            }
+        }
+    }
+    if (http_response_is_encoded(httpc)) {
+        return http_response_inflate(httpc, buf, buf_len);
+    }
+    return http_response_recv_body(httpc, buf, buf_len);
+}
+
 int http_header_fetch(httpc_conn_t *httpc)
 {
     if (httpc->state < ESP_HTTP_RESP_STARTED) {
@@ -762,23 +1709,24 @@ int http_send_chunk(httpc_conn_t *httpc, const char *data, size_t data_len)
         return -1;
     }
     chunk_len = ret;
-    if (esp_tls_conn_write(httpc->tls, start_chunk, chunk_len) < 0) {
+    if (http_write(httpc, start_chunk, chunk_len) < 0) {
         return -1;
     }
-    if (esp_tls_conn_write(httpc->tls, data, data_len) < 0) {
+    if (http_write(httpc, data, data_len) < 0) {
         return -1;
     }
-    if (esp_tls_conn_write(httpc->tls, cr_lf, strlen(cr_lf)) < 0) {
+    if (http_request_flush(httpc) < 0) {
         return -1;
     }
-    return 0;
+    /* The server has the data already: the CRLF can wait for the next chunk */
+    return http_write(httpc, cr_lf, strlen(cr_lf));
 }
 
 int http_send_last_chunk(httpc_conn_t *httpc)
 {
     const char *last_chunk = "0\r\n\r\n";
-    if (esp_tls_conn_write(httpc->tls, last_chunk, strlen(last_chunk)) < 0) {
+    if (http_write(httpc, last_chunk, strlen(last_chunk)) < 0) {
         return -1;
     }
-    return 0;
+    return http_request_flush(httpc);
 }
@@ -17,6 +17,8 @@
 
 #include <esp_tls.h>
 #include <http_parser.h>
+#include <httpc_inflate.h>
+#include <httpc_connect.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +26,12 @@ extern "C" {
 
 #define HTTPC_BUF_SIZE 50
 
+/* Headers of interest per request, Content-Type, Location and Content-Encoding included */
+#define HTTPC_HDR_INTEREST_MAX 9
+
+/* GETs which can be sent ahead on a connection, see http_request_pipeline() */
+#define HTTPC_PIPELINE_MAX 4
+
 typedef enum {
     ESP_HTTP_GET,
     ESP_HTTP_POST,
@@ -41,6 +49,8 @@ enum httpc_conn_state {
     ESP_HTTP_RESP_STARTED,
     ESP_HTTP_RESP_HDR_RECEIVED,
     ESP_HTTP_RESP_BDY_RECEIVED,
+    /* Between ESP_HTTP_INIT and ESP_HTTP_TLS_CONNECT, added last to keep the values above */
+    ESP_HTTP_TCP_CONNECT,
 };
 
 typedef struct redirect_location {
@@ -48,6 +58,17 @@ typedef struct redirect_location {
     int buf_size;
 } redirect_location_t;
 
+typedef struct {
+    size_t in_bytes;            /* Compressed bytes decoded */
+    size_t out_bytes;           /* Bytes they decoded to */
+    uint32_t decode_us;         /* Time spent decoding */
+} httpc_inflate_stats_t;
+
+typedef struct {
+    uint32_t writes;            /* esp_tls_conn_write() calls: TLS records, for https */
+    size_t bytes;
+} httpc_write_stats_t;
+
 typedef void  (* httpc_response_header_cb)(const char *, const char *, void *arg);
 
 /* The maximum length of a header or value that we are interested in */
@@ -95,9 +116,72 @@ typedef struct httpc_conn {
         int hdr_overflow_buf_len;
         int hdr_overflow_buf_index;
         char response_content_type[MAX_HDR_VAL_LEN];
+        /* A body which is not chunked is read straight into the user's
+         * buffer once the headers are parsed, without the parser.
+         * body_left is ULLONG_MAX if the body ends with the connection.
+         */
+        bool body_raw;
+        uint64_t body_left;
+        /* Headers of interest, see http_response_set_header_interest().
+         * If there are none, every header goes through parser_state.
+         */
+        struct hdr_interest {
+            int count;
+            uint32_t candidates;    /* Entries the header name being parsed may still match */
+            size_t name_len;        /* Of the header name parsed so far */
+            int current;            /* Entry of the value being parsed, -1 for none */
+            struct hdr_interest_entry {
+                const char *name;
+                size_t len;
+                char *value;        /* NUL terminated, NULL until the header is received */
+                size_t value_len;
+                size_t value_size;
+            } entries[HTTPC_HDR_INTEREST_MAX];
+        } hdr_interest;
+        /* Compressed response, see http_request_set_accept_encoding() */
+        struct body_inflate {
+            bool accept;
+            size_t max_len;         /* Of the decoded body, 0 for no limit */
+            httpc_coding_t coding;  /* From the Content-Encoding header */
+            httpc_inflate_t *inf;
+            char *in;               /* Compressed data not decoded yet */
+            size_t in_size;
+            size_t in_len;
+            size_t in_pos;
+            bool in_eof;
+            httpc_inflate_stats_t stats;
+        } inflate;
+        bool pipelined;     /* Sent ahead with http_request_pipeline() */
     } request;
+
+    /* Prebuilt libraries read the members above at their offsets, add new ones below */
+    int port;
+    httpc_connect_t *connect;       /* While the async TCP connect is in progress */
+    /* Request data not written yet, so that the request line, headers and
+     * chunk framing go out together. See http_request_flush().
+     */
+    struct write_buf {
+        char *buf;
+        size_t len;
+        httpc_write_stats_t stats;
+    } wbuf;
+    /* GETs sent ahead of the response being read, oldest first, and what
+     * was received of their responses along with it. See http_request_pipeline().
+     */
+    struct pipeline {
+        char *paths[HTTPC_PIPELINE_MAX];
+        int count;
+        char *carry;
+        size_t carry_len;
+        size_t carry_pos;
+    } pipeline;
 } httpc_conn_t;
 
+/**
+ * Connect to the host of `url`. The host name is resolved through the DNS
+ * cache, and when it has several addresses they are tried a little apart,
+ * without waiting for the previous ones to time out: see httpc_connect.h.
+ */
 httpc_conn_t *http_connection_new(const char *url, esp_tls_cfg_t *tls_cfg);
 /**
  * Returns 1 on success.
@@ -105,6 +189,12 @@ httpc_conn_t *http_connection_new(const char *url, esp_tls_cfg_t *tls_cfg);
  * -1 on fatal error.
  */
 int http_connection_new_async(const char *url, esp_tls_cfg_t *tls_cfg, httpc_conn_t **hc);
+/**
+ * Wait for up to `wait_ms` for the connect in progress of `h` to go on, as
+ * left by http_connection_new_async() returning 0, before calling it again.
+ * Returns at once if there is nothing to wait for.
+ */
+void http_connection_wait_async(httpc_conn_t *h, int wait_ms);
 
 /* Cleanup the connection. */
 void http_connection_delete(httpc_conn_t *httpc);
@@ -122,6 +212,46 @@ int http_request_send(httpc_conn_t *httpc, const char *data, size_t data_len);
 int http_response_recv(httpc_conn_t *httpc, char *data, size_t data_len);
 void http_response_set_header_cb(httpc_conn_t *httpc, httpc_response_header_cb cb, void *arg);
 
+/**
+ * Ask for a gzip or deflate compressed response, and have http_response_recv()
+ * decode it into the caller's buffer as it comes in. Meant for text: JSON,
+ * playlists... If the server compresses the response, the decoder takes about
+ * 43 KB until http_request_delete(), and http_response_get_content_len() is 0
+ * since the decoded length is unknown. `max_len` caps the decoded length, 0
+ * for no limit: the response fails past it.
+ *
+ * Call it after http_request_new(), before http_request_send(), which adds
+ * the Accept-Encoding header. With http_request_send_custom_hdr(), add the
+ * header yourself. Don't use it with an offset, which would count compressed
+ * bytes.
+ */
+void http_request_set_accept_encoding(httpc_conn_t *httpc, size_t max_len);
+
+/* Compressed and decoded bytes of the response so far, all 0 if it isn't compressed */
+static inline void http_response_get_inflate_stats(httpc_conn_t *httpc, httpc_inflate_stats_t *stats)
+{
+    *stats = httpc->request.inflate.stats;
+}
+
+/**
+ * Only keep the response headers named in `names`, plus Content-Type,
+ * Location and Content-Encoding, instead of copying every header into the parser buffers. Names
+ * are matched case-insensitively as they are parsed, and the other headers
+ * are skipped without being copied. The values are kept whole, whatever
+ * their length, and can be read with http_response_get_header(). The header
+ * callback is only called for these headers.
+ *
+ * `names` may be NULL for the built-in headers only. Call it after
+ * http_request_new(), before the response is received. The names must stay
+ * valid until http_request_delete().
+ *
+ * Returns -1 if there are more than HTTPC_HDR_INTEREST_MAX - 3 names.
+ */
+int http_response_set_header_interest(httpc_conn_t *httpc, const char *const *names, int count);
+
+/* Value of a header of interest, NULL if it was not in the response (yet) */
+const char *http_response_get_header(httpc_conn_t *httpc, const char *name);
+
 static inline int http_response_get_code(httpc_conn_t *httpc)
 {
     return httpc->request.parser.status_code;
@@ -149,6 +279,55 @@ static inline char *http_response_get_redirect_location(httpc_conn_t *httpc)
 int http_request_send_custom_hdr(httpc_conn_t *httpc, const char *hdr);
 int http_send_chunk(httpc_conn_t *httpc, const char *data, size_t data_len);
 int http_send_last_chunk(httpc_conn_t *httpc);
+
+/**
+ * Request data goes through a small per connection buffer, so that small
+ * pieces of it share a write, and a TLS record. http_request_send(),
+ * http_send_chunk() and http_send_last_chunk() write it out before they
+ * return, but for the CRLF after a chunk, which goes with the next chunk.
+ * http_request_send_custom_hdr() leaves the headers in the buffer for the
+ * body. Reading the response writes out what is left.
+ *
+ * Write out the buffered data now. Returns 0, or -1 if the write failed.
+ */
+int http_request_flush(httpc_conn_t *httpc);
+
+/**
+ * HTTP/1.1 pipelining: send a GET for `url` now, ahead of the response being
+ * read on this connection. Its response is read after that one, by calling
+ * http_request_new() with the same `url`, which then sends nothing, and
+ * neither does http_request_send(). The responses must be read in the order
+ * of the requests: http_request_new() with another URL reads and drops the
+ * responses to the requests sent ahead first.
+ *
+ * Only while a GET is being sent or read. Up to HTTPC_PIPELINE_MAX requests
+ * can be ahead. They ask for the whole resource, without Accept-Encoding.
+ * Returns 0, or -1.
+ *
+ * A server may close the connection instead of answering them. If it said
+ * so in the response being read, http_request_new() returns -ENOTCONN for
+ * them; else reading their response fails with http_response_get_code()
+ * still 0. Either way they need to be sent again on a new connection.
+ */
+int http_request_pipeline(httpc_conn_t *httpc, const char *url);
+
+/* Requests sent ahead with http_request_pipeline(), not read yet */
+static inline int http_request_pipeline_count(httpc_conn_t *httpc)
+{
+    return httpc->pipeline.count;
+}
+
+/* Whether the current request was sent ahead with http_request_pipeline() */
+static inline bool http_request_is_pipelined(httpc_conn_t *httpc)
+{
+    return httpc->request.pipelined;
+}
+
+/* Writes of the connection so far */
+static inline void http_connection_get_write_stats(httpc_conn_t *httpc, httpc_write_stats_t *stats)
+{
+    *stats = httpc->wbuf.stats;
+}
 int http_connection_get_sockfd(httpc_conn_t *http_conn);
 
 /**
@@ -157,6 +336,40 @@ int http_connection_get_sockfd(httpc_conn_t *http_conn);
  */
 void http_connection_set_keepalive_and_recv_timeout(httpc_conn_t *httpc);
 
+/**
+ * Keep-alive connection pool.
+ *
+ * http_connection_new() and http_connection_new_async() first look for an
+ * idle connection to the same host, port and scheme in the pool, and only
+ * connect if there is none. Hand a connection back with
+ * http_connection_release() instead of deleting it once its response was
+ * read in full. A pooled connection is handed out blocking, with the
+ * SO_RCVTIMEO and SO_SNDTIMEO of the new `tls_cfg`, whatever its previous
+ * user set.
+ */
+typedef struct {
+    uint32_t hits;                  /* Connections taken from the pool */
+    uint32_t misses;                /* New connections opened */
+    uint32_t tls_handshakes_avoided;
+    uint32_t stale;                 /* Closed by the server while idle, found on checkout */
+    uint32_t expired;               /* Closed after the idle timeout */
+    uint32_t evicted;               /* Closed to make room */
+    uint32_t idle;                  /* Connections in the pool right now */
+} httpc_pool_stats_t;
+
+/**
+ * Return the connection to the pool if it can be reused: the response was
+ * read in full and the server did not ask to close it. Else, or if the pool
+ * is disabled, this is the same as http_connection_delete().
+ * The request must have been deleted with http_request_delete() already.
+ */
+void http_connection_release(httpc_conn_t *httpc);
+
+/* Close all the idle connections, e.g. after the network changed. */
+void http_connection_pool_flush(void);
+
+void http_connection_pool_get_stats(httpc_pool_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
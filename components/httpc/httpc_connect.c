@@ -0,0 +1,471 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "httpc_connect.h"
+
+static const char *TAG = "httpc_connect";
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#include <esp_timer.h>
+#else
+#include <time.h>
+#include "mbedtls/esp_debug.h"
+#endif
+
+#ifdef ESP_PLATFORM
+#ifdef CONFIG_HTTP_CLIENT_DNS_CACHE
+#define HTTPC_DNS_CACHE_SIZE        CONFIG_HTTP_CLIENT_DNS_CACHE_SIZE
+#define HTTPC_DNS_CACHE_TTL_SEC     CONFIG_HTTP_CLIENT_DNS_CACHE_TTL
+#else
+#define HTTPC_DNS_CACHE_SIZE        0
+#define HTTPC_DNS_CACHE_TTL_SEC     0
+#endif
+#define HTTPC_CONNECT_STAGGER_MS    CONFIG_HTTP_CLIENT_CONNECT_STAGGER_MS
+#define HTTPC_CONNECT_TIMEOUT_MS    CONFIG_HTTP_CLIENT_CONNECT_TIMEOUT_MS
+#else
+#define HTTPC_DNS_CACHE_SIZE        4
+#define HTTPC_DNS_CACHE_TTL_SEC     60
+#define HTTPC_CONNECT_STAGGER_MS    250
+#define HTTPC_CONNECT_TIMEOUT_MS    10000
+#endif
+
+#define HTTPC_DNS_HOST_MAX 64
+
+static int64_t connect_now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* DNS cache.
+ *
+ * A small array of host names and their addresses, each kept for the TTL
+ * the resolver gave. getaddrinfo() doesn't tell the TTL of the records, so
+ * its addresses are kept for HTTPC_DNS_CACHE_TTL_SEC. When the cache is
+ * full, the least recently used host goes. A host is forgotten when none of
+ * its addresses could be connected to, in case they changed.
+ */
+typedef struct {
+    char host[HTTPC_DNS_HOST_MAX];
+    struct sockaddr_storage addrs[HTTPC_CONNECT_MAX_ADDRS];
+    int count;
+    int64_t expires_us;
+    int64_t used_us;
+} dns_entry_t;
+
+static dns_entry_t dns_cache[HTTPC_DNS_CACHE_SIZE > 0 ? HTTPC_DNS_CACHE_SIZE : 1];
+static httpc_resolver_t dns_resolver;
+static httpc_connect_stats_t connect_stats;
+static uint32_t connect_samples[HTTPC_CONNECT_SAMPLES];
+static uint32_t connect_sample_count;
+static pthread_mutex_t connect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int getaddrinfo_resolver(const char *host, struct sockaddr_storage *addrs, int max, uint32_t *ttl_s)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) {
+        return -1;
+    }
+    int count = 0;
+    for (struct addrinfo *ai = res; ai && count < max; ai = ai->ai_next) {
+        if (ai->ai_addrlen <= sizeof(addrs[count])) {
+            memcpy(&addrs[count++], ai->ai_addr, ai->ai_addrlen);
+        }
+    }
+    freeaddrinfo(res);
+    *ttl_s = HTTPC_DNS_CACHE_TTL_SEC;
+    return count ? count : -1;
+}
+
+/* Alternate the address families, the first one first, as RFC 8305 says */
+static void dns_interleave(struct sockaddr_storage *addrs, int count)
+{
+    for (int i = 1; i < count; i++) {
+        if (addrs[i].ss_family != addrs[i - 1].ss_family) {
+            continue;
+        }
+        for (int j = i + 1; j < count; j++) {
+            if (addrs[j].ss_family != addrs[i - 1].ss_family) {
+                struct sockaddr_storage other = addrs[j];
+                memmove(&addrs[i + 1], &addrs[i], (j - i) * sizeof(addrs[0]));
+                addrs[i] = other;
+                break;
+            }
+        }
+    }
+}
+
+static int dns_find_locked(const char *host)
+{
+    for (int i = 0; i < HTTPC_DNS_CACHE_SIZE; i++) {
+        if (dns_cache[i].count && strcasecmp(dns_cache[i].host, host) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void dns_forget(const char *host)
+{
+    pthread_mutex_lock(&connect_lock);
+    int i = dns_find_locked(host);
+    if (i >= 0) {
+        dns_cache[i].count = 0;
+    }
+    pthread_mutex_unlock(&connect_lock);
+}
+
+static int dns_resolve(const char *host, struct sockaddr_storage *addrs)
+{
+    struct in_addr addr4;
+    struct in6_addr addr6;
+    if (inet_pton(AF_INET, host, &addr4) == 1 || inet_pton(AF_INET6, host, &addr6) == 1) {
+        /* An address already: nothing to cache */
+        uint32_t ttl_s;
+        return getaddrinfo_resolver(host, addrs, 1, &ttl_s);
+    }
+
+    int64_t now = connect_now_us();
+    pthread_mutex_lock(&connect_lock);
+    int i = dns_find_locked(host);
+    if (i >= 0 && now < dns_cache[i].expires_us) {
+        int count = dns_cache[i].count;
+        memcpy(addrs, dns_cache[i].addrs, count * sizeof(addrs[0]));
+        dns_cache[i].used_us = now;
+        connect_stats.dns_hits++;
+        pthread_mutex_unlock(&connect_lock);
+        return count;
+    }
+    httpc_resolver_t resolver = dns_resolver ? dns_resolver : getaddrinfo_resolver;
+    pthread_mutex_unlock(&connect_lock);
+
+    /* Not under the lock: this may take seconds */
+    uint32_t ttl_s = 0;
+    int count = resolver(host, addrs, HTTPC_CONNECT_MAX_ADDRS, &ttl_s);
+
+    pthread_mutex_lock(&connect_lock);
+    if (count <= 0) {
+        connect_stats.dns_failures++;
+        pthread_mutex_unlock(&connect_lock);
+        ESP_LOGE(TAG, "Could not resolve %s", host);
+        return -1;
+    }
+    connect_stats.dns_misses++;
+    dns_interleave(addrs, count);
+    if (HTTPC_DNS_CACHE_SIZE > 0 && ttl_s > 0 && strlen(host) < HTTPC_DNS_HOST_MAX) {
+        now = connect_now_us();
+        /* The host itself if another task resolved it meanwhile, else a free or the least recently used entry */
+        i = dns_find_locked(host);
+        for (int j = 0; i < 0 && j < HTTPC_DNS_CACHE_SIZE; j++) {
+            if (!dns_cache[j].count) {
+                i = j;
+            }
+        }
+        if (i < 0) {
+            i = 0;
+            for (int j = 1; j < HTTPC_DNS_CACHE_SIZE; j++) {
+                if (dns_cache[j].used_us < dns_cache[i].used_us) {
+                    i = j;
+                }
+            }
+        }
+        dns_entry_t *e = &dns_cache[i];
+        strcpy(e->host, host);
+        memcpy(e->addrs, addrs, count * sizeof(addrs[0]));
+        e->count = count;
+        e->expires_us = now + ttl_s * 1000000LL;
+        e->used_us = now;
+    }
+    pthread_mutex_unlock(&connect_lock);
+    return count;
+}
+
+void httpc_connect_set_resolver(httpc_resolver_t resolver)
+{
+    pthread_mutex_lock(&connect_lock);
+    dns_resolver = resolver;
+    pthread_mutex_unlock(&connect_lock);
+    httpc_connect_dns_flush();
+}
+
+void httpc_connect_dns_flush(void)
+{
+    pthread_mutex_lock(&connect_lock);
+    memset(dns_cache, 0, sizeof(dns_cache));
+    pthread_mutex_unlock(&connect_lock);
+}
+
+static int cmp_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+void httpc_connect_get_stats(httpc_connect_stats_t *stats)
+{
+    uint32_t samples[HTTPC_CONNECT_SAMPLES];
+    pthread_mutex_lock(&connect_lock);
+    *stats = connect_stats;
+    int count = connect_sample_count < HTTPC_CONNECT_SAMPLES ? connect_sample_count : HTTPC_CONNECT_SAMPLES;
+    memcpy(samples, connect_samples, count * sizeof(samples[0]));
+    pthread_mutex_unlock(&connect_lock);
+
+    if (count) {
+        qsort(samples, count, sizeof(samples[0]), cmp_uint32);
+        stats->connect_p50_us = samples[count * 50 / 100];
+        stats->connect_p90_us = samples[count * 90 / 100];
+        stats->connect_p99_us = samples[count * 99 / 100];
+    }
+}
+
+/* Connection attempts */
+struct httpc_connect {
+    char host[HTTPC_DNS_HOST_MAX];
+    struct sockaddr_storage addrs[HTTPC_CONNECT_MAX_ADDRS];
+    int count;
+    int fds[HTTPC_CONNECT_MAX_ADDRS];   /* Of the attempts in progress, -1 for none */
+    int next;                           /* Address of the next attempt */
+    int64_t start_us;
+    int64_t next_attempt_us;
+    int64_t deadline_us;
+};
+
+static socklen_t addr_len(const struct sockaddr_storage *addr)
+{
+    return addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static void connect_done(httpc_connect_t *c, int winner)
+{
+    uint32_t elapsed = connect_now_us() - c->start_us;
+    pthread_mutex_lock(&connect_lock);
+    if (winner >= 0) {
+        connect_stats.connects++;
+        if (winner > 0) {
+            connect_stats.fallbacks++;
+        }
+        connect_samples[connect_sample_count++ % HTTPC_CONNECT_SAMPLES] = elapsed;
+    } else {
+        connect_stats.connect_failures++;
+    }
+    pthread_mutex_unlock(&connect_lock);
+    if (winner > 0) {
+        ESP_LOGI(TAG, "Connected to %s through address %d, in %u ms", c->host, winner + 1, (unsigned) (elapsed / 1000));
+    }
+}
+
+/* Returns the socket if it connected right away, else -1 */
+static int connect_attempt(httpc_connect_t *c)
+{
+    int i = c->next++;
+    c->next_attempt_us = connect_now_us() + HTTPC_CONNECT_STAGGER_MS * 1000LL;
+    int fd = socket(c->addrs[i].ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Could not create a socket, errno %d", errno);
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(fd, (struct sockaddr *) &c->addrs[i], addr_len(&c->addrs[i])) == 0) {
+        connect_done(c, i);
+        return fd;
+    }
+    if (errno != EINPROGRESS) {
+        ESP_LOGD(TAG, "Connect to address %d of %s failed, errno %d", i + 1, c->host, errno);
+        close(fd);
+        /* No need to wait before the next one */
+        c->next_attempt_us = 0;
+        return -1;
+    }
+    c->fds[i] = fd;
+    return -1;
+}
+
+httpc_connect_t *httpc_connect_start(const char *host, size_t host_len, int port, int timeout_ms)
+{
+    if (host_len >= HTTPC_DNS_HOST_MAX) {
+        ESP_LOGE(TAG, "Host name too long");
+        return NULL;
+    }
+    httpc_connect_t *c = calloc(1, sizeof(*c));
+    if (!c) {
+        ESP_LOGE(TAG, "Could not allocate httpc_connect_t. Line = %d", __LINE__);
+        return NULL;
+    }
+    memcpy(c->host, host, host_len);
+    c->count = dns_resolve(c->host, c->addrs);
+    if (c->count <= 0) {
+        free(c);
+        return NULL;
+    }
+    for (int i = 0; i < c->count; i++) {
+        c->fds[i] = -1;
+        if (c->addrs[i].ss_family == AF_INET6) {
+            ((struct sockaddr_in6 *) &c->addrs[i])->sin6_port = htons(port);
+        } else {
+            ((struct sockaddr_in *) &c->addrs[i])->sin_port = htons(port);
+        }
+    }
+    c->start_us = connect_now_us();
+    c->deadline_us = c->start_us + (int64_t) (timeout_ms > 0 ? timeout_ms : HTTPC_CONNECT_TIMEOUT_MS) * 1000;
+    return c;
+}
+
+int httpc_connect_fds(httpc_connect_t *c, int *fds, int max, int *wait_ms)
+{
+    int n = 0;
+    for (int i = 0; i < c->next && n < max; i++) {
+        if (c->fds[i] >= 0) {
+            fds[n++] = c->fds[i];
+        }
+    }
+    int64_t now = connect_now_us();
+    int64_t until = c->deadline_us;
+    if (c->next < c->count && c->next_attempt_us < until) {
+        until = c->next_attempt_us;
+    }
+    *wait_ms = until > now ? (until - now + 999) / 1000 : 0;
+    return n;
+}
+
+static void connect_close_others(httpc_connect_t *c, int winner)
+{
+    for (int i = 0; i < c->next; i++) {
+        if (i != winner && c->fds[i] >= 0) {
+            close(c->fds[i]);
+        }
+        c->fds[i] = -1;
+    }
+}
+
+int httpc_connect_poll(httpc_connect_t *c, int wait_ms)
+{
+    int64_t give_up_us = wait_ms < 0 ? c->deadline_us : connect_now_us() + (int64_t) wait_ms * 1000;
+    while (1) {
+        int64_t now = connect_now_us();
+        if (now >= c->deadline_us) {
+            ESP_LOGE(TAG, "Connect to %s timed out", c->host);
+            dns_forget(c->host);
+            connect_close_others(c, -1);
+            connect_done(c, -1);
+            return -1;
+        }
+        int fds[HTTPC_CONNECT_MAX_ADDRS], wait;
+        int n = httpc_connect_fds(c, fds, HTTPC_CONNECT_MAX_ADDRS, &wait);
+        if (c->next < c->count && (n == 0 || now >= c->next_attempt_us)) {
+            int fd = connect_attempt(c);
+            if (fd >= 0) {
+                connect_close_others(c, c->next - 1);
+                return fd;
+            }
+            continue;
+        }
+        if (n == 0) {
+            ESP_LOGE(TAG, "Could not connect to any address of %s", c->host);
+            dns_forget(c->host);
+            connect_done(c, -1);
+            return -1;
+        }
+
+        fd_set write_fds;
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        for (int i = 0; i < n; i++) {
+            FD_SET(fds[i], &write_fds);
+            max_fd = fds[i] > max_fd ? fds[i] : max_fd;
+        }
+        int64_t wait_us = (int64_t) wait * 1000;
+        if (give_up_us - now < wait_us) {
+            wait_us = give_up_us > now ? give_up_us - now : 0;
+        }
+        struct timeval tv = {
+            .tv_sec = wait_us / 1000000,
+            .tv_usec = wait_us % 1000000,
+        };
+        int ret = select(max_fd + 1, NULL, &write_fds, NULL, &tv);
+        if (ret < 0 && errno != EINTR) {
+            ESP_LOGE(TAG, "select() failed, errno %d", errno);
+            connect_close_others(c, -1);
+            connect_done(c, -1);
+            return -1;
+        }
+        for (int i = 0; ret > 0 && i < c->next; i++) {
+            if (c->fds[i] < 0 || !FD_ISSET(c->fds[i], &write_fds)) {
+                continue;
+            }
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(c->fds[i], SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+                int fd = c->fds[i];
+                connect_close_others(c, i);
+                connect_done(c, i);
+                return fd;
+            }
+            ESP_LOGD(TAG, "Connect to address %d of %s failed, error %d", i + 1, c->host, error);
+            close(c->fds[i]);
+            c->fds[i] = -1;
+            /* Don't wait for the stagger: go on with the next address */
+            c->next_attempt_us = 0;
+        }
+        if (wait_ms >= 0 && ret == 0 && connect_now_us() >= give_up_us) {
+            return -EAGAIN;
+        }
+    }
+}
+
+int httpc_connect_resolve(const char *host, size_t host_len)
+{
+    char name[HTTPC_DNS_HOST_MAX];
+    struct sockaddr_storage addrs[HTTPC_CONNECT_MAX_ADDRS];
+    if (host_len >= sizeof(name)) {
+        ESP_LOGE(TAG, "Host name too long");
+        return -1;
+    }
+    memcpy(name, host, host_len);
+    name[host_len] = '\0';
+    return dns_resolve(name, addrs) > 0 ? 0 : -1;
+}
+
+void httpc_connect_delete(httpc_connect_t *c)
+{
+    if (!c) {
+        return;
+    }
+    connect_close_others(c, -1);
+    free(c);
+}
@@ -0,0 +1,102 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _ESP_HTTPC_CONNECT_H_
+#define _ESP_HTTPC_CONNECT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * TCP connect for httpc: a DNS cache, and connection attempts to the
+ * addresses of the host one after the other, a little apart, without waiting
+ * for the previous ones to fail ("happy eyeballs", RFC 8305). The first
+ * attempt to succeed wins, the others are closed.
+ */
+
+/* Addresses kept per host, and connection attempts at a time */
+#define HTTPC_CONNECT_MAX_ADDRS 4
+
+/**
+ * Resolve `host` to up to `max` addresses, the port left 0. Sets `*ttl_s` to
+ * the time they may be cached for. Returns their number, or -1.
+ */
+typedef int (*httpc_resolver_t)(const char *host, struct sockaddr_storage *addrs, int max, uint32_t *ttl_s);
+
+typedef struct {
+    uint32_t dns_hits;              /* Host names found in the cache */
+    uint32_t dns_misses;            /* Host names resolved */
+    uint32_t dns_failures;
+    uint32_t connects;
+    uint32_t connect_failures;      /* No address could be connected to in time */
+    uint32_t fallbacks;             /* Connected to another address than the first */
+    /* Connect times of the last HTTPC_CONNECT_SAMPLES connects */
+    uint32_t connect_p50_us;
+    uint32_t connect_p90_us;
+    uint32_t connect_p99_us;
+} httpc_connect_stats_t;
+
+#define HTTPC_CONNECT_SAMPLES 64
+
+typedef struct httpc_connect httpc_connect_t;
+
+/**
+ * Resolve the host, blocking if it isn't cached. The connection attempts are
+ * made by httpc_connect_poll(). Returns NULL if the host couldn't be
+ * resolved. `timeout_ms` is for the whole connect, 0 for the default.
+ */
+httpc_connect_t *httpc_connect_start(const char *host, size_t host_len, int port, int timeout_ms);
+
+/**
+ * Resolve the host into the DNS cache, blocking if it isn't there yet, so
+ * that a httpc_connect_start() for it from another task doesn't block.
+ * Returns 0, or -1 if it couldn't be resolved.
+ */
+int httpc_connect_resolve(const char *host, size_t host_len);
+
+/**
+ * Wait for up to `wait_ms` for an attempt to succeed, -1 for as long as it
+ * takes. Returns the connected socket, which is non-blocking, -EAGAIN if it
+ * is still in progress, or -1 if all the attempts failed or timed out.
+ */
+int httpc_connect_poll(httpc_connect_t *c, int wait_ms);
+
+/**
+ * The sockets of the attempts in progress, to wait for any of them to be
+ * writable before the next httpc_connect_poll(). `*wait_ms` is set to the
+ * time by which it should be called anyway. Returns their number.
+ */
+int httpc_connect_fds(httpc_connect_t *c, int *fds, int max, int *wait_ms);
+
+/* Close the attempts left, not the socket returned by httpc_connect_poll() */
+void httpc_connect_delete(httpc_connect_t *c);
+
+/* Use another resolver than getaddrinfo(), NULL to go back to it. Flushes the cache. */
+void httpc_connect_set_resolver(httpc_resolver_t resolver);
+
+/* Forget the resolved addresses, e.g. after the network changed */
+void httpc_connect_dns_flush(void);
+
+void httpc_connect_get_stats(httpc_connect_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _ESP_HTTPC_CONNECT_H_ */
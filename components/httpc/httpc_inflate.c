@@ -0,0 +1,402 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include "httpc_inflate.h"
+
+static const char *TAG = "httpc_inflate";
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#include "esp32/rom/miniz.h"
+#include "esp32/rom/crc.h"
+#define inflate_crc32(crc, buf, len) crc32_le(crc, buf, len)
+#else
+#include <zlib.h>
+#include "mbedtls/esp_debug.h"
+#define inflate_crc32(crc, buf, len) crc32(crc, buf, len)
+#endif
+
+/* gzip header flags (RFC 1952) */
+#define GZIP_FHCRC      0x02
+#define GZIP_FEXTRA     0x04
+#define GZIP_FNAME      0x08
+#define GZIP_FCOMMENT   0x10
+#define GZIP_FIXED_LEN  10
+#define GZIP_TRAILER_LEN 8
+
+struct httpc_inflate {
+    httpc_coding_t coding;
+    enum {
+        INFLATE_HEADER,
+        INFLATE_BODY,
+        INFLATE_TRAILER,
+        INFLATE_DONE,
+    } state;
+    /* gzip header and trailer */
+    enum {
+        GZIP_FIELD_FIXED,
+        GZIP_FIELD_EXTRA_LEN,
+        GZIP_FIELD_EXTRA,
+        GZIP_FIELD_NAME,
+        GZIP_FIELD_COMMENT,
+        GZIP_FIELD_HCRC,
+        GZIP_FIELD_END,
+    } gzip_field;
+    uint8_t gzip_flags;
+    size_t skip;                /* Bytes left of the field being skipped */
+    uint8_t field[GZIP_FIXED_LEN];
+    size_t field_len;
+    uint32_t crc;
+    uint32_t size;
+    /* deflate: zlib stream (RFC 1950), or raw deflate from broken servers */
+    bool zlib_wrapped;
+#ifdef ESP_PLATFORM
+    /* tinfl writes into the window, and we copy out of it */
+    tinfl_decompressor tinfl;
+    tinfl_status status;
+    uint8_t *window;
+    size_t window_ofs;
+    size_t pending_ofs;
+    size_t pending_len;
+#else
+    z_stream zs;
+    bool zs_init;
+#endif
+};
+
+httpc_coding_t httpc_inflate_coding(const char *content_encoding)
+{
+    while (isspace((unsigned char) *content_encoding)) {
+        content_encoding++;
+    }
+    size_t len = strlen(content_encoding);
+    while (len && isspace((unsigned char) content_encoding[len - 1])) {
+        len--;
+    }
+    if (len == 0 || (len == 8 && !strncasecmp(content_encoding, "identity", len))) {
+        return HTTPC_CODING_IDENTITY;
+    }
+    if ((len == 4 && !strncasecmp(content_encoding, "gzip", len)) ||
+            (len == 6 && !strncasecmp(content_encoding, "x-gzip", len))) {
+        return HTTPC_CODING_GZIP;
+    }
+    if (len == 7 && !strncasecmp(content_encoding, "deflate", len)) {
+        return HTTPC_CODING_DEFLATE;
+    }
+    /* Including several codings, which we never ask for */
+    return HTTPC_CODING_UNSUPPORTED;
+}
+
+#ifdef ESP_PLATFORM
+static int backend_start(httpc_inflate_t *inf)
+{
+    inf->window = malloc(TINFL_LZ_DICT_SIZE);
+    if (!inf->window) {
+        ESP_LOGE(TAG, "Could not allocate the window");
+        return -1;
+    }
+    tinfl_init(&inf->tinfl);
+    inf->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    return 0;
+}
+
+static void backend_end(httpc_inflate_t *inf)
+{
+    free(inf->window);
+}
+
+static int backend_run(httpc_inflate_t *inf, const uint8_t *in, size_t in_len, size_t *in_used,
+                       uint8_t *out, size_t out_len, size_t *out_used, bool *end)
+{
+    int flags = TINFL_FLAG_HAS_MORE_INPUT;
+    if (inf->zlib_wrapped) {
+        flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+    }
+    *in_used = 0;
+    *out_used = 0;
+    while (1) {
+        size_t n = inf->pending_len < out_len - *out_used ? inf->pending_len : out_len - *out_used;
+        memcpy(out + *out_used, inf->window + inf->pending_ofs, n);
+        *out_used += n;
+        inf->pending_ofs += n;
+        inf->pending_len -= n;
+        if (inf->pending_len) {
+            return 0;
+        }
+        if (inf->status == TINFL_STATUS_DONE) {
+            *end = true;
+            return 0;
+        }
+        if (*out_used == out_len) {
+            return 0;
+        }
+        size_t in_bytes = in_len - *in_used;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - inf->window_ofs;
+        inf->status = tinfl_decompress(&inf->tinfl, in + *in_used, &in_bytes, inf->window,
+                                       inf->window + inf->window_ofs, &out_bytes, flags);
+        if (inf->status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupt data: %d", inf->status);
+            return -1;
+        }
+        *in_used += in_bytes;
+        inf->pending_ofs = inf->window_ofs;
+        inf->pending_len = out_bytes;
+        inf->window_ofs = (inf->window_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        if (inf->status == TINFL_STATUS_NEEDS_MORE_INPUT && out_bytes == 0) {
+            return 0;
+        }
+    }
+}
+#else
+static int backend_start(httpc_inflate_t *inf)
+{
+    if (inflateInit2(&inf->zs, inf->zlib_wrapped ? MAX_WBITS : -MAX_WBITS) != Z_OK) {
+        ESP_LOGE(TAG, "inflateInit2 failed");
+        return -1;
+    }
+    inf->zs_init = true;
+    return 0;
+}
+
+static void backend_end(httpc_inflate_t *inf)
+{
+    if (inf->zs_init) {
+        inflateEnd(&inf->zs);
+    }
+}
+
+static int backend_run(httpc_inflate_t *inf, const uint8_t *in, size_t in_len, size_t *in_used,
+                       uint8_t *out, size_t out_len, size_t *out_used, bool *end)
+{
+    inf->zs.next_in = (uint8_t *) in;
+    inf->zs.avail_in = in_len;
+    inf->zs.next_out = out;
+    inf->zs.avail_out = out_len;
+    int ret = inflate(&inf->zs, Z_NO_FLUSH);
+    *in_used = in_len - inf->zs.avail_in;
+    *out_used = out_len - inf->zs.avail_out;
+    if (ret == Z_STREAM_END) {
+        *end = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        ESP_LOGE(TAG, "Corrupt data: %d", ret);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/* Collect `want` bytes of a field. Returns the bytes used up. */
+static size_t collect_field(httpc_inflate_t *inf, size_t want, const uint8_t *in, size_t len)
+{
+    size_t n = want - inf->field_len < len ? want - inf->field_len : len;
+    memcpy(inf->field + inf->field_len, in, n);
+    inf->field_len += n;
+    return n;
+}
+
+/* Returns the bytes of the gzip header used up, -1 if it is not one */
+static int gzip_header(httpc_inflate_t *inf, const uint8_t *in, size_t len)
+{
+    size_t i = 0;
+    while (inf->state == INFLATE_HEADER) {
+        size_t n = inf->skip < len - i ? inf->skip : len - i;
+        i += n;
+        inf->skip -= n;
+        if (inf->skip) {
+            return i;
+        }
+        switch (inf->gzip_field) {
+        case GZIP_FIELD_FIXED:
+            i += collect_field(inf, GZIP_FIXED_LEN, in + i, len - i);
+            if (inf->field_len < GZIP_FIXED_LEN) {
+                return i;
+            }
+            if (inf->field[0] != 0x1f || inf->field[1] != 0x8b || inf->field[2] != 8) {
+                ESP_LOGE(TAG, "Not a gzip stream");
+                return -1;
+            }
+            inf->gzip_flags = inf->field[3];
+            inf->field_len = 0;
+            inf->gzip_field = GZIP_FIELD_EXTRA_LEN;
+            break;
+        case GZIP_FIELD_EXTRA_LEN:
+            if (inf->gzip_flags & GZIP_FEXTRA) {
+                i += collect_field(inf, 2, in + i, len - i);
+                if (inf->field_len < 2) {
+                    return i;
+                }
+                inf->skip = inf->field[0] | inf->field[1] << 8;
+            }
+            inf->gzip_field = GZIP_FIELD_EXTRA;
+            break;
+        case GZIP_FIELD_EXTRA:
+            /* Skipped already */
+            inf->gzip_field = GZIP_FIELD_NAME;
+            break;
+        case GZIP_FIELD_NAME:
+        case GZIP_FIELD_COMMENT:
+            if (inf->gzip_flags & (inf->gzip_field == GZIP_FIELD_NAME ? GZIP_FNAME : GZIP_FCOMMENT)) {
+                /* NUL terminated */
+                const uint8_t *nul = memchr(in + i, '\0', len - i);
+                if (!nul) {
+                    return len;
+                }
+                i = nul - in + 1;
+            }
+            inf->gzip_field = inf->gzip_field == GZIP_FIELD_NAME ? GZIP_FIELD_COMMENT : GZIP_FIELD_HCRC;
+            break;
+        case GZIP_FIELD_HCRC:
+            inf->skip = inf->gzip_flags & GZIP_FHCRC ? 2 : 0;
+            inf->gzip_field = GZIP_FIELD_END;
+            break;
+        case GZIP_FIELD_END:
+            inf->state = INFLATE_BODY;
+            break;
+        }
+    }
+    return i;
+}
+
+/* Returns the bytes of the gzip trailer used up, -1 if it doesn't match */
+static int gzip_trailer(httpc_inflate_t *inf, const uint8_t *in, size_t len)
+{
+    size_t i = collect_field(inf, GZIP_TRAILER_LEN, in, len);
+    if (inf->field_len < GZIP_TRAILER_LEN) {
+        return i;
+    }
+    const uint8_t *t = inf->field;
+    uint32_t crc = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t) t[3] << 24;
+    uint32_t size = t[4] | t[5] << 8 | t[6] << 16 | (uint32_t) t[7] << 24;
+    if (crc != inf->crc || size != inf->size) {
+        ESP_LOGE(TAG, "gzip trailer mismatch: crc %08x/%08x, size %u/%u",
+                 (unsigned) crc, (unsigned) inf->crc, (unsigned) size, (unsigned) inf->size);
+        return -1;
+    }
+    inf->state = INFLATE_DONE;
+    return i;
+}
+
+int httpc_inflate_new(httpc_coding_t coding, httpc_inflate_t **inf)
+{
+    *inf = NULL;
+    if (coding != HTTPC_CODING_GZIP && coding != HTTPC_CODING_DEFLATE) {
+        return -ENOTSUP;
+    }
+    httpc_inflate_t *i = calloc(1, sizeof(httpc_inflate_t));
+    if (!i) {
+        return -ENOMEM;
+    }
+    i->coding = coding;
+    i->state = INFLATE_HEADER;
+    *inf = i;
+    return 0;
+}
+
+void httpc_inflate_delete(httpc_inflate_t *inf)
+{
+    if (!inf) {
+        return;
+    }
+    if (inf->state != INFLATE_HEADER) {
+        backend_end(inf);
+    }
+    free(inf);
+}
+
+bool httpc_inflate_done(httpc_inflate_t *inf)
+{
+    return inf->state == INFLATE_DONE;
+}
+
+int httpc_inflate_run(httpc_inflate_t *inf, const char *in_data, size_t in_len, size_t *consumed,
+                      char *out_data, size_t out_len)
+{
+    const uint8_t *in = (const uint8_t *) in_data;
+    uint8_t *out = (uint8_t *) out_data;
+    size_t used = 0, produced = 0;
+    int n;
+
+    while (1) {
+        switch (inf->state) {
+        case INFLATE_HEADER:
+            if (inf->coding == HTTPC_CODING_GZIP) {
+                n = gzip_header(inf, in + used, in_len - used);
+                if (n < 0) {
+                    return -1;
+                }
+                used += n;
+                if (inf->state == INFLATE_HEADER) {
+                    goto out;
+                }
+            } else {
+                /* A zlib header is a multiple of 31, and says deflate. Raw
+                 * deflate data rarely looks like one.
+                 */
+                if (in_len - used < 2) {
+                    goto out;
+                }
+                uint8_t cmf = in[used], flg = in[used + 1];
+                inf->zlib_wrapped = (cmf & 0x0f) == 8 && (cmf >> 4) <= 7 && (cmf << 8 | flg) % 31 == 0;
+                inf->state = INFLATE_BODY;
+            }
+            if (backend_start(inf) != 0) {
+                inf->state = INFLATE_HEADER;
+                return -1;
+            }
+            break;
+        case INFLATE_BODY: {
+            size_t in_used, out_used;
+            bool end = false;
+            if (backend_run(inf, in + used, in_len - used, &in_used,
+                            out + produced, out_len - produced, &out_used, &end) != 0) {
+                return -1;
+            }
+            if (inf->coding == HTTPC_CODING_GZIP) {
+                inf->crc = inflate_crc32(inf->crc, out + produced, out_used);
+                inf->size += out_used;
+            }
+            used += in_used;
+            produced += out_used;
+            if (!end) {
+                /* The input is used up, or the output full */
+                goto out;
+            }
+            inf->field_len = 0;
+            inf->state = inf->coding == HTTPC_CODING_GZIP ? INFLATE_TRAILER : INFLATE_DONE;
+            break;
+        }
+        case INFLATE_TRAILER:
+            n = gzip_trailer(inf, in + used, in_len - used);
+            if (n < 0) {
+                return -1;
+            }
+            used += n;
+            if (inf->state == INFLATE_TRAILER) {
+                goto out;
+            }
+            break;
+        case INFLATE_DONE:
+            used = in_len;
+            goto out;
+        }
+    }
+out:
+    *consumed = used;
+    return produced;
+}
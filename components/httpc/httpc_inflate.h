@@ -0,0 +1,72 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _ESP_HTTPC_INFLATE_H_
+#define _ESP_HTTPC_INFLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming decoder of the gzip and deflate content codings, for
+ * http_response_recv().
+ *
+ * It decodes into buffers of any size, and keeps the 32 KB window deflate
+ * needs on the side: about 43 KB in all on the ESP32, which uses the miniz
+ * inflater in ROM. The host build uses zlib.
+ */
+
+typedef enum {
+    HTTPC_CODING_IDENTITY = 0,
+    HTTPC_CODING_GZIP,
+    HTTPC_CODING_DEFLATE,
+    HTTPC_CODING_UNSUPPORTED,
+} httpc_coding_t;
+
+typedef struct httpc_inflate httpc_inflate_t;
+
+/* The coding of a Content-Encoding header value */
+httpc_coding_t httpc_inflate_coding(const char *content_encoding);
+
+/**
+ * Create a decoder of `coding` in `*inf`. Returns 0, -ENOTSUP if `coding` is
+ * not one it decodes, or -ENOMEM.
+ */
+int httpc_inflate_new(httpc_coding_t coding, httpc_inflate_t **inf);
+
+void httpc_inflate_delete(httpc_inflate_t *inf);
+
+/**
+ * Decode what it can of `in` into `out`. `*consumed` is set to the bytes of
+ * `in` used up; the others must be given again, with more after them.
+ * Returns the bytes written to `out`, or -1 if the data is corrupt.
+ *
+ * When `out` is full, some output may be held back: call it again, with or
+ * without more input, until it returns 0.
+ */
+int httpc_inflate_run(httpc_inflate_t *inf, const char *in, size_t in_len, size_t *consumed,
+                      char *out, size_t out_len);
+
+/* The compressed data ended and was checked. Anything after it is ignored. */
+bool httpc_inflate_done(httpc_inflate_t *inf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _ESP_HTTPC_INFLATE_H_ */
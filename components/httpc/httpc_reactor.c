@@ -0,0 +1,438 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "httpc_reactor.h"
+
+static const char *TAG = "httpc_reactor";
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#include <esp_timer.h>
+#else
+#include <time.h>
+#include "mbedtls/esp_debug.h"
+#endif
+
+/* Body data is read in chunks of this size, and handed to on_data() */
+#define REACTOR_BUF_SIZE        2048
+/* Reads in a row for one transfer, before the others get their turn */
+#define REACTOR_READS_PER_TURN  8
+
+typedef enum {
+    TRANSFER_CONNECTING,
+    TRANSFER_RECEIVING,
+} transfer_state_t;
+
+typedef struct httpc_transfer {
+    httpc_transfer_cfg_t cfg;
+    char *url;
+    esp_tls_cfg_t tls_cfg;
+    httpc_conn_t *h;
+    transfer_state_t state;
+    int64_t deadline_us;            /* 0 for none */
+    bool pending;                   /* There may be data to read without waiting, e.g. in the TLS buffers */
+    struct httpc_transfer *next;
+} httpc_transfer_t;
+
+struct httpc_reactor {
+    pthread_mutex_t lock;
+    httpc_transfer_t *queued;       /* Added, not started yet. Under `lock`. */
+    httpc_transfer_t *active;       /* Only touched by the reactor task */
+    int active_count;
+    int max_active;
+    int ctrl_fd;                    /* Wakes up select() when a transfer is added */
+    struct sockaddr_in ctrl_addr;
+    volatile bool stop;
+    char buf[REACTOR_BUF_SIZE];
+};
+
+static int64_t reactor_now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void set_nonblocking(int fd, bool nonblocking)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+static int transfer_fd(httpc_transfer_t *t)
+{
+    return t->h && t->h->tls ? t->h->tls->sockfd : -1;
+}
+
+/* Whether one of the TCP connects completed, or it is time for the next one */
+static bool transfer_connect_ready(httpc_transfer_t *t, fd_set *write_fds)
+{
+    int fds[HTTPC_CONNECT_MAX_ADDRS], wait_ms;
+    int n = httpc_connect_fds(t->h->connect, fds, HTTPC_CONNECT_MAX_ADDRS, &wait_ms);
+    if (wait_ms == 0) {
+        return true;
+    }
+    for (int i = 0; write_fds && i < n; i++) {
+        if (FD_ISSET(fds[i], write_fds)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void reactor_wake(httpc_reactor_t *r)
+{
+    char c = 0;
+    sendto(r->ctrl_fd, &c, 1, 0, (struct sockaddr *) &r->ctrl_addr, sizeof(r->ctrl_addr));
+}
+
+httpc_reactor_t *httpc_reactor_new(int max_active)
+{
+    httpc_reactor_t *r = calloc(1, sizeof(*r));
+    if (!r) {
+        ESP_LOGE(TAG, "Could not allocate the reactor. Line = %d", __LINE__);
+        return NULL;
+    }
+    r->max_active = max_active > 0 ? max_active : 1;
+    pthread_mutex_init(&r->lock, NULL);
+
+    /* A UDP socket on the loopback, which we send to ourselves to wake up */
+    r->ctrl_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (r->ctrl_fd < 0) {
+        goto error;
+    }
+    socklen_t addr_len = sizeof(r->ctrl_addr);
+    r->ctrl_addr.sin_family = AF_INET;
+    r->ctrl_addr.sin_port = 0;
+    r->ctrl_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(r->ctrl_fd, (struct sockaddr *) &r->ctrl_addr, sizeof(r->ctrl_addr)) != 0 ||
+            getsockname(r->ctrl_fd, (struct sockaddr *) &r->ctrl_addr, &addr_len) != 0) {
+        close(r->ctrl_fd);
+        goto error;
+    }
+    set_nonblocking(r->ctrl_fd, true);
+    return r;
+
+error:
+    ESP_LOGE(TAG, "Could not create the control socket, errno %d", errno);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+    return NULL;
+}
+
+int httpc_reactor_add(httpc_reactor_t *r, const httpc_transfer_cfg_t *cfg)
+{
+    /* Resolved here, by the caller, for the reactor to find the host in the
+     * DNS cache: the lookup would block all its transfers.
+     */
+    struct http_parser_url u;
+    http_parser_url_init(&u);
+    if (http_parser_parse_url(cfg->url, strlen(cfg->url), 0, &u) != 0 || !(u.field_set & (1 << UF_HOST))) {
+        ESP_LOGE(TAG, "Invalid url %s", cfg->url);
+        return -1;
+    }
+    if (httpc_connect_resolve(&cfg->url[u.field_data[UF_HOST].off], u.field_data[UF_HOST].len) != 0) {
+        return -1;
+    }
+
+    httpc_transfer_t *t = calloc(1, sizeof(*t));
+    if (!t) {
+        return -1;
+    }
+    t->cfg = *cfg;
+    t->url = strdup(cfg->url);
+    if (!t->url) {
+        free(t);
+        return -1;
+    }
+    if (cfg->tls_cfg) {
+        t->tls_cfg = *cfg->tls_cfg;
+        /* Connect and handshake without blocking the reactor */
+        t->tls_cfg.non_block = true;
+    }
+    if (cfg->timeout_ms) {
+        t->deadline_us = reactor_now_us() + (int64_t) cfg->timeout_ms * 1000;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    httpc_transfer_t **tail = &r->queued;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = t;
+    pthread_mutex_unlock(&r->lock);
+    reactor_wake(r);
+    return 0;
+}
+
+static void transfer_finish(httpc_reactor_t *r, httpc_transfer_t *t, int err)
+{
+    httpc_transfer_t **p = &r->active;
+    while (*p != t) {
+        p = &(*p)->next;
+    }
+    *p = t->next;
+    r->active_count--;
+
+    httpc_conn_t *h = t->h;
+    if (h && transfer_fd(t) >= 0) {
+        /* Pooled connections are blocking, as http_connection_new() makes them */
+        set_nonblocking(transfer_fd(t), false);
+    }
+    if (t->cfg.on_done) {
+        t->cfg.on_done(h, err, t->cfg.arg);
+    }
+    if (h) {
+        http_request_delete(h);
+        if (err == 0) {
+            http_connection_release(h);
+        } else {
+            http_connection_delete(h);
+        }
+    }
+    free(t->url);
+    free(t);
+}
+
+/* Connected: send the request */
+static int transfer_send(httpc_transfer_t *t)
+{
+    httpc_conn_t *h = t->h;
+    if (http_request_new(h, t->cfg.op, t->url) < 0) {
+        return -1;
+    }
+    if (t->cfg.on_request) {
+        t->cfg.on_request(h, t->cfg.arg);
+    }
+    /* Sent blocking: requests are small, they fit in the socket buffers */
+    set_nonblocking(transfer_fd(t), false);
+    int ret = http_request_send(h, t->cfg.body, t->cfg.body_len);
+    set_nonblocking(transfer_fd(t), true);
+    if (ret < 0) {
+        return -1;
+    }
+    t->state = TRANSFER_RECEIVING;
+    /* The response may well be there already for pooled connections */
+    t->pending = true;
+    return 0;
+}
+
+static void transfer_connect(httpc_reactor_t *r, httpc_transfer_t *t)
+{
+    int ret = http_connection_new_async(t->url, t->cfg.tls_cfg ? &t->tls_cfg : NULL, &t->h);
+    if (ret == 0) {
+        return;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to connect for %s", t->url);
+        transfer_finish(r, t, -1);
+        return;
+    }
+    if (transfer_send(t) < 0) {
+        ESP_LOGE(TAG, "Failed to send the request for %s", t->url);
+        transfer_finish(r, t, -1);
+    }
+}
+
+static void transfer_receive(httpc_reactor_t *r, httpc_transfer_t *t)
+{
+    for (int i = 0; i < REACTOR_READS_PER_TURN; i++) {
+        int len = http_response_recv(t->h, r->buf, sizeof(r->buf));
+        if (len == -EAGAIN) {
+            t->pending = false;
+            return;
+        }
+        if (len <= 0) {
+            transfer_finish(r, t, len);
+            return;
+        }
+        if (t->cfg.on_data && t->cfg.on_data(t->h, r->buf, len, t->cfg.arg) < 0) {
+            transfer_finish(r, t, -ECANCELED);
+            return;
+        }
+    }
+    /* Our turn is over, but there may be more */
+    t->pending = true;
+}
+
+static void reactor_start_queued(httpc_reactor_t *r)
+{
+    while (r->active_count < r->max_active) {
+        pthread_mutex_lock(&r->lock);
+        httpc_transfer_t *t = r->queued;
+        if (t) {
+            r->queued = t->next;
+        }
+        pthread_mutex_unlock(&r->lock);
+        if (!t) {
+            return;
+        }
+        t->next = r->active;
+        r->active = t;
+        r->active_count++;
+        transfer_connect(r, t);
+    }
+}
+
+int httpc_reactor_run_once(httpc_reactor_t *r, int timeout_ms)
+{
+    reactor_start_queued(r);
+
+    fd_set read_fds, write_fds;
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_SET(r->ctrl_fd, &read_fds);
+    int max_fd = r->ctrl_fd;
+    int64_t now = reactor_now_us();
+    int64_t wait_us = (int64_t) timeout_ms * 1000;
+
+    for (httpc_transfer_t *t = r->active; t; t = t->next) {
+        if (t->deadline_us && t->deadline_us - now < wait_us) {
+            wait_us = t->deadline_us > now ? t->deadline_us - now : 0;
+        }
+        if (t->h && t->h->connect) {
+            /* Racing TCP connects to the addresses of the host */
+            int fds[HTTPC_CONNECT_MAX_ADDRS], wait_ms;
+            int n = httpc_connect_fds(t->h->connect, fds, HTTPC_CONNECT_MAX_ADDRS, &wait_ms);
+            for (int i = 0; i < n; i++) {
+                FD_SET(fds[i], &write_fds);
+                if (fds[i] > max_fd) {
+                    max_fd = fds[i];
+                }
+            }
+            if ((int64_t) wait_ms * 1000 < wait_us) {
+                wait_us = (int64_t) wait_ms * 1000;
+            }
+            continue;
+        }
+        int fd = transfer_fd(t);
+        if (t->pending || fd < 0) {
+            wait_us = 0;
+            continue;
+        }
+        if (t->state == TRANSFER_CONNECTING && t->h->tls->conn_state == ESP_TLS_CONNECTING) {
+            FD_SET(fd, &write_fds);
+        } else {
+            /* The TLS handshake, or the response */
+            FD_SET(fd, &read_fds);
+        }
+        if (fd > max_fd) {
+            max_fd = fd;
+        }
+    }
+
+    struct timeval tv = {
+        .tv_sec = wait_us / 1000000,
+        .tv_usec = wait_us % 1000000,
+    };
+    int ret = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+    if (ret < 0 && errno != EINTR) {
+        ESP_LOGE(TAG, "select() failed, errno %d", errno);
+        return -1;
+    }
+    if (ret > 0 && FD_ISSET(r->ctrl_fd, &read_fds)) {
+        char c[16];
+        while (recv(r->ctrl_fd, c, sizeof(c), 0) > 0);
+    }
+
+    now = reactor_now_us();
+    httpc_transfer_t *next;
+    for (httpc_transfer_t *t = r->active; t; t = next) {
+        /* `t` may be finished, and freed, in here */
+        next = t->next;
+        bool ready;
+        if (t->h && t->h->connect) {
+            ready = transfer_connect_ready(t, ret > 0 ? &write_fds : NULL);
+        } else {
+            int fd = transfer_fd(t);
+            ready = t->pending || fd < 0 ||
+                    (ret > 0 && (FD_ISSET(fd, &read_fds) || FD_ISSET(fd, &write_fds)));
+        }
+        if (t->deadline_us && now >= t->deadline_us) {
+            ESP_LOGW(TAG, "Transfer of %s timed out", t->url);
+            transfer_finish(r, t, -ETIMEDOUT);
+        } else if (ready) {
+            if (t->state == TRANSFER_CONNECTING) {
+                transfer_connect(r, t);
+            } else {
+                transfer_receive(r, t);
+            }
+        }
+    }
+    /* Start the ones waiting for those which finished */
+    reactor_start_queued(r);
+
+    pthread_mutex_lock(&r->lock);
+    int left = r->active_count;
+    for (httpc_transfer_t *t = r->queued; t; t = t->next) {
+        left++;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return left;
+}
+
+void httpc_reactor_run(httpc_reactor_t *r)
+{
+    while (!r->stop) {
+        if (httpc_reactor_run_once(r, 1000) < 0) {
+            break;
+        }
+    }
+    r->stop = false;
+}
+
+void httpc_reactor_stop(httpc_reactor_t *r)
+{
+    r->stop = true;
+    reactor_wake(r);
+}
+
+void httpc_reactor_delete(httpc_reactor_t *r)
+{
+    if (!r) {
+        return;
+    }
+    while (r->active) {
+        transfer_finish(r, r->active, -ECANCELED);
+    }
+    /* The queued ones never started: move them over to finish them the same way */
+    pthread_mutex_lock(&r->lock);
+    r->active = r->queued;
+    r->queued = NULL;
+    pthread_mutex_unlock(&r->lock);
+    while (r->active) {
+        r->active_count++;
+        transfer_finish(r, r->active, -ECANCELED);
+    }
+    close(r->ctrl_fd);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
@@ -0,0 +1,121 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _ESP_HTTPC_REACTOR_H_
+#define _ESP_HTTPC_REACTOR_H_
+
+#include <httpc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event driven httpc: one task runs many transfers.
+ *
+ * A transfer is a request and its response. Any task can add transfers to
+ * the reactor; the task running the reactor connects, sends the request and
+ * waits for all the sockets at once with select(), and calls the transfer
+ * callbacks as the response comes in. Connections are taken from, and given
+ * back to, the keep-alive pool.
+ *
+ *     httpc_reactor_t *r = httpc_reactor_new(8);
+ *     xTaskCreate(reactor_task, ...);      // calls httpc_reactor_run(r)
+ *     ...
+ *     httpc_transfer_cfg_t cfg = {
+ *         .op = ESP_HTTP_GET,
+ *         .url = "https://example.com/thumbnail.jpg",
+ *         .tls_cfg = &tls_cfg,
+ *         .on_data = thumbnail_data,
+ *         .on_done = thumbnail_done,
+ *         .arg = ctx,
+ *     };
+ *     httpc_reactor_add(r, &cfg);
+ *
+ * The callbacks run in the reactor task and must not block.
+ *
+ * The TCP connect and the TLS handshake don't block. The host is resolved
+ * by httpc_reactor_add(), in the task adding the transfer, into the DNS cache
+ * of httpc_connect.h where the reactor finds it, if the cache is enabled.
+ * The request is sent in one
+ * go, so large uploads are better done by a task of their own.
+ *
+ * Nothing runs on a reactor yet: the playback and playlist streams still
+ * connect and receive from their own tasks.
+ */
+
+typedef struct httpc_reactor httpc_reactor_t;
+
+typedef struct {
+    httpc_ops_t op;
+    const char *url;                /* Copied */
+    esp_tls_cfg_t *tls_cfg;         /* Copied. For https, NULL for http. */
+    const char *body;               /* Of a POST or PUT, must stay valid until on_done() */
+    size_t body_len;
+    int timeout_ms;                 /* For the whole transfer, 0 for none */
+
+    /* Called once the request was created, before it is sent: set the
+     * headers of interest, the header callback, the offset...
+     */
+    void (*on_request)(httpc_conn_t *h, void *arg);
+    /* Called with the body as it comes in. Return a negative value to abort. */
+    int (*on_data)(httpc_conn_t *h, const char *data, size_t len, void *arg);
+    /**
+     * Called once, when the transfer is over. `err` is 0 when the response
+     * was received in full, else negative: -ETIMEDOUT, -ECANCELED if on_data()
+     * aborted it or the reactor was deleted, or the httpc error. `h` is NULL
+     * if there was no connection; else the response code and headers can be
+     * read from it. It is released to the pool after the call.
+     */
+    void (*on_done)(httpc_conn_t *h, int err, void *arg);
+    void *arg;
+} httpc_transfer_cfg_t;
+
+/**
+ * Create a reactor running up to `max_active` transfers at a time. The others
+ * wait for their turn. Keep it within the sockets lwIP has (LWIP_MAX_SOCKETS).
+ */
+httpc_reactor_t *httpc_reactor_new(int max_active);
+
+/**
+ * Fail the transfers left with -ECANCELED and free the reactor. The reactor
+ * must not be running.
+ */
+void httpc_reactor_delete(httpc_reactor_t *r);
+
+/**
+ * Add a transfer. Can be called from any task, which blocks while the host is
+ * resolved if it isn't in the DNS cache. Returns 0, or -1 if the host
+ * couldn't be resolved or out of memory.
+ */
+int httpc_reactor_add(httpc_reactor_t *r, const httpc_transfer_cfg_t *cfg);
+
+/**
+ * Wait for up to `timeout_ms` for something to happen, and handle it.
+ * Returns the number of transfers left, running or waiting, or -1 if
+ * select() failed.
+ */
+int httpc_reactor_run_once(httpc_reactor_t *r, int timeout_ms);
+
+/* Run the reactor until httpc_reactor_stop() */
+void httpc_reactor_run(httpc_reactor_t *r);
+
+/* Make httpc_reactor_run() return. Can be called from any task. */
+void httpc_reactor_stop(httpc_reactor_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _ESP_HTTPC_REACTOR_H_ */
@@ -0,0 +1,316 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "local_server.h"
+
+typedef struct {
+    local_server_t *server;
+    local_conn_t conn;
+} local_conn_ctx_t;
+
+static void *local_conn_task(void *arg)
+{
+    local_conn_ctx_t *ctx = arg;
+    local_server_t *s = ctx->server;
+    int open = __sync_add_and_fetch(&s->open, 1);
+    /* Good enough for the tests: the peak may miss a concurrent update */
+    if (open > s->open_peak) {
+        s->open_peak = open;
+    }
+    s->handler(&ctx->conn, s->arg);
+    __sync_fetch_and_sub(&s->open, 1);
+    close(ctx->conn.fd);
+    free(ctx);
+    return NULL;
+}
+
+static void *local_accept_task(void *arg)
+{
+    local_server_t *s = arg;
+    while (1) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        local_conn_ctx_t *ctx = calloc(1, sizeof(*ctx));
+        if (!ctx) {
+            close(fd);
+            continue;
+        }
+        ctx->server = s;
+        ctx->conn.fd = fd;
+        __sync_fetch_and_add(&s->connections, 1);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, local_conn_task, ctx) != 0) {
+            close(fd);
+            free(ctx);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int local_server_start(local_server_t *s, local_server_handler_t handler, void *arg)
+{
+    memset(s, 0, sizeof(*s));
+    s->handler = handler;
+    s->arg = arg;
+    /* A client closing on us must not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->listen_fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = 0,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(s->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(s->listen_fd, 64) != 0 ||
+            getsockname(s->listen_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+        close(s->listen_fd);
+        return -1;
+    }
+    s->port = ntohs(addr.sin_port);
+    if (pthread_create(&s->thread, NULL, local_accept_task, s) != 0) {
+        close(s->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void local_server_stop(local_server_t *s)
+{
+    shutdown(s->listen_fd, SHUT_RDWR);
+    close(s->listen_fd);
+    pthread_join(s->thread, NULL);
+}
+
+void local_server_url(local_server_t *s, const char *path, char *url, size_t url_len)
+{
+    snprintf(url, url_len, "http://127.0.0.1:%d%s", s->port, path);
+}
+
+static long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Make sure there are `want` bytes in the buffer. Returns 0 if the client closed first. */
+static int conn_fill(local_conn_t *conn, size_t want)
+{
+    while (conn->len < want) {
+        ssize_t ret = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret;
+        }
+        conn->len += ret;
+        conn->last_recv_us = now_us();
+    }
+    return 1;
+}
+
+static void conn_consume(local_conn_t *conn, size_t len)
+{
+    memmove(conn->buf, conn->buf + len, conn->len - len);
+    conn->len -= len;
+}
+
+/* Returns the length of the line including its CRLF, 0 if closed, -1 if too long */
+static int conn_read_line(local_conn_t *conn)
+{
+    size_t scanned = 0;
+    while (1) {
+        char *crlf = memmem(conn->buf + scanned, conn->len - scanned, "\r\n", 2);
+        if (crlf) {
+            return crlf - conn->buf + 2;
+        }
+        if (conn->len == sizeof(conn->buf)) {
+            return -1;
+        }
+        scanned = conn->len ? conn->len - 1 : 0;
+        int ret = conn_fill(conn, conn->len + 1);
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+}
+
+static int conn_read_body(local_conn_t *conn, local_request_t *req, size_t len)
+{
+    while (len) {
+        if (conn->len == 0 && conn_fill(conn, 1) <= 0) {
+            return -1;
+        }
+        size_t n = conn->len < len ? conn->len : len;
+        for (size_t i = 0; i < n; i++) {
+            req->body_sum += (unsigned char) conn->buf[i];
+        }
+        req->body_len += n;
+        conn_consume(conn, n);
+        len -= n;
+    }
+    return 0;
+}
+
+int local_server_read_request(local_conn_t *conn, local_request_t *req)
+{
+    memset(req, 0, sizeof(*req));
+    size_t content_length = 0;
+
+    /* If it came with the previous one, by then */
+    req->arrival_us = conn->len ? conn->last_recv_us : 0;
+    int len = conn_read_line(conn);
+    if (len <= 0) {
+        return len;
+    }
+    if (!req->arrival_us) {
+        req->arrival_us = conn->last_recv_us;
+    }
+    char fmt[32];
+    snprintf(fmt, sizeof(fmt), "%%%zus %%%zus", sizeof(req->method) - 1, sizeof(req->path) - 1);
+    conn->buf[len - 2] = '\0';
+    if (sscanf(conn->buf, fmt, req->method, req->path) != 2) {
+        return -1;
+    }
+    conn_consume(conn, len);
+
+    while ((len = conn_read_line(conn)) > 2) {
+        conn->buf[len - 2] = '\0';
+        if (strncasecmp(conn->buf, "Content-Length:", 15) == 0) {
+            content_length = strtoul(conn->buf + 15, NULL, 10);
+        } else if (strncasecmp(conn->buf, "Transfer-Encoding:", 18) == 0 && strstr(conn->buf, "chunked")) {
+            req->chunked = true;
+        } else if (strncasecmp(conn->buf, "Accept-Encoding:", 16) == 0) {
+            snprintf(req->accept_encoding, sizeof(req->accept_encoding), "%s", conn->buf + 16);
+        }
+        conn_consume(conn, len);
+    }
+    if (len <= 0) {
+        return -1;
+    }
+    conn_consume(conn, len);
+
+    if (!req->chunked) {
+        return conn_read_body(conn, req, content_length) == 0 ? 1 : -1;
+    }
+    while (1) {
+        len = conn_read_line(conn);
+        if (len <= 0) {
+            return -1;
+        }
+        size_t chunk_len = strtoul(conn->buf, NULL, 16);
+        conn_consume(conn, len);
+        if (chunk_len == 0) {
+            /* No trailers: just the final CRLF */
+            len = conn_read_line(conn);
+            if (len <= 0) {
+                return -1;
+            }
+            conn_consume(conn, len);
+            return 1;
+        }
+        if (conn_read_body(conn, req, chunk_len) != 0 || conn_fill(conn, 2) <= 0) {
+            return -1;
+        }
+        conn_consume(conn, 2);
+    }
+}
+
+void local_server_poll(local_conn_t *conn)
+{
+    if (conn->len == sizeof(conn->buf)) {
+        return;
+    }
+    ssize_t ret = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, MSG_DONTWAIT);
+    if (ret > 0) {
+        conn->len += ret;
+        conn->last_recv_us = now_us();
+    }
+}
+
+int local_server_send(local_conn_t *conn, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len) {
+        ssize_t ret = send(conn->fd, p, len, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+int local_server_sendf(local_conn_t *conn, const char *fmt, ...)
+{
+    char buf[4096];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= sizeof(buf)) {
+        return -1;
+    }
+    return local_server_send(conn, buf, len);
+}
+
+int local_server_send_slow(local_conn_t *conn, const void *data, size_t len, size_t step, unsigned delay_us)
+{
+    const char *p = data;
+    while (len) {
+        size_t n = len < step ? len : step;
+        if (local_server_send(conn, p, n) != 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+        usleep(delay_us);
+    }
+    return 0;
+}
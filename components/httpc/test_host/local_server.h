@@ -0,0 +1,86 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* A minimal in-process HTTP/1.1 server on 127.0.0.1 for the offline tests.
+ *
+ * Every accepted connection is served by its own thread, which calls the
+ * handler once. The handler reads the requests with local_server_read_request()
+ * and writes whatever response the test needs, possibly a broken one.
+ */
+
+#define LOCAL_CONN_BUF_SIZE 8192
+
+typedef struct {
+    int fd;
+    char buf[LOCAL_CONN_BUF_SIZE];
+    size_t len;                 /* Bytes received but not consumed yet */
+    long long last_recv_us;     /* CLOCK_MONOTONIC */
+} local_conn_t;
+
+typedef struct {
+    char method[16];
+    char path[2048];
+    size_t body_len;            /* De-chunked */
+    unsigned long body_sum;     /* Sum of the body bytes */
+    bool chunked;
+    char accept_encoding[64];   /* Empty if there was no Accept-Encoding */
+    long long arrival_us;       /* When its first line was received, CLOCK_MONOTONIC */
+} local_request_t;
+
+typedef void (*local_server_handler_t)(local_conn_t *conn, void *arg);
+
+typedef struct {
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    local_server_handler_t handler;
+    void *arg;
+    volatile int connections;   /* Accepted so far */
+    volatile int open;          /* Being served right now */
+    volatile int open_peak;
+} local_server_t;
+
+/* Listen on an ephemeral port of 127.0.0.1. Returns 0 on success. */
+int local_server_start(local_server_t *s, local_server_handler_t handler, void *arg);
+
+/* Stop accepting. Connections which are still open finish on their own. */
+void local_server_stop(local_server_t *s);
+
+/* Writes the "http://127.0.0.1:<port><path>" URL of the server */
+void local_server_url(local_server_t *s, const char *path, char *url, size_t url_len);
+
+/**
+ * Read one request. The body, if any, is consumed and only its length and
+ * sum are kept. Returns 1 for a request, 0 if the client closed the
+ * connection, -1 on error.
+ */
+int local_server_read_request(local_conn_t *conn, local_request_t *req);
+
+/*
+ * Receive what the client sent, without waiting. For a handler taking its
+ * time, so that the requests sent meanwhile get their arrival time.
+ */
+void local_server_poll(local_conn_t *conn);
+
+int local_server_send(local_conn_t *conn, const void *data, size_t len);
+int local_server_sendf(local_conn_t *conn, const char *fmt, ...);
+
+/* Send `len` bytes, `step` bytes at a time with `delay_us` in between */
+int local_server_send_slow(local_conn_t *conn, const void *data, size_t len, size_t step, unsigned delay_us);
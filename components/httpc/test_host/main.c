@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <httpc.h>
 
@@ -480,6 +481,90 @@ static int test_validate_header_values()
     return 0;
 }
 
+static int test_postman_connection_pool()
+{
+    printf("test: reuse pooled connection to https://postman-echo.com/ ....");
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    httpc_pool_stats_t before, after;
+    http_connection_pool_get_stats(&before);
+
+    httpc_conn_t *first = NULL;
+    for (int i = 0; i < 3; i++) {
+        httpc_conn_t *h = http_connection_new("https://postman-echo.com/get", &tls_cfg);
+        if (!h) {
+            printf("Fail, couldn't open connection\n");
+            return -1;
+        }
+        if (i == 0) {
+            first = h;
+        } else if (h != first) {
+            printf("Fail, connection %d was not taken from the pool\n", i);
+            return -1;
+        }
+        http_request_new(h, ESP_HTTP_GET, "/get");
+        http_request_send(h, NULL, 0);
+        char buf[500];
+        while (http_response_recv(h, buf, sizeof(buf)) > 0);
+        if (validate_status_code(h, 200)) {
+            return -1;
+        }
+        http_request_delete(h);
+        http_connection_release(h);
+    }
+
+    http_connection_pool_get_stats(&after);
+    if (after.misses - before.misses != 1 || after.hits - before.hits != 2 ||
+            after.tls_handshakes_avoided - before.tls_handshakes_avoided != 2) {
+        printf("Fail, hits %u misses %u tls handshakes avoided %u\n", after.hits - before.hits,
+               after.misses - before.misses, after.tls_handshakes_avoided - before.tls_handshakes_avoided);
+        return -1;
+    }
+    http_connection_pool_flush();
+    printf("Success\n");
+    return 0;
+}
+
+/* Download `path` and report the throughput and the CPU time it took, e.g.
+ * against a local `python3 -m http.server` serving a large file.
+ */
+static int bench_func(const char *url, const char *path)
+{
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    struct timespec start, end;
+    clock_t cpu_start = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    httpc_conn_t *h = http_connection_new(url, &tls_cfg);
+    if (!h) {
+        printf("Fail, couldn't open connection\n");
+        return -1;
+    }
+    http_request_new(h, ESP_HTTP_GET, path);
+    http_request_send(h, NULL, 0);
+    static char buf[4096];
+    int data_read;
+    size_t total = 0;
+    while ((data_read = http_response_recv(h, buf, sizeof(buf))) > 0) {
+        total += data_read;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_t cpu_end = clock();
+    http_request_delete(h);
+    http_connection_delete(h);
+    if (data_read < 0) {
+        printf("Fail, error %d after %zu bytes\n", data_read, total);
+        return -1;
+    }
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double cpu_ms = (cpu_end - cpu_start) * 1000.0 / CLOCKS_PER_SEC;
+    double mb = total / (1024.0 * 1024.0);
+    printf("%zu bytes in %.3f s: %.2f MB/s, %.2f ms CPU per MB\n", total, secs, mb / secs, mb ? cpu_ms / mb : 0);
+    return 0;
+}
+
 int main_test_func()
 {
     test_postman_http_get();
@@ -489,6 +574,7 @@ int main_test_func()
     test_postman_send_custom_hdrs();
     test_postman_get_multi_with_header_fetch();
     test_validate_header_values();
+    test_postman_connection_pool();
     return 0;
 }
 
@@ -524,6 +610,7 @@ int main(int argc, char *argv[])
         printf("      %s GET https://postman-echo.com \"/get?a=b&c=d\" <-o out_file> \n", argv[0]);
         printf("      %s POST https://postman-echo.com /post \"a=b&c=d\"\n", argv[0]);
         printf("      %s TEST\n", argv[0]);
+        printf("      %s BENCH http://127.0.0.1:8000 /large_file\n", argv[0]);
         return 0;
     }
 
@@ -534,6 +621,8 @@ int main(int argc, char *argv[])
         op = ESP_HTTP_POST;
     } else if (strcmp(op_str, "TEST") == 0) {
         return main_test_func();
+    } else if (strcmp(op_str, "BENCH") == 0) {
+        return bench_func(url, path);
     }
     esp_tls_cfg_t tls_cfg;
     memset(&tls_cfg, 0, sizeof(tls_cfg));
@@ -12,4 +12,5 @@
 
 #define ESP_LOGD(TAG, ...) //printf(__VA_ARGS__);
 #define ESP_LOGE(TAG, ...) printf(__VA_ARGS__);
+#define ESP_LOGW(TAG, ...) printf(__VA_ARGS__);
 #define ESP_LOGI(TAG, ...) printf(__VA_ARGS__);
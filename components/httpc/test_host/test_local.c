@@ -0,0 +1,2049 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* httpc tests which need no network: the server is a thread of this process,
+ * listening on 127.0.0.1, and it can send the broken, slow or odd responses
+ * which are hard to get out of a public echo server.
+ *
+ *     test_httpc_local              run the tests
+ *     test_httpc_local BENCH [MB]   measure throughput and latency
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <httpc.h>
+#include <httpc_reactor.h>
+#include "local_server.h"
+
+/* Bodies are a pattern: the byte at offset `i` is `i % PATTERN_PERIOD` */
+#define PATTERN_PERIOD 251
+#define PATTERN_BUF_SIZE (PATTERN_PERIOD * 261)
+
+static char pattern[PATTERN_BUF_SIZE];
+static local_server_t server;
+static volatile int requests_served;
+static int failures;
+
+/* Content-Type of /long-headers: longer than MAX_HDR_VAL_LEN */
+static const char *long_content_type =
+    "audio/mpeg; codecs=mp3; rate=44100; channels=2; comment=this-is-longer-than-the-header-buffer";
+
+/* Text served compressed under /encoded/ */
+static char *playlist_doc, *json_doc;
+static size_t playlist_doc_len, json_doc_len;
+
+static void pattern_init(void)
+{
+    for (int i = 0; i < PATTERN_BUF_SIZE; i++) {
+        pattern[i] = i % PATTERN_PERIOD;
+    }
+}
+
+static void docs_init(void)
+{
+    const size_t size = 64 * 1024;
+    playlist_doc = malloc(size);
+    int len = snprintf(playlist_doc, size, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:10\n"
+                       "#EXT-X-MEDIA-SEQUENCE:1000\n");
+    for (int i = 0; i < 600; i++) {
+        len += snprintf(playlist_doc + len, size - len, "#EXTINF:%d.%03d,\n"
+                        "https://cdn.example.com/live/stream_128k/segment-%06d.aac\n",
+                        9 + i % 2, i * 37 % 1000, 1000 + i);
+    }
+    len += snprintf(playlist_doc + len, size - len, "#EXT-X-ENDLIST\n");
+    playlist_doc_len = len;
+
+    /* Directives with ids which don't compress well */
+    json_doc = malloc(size);
+    unsigned id = 12345;
+    len = snprintf(json_doc, size, "{\"directives\":[");
+    for (int i = 0; i < 120; i++) {
+        id = id * 1103515245 + 12345;
+        len += snprintf(json_doc + len, size - len, "%s{\"header\":{\"namespace\":\"SpeechSynthesizer\","
+                        "\"name\":\"Speak\",\"messageId\":\"%08x-%04x\",\"dialogRequestId\":\"%08x\"},"
+                        "\"payload\":{\"url\":\"cid:%d\",\"format\":\"AUDIO_MPEG\","
+                        "\"token\":\"amzn1.as-ct.v1.#%08x\"}}",
+                        i ? "," : "", id, i, id ^ 0x5a5a5a5a, i, id * 31);
+    }
+    len += snprintf(json_doc + len, size - len, "]}");
+    json_doc_len = len;
+}
+
+/* `kind`: gzip, gzip-named (every optional gzip header field), deflate, deflate-raw */
+static unsigned char *compress_doc(const char *doc, size_t doc_len, const char *kind, size_t *out_len)
+{
+    z_stream zs = {0};
+    int wbits = strcmp(kind, "deflate") == 0 ? MAX_WBITS :
+                strcmp(kind, "deflate-raw") == 0 ? -MAX_WBITS : MAX_WBITS + 16;
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    static unsigned char extra[] = "local-server";
+    gz_header gz = {
+        .extra = extra,
+        .extra_len = sizeof(extra),
+        .name = (unsigned char *) "doc.txt",
+        .comment = (unsigned char *) "served by local_server",
+        .hcrc = 1,
+    };
+    if (strcmp(kind, "gzip-named") == 0) {
+        deflateSetHeader(&zs, &gz);
+    }
+    size_t size = deflateBound(&zs, doc_len) + 128;
+    unsigned char *out = malloc(size);
+    zs.next_in = (unsigned char *) doc;
+    zs.avail_in = doc_len;
+    zs.next_out = out;
+    zs.avail_out = size;
+    int ret = deflate(&zs, Z_FINISH);
+    *out_len = size - zs.avail_out;
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/* /encoded/<kind>/<doc>[?<how>]: a document, compressed if the client asked for it */
+static bool send_encoded(local_conn_t *conn, local_request_t *req, const char *path)
+{
+    char kind[16], name[32], how[16] = "";
+    if (sscanf(path, "%15[^/]/%31[^?]?%15s", kind, name, how) < 2) {
+        return local_server_sendf(conn, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n") == 0;
+    }
+    bool playlist = strncmp(name, "playlist", 8) == 0;
+    const char *doc = playlist ? playlist_doc : json_doc;
+    size_t doc_len = playlist ? playlist_doc_len : json_doc_len;
+    const char *type = playlist ? "application/vnd.apple.mpegurl" : "application/json";
+
+    if (!req->accept_encoding[0] || strcmp(kind, "identity") == 0) {
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                           type, doc_len);
+        return local_server_send(conn, doc, doc_len) == 0;
+    }
+    size_t len;
+    unsigned char *z = compress_doc(doc, doc_len, kind, &len);
+    if (!z) {
+        return false;
+    }
+    const char *coding = strncmp(kind, "gzip", 4) == 0 ? "gzip" : "deflate";
+    bool ok;
+    if (strcmp(how, "corrupt") == 0) {
+        /* The gzip CRC, or the zlib Adler-32 */
+        z[strcmp(coding, "gzip") == 0 ? len - 8 : len - 1] ^= 1;
+    } else if (strcmp(how, "truncated") == 0) {
+        len /= 2;
+    }
+    if (strcmp(how, "chunked") == 0) {
+        ok = local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Encoding: %s\r\n"
+                                "Transfer-Encoding: chunked\r\n\r\n", type, coding) == 0;
+        for (size_t offset = 0; ok && offset < len; offset += 333) {
+            size_t n = len - offset < 333 ? len - offset : 333;
+            ok = local_server_sendf(conn, "%zx\r\n", n) == 0 && local_server_send(conn, z + offset, n) == 0 &&
+                 local_server_send(conn, "\r\n", 2) == 0;
+        }
+        ok = ok && local_server_send(conn, "0\r\n\r\n", 5) == 0;
+    } else {
+        /* Content-Encoding last: the last header is only handled once the headers are complete */
+        ok = local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                                "Content-Encoding: %s\r\n\r\n", type, len, coding) == 0;
+        if (strcmp(how, "drip") == 0) {
+            ok = ok && local_server_send_slow(conn, z, len, 97, 50) == 0;
+        } else {
+            ok = ok && local_server_send(conn, z, len) == 0;
+        }
+    }
+    free(z);
+    return ok;
+}
+
+static int send_pattern(local_conn_t *conn, size_t offset, size_t len)
+{
+    while (len) {
+        size_t start = offset % PATTERN_PERIOD;
+        size_t n = PATTERN_BUF_SIZE - start;
+        if (n > len) {
+            n = len;
+        }
+        if (local_server_send(conn, pattern + start, n) != 0) {
+            return -1;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static bool check_pattern(size_t offset, const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if ((unsigned char) buf[i] != (offset + i) % PATTERN_PERIOD) {
+            printf("Body mismatch at offset %zu ....", offset + i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static int send_chunked_pattern(local_conn_t *conn, size_t len, size_t chunk_len)
+{
+    size_t offset = 0;
+    while (offset < len) {
+        size_t n = len - offset < chunk_len ? len - offset : chunk_len;
+        if (local_server_sendf(conn, "%zx\r\n", n) != 0 ||
+                send_pattern(conn, offset, n) != 0 ||
+                local_server_send(conn, "\r\n", 2) != 0) {
+            return -1;
+        }
+        offset += n;
+    }
+    return local_server_send(conn, "0\r\n\r\n", 5);
+}
+
+/* As many headers as a CDN or a streaming server sends: 45 */
+static int send_many_headers(local_conn_t *conn)
+{
+    char cookie[201];
+    memset(cookie, 'c', sizeof(cookie) - 1);
+    cookie[sizeof(cookie) - 1] = '\0';
+    char *resp = malloc(8192);
+    int len = snprintf(resp, 8192, "HTTP/1.1 200 OK\r\n"
+                       "Date: Fri, 16 Oct 2026 10:00:00 GMT\r\n"
+                       "Server: local_server\r\n"
+                       "Content-Type: audio/mpeg\r\n"
+                       "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+                       "Set-Cookie: session=%s\r\n"
+                       "icy-metaint: 16000\r\n"
+                       "icy-br: 128\r\n"
+                       "icy-name: Local test stream\r\n", cookie);
+    for (int i = 0; i < 36; i++) {
+        len += snprintf(resp + len, 8192 - len, "X-Edge-Header-%02d: value-%d-abcdefghijklmnopqrstuvwxyz\r\n", i, i);
+    }
+    len += snprintf(resp + len, 8192 - len, "Content-Length: 2\r\n\r\nok");
+    int ret = local_server_send(conn, resp, len);
+    free(resp);
+    return ret;
+}
+
+/* Serve one request. Returns false to close the connection. */
+static bool route(local_conn_t *conn, local_request_t *req)
+{
+    const char *path = req->path;
+    char url[64];
+    local_server_url(&server, "", url, sizeof(url));
+
+    if (strcmp(path, "/hello") == 0 || strncmp(path, "/hello?", 7) == 0) {
+        return local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                                  "Content-Length: 13\r\n\r\nHello, world!") == 0;
+    } else if (strcmp(path, "/small") == 0) {
+        return local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok") == 0;
+    } else if (strcmp(path, "/hello-then-close") == 0) {
+        /* Looks like keep-alive, but the server goes away */
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nHello, world!");
+        return false;
+    } else if (strcmp(path, "/hello-close") == 0) {
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 13\r\n\r\nHello, world!");
+        return false;
+    } else if (strncmp(path, "/rtt/", 5) == 0) {
+        /* /rtt/<ms>/<path>: <path>, answered <ms> after the request came, as if that far */
+        char *rest = strchr(path + 5, '/');
+        if (rest) {
+            long long at = req->arrival_us + strtoul(path + 5, NULL, 10) * 1000;
+            while (1) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                long long now = (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+                if (now >= at) {
+                    break;
+                }
+                /* The requests sent ahead arrive meanwhile */
+                local_server_poll(conn);
+                usleep(at - now < 1000 ? at - now : 1000);
+            }
+            memmove(req->path, rest, strlen(rest) + 1);
+            return route(conn, req);
+        }
+    } else if (strcmp(path, "/chunked") == 0) {
+        static const size_t sizes[] = {1, 2, 15, 16, 17, 255, 256, 4095, 4096, 10000};
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+        size_t offset = 0;
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            local_server_sendf(conn, "%zx\r\n", sizes[i]);
+            send_pattern(conn, offset, sizes[i]);
+            local_server_send(conn, "\r\n", 2);
+            offset += sizes[i];
+        }
+        return local_server_send(conn, "0\r\n\r\n", 5) == 0;
+    } else if (strcmp(path, "/long-headers") == 0) {
+        char name[81], value[301], filler[61];
+        memset(name, 'n', sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        memset(value, 'v', sizeof(value) - 1);
+        value[sizeof(value) - 1] = '\0';
+        memset(filler, 'f', sizeof(filler) - 1);
+        filler[sizeof(filler) - 1] = '\0';
+
+        /* Everything in one write, so that the start of the body comes along with the headers */
+        char *resp = malloc(4096);
+        int len = snprintf(resp, 4096, "HTTP/1.1 200 OK\r\nX-%s: short\r\nX-Long-Value: %s\r\nContent-Type: %s\r\n",
+                           name, value, long_content_type);
+        for (int i = 0; i < 30; i++) {
+            len += snprintf(resp + len, 4096 - len, "X-Filler-%d: %s\r\n", i, filler);
+        }
+        len += snprintf(resp + len, 4096 - len, "Content-Length: 300\r\n\r\n");
+        memcpy(resp + len, pattern, 300);
+        int ret = local_server_send(conn, resp, len + 300);
+        free(resp);
+        return ret == 0;
+    } else if (strcmp(path, "/close-delimited") == 0) {
+        /* No length: the body ends with the connection */
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+        send_pattern(conn, 0, 5000);
+        return false;
+    } else if (strcmp(path, "/drip") == 0) {
+        char head[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n7d0\r\n";
+        local_server_send_slow(conn, head, strlen(head), 3, 200);
+        local_server_send_slow(conn, pattern, 2000, 3, 200);
+        return local_server_send_slow(conn, "\r\n0\r\n\r\n", 7, 1, 200) == 0;
+    } else if (strcmp(path, "/stall") == 0) {
+        sleep(1);
+        return false;
+    } else if (strcmp(path, "/drip-cl") == 0) {
+        char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 2000\r\n\r\n";
+        local_server_send_slow(conn, head, strlen(head), 1, 200);
+        return local_server_send_slow(conn, pattern, 2000, 5, 200) == 0;
+    } else if (strcmp(path, "/abort-headers") == 0) {
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Le");
+        return false;
+    } else if (strcmp(path, "/abort-nothing") == 0) {
+        return false;
+    } else if (strcmp(path, "/abort-body") == 0) {
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\n\r\n");
+        send_pattern(conn, 0, 500);
+        return false;
+    } else if (strcmp(path, "/abort-chunk") == 0) {
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3e8\r\n");
+        send_pattern(conn, 0, 500);
+        return false;
+    } else if (strcmp(path, "/redirect") == 0) {
+        return local_server_sendf(conn, "HTTP/1.1 302 Found\r\nLocation: %s/hello\r\n"
+                                  "Content-Length: 0\r\n\r\n", url) == 0;
+    } else if (strcmp(path, "/redirect-long") == 0) {
+        /* Dripped, so that the location arrives in many pieces */
+        char head[2048];
+        int len = snprintf(head, sizeof(head), "HTTP/1.1 301 Moved Permanently\r\nLocation: %s/hello?pad=", url);
+        memset(head + len, 'p', 1500);
+        len += 1500;
+        len += snprintf(head + len, sizeof(head) - len, "\r\nContent-Length: 0\r\n\r\n");
+        return local_server_send_slow(conn, head, len, 7, 50) == 0;
+    } else if (strncmp(path, "/large/", 7) == 0) {
+        size_t len = strtoul(path + 7, NULL, 10);
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", len);
+        return send_pattern(conn, 0, len) == 0;
+    } else if (strncmp(path, "/large-chunked/", 15) == 0) {
+        size_t len = strtoul(path + 15, NULL, 10);
+        local_server_sendf(conn, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+        return send_chunked_pattern(conn, len, 16384) == 0;
+    } else if (strcmp(path, "/many-headers") == 0) {
+        return send_many_headers(conn) == 0;
+    } else if (strncmp(path, "/encoded/", 9) == 0) {
+        return send_encoded(conn, req, path + 9);
+    } else if (strcmp(path, "/upload") == 0) {
+        char body[64];
+        int len = snprintf(body, sizeof(body), "%zu %lu", req->body_len, req->body_sum);
+        return local_server_sendf(conn, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s", len, body) == 0;
+    }
+    return local_server_sendf(conn, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n") == 0;
+}
+
+static void handler(local_conn_t *conn, void *arg)
+{
+    local_request_t *req = malloc(sizeof(*req));
+    while (local_server_read_request(conn, req) == 1) {
+        __sync_fetch_and_add(&requests_served, 1);
+        if (!route(conn, req)) {
+            break;
+        }
+    }
+    free(req);
+}
+
+static void url_for(const char *path, char *url, size_t url_len)
+{
+    local_server_url(&server, path, url, url_len);
+}
+
+static httpc_conn_t *connect_local(void)
+{
+    char url[64];
+    url_for("", url, sizeof(url));
+    return http_connection_new(url, NULL);
+}
+
+static int check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("Fail\n");
+        printf("Expected %s\n", what);
+        failures++;
+        return -1;
+    }
+    return 0;
+}
+
+static int send_get(httpc_conn_t *h, const char *path)
+{
+    if (http_request_new(h, ESP_HTTP_GET, path) != 0) {
+        return -1;
+    }
+    return http_request_send(h, NULL, 0);
+}
+
+/* Read the whole body with `buf_len` sized reads. Returns its length, or the error. */
+static long recv_all(httpc_conn_t *h, char *buf, size_t buf_len, bool check_body)
+{
+    long total = 0;
+    int ret;
+    while ((ret = http_response_recv(h, buf, buf_len)) > 0) {
+        if (ret > buf_len) {
+            printf("Read %d bytes into a %zu byte buffer ....", ret, buf_len);
+            return -1;
+        }
+        if (check_body && !check_pattern(total, buf, ret)) {
+            return -1;
+        }
+        total += ret;
+    }
+    return ret < 0 ? ret : total;
+}
+
+static void test_content_length(void)
+{
+    printf("test: GET with a content length ....");
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    char buf[64];
+    send_get(h, "/hello");
+    long len = recv_all(h, buf, sizeof(buf), false);
+    if (check(http_response_get_code(h) == 200, "status 200") ||
+            check(len == 13 && memcmp(buf, "Hello, world!", 13) == 0, "\"Hello, world!\"") ||
+            check(strcmp(http_response_get_content_type(h), "text/plain") == 0, "text/plain") ||
+            check(http_response_get_content_len(h) == 13, "content length 13")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+static void test_chunked(void)
+{
+    static const size_t buf_lens[] = {1, 7, 50, 4096, 65536};
+    for (int i = 0; i < sizeof(buf_lens) / sizeof(buf_lens[0]); i++) {
+        printf("test: chunked response, %zu byte reads ....", buf_lens[i]);
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        char *buf = malloc(buf_lens[i]);
+        send_get(h, "/chunked");
+        long len = recv_all(h, buf, buf_lens[i], true);
+        if (check(len == 18753, "18753 bytes") == 0) {
+            printf("Success\n");
+        }
+        free(buf);
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+}
+
+typedef struct {
+    int count;
+    size_t max_hdr_len;
+    size_t max_val_len;
+    bool long_name_seen;
+    bool long_value_seen;
+} hdr_stats_t;
+
+static void hdr_cb(const char *hdr, const char *val, void *arg)
+{
+    hdr_stats_t *stats = arg;
+    stats->count++;
+    if (strlen(hdr) > stats->max_hdr_len) {
+        stats->max_hdr_len = strlen(hdr);
+    }
+    if (strlen(val) > stats->max_val_len) {
+        stats->max_val_len = strlen(val);
+    }
+    if (strncmp(hdr, "X-nnnnnnnn", 10) == 0 && strcmp(val, "short") == 0) {
+        stats->long_name_seen = true;
+    }
+    if (strcmp(hdr, "X-Long-Value") == 0 && strncmp(val, "vvvvvvvv", 8) == 0 && strspn(val, "v") == strlen(val)) {
+        stats->long_value_seen = true;
+    }
+}
+
+static void test_long_headers(void)
+{
+    for (int fetch = 0; fetch < 2; fetch++) {
+        printf("test: headers longer than the buffers%s ....", fetch ? ", http_header_fetch()" : "");
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        hdr_stats_t stats = {0};
+        http_request_new(h, ESP_HTTP_GET, "/long-headers");
+        http_response_set_header_cb(h, hdr_cb, &stats);
+        http_request_send(h, NULL, 0);
+        if (fetch && check(http_header_fetch(h) == 0, "http_header_fetch() to succeed")) {
+            goto next;
+        }
+        /* Smaller reads than what is left over from the header fetch */
+        char buf[7];
+        long len = recv_all(h, buf, sizeof(buf), true);
+        const char *ct = http_response_get_content_type(h);
+        if (check(len == 300, "300 bytes of body") ||
+                check(stats.count == 34, "34 headers") ||
+                check(stats.max_hdr_len < MAX_HDR_VAL_LEN && stats.max_val_len < MAX_HDR_VAL_LEN,
+                      "truncated headers") ||
+                check(stats.long_name_seen && stats.long_value_seen, "the long header and value") ||
+                check(strlen(ct) > 0 && strncmp(ct, long_content_type, strlen(ct)) == 0,
+                      "a truncated content type")) {
+            goto next;
+        }
+        printf("Success\n");
+next:
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+}
+
+static void test_keep_alive(void)
+{
+    printf("test: keep-alive, requests on one connection ....");
+    int conns = server.connections;
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    char buf[64];
+    for (int i = 0; i < 5; i++) {
+        send_get(h, "/hello");
+        long len = recv_all(h, buf, sizeof(buf), false);
+        http_request_delete(h);
+        if (check(len == 13 && memcmp(buf, "Hello, world!", 13) == 0, "\"Hello, world!\"")) {
+            http_connection_delete(h);
+            return;
+        }
+    }
+    /* The rest of a partly read response is flushed by the next request */
+    for (int fetch = 0; fetch < 2; fetch++) {
+        send_get(h, fetch ? "/long-headers" : "/large/100000");
+        if (fetch) {
+            http_header_fetch(h);
+        }
+        http_response_recv(h, buf, 10);
+        http_request_delete(h);
+        send_get(h, "/hello");
+        long len = recv_all(h, buf, sizeof(buf), false);
+        http_request_delete(h);
+        if (check(len == 13 && memcmp(buf, "Hello, world!", 13) == 0, "\"Hello, world!\" after a partial read")) {
+            http_connection_delete(h);
+            return;
+        }
+    }
+    if (check(server.connections == conns + 1, "a single connection")) {
+        http_connection_delete(h);
+        return;
+    }
+    printf("Success\n");
+
+    printf("test: keep-alive, pooled connection ....");
+    httpc_pool_stats_t before, after;
+    http_connection_pool_get_stats(&before);
+    http_connection_release(h);
+    httpc_conn_t *h2 = connect_local();
+    http_connection_pool_get_stats(&after);
+    if (check(h2 == h, "the released connection back") ||
+            check(after.hits == before.hits + 1, "a pool hit") ||
+            check(server.connections == conns + 1, "no new connection")) {
+        http_connection_delete(h2);
+        return;
+    }
+    /* Not kept: the server said it closes */
+    send_get(h2, "/close-delimited");
+    long len = recv_all(h2, buf, sizeof(buf), true);
+    http_request_delete(h2);
+    http_connection_release(h2);
+    http_connection_pool_get_stats(&after);
+    if (check(len == 5000, "5000 bytes up to the close") ||
+            check(after.idle == before.idle, "the closed connection not pooled")) {
+        return;
+    }
+    printf("Success\n");
+
+    printf("test: keep-alive, pooled connection socket options reset ....");
+    h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    /* The way a stream polls its connection */
+    struct timeval tv = {
+        .tv_sec = 0,
+        .tv_usec = 500 * 1000,
+    };
+    int fd = http_connection_get_sockfd(h);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    http_connection_release(h);
+    h2 = connect_local();
+    struct timeval rcv_tv = {1}, snd_tv = {1};
+    socklen_t tv_len = sizeof(tv);
+    getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv_tv, &tv_len);
+    getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd_tv, &tv_len);
+    if (check(h2 == h, "the released connection back") ||
+            check(!(fcntl(fd, F_GETFL, 0) & O_NONBLOCK), "a blocking socket") ||
+            check(rcv_tv.tv_sec == 0 && rcv_tv.tv_usec == 0 && snd_tv.tv_sec == 0 && snd_tv.tv_usec == 0,
+                  "no timeouts, as for a new connection")) {
+        http_connection_delete(h2);
+        return;
+    }
+    /* Still usable, blocking */
+    send_get(h2, "/drip");
+    len = recv_all(h2, buf, sizeof(buf), false);
+    http_request_delete(h2);
+    if (check(len == 2000, "2000 bytes")) {
+        http_connection_delete(h2);
+        return;
+    }
+    http_connection_release(h2);
+    char url[64];
+    url_for("", url, sizeof(url));
+    esp_tls_cfg_t cfg = {
+        .timeout_ms = 1500,
+    };
+    h2 = http_connection_new(url, &cfg);
+    getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv_tv, &tv_len);
+    bool reused = h2 == h;
+    http_connection_delete(h2);
+    if (check(reused, "the released connection back") ||
+            check(rcv_tv.tv_sec == 1 && rcv_tv.tv_usec == 500 * 1000, "the timeout of the new tls_cfg")) {
+        return;
+    }
+    printf("Success\n");
+
+    printf("test: keep-alive, server closed the pooled connection ....");
+    h = connect_local();
+    send_get(h, "/hello-then-close");
+    recv_all(h, buf, sizeof(buf), false);
+    http_request_delete(h);
+    http_connection_release(h);
+    http_connection_pool_get_stats(&before);
+    /* Let the FIN arrive */
+    usleep(50 * 1000);
+    conns = server.connections;
+    h = connect_local();
+    http_connection_pool_get_stats(&after);
+    /* The server counts the connection once it accepted it */
+    for (int i = 0; i < 100 && h && server.connections == conns; i++) {
+        usleep(10 * 1000);
+    }
+    if (check(h != NULL, "a connection") ||
+            check(after.stale == before.stale + 1, "the stale connection dropped") ||
+            check(server.connections == conns + 1, "a new connection")) {
+        if (h) {
+            http_connection_delete(h);
+        }
+        return;
+    }
+    http_connection_delete(h);
+    printf("Success\n");
+}
+
+static void test_slow_drip(void)
+{
+    static const char *paths[] = {"/drip", "/drip-cl"};
+    for (int i = 0; i < 2; i++) {
+        printf("test: slow drip %s ....", paths[i]);
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        char buf[512];
+        send_get(h, paths[i]);
+        long len = recv_all(h, buf, sizeof(buf), true);
+        if (check(http_response_get_code(h) == 200, "status 200") == 0 &&
+                check(len == 2000, "2000 bytes") == 0) {
+            printf("Success\n");
+        }
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+}
+
+static void test_abrupt_close(void)
+{
+    static const char *paths[] = {"/abort-nothing", "/abort-headers", "/abort-body", "/abort-chunk"};
+    for (int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        for (int fetch = 0; fetch < 2; fetch++) {
+            printf("test: abrupt close %s%s ....", paths[i], fetch ? ", http_header_fetch()" : "");
+            httpc_conn_t *h = connect_local();
+            if (check(h != NULL, "a connection")) {
+                return;
+            }
+            char buf[100];
+            send_get(h, paths[i]);
+            int ret = fetch ? http_header_fetch(h) : 0;
+            long len = ret < 0 ? ret : recv_all(h, buf, sizeof(buf), true);
+            http_request_delete(h);
+
+            httpc_pool_stats_t before, after;
+            http_connection_pool_get_stats(&before);
+            http_connection_release(h);
+            http_connection_pool_get_stats(&after);
+            if (check(len < 0, "an error") == 0 &&
+                    check(after.idle == before.idle, "the broken connection not pooled") == 0) {
+                printf("Success\n");
+            }
+        }
+    }
+}
+
+static void test_redirect(void)
+{
+    static const char *paths[] = {"/redirect", "/redirect-long"};
+    for (int i = 0; i < 2; i++) {
+        printf("test: redirect %s ....", paths[i]);
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        char buf[64], expected[2048];
+        int n = snprintf(expected, sizeof(expected), "http://127.0.0.1:%d/hello", server.port);
+        if (i == 1) {
+            n += snprintf(expected + n, sizeof(expected) - n, "?pad=");
+            memset(expected + n, 'p', 1500);
+            expected[n + 1500] = '\0';
+        }
+        send_get(h, paths[i]);
+        long len = recv_all(h, buf, sizeof(buf), false);
+        const char *location = http_response_get_redirect_location(h);
+        if (check(len == 0, "no body") ||
+                check(http_response_get_code(h) == (i ? 301 : 302), "a redirect") ||
+                check(location && strcmp(location, expected) == 0, "the location")) {
+            goto next;
+        }
+        /* Follow it, on the same connection */
+        char *next_url = strdup(location);
+        http_request_delete(h);
+        if (check(!http_connection_new_needed(h, next_url), "the same host")) {
+            free(next_url);
+            goto next;
+        }
+        send_get(h, next_url);
+        free(next_url);
+        len = recv_all(h, buf, sizeof(buf), false);
+        if (check(http_response_get_code(h) == 200, "status 200") == 0 &&
+                check(len == 13 && memcmp(buf, "Hello, world!", 13) == 0, "\"Hello, world!\"") == 0) {
+            printf("Success\n");
+        }
+next:
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+}
+
+static void test_large_body(void)
+{
+    static const char *paths[] = {"/large/8388608", "/large-chunked/8388608"};
+    static const size_t buf_lens[] = {4096, 1000};
+    for (int i = 0; i < 2; i++) {
+        printf("test: large body %s ....", paths[i]);
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        char *buf = malloc(buf_lens[i]);
+        send_get(h, paths[i]);
+        long len = recv_all(h, buf, buf_lens[i], true);
+        if (check(len == 8388608, "8 MB") == 0) {
+            printf("Success\n");
+        }
+        free(buf);
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+}
+
+typedef struct {
+    int count;
+    bool others;        /* Called for a header not of interest */
+} interest_stats_t;
+
+static void interest_cb(const char *hdr, const char *val, void *arg)
+{
+    interest_stats_t *stats = arg;
+    stats->count++;
+    if (strcasecmp(hdr, "Content-Type") && strcasecmp(hdr, "icy-metaint") && strcasecmp(hdr, "Set-Cookie")) {
+        stats->others = true;
+    }
+}
+
+static void test_header_interest(void)
+{
+    static const char *names[] = {"ICY-METAINT", "Set-Cookie", "X-Not-There", "content-type"};
+    for (int fetch = 0; fetch < 2; fetch++) {
+        printf("test: headers of interest%s ....", fetch ? ", http_header_fetch()" : "");
+        httpc_conn_t *h = connect_local();
+        if (check(h != NULL, "a connection")) {
+            return;
+        }
+        interest_stats_t stats = {0};
+        http_request_new(h, ESP_HTTP_GET, "/many-headers");
+        if (check(http_response_set_header_interest(h, names, 4) == 0, "the headers of interest set")) {
+            goto next;
+        }
+        http_response_set_header_cb(h, interest_cb, &stats);
+        http_request_send(h, NULL, 0);
+        if (fetch) {
+            http_header_fetch(h);
+        }
+        /* Small reads, so that names and values arrive in pieces */
+        char buf[7];
+        long len = recv_all(h, buf, sizeof(buf), false);
+        const char *metaint = http_response_get_header(h, "icy-metaint");
+        const char *cookie = http_response_get_header(h, "set-cookie");
+        if (check(len == 2, "the body") ||
+                check(stats.count == 3 && !stats.others, "the callback for the headers of interest only") ||
+                check(metaint && strcmp(metaint, "16000") == 0, "icy-metaint: 16000") ||
+                check(cookie && strlen(cookie) == 208 && strncmp(cookie, "session=ccc", 11) == 0,
+                      "the whole cookie") ||
+                check(!http_response_get_header(h, "X-Not-There") && !http_response_get_header(h, "Server"),
+                      "no other headers") ||
+                check(strcmp(http_response_get_content_type(h), "audio/mpeg") == 0, "audio/mpeg")) {
+            goto next;
+        }
+        printf("Success\n");
+next:
+        http_request_delete(h);
+        http_connection_delete(h);
+    }
+
+    printf("test: headers of interest, too many ....");
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    static const char *too_many[] = {"a", "b", "c", "d", "e", "f", "g"};
+    http_request_new(h, ESP_HTTP_GET, "/hello");
+    if (check(http_response_set_header_interest(h, too_many, 7) < 0, "an error")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: headers of interest, long redirect ....");
+    char buf[64], expected[2048];
+    int n = snprintf(expected, sizeof(expected), "http://127.0.0.1:%d/hello?pad=", server.port);
+    memset(expected + n, 'p', 1500);
+    expected[n + 1500] = '\0';
+    http_request_delete(h);
+    http_request_new(h, ESP_HTTP_GET, "/redirect-long");
+    http_response_set_header_interest(h, NULL, 0);
+    http_request_send(h, NULL, 0);
+    recv_all(h, buf, sizeof(buf), false);
+    const char *location = http_response_get_redirect_location(h);
+    if (check(http_response_get_code(h) == 301, "a redirect") ||
+            check(location && strcmp(location, expected) == 0, "the location")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+typedef struct {
+    const char *path;
+    long expected_len;      /* -1 if it should fail */
+    int timeout_ms;
+    bool check_body;
+    /* Results */
+    long len;
+    int err;
+    int code;
+    bool done;
+    bool body_bad;
+} reactor_job_t;
+
+static volatile int reactor_jobs_done;
+
+static int reactor_on_data(httpc_conn_t *h, const char *data, size_t len, void *arg)
+{
+    reactor_job_t *job = arg;
+    for (size_t i = 0; job->check_body && i < len; i++) {
+        if ((unsigned char) data[i] != (job->len + i) % PATTERN_PERIOD) {
+            job->body_bad = true;
+        }
+    }
+    job->len += len;
+    return 0;
+}
+
+static void reactor_on_done(httpc_conn_t *h, int err, void *arg)
+{
+    reactor_job_t *job = arg;
+    job->err = err;
+    job->code = h ? http_response_get_code(h) : 0;
+    job->done = true;
+    __sync_fetch_and_add(&reactor_jobs_done, 1);
+}
+
+static void *reactor_task(void *arg)
+{
+    httpc_reactor_run(arg);
+    return NULL;
+}
+
+static int reactor_add_job(httpc_reactor_t *r, reactor_job_t *job)
+{
+    char url[128];
+    if (strncmp(job->path, "http://", 7) == 0) {
+        snprintf(url, sizeof(url), "%s", job->path);
+    } else {
+        url_for(job->path, url, sizeof(url));
+    }
+    httpc_transfer_cfg_t cfg = {
+        .op = ESP_HTTP_GET,
+        .url = url,
+        .timeout_ms = job->timeout_ms,
+        .on_data = reactor_on_data,
+        .on_done = reactor_on_done,
+        .arg = job,
+    };
+    return httpc_reactor_add(r, &cfg);
+}
+
+static bool reactor_job_ok(reactor_job_t *job)
+{
+    if (!job->done) {
+        printf("%s not done ....", job->path);
+        return false;
+    }
+    if (job->expected_len < 0) {
+        if (job->err == 0 || (job->timeout_ms && job->err != -ETIMEDOUT)) {
+            printf("%s didn't fail as expected: %d ....", job->path, job->err);
+            return false;
+        }
+        return true;
+    }
+    if (job->err || job->code != 200 || job->len != job->expected_len || job->body_bad) {
+        printf("%s: err %d, status %d, %ld bytes%s ....", job->path, job->err, job->code, job->len,
+               job->body_bad ? ", body mismatch" : "");
+        return false;
+    }
+    return true;
+}
+
+static void test_reactor(void)
+{
+    reactor_job_t jobs[22] = {
+        [0 ... 9] = {"/drip", 2000, 0, true},
+        [10 ... 14] = {"/large/1048576", 1048576, 0, true},
+        [15 ... 16] = {"/chunked", 18753, 0, true},
+        [17] = {"/many-headers", 2},
+        [18] = {"/large-chunked/524288", 524288, 0, true},
+        [19] = {"/hello", 13},
+        /* And two which fail */
+        [20] = {"/abort-body", -1},
+        [21] = {"/stall", -1, 300},
+    };
+    const int count = sizeof(jobs) / sizeof(jobs[0]);
+
+    printf("test: reactor, 20 transfers at once in one thread ....");
+    /* The idle connections of the pool are open at the server too */
+    http_connection_pool_flush();
+    usleep(50 * 1000);
+    server.open_peak = server.open;
+    httpc_reactor_t *r = httpc_reactor_new(32);
+    if (check(r != NULL, "a reactor")) {
+        return;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, reactor_task, r);
+    reactor_jobs_done = 0;
+    for (int i = 0; i < count; i++) {
+        reactor_add_job(r, &jobs[i]);
+    }
+    for (int i = 0; i < 3000 && reactor_jobs_done < count; i++) {
+        usleep(10 * 1000);
+    }
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = reactor_job_ok(&jobs[i]) && ok;
+    }
+    if (check(ok, "all the transfers done") ||
+            check(server.open_peak >= 15, "the transfers to run at the same time")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: reactor, pooled connections ....");
+    httpc_pool_stats_t before, after;
+    http_connection_pool_get_stats(&before);
+    reactor_job_t again[4] = {
+        [0 ... 3] = {"/hello", 13},
+    };
+    reactor_jobs_done = 0;
+    for (int i = 0; i < 4; i++) {
+        reactor_add_job(r, &again[i]);
+    }
+    for (int i = 0; i < 3000 && reactor_jobs_done < 4; i++) {
+        usleep(10 * 1000);
+    }
+    http_connection_pool_get_stats(&after);
+    for (int i = 0; i < 4; i++) {
+        ok = reactor_job_ok(&again[i]) && ok;
+    }
+    if (check(ok, "all the transfers done") ||
+            check(after.hits > before.hits, "pooled connections used")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    httpc_reactor_stop(r);
+    pthread_join(thread, NULL);
+    httpc_reactor_delete(r);
+}
+
+static void test_upload(void)
+{
+    printf("test: chunked upload ....");
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    char buf[64], expected[64];
+    size_t offset = 0;
+    unsigned long sum = 0;
+    http_request_new(h, ESP_HTTP_POST, "/upload");
+    http_request_send_custom_hdr(h, "Host: 127.0.0.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (size_t n = 1; n <= 32768; n *= 2) {
+        if (check(http_send_chunk(h, pattern + offset % PATTERN_PERIOD, n) == 0, "http_send_chunk() to succeed")) {
+            goto out;
+        }
+        for (size_t i = 0; i < n; i++) {
+            sum += (offset + i) % PATTERN_PERIOD;
+        }
+        offset += n;
+    }
+    http_send_last_chunk(h);
+    long len = recv_all(h, buf, sizeof(buf) - 1, false);
+    snprintf(expected, sizeof(expected), "%zu %lu", offset, sum);
+    if (check(len > 0 && strncmp(buf, expected, len) == 0 && len == strlen(expected), expected)) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: upload with a content length ....");
+    http_request_delete(h);
+    http_request_new(h, ESP_HTTP_POST, "/upload");
+    http_request_send(h, "a=b&c=d", 7);
+    len = recv_all(h, buf, sizeof(buf) - 1, false);
+    if (check(len > 0 && strncmp(buf, "7 554", len) == 0 && len == 5, "\"7 554\"")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+/* Expect `expected` writes since `before`, for `what` */
+static int check_writes(httpc_conn_t *h, const httpc_write_stats_t *before, uint32_t expected, const char *what)
+{
+    httpc_write_stats_t after;
+    http_connection_get_write_stats(h, &after);
+    if (after.writes - before->writes != expected) {
+        printf("%u writes ....", (unsigned) (after.writes - before->writes));
+        return check(false, what);
+    }
+    return 0;
+}
+
+static void test_write_coalescing(void)
+{
+    printf("test: request in one write ....");
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    char buf[64], expected[64];
+    httpc_write_stats_t before;
+    http_connection_get_write_stats(h, &before);
+    send_get(h, "/hello");
+    long len = recv_all(h, buf, sizeof(buf), false);
+    http_request_delete(h);
+    if (check(len == 13, "\"Hello, world!\"") || check_writes(h, &before, 1, "1 write for a GET")) {
+        goto out;
+    }
+    http_connection_get_write_stats(h, &before);
+    http_request_new(h, ESP_HTTP_POST, "/upload");
+    http_request_send(h, "a=b&c=d", 7);
+    len = recv_all(h, buf, sizeof(buf) - 1, false);
+    http_request_delete(h);
+    if (check(len == 5 && strncmp(buf, "7 554", 5) == 0, "\"7 554\"") ||
+            check_writes(h, &before, 1, "1 write for a POST with a small body")) {
+        goto out;
+    }
+    /* The custom headers wait for the response to be read */
+    http_connection_get_write_stats(h, &before);
+    http_request_new(h, ESP_HTTP_GET, "/hello");
+    http_request_send_custom_hdr(h, "Host: 127.0.0.1\r\n\r\n");
+    len = recv_all(h, buf, sizeof(buf), false);
+    http_request_delete(h);
+    if (check(len == 13, "\"Hello, world!\" after custom headers") ||
+            check_writes(h, &before, 1, "1 write for custom headers")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: chunked upload, one write per chunk ....");
+    http_connection_get_write_stats(h, &before);
+    http_request_new(h, ESP_HTTP_POST, "/upload");
+    http_request_send_custom_hdr(h, "Host: 127.0.0.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    unsigned long sum = 0;
+    for (int i = 0; i < 4; i++) {
+        http_send_chunk(h, pattern, 100);
+        if (check_writes(h, &before, i + 1, "the headers and chunks to go out with the chunks")) {
+            goto out;
+        }
+    }
+    for (size_t i = 0; i < 100; i++) {
+        sum += 4 * (i % PATTERN_PERIOD);
+    }
+    /* Larger than the buffer: the framing goes with the start of the data */
+    http_send_chunk(h, pattern, 8000);
+    for (size_t i = 0; i < 8000; i++) {
+        sum += i % PATTERN_PERIOD;
+    }
+    if (check_writes(h, &before, 4 + 2, "2 writes for a large chunk")) {
+        goto out;
+    }
+    http_send_last_chunk(h);
+    len = recv_all(h, buf, sizeof(buf) - 1, false);
+    http_request_delete(h);
+    snprintf(expected, sizeof(expected), "%d %lu", 4 * 100 + 8000, sum);
+    if (check(len > 0 && strncmp(buf, expected, len) == 0 && len == strlen(expected), expected) ||
+            check_writes(h, &before, 4 + 2 + 1, "1 write for the last chunk")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    http_connection_delete(h);
+}
+
+static int recv_expect(httpc_conn_t *h, const char *path, long expected_len)
+{
+    static char buf[4096];
+    bool pattern_body = strncmp(path, "/large/", 7) == 0 || strcmp(path, "/chunked") == 0;
+    long len = recv_all(h, buf, sizeof(buf), pattern_body);
+    if (len != expected_len || (!pattern_body && expected_len == 13 && memcmp(buf, "Hello, world!", 13) != 0)) {
+        printf("%s: %ld bytes ....", path, len);
+        return -1;
+    }
+    return 0;
+}
+
+static void test_pipeline(void)
+{
+    static const struct {
+        const char *path;
+        long len;
+    } ahead[] = {
+        {"/hello", 13},
+        {"/chunked", 18753},
+        {"/large/5000", 5000},
+    };
+
+    printf("test: pipelined GETs ....");
+    int conns = server.connections;
+    int served = requests_served;
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    httpc_write_stats_t before;
+    http_connection_get_write_stats(h, &before);
+    send_get(h, "/large/100000");
+    for (int i = 0; i < 3; i++) {
+        if (check(http_request_pipeline(h, ahead[i].path) == 0, "http_request_pipeline() to succeed")) {
+            goto out;
+        }
+    }
+    if (check(http_request_pipeline_count(h) == 3, "3 requests ahead") ||
+            check(recv_expect(h, "/large/100000", 100000) == 0, "the first response")) {
+        goto out;
+    }
+    for (int i = 0; i < 3; i++) {
+        http_request_delete(h);
+        if (check(http_request_new(h, ESP_HTTP_GET, ahead[i].path) == 0 && http_request_is_pipelined(h),
+                  "the request sent ahead") ||
+                check(http_request_send(h, NULL, 0) == 0, "http_request_send() to do nothing") ||
+                check(recv_expect(h, ahead[i].path, ahead[i].len) == 0, "the responses in order")) {
+            goto out;
+        }
+    }
+    http_request_delete(h);
+    if (check(requests_served == served + 4 && server.connections == conns + 1, "4 requests on one connection") ||
+            check_writes(h, &before, 4, "1 write per request")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: pipelined GETs, responses received together ....");
+    send_get(h, "/hello");
+    for (int i = 0; i < HTTPC_PIPELINE_MAX; i++) {
+        http_request_pipeline(h, "/hello");
+    }
+    if (check(http_request_pipeline(h, "/hello") != 0, "no more than HTTPC_PIPELINE_MAX requests ahead")) {
+        goto out;
+    }
+    /* For all the responses to arrive before the first is read */
+    usleep(50 * 1000);
+    for (int i = 0; i <= HTTPC_PIPELINE_MAX; i++) {
+        if (i) {
+            http_request_delete(h);
+            http_request_new(h, ESP_HTTP_GET, "/hello");
+        }
+        if (check(recv_expect(h, "/hello", 13) == 0, "each response whole")) {
+            goto out;
+        }
+    }
+    http_request_delete(h);
+    printf("Success\n");
+
+    printf("test: pipelined GETs, a response not asked for ....");
+    send_get(h, "/hello");
+    http_request_pipeline(h, "/large/3000");
+    http_request_pipeline(h, "/small");
+    recv_expect(h, "/hello", 13);
+    http_request_delete(h);
+    /* The response to /large/3000 is dropped */
+    char buf[16];
+    if (check(http_request_new(h, ESP_HTTP_GET, "/small") == 0 && http_request_is_pipelined(h), "/small sent ahead") ||
+            check(recv_all(h, buf, sizeof(buf), false) == 2 && memcmp(buf, "ok", 2) == 0, "\"ok\"")) {
+        goto out;
+    }
+    http_request_delete(h);
+    send_get(h, "/hello");
+    if (check(recv_expect(h, "/hello", 13) == 0, "the connection usable after")) {
+        goto out;
+    }
+    http_request_delete(h);
+    printf("Success\n");
+
+    printf("test: pipelined GETs, server closing ....");
+    send_get(h, "/hello-close");
+    http_request_pipeline(h, "/hello");
+    recv_expect(h, "/hello-close", 13);
+    http_request_delete(h);
+    if (check(http_request_new(h, ESP_HTTP_GET, "/hello") == -ENOTCONN, "-ENOTCONN") ||
+            check(http_request_pipeline_count(h) == 0, "no requests left ahead")) {
+        goto out;
+    }
+    http_connection_delete(h);
+
+    /* Without saying so */
+    h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    send_get(h, "/hello-then-close");
+    http_request_pipeline(h, "/hello");
+    recv_expect(h, "/hello-then-close", 13);
+    http_request_delete(h);
+    if (check(http_request_new(h, ESP_HTTP_GET, "/hello") == 0, "the request sent ahead") ||
+            check(http_header_fetch(h) < 0 && http_response_get_code(h) == 0, "no response")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+/* Read a decoded body with `buf_len` sized reads and compare it to `doc` */
+static long recv_doc(httpc_conn_t *h, size_t buf_len, const char *doc, size_t doc_len)
+{
+    char *buf = malloc(buf_len);
+    long total = 0;
+    int ret;
+    while ((ret = http_response_recv(h, buf, buf_len)) > 0) {
+        if (ret > buf_len || total + ret > doc_len || memcmp(buf, doc + total, ret) != 0) {
+            printf("Body mismatch at offset %ld ....", total);
+            ret = -1;
+            break;
+        }
+        total += ret;
+    }
+    free(buf);
+    return ret < 0 ? ret : total;
+}
+
+/* GET `path` asking for a compressed response. Returns what recv_doc() does. */
+static long get_encoded(httpc_conn_t *h, const char *path, size_t max_len, size_t buf_len,
+                        httpc_inflate_stats_t *stats)
+{
+    const char *doc = strstr(path, "playlist") ? playlist_doc : json_doc;
+    size_t doc_len = strstr(path, "playlist") ? playlist_doc_len : json_doc_len;
+    http_request_new(h, ESP_HTTP_GET, path);
+    http_request_set_accept_encoding(h, max_len);
+    http_request_send(h, NULL, 0);
+    long len = recv_doc(h, buf_len, doc, doc_len);
+    http_response_get_inflate_stats(h, stats);
+    return len;
+}
+
+static void test_inflate(void)
+{
+    static const char *kinds[] = {"gzip", "gzip-named", "deflate", "deflate-raw"};
+    static const char *hows[] = {"", "?chunked", "?drip"};
+    static const char *docs[] = {"playlist.m3u8", "directive.json"};
+    static const size_t buf_lens[] = {7, 512, 65536};
+    char path[64];
+    httpc_inflate_stats_t stats;
+
+    for (int k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        for (int w = 0; w < sizeof(hows) / sizeof(hows[0]); w++) {
+            printf("test: %s response%s%s ....", kinds[k], hows[w][0] ? ", " : "", hows[w][0] ? hows[w] + 1 : "");
+            bool ok = true;
+            for (int d = 0; ok && d < sizeof(docs) / sizeof(docs[0]); d++) {
+                size_t doc_len = d == 0 ? playlist_doc_len : json_doc_len;
+                for (int b = 0; ok && b < sizeof(buf_lens) / sizeof(buf_lens[0]); b++) {
+                    httpc_conn_t *h = connect_local();
+                    if (check(h != NULL, "a connection")) {
+                        return;
+                    }
+                    snprintf(path, sizeof(path), "/encoded/%s/%s%s", kinds[k], docs[d], hows[w]);
+                    long len = get_encoded(h, path, 0, buf_lens[b], &stats);
+                    ok = check(len == doc_len, "the decoded document") == 0 &&
+                         check(http_response_get_content_len(h) == 0, "no content length") == 0 &&
+                         check(stats.out_bytes == doc_len && stats.in_bytes > 0 && stats.in_bytes < doc_len / 2,
+                               "the compressed and decoded lengths") == 0;
+                    http_request_delete(h);
+                    http_connection_delete(h);
+                }
+            }
+            if (ok) {
+                printf("Success\n");
+            }
+        }
+    }
+
+    printf("test: compressed response, decoder for an unsupported coding ....");
+    httpc_inflate_t *inf;
+    int unsupported = httpc_inflate_new(HTTPC_CODING_UNSUPPORTED, &inf);
+    httpc_inflate_t *unsupported_inf = inf;
+    int gzip = httpc_inflate_new(HTTPC_CODING_GZIP, &inf);
+    httpc_inflate_delete(inf);
+    if (check(unsupported == -ENOTSUP && unsupported_inf == NULL, "-ENOTSUP, not an allocation failure") ||
+            check(gzip == 0 && inf != NULL, "a gzip decoder")) {
+        return;
+    }
+    printf("Success\n");
+
+    printf("test: compressed response, not asked for ....");
+    httpc_conn_t *h = connect_local();
+    if (check(h != NULL, "a connection")) {
+        return;
+    }
+    send_get(h, "/encoded/gzip/playlist.m3u8");
+    long len = recv_doc(h, 4096, playlist_doc, playlist_doc_len);
+    http_response_get_inflate_stats(h, &stats);
+    if (check(len == playlist_doc_len, "the document as is") ||
+            check(http_response_get_content_len(h) == playlist_doc_len, "the content length") ||
+            check(stats.in_bytes == 0 && stats.out_bytes == 0, "nothing decoded")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: compressed response, asked for but not compressed ....");
+    http_request_delete(h);
+    len = get_encoded(h, "/encoded/identity/directive.json", 0, 4096, &stats);
+    if (check(len == json_doc_len, "the document as is") ||
+            check(stats.in_bytes == 0 && stats.out_bytes == 0, "nothing decoded")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: compressed response, kept alive ....");
+    /* The decoder stops at the end of the data, the rest must be read still */
+    http_request_delete(h);
+    int connections = server.connections;
+    get_encoded(h, "/encoded/gzip-named/directive.json", 0, 512, &stats);
+    http_request_delete(h);
+    get_encoded(h, "/encoded/deflate/playlist.m3u8?chunked", 0, 100, &stats);
+    /* Only partly read */
+    http_request_delete(h);
+    http_request_new(h, ESP_HTTP_GET, "/encoded/gzip/playlist.m3u8");
+    http_request_set_accept_encoding(h, 0);
+    http_request_send(h, NULL, 0);
+    char buf[64];
+    http_response_recv(h, buf, sizeof(buf));
+    http_request_delete(h);
+    send_get(h, "/hello");
+    len = recv_all(h, buf, sizeof(buf), false);
+    if (check(len == 13 && memcmp(buf, "Hello, world!", 13) == 0, "\"Hello, world!\"") ||
+            check(server.connections == connections, "the same connection")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: compressed response, headers of interest and http_header_fetch() ....");
+    static const char *names[] = {"X-Not-There"};
+    http_request_delete(h);
+    http_request_new(h, ESP_HTTP_GET, "/encoded/gzip/playlist.m3u8?drip");
+    http_response_set_header_interest(h, names, 1);
+    http_request_set_accept_encoding(h, 0);
+    http_request_send(h, NULL, 0);
+    http_header_fetch(h);
+    len = recv_doc(h, 333, playlist_doc, playlist_doc_len);
+    const char *coding = http_response_get_header(h, "content-encoding");
+    if (check(len == playlist_doc_len, "the decoded document") ||
+            check(coding && strcmp(coding, "gzip") == 0, "Content-Encoding: gzip") ||
+            check(strcmp(http_response_get_content_type(h), "application/vnd.apple.mpegurl") == 0,
+                  "the playlist content type")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: compressed response, longer than the cap ....");
+    http_request_delete(h);
+    len = get_encoded(h, "/encoded/gzip/directive.json", json_doc_len - 1, 4096, &stats);
+    if (check(len < 0, "an error")) {
+        goto out;
+    }
+    http_request_delete(h);
+    http_connection_delete(h);
+    h = connect_local();
+    len = get_encoded(h, "/encoded/gzip/directive.json", json_doc_len, 4096, &stats);
+    if (check(len == json_doc_len, "the document, at the cap")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    static const char *broken[] = {"gzip/playlist.m3u8?corrupt", "deflate/directive.json?corrupt",
+                                   "gzip/directive.json?truncated", "deflate-raw/playlist.m3u8?truncated"};
+    for (int i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+        printf("test: compressed response, %s ....", broken[i]);
+        http_request_delete(h);
+        http_connection_delete(h);
+        h = connect_local();
+        snprintf(path, sizeof(path), "/encoded/%s", broken[i]);
+        len = get_encoded(h, path, 0, 4096, &stats);
+        if (check(len < 0, "an error")) {
+            goto out;
+        }
+        printf("Success\n");
+    }
+out:
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+static int64_t now_us(int clock_id)
+{
+    struct timespec ts;
+    clock_gettime(clock_id, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Throughput of http_response_recv(): wall clock, and CPU time of this thread only, not the server's */
+/* Addresses of "cdn.test", for the resolver stub */
+static const char *cdn_addrs[HTTPC_CONNECT_MAX_ADDRS];
+static uint32_t cdn_ttl_s;
+static volatile int resolver_calls;
+
+static int resolve_stub(const char *host, struct sockaddr_storage *addrs, int max, uint32_t *ttl_s)
+{
+    __sync_fetch_and_add(&resolver_calls, 1);
+    if (strcmp(host, "cdn.test") != 0) {
+        return -1;
+    }
+    int count = 0;
+    for (int i = 0; i < max && cdn_addrs[i]; i++) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) &addrs[count++];
+        memset(sin, 0, sizeof(*sin));
+        sin->sin_family = AF_INET;
+        inet_pton(AF_INET, cdn_addrs[i], &sin->sin_addr);
+    }
+    *ttl_s = cdn_ttl_s;
+    return count;
+}
+
+static void cdn_set(uint32_t ttl_s, const char *addr0, const char *addr1)
+{
+    memset(cdn_addrs, 0, sizeof(cdn_addrs));
+    cdn_addrs[0] = addr0;
+    cdn_addrs[1] = addr1;
+    cdn_ttl_s = ttl_s;
+    httpc_connect_dns_flush();
+}
+
+/* A listener on 127.0.0.2 which drops the SYNs: its accept queue is full */
+#define BLACKHOLE_CONNS 4
+static int blackhole_fds[BLACKHOLE_CONNS + 1] = {-1, -1, -1, -1, -1};
+
+static int blackhole_start(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(server.port),
+    };
+    inet_pton(AF_INET, "127.0.0.2", &addr.sin_addr);
+    blackhole_fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(blackhole_fds[0], (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(blackhole_fds[0], 0) != 0) {
+        return -1;
+    }
+    for (int i = 1; i <= BLACKHOLE_CONNS; i++) {
+        blackhole_fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        connect(blackhole_fds[i], (struct sockaddr *) &addr, sizeof(addr));
+    }
+    /* Let the handshakes which make it fill the queue */
+    usleep(100 * 1000);
+    return 0;
+}
+
+static void blackhole_stop(void)
+{
+    for (int i = 0; i <= BLACKHOLE_CONNS; i++) {
+        if (blackhole_fds[i] >= 0) {
+            close(blackhole_fds[i]);
+            blackhole_fds[i] = -1;
+        }
+    }
+}
+
+/* GET /hello from cdn.test. Returns the time it took in us, or -1. */
+static int64_t get_cdn_hello(const esp_tls_cfg_t *cfg)
+{
+    char url[64], buf[64];
+    snprintf(url, sizeof(url), "http://cdn.test:%d", server.port);
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    httpc_conn_t *h = http_connection_new(url, (esp_tls_cfg_t *) cfg);
+    if (!h) {
+        return -1;
+    }
+    send_get(h, "/hello");
+    long len = recv_all(h, buf, sizeof(buf), false);
+    http_request_delete(h);
+    /* Not back to the pool: the next one must connect */
+    http_connection_delete(h);
+    if (len != 13 || memcmp(buf, "Hello, world!", 13) != 0) {
+        return -1;
+    }
+    return now_us(CLOCK_MONOTONIC) - start;
+}
+
+static void test_connect(void)
+{
+    httpc_connect_stats_t before, after;
+    httpc_connect_set_resolver(resolve_stub);
+
+    printf("test: connect, DNS cache hits ....");
+    cdn_set(60, "127.0.0.1", NULL);
+    resolver_calls = 0;
+    httpc_connect_get_stats(&before);
+    bool ok = true;
+    for (int i = 0; i < 3; i++) {
+        ok = get_cdn_hello(NULL) >= 0 && ok;
+    }
+    httpc_connect_get_stats(&after);
+    if (check(ok, "all the requests to succeed") ||
+            check(resolver_calls == 1, "a single DNS lookup") ||
+            check(after.dns_hits == before.dns_hits + 2 && after.dns_misses == before.dns_misses + 1,
+                  "1 DNS miss and 2 hits")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: connect, DNS cache TTL ....");
+    cdn_set(1, "127.0.0.1", NULL);
+    resolver_calls = 0;
+    ok = get_cdn_hello(NULL) >= 0 && get_cdn_hello(NULL) >= 0;
+    int cached_calls = resolver_calls;
+    usleep(1100 * 1000);
+    ok = get_cdn_hello(NULL) >= 0 && ok;
+    if (check(ok, "all the requests to succeed") ||
+            check(cached_calls == 1, "the address cached within its TTL") ||
+            check(resolver_calls == 2, "the address resolved again after its TTL")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    if (blackhole_start() != 0) {
+        printf("test: connect, unresponsive first address .... Skipped, no 127.0.0.2\n");
+    } else {
+        printf("test: connect, unresponsive first address ....");
+        cdn_set(60, "127.0.0.2", "127.0.0.1");
+        httpc_connect_get_stats(&before);
+        int64_t elapsed = get_cdn_hello(NULL);
+        httpc_connect_get_stats(&after);
+        if (check(elapsed >= 0, "the request to succeed") ||
+                check(elapsed < 2000 * 1000, "the second address tried well before the timeout") ||
+                check(after.fallbacks == before.fallbacks + 1, "a fallback counted")) {
+            printf("Took %lld ms\n", (long long) elapsed / 1000);
+            blackhole_stop();
+            goto out;
+        }
+        printf("Success, in %lld ms\n", (long long) elapsed / 1000);
+
+        printf("test: connect, timeout ....");
+        cdn_set(60, "127.0.0.2", NULL);
+        esp_tls_cfg_t cfg = {
+            .timeout_ms = 300,
+        };
+        resolver_calls = 0;
+        int64_t start = now_us(CLOCK_MONOTONIC);
+        ok = get_cdn_hello(&cfg) < 0;
+        elapsed = now_us(CLOCK_MONOTONIC) - start;
+        blackhole_stop();
+        if (check(ok, "the connect to fail") ||
+                check(elapsed >= 250 * 1000 && elapsed < 1000 * 1000, "the connect to time out after 300 ms")) {
+            goto out;
+        }
+        /* The host was forgotten with its address */
+        cdn_set(60, "127.0.0.1", NULL);
+        if (check(get_cdn_hello(NULL) >= 0 && resolver_calls == 2, "the host resolved again")) {
+            goto out;
+        }
+        printf("Success\n");
+    }
+
+    printf("test: connect, refused first address ....");
+    /* Nothing listens on 127.0.0.3 */
+    cdn_set(60, "127.0.0.3", "127.0.0.1");
+    httpc_connect_get_stats(&before);
+    int64_t elapsed = get_cdn_hello(NULL);
+    httpc_connect_get_stats(&after);
+    if (check(elapsed >= 0, "the request to succeed") ||
+            check(elapsed < 200 * 1000, "the second address tried without waiting") ||
+            check(after.fallbacks == before.fallbacks + 1, "a fallback counted")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: connect, no address answers ....");
+    cdn_set(60, "127.0.0.3", NULL);
+    resolver_calls = 0;
+    httpc_connect_get_stats(&before);
+    ok = get_cdn_hello(NULL) < 0;
+    /* Not cached: the address may have changed */
+    ok = get_cdn_hello(NULL) < 0 && ok;
+    httpc_connect_get_stats(&after);
+    if (check(ok, "the connects to fail") ||
+            check(after.connect_failures == before.connect_failures + 2, "2 failures counted") ||
+            check(resolver_calls == 2, "the failed address not cached")) {
+        goto out;
+    }
+    cdn_set(60, NULL, NULL);
+    ok = get_cdn_hello(NULL) < 0;
+    httpc_connect_get_stats(&after);
+    if (check(ok && after.dns_failures == before.dns_failures + 1, "a DNS failure")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: connect, reactor transfers ....");
+    cdn_set(60, "127.0.0.3", "127.0.0.1");
+    char url[64];
+    snprintf(url, sizeof(url), "http://cdn.test:%d/large/100000", server.port);
+    reactor_job_t jobs[4] = {
+        [0 ... 3] = {url, 100000, 0, true},
+    };
+    httpc_reactor_t *r = httpc_reactor_new(4);
+    if (check(r != NULL, "a reactor")) {
+        goto out;
+    }
+    http_connection_pool_flush();
+    resolver_calls = 0;
+    for (int i = 0; i < 4; i++) {
+        reactor_add_job(r, &jobs[i]);
+    }
+    /* Resolved when added, not by the reactor */
+    int added_calls = resolver_calls;
+    reactor_job_t unknown = {"http://unknown.test/hello", -1};
+    int unknown_ret = reactor_add_job(r, &unknown);
+    while (httpc_reactor_run_once(r, 1000) > 0);
+    httpc_reactor_delete(r);
+    http_connection_pool_flush();
+    ok = true;
+    for (int i = 0; i < 4; i++) {
+        ok = reactor_job_ok(&jobs[i]) && ok;
+    }
+    if (check(ok, "all the transfers done") ||
+            check(added_calls == 1 && resolver_calls == 2, "the hosts resolved by httpc_reactor_add()") ||
+            check(unknown_ret == -1 && !unknown.done, "an unknown host not added")) {
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: connect, async connect waits on its sockets ....");
+    snprintf(url, sizeof(url), "http://cdn.test:%d", server.port);
+    httpc_conn_t *h = NULL;
+    int calls = 0, ret;
+    while ((ret = http_connection_new_async(url, NULL, &h)) == 0) {
+        http_connection_wait_async(h, 100);
+        calls++;
+    }
+    if (h) {
+        http_connection_delete(h);
+    }
+    if (check(ret == 1, "the connect to succeed") ||
+            check(calls < 10, "no busy retries")) {
+        printf("%d retries ....", calls);
+        goto out;
+    }
+    printf("Success\n");
+
+    printf("test: connect, connect time percentiles ....");
+    httpc_connect_get_stats(&after);
+    if (check(after.connects > 0 && after.connect_p50_us > 0, "connect times") ||
+            check(after.connect_p50_us <= after.connect_p90_us && after.connect_p90_us <= after.connect_p99_us,
+                  "ordered percentiles")) {
+        goto out;
+    }
+    printf("Success, p50 %u us, p90 %u us, p99 %u us\n", after.connect_p50_us, after.connect_p90_us,
+           after.connect_p99_us);
+out:
+    httpc_connect_set_resolver(NULL);
+}
+
+static void bench_recv(const char *fmt, size_t body_len, size_t buf_len)
+{
+    char path[64];
+    snprintf(path, sizeof(path), fmt, body_len);
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    char *buf = malloc(buf_len);
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    int64_t cpu_start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    send_get(h, path);
+    long len = recv_all(h, buf, buf_len, false);
+    int64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    double mb = (double) len / (1024 * 1024);
+    printf("http_response_recv, %-7s body, %6zu byte reads: %8.1f MB/s, %.3f CPU ms/MB\n",
+           strstr(fmt, "chunked") ? "chunked" : "length", buf_len, mb / (elapsed / 1e6), cpu / 1e3 / mb);
+    free(buf);
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+/* Request latency on a kept-alive connection, headers read with http_header_fetch() */
+static void bench_header_fetch(int count)
+{
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    int64_t *samples = malloc(count * sizeof(*samples));
+    int64_t total = 0;
+    char buf[16];
+    for (int i = 0; i < count; i++) {
+        int64_t start = now_us(CLOCK_MONOTONIC);
+        send_get(h, "/small");
+        http_header_fetch(h);
+        recv_all(h, buf, sizeof(buf), false);
+        http_request_delete(h);
+        samples[i] = now_us(CLOCK_MONOTONIC) - start;
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(*samples), cmp_int64);
+    printf("http_header_fetch latency, %d requests: avg %lld us, p50 %lld us, p99 %lld us\n", count,
+           (long long) (total / count), (long long) samples[count / 2], (long long) samples[count * 99 / 100]);
+    free(samples);
+    http_connection_delete(h);
+}
+
+/* Connect to "localhost" through getaddrinfo(), or the DNS cache */
+static void bench_connect(int count, bool cached)
+{
+    char url[64];
+    snprintf(url, sizeof(url), "http://localhost:%d", server.port);
+    int64_t *samples = malloc(count * sizeof(*samples));
+    httpc_connect_dns_flush();
+    for (int i = 0; i < count; i++) {
+        if (!cached) {
+            httpc_connect_dns_flush();
+        }
+        int64_t start = now_us(CLOCK_MONOTONIC);
+        httpc_conn_t *h = http_connection_new(url, NULL);
+        samples[i] = now_us(CLOCK_MONOTONIC) - start;
+        if (!h) {
+            printf("Couldn't connect\n");
+            free(samples);
+            return;
+        }
+        http_connection_delete(h);
+    }
+    qsort(samples, count, sizeof(*samples), cmp_int64);
+    printf("http_connection_new, %s DNS: p50 %lld us, p90 %lld us\n", cached ? "cached" : "uncached",
+           (long long) samples[count / 2], (long long) samples[count * 90 / 100]);
+    free(samples);
+}
+
+/* `count` GETs of `len` bytes each from a server `rtt_ms` away, `depth` of them ahead */
+static void bench_pipeline(int count, size_t len, int rtt_ms, int depth)
+{
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/rtt/%d/large/%zu", rtt_ms, len);
+    char *buf = malloc(4096);
+    int sent = 1;
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    send_get(h, path);
+    for (int i = 0; i < count; i++) {
+        if (i) {
+            http_request_delete(h);
+            http_request_new(h, ESP_HTTP_GET, path);
+            if (!http_request_is_pipelined(h)) {
+                http_request_send(h, NULL, 0);
+                sent++;
+            }
+        }
+        while (sent < count && http_request_pipeline_count(h) < depth && http_request_pipeline(h, path) == 0) {
+            sent++;
+        }
+        recv_all(h, buf, 4096, false);
+    }
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    printf("%d GETs of %zu bytes, %d ms RTT, %d ahead: %6lld ms, %6.2f MB/s\n", count, len, rtt_ms, depth,
+           (long long) elapsed / 1000, (double) count * len / (1024 * 1024) / (elapsed / 1e6));
+    free(buf);
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+static void bench_send_chunk(size_t total, size_t chunk_len)
+{
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    char buf[64];
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    int64_t cpu_start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    http_request_new(h, ESP_HTTP_POST, "/upload");
+    http_request_send_custom_hdr(h, "Host: 127.0.0.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (size_t sent = 0; sent < total; sent += chunk_len) {
+        http_send_chunk(h, pattern, chunk_len);
+    }
+    http_send_last_chunk(h);
+    recv_all(h, buf, sizeof(buf), false);
+    int64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    double mb = (double) total / (1024 * 1024);
+    httpc_write_stats_t stats;
+    http_connection_get_write_stats(h, &stats);
+    printf("http_send_chunk %6zu byte chunks: %8.1f MB/s, %.3f CPU ms/MB, %.2f writes per chunk\n",
+           chunk_len, mb / (elapsed / 1e6), cpu / 1e3 / mb, (double) stats.writes / (total / chunk_len));
+    http_request_delete(h);
+    http_connection_delete(h);
+}
+
+/* Cost of a response with 45 headers, all of them buffered or only those of interest */
+static void bench_headers(int count, bool interest)
+{
+    static const char *names[] = {"icy-metaint"};
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    char buf[16];
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    int64_t cpu_start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < count; i++) {
+        http_request_new(h, ESP_HTTP_GET, "/many-headers");
+        if (interest) {
+            http_response_set_header_interest(h, names, 1);
+        }
+        http_request_send(h, NULL, 0);
+        http_header_fetch(h);
+        recv_all(h, buf, sizeof(buf), false);
+        http_request_delete(h);
+    }
+    int64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    printf("45 header responses, %-20s: %6.1f us/response, %5.2f CPU us/response\n",
+           interest ? "headers of interest" : "all headers", (double) elapsed / count, (double) cpu / count);
+    http_connection_delete(h);
+}
+
+/* Decoding cost of compressed responses, read with `buf_len` sized reads on a kept-alive connection */
+static void bench_inflate(const char *path, int count, size_t buf_len)
+{
+    httpc_conn_t *h = connect_local();
+    if (!h) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    httpc_inflate_stats_t stats;
+    uint64_t in_bytes = 0, out_bytes = 0, decode_us = 0;
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    int64_t cpu_start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < count; i++) {
+        get_encoded(h, path, 0, buf_len, &stats);
+        http_request_delete(h);
+        in_bytes += stats.in_bytes;
+        out_bytes += stats.out_bytes;
+        decode_us += stats.decode_us;
+    }
+    int64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    double mb = (double) out_bytes / (1024 * 1024);
+    printf("%-34s %5zu byte reads: %4.1f%% of the size, decoding %.3f ms/MB, %.3f CPU ms/MB in all, %6.1f MB/s\n",
+           path, buf_len, 100.0 * in_bytes / out_bytes, decode_us / 1e3 / mb, cpu / 1e3 / mb, mb / (elapsed / 1e6));
+    http_connection_delete(h);
+}
+
+/* Many transfers at once, run by httpc_reactor_run_once() in this thread */
+static void bench_reactor(size_t total, int transfers)
+{
+    reactor_job_t *jobs = calloc(transfers, sizeof(*jobs));
+    char path[64];
+    snprintf(path, sizeof(path), "/large/%zu", total / transfers);
+    httpc_reactor_t *r = httpc_reactor_new(transfers);
+    if (!jobs || !r) {
+        printf("Couldn't create the reactor\n");
+        free(jobs);
+        return;
+    }
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    int64_t cpu_start = now_us(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < transfers; i++) {
+        jobs[i].path = path;
+        reactor_add_job(r, &jobs[i]);
+    }
+    while (httpc_reactor_run_once(r, 1000) > 0);
+    int64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+    size_t len = 0;
+    for (int i = 0; i < transfers; i++) {
+        len += jobs[i].len;
+    }
+    double mb = (double) len / (1024 * 1024);
+    printf("httpc_reactor, %2d transfers at once: %8.1f MB/s, %.3f CPU ms/MB\n",
+           transfers, mb / (elapsed / 1e6), cpu / 1e3 / mb);
+    httpc_reactor_delete(r);
+    free(jobs);
+}
+
+static int bench(size_t mb)
+{
+    static const size_t buf_lens[] = {512, 4096, 16384};
+    size_t len = mb * 1024 * 1024;
+    for (int i = 0; i < sizeof(buf_lens) / sizeof(buf_lens[0]); i++) {
+        bench_recv("/large/%zu", len, buf_lens[i]);
+    }
+    for (int i = 0; i < sizeof(buf_lens) / sizeof(buf_lens[0]); i++) {
+        bench_recv("/large-chunked/%zu", len, buf_lens[i]);
+    }
+    bench_header_fetch(2000);
+    bench_headers(5000, false);
+    bench_headers(5000, true);
+    bench_reactor(len, 1);
+    bench_reactor(len, 16);
+    bench_send_chunk(len / 16, 64);
+    bench_send_chunk(len, 512);
+    bench_send_chunk(len, 4096);
+    bench_inflate("/encoded/gzip/playlist.m3u8", 500, 512);
+    bench_inflate("/encoded/gzip/playlist.m3u8", 500, 4096);
+    bench_inflate("/encoded/deflate/directive.json", 500, 4096);
+    bench_pipeline(10, 65536, 50, 0);
+    bench_pipeline(10, 65536, 50, 1);
+    bench_pipeline(10, 65536, 50, 3);
+    bench_connect(200, false);
+    bench_connect(200, true);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    pattern_init();
+    docs_init();
+    if (local_server_start(&server, handler, NULL) != 0) {
+        printf("Couldn't start the local server\n");
+        return 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "BENCH") == 0) {
+        return bench(argc >= 3 ? strtoul(argv[2], NULL, 10) : 64);
+    }
+    /* A hung test fails the whole run, instead of blocking it */
+    alarm(120);
+
+    test_content_length();
+    test_chunked();
+    test_long_headers();
+    test_keep_alive();
+    test_slow_drip();
+    test_abrupt_close();
+    test_redirect();
+    test_large_body();
+    test_header_interest();
+    test_upload();
+    test_write_coalescing();
+    test_pipeline();
+    test_reactor();
+    test_inflate();
+    test_connect();
+
+    http_connection_pool_flush();
+    local_server_stop(&server);
+    printf("%d requests served, %d failures\n", requests_served, failures);
+    return failures ? 1 : 0;
+}
@@ -18,11 +18,18 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <pthread.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <http_parser.h>
+#include <tls_handshake_stats.h>
+#include <abstract_rb.h>
 
 #include "sh2lib.h"
 
@@ -30,16 +37,249 @@ static const char *TAG = "[sh2lib]";
 
 #define DBG_FRAME_SEND 1
 
+/*
+ * Connection level receive window. It only limits how much all the streams
+ * together may have in flight: what is received is consumed at once, or
+ * bounded by the stream windows.
+ */
+#define SH2LIB_CONNECTION_WINDOW_SIZE (1024 * 1024)
+
+/*
+ * The frames of a sh2lib_execute() are gathered, and written together: one
+ * TLS record, of the largest size mbedTLS sends with the examples'
+ * CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN.
+ */
+#define SH2LIB_SEND_BUF_SIZE 4096
+
+/* The header of an HTTP/2 frame */
+#define SH2LIB_FRAME_HDLEN 9
+
+/* What is read from the connection at once: a TLS record, or a DATA frame, of the largest size */
+#define SH2LIB_RECV_BUF_SIZE 16384
+
+/* Defaults of sh2lib_keepalive_cfg_t */
+#define SH2LIB_KEEPALIVE_INTERVAL_MS 10000
+#define SH2LIB_KEEPALIVE_TIMEOUT_MS 3000
+#define SH2LIB_KEEPALIVE_MAX_MISSED 2
+
+/* Once a DATA frame of an upload is started, how long the socket may stay full */
+#define SH2LIB_SEND_DATA_TIMEOUT_MS 5000
+
+/* A stream whose response body goes into a ring buffer, see sh2lib_download() */
+struct sh2lib_download {
+    int32_t stream_id;
+    rb_handle_t rb;
+    int32_t window;             /* Credit granted when the stream opens: the free space of rb then */
+    int in_rb;                  /* Written to rb, not given back to the server yet */
+    int status;
+    sh2lib_download_done_cb_t done_cb;
+    void *arg;
+    struct sh2lib_download *next;
+};
+
+/* A request whose body is sent from a ring buffer, see sh2lib_do_putpost_with_rb() */
+struct sh2lib_upload {
+    int32_t stream_id;
+    rb_handle_t rb;
+    bool deferred;              /* Until rb has data, or its writer finished */
+    struct sh2lib_upload *next;
+};
+
+/* A stream credited by the application, see sh2lib_stream_set_window() */
+struct sh2lib_window {
+    int32_t stream_id;
+    int32_t window;
+    struct sh2lib_window *next;
+};
+
+/*
+ * What sh2lib keeps on a connection besides struct sh2lib_handle, whose
+ * layout the prebuilt libraries were compiled against. It is the user data of
+ * the nghttp2 session; the application's callbacks still get the handle.
+ */
+struct sh2lib_priv {
+    struct sh2lib_handle *hd;
+    /* The application's callbacks, for the streams other than downloads */
+    nghttp2_on_header_callback hdr_cb;
+    nghttp2_on_data_chunk_recv_callback data_chunk_recv_cb;
+    nghttp2_on_stream_close_callback stream_close_cb;
+    struct sh2lib_download *downloads;  /* Downloads in progress, see sh2lib_download() */
+    struct sh2lib_window *windows;      /* Streams with their own window */
+    struct sh2lib_upload *uploads;
+    int32_t stream_window;              /* For the other streams */
+    bool h2c;                           /* HTTP/2 over plain TCP, for an 'http' URI */
+    bool settings_acked;                /* Our SETTINGS, with their initial window size of 0, are in effect */
+    uint8_t *send_buf;                  /* Frames not written yet, see callback_send() */
+    size_t send_off;                    /* Written of them so far */
+    size_t send_len;
+    uint8_t *recv_buf;
+    sh2lib_stats_t stats;
+    /* PINGs, see sh2lib_keepalive_start() */
+    bool keepalive;
+    sh2lib_keepalive_cfg_t keepalive_cfg;
+    int64_t ping_due_us;                /* Of the next one */
+    int64_t ping_sent_us;               /* Of the one waiting for its ACK, 0 if none */
+    /* Under privs_lock, for sh2lib_get_rtt() */
+    sh2lib_rtt_t rtt;
+    uint32_t rtt_samples[SH2LIB_RTT_SAMPLES];
+    uint32_t rtt_sample_count;
+    struct sh2lib_priv *next;
+};
+
+static struct sh2lib_priv *privs;
+static pthread_mutex_t privs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sh2lib_priv *priv_get(struct sh2lib_handle *hd)
+{
+    struct sh2lib_priv *p;
+    pthread_mutex_lock(&privs_lock);
+    for (p = privs; p; p = p->next) {
+        if (p->hd == hd) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&privs_lock);
+    return p;
+}
+
+static struct sh2lib_priv *priv_new(struct sh2lib_handle *hd)
+{
+    struct sh2lib_priv *p = calloc(1, sizeof(struct sh2lib_priv));
+    if (!p) {
+        return NULL;
+    }
+    p->send_buf = malloc(SH2LIB_SEND_BUF_SIZE);
+    p->recv_buf = malloc(SH2LIB_RECV_BUF_SIZE);
+    if (!p->send_buf || !p->recv_buf) {
+        free(p->send_buf);
+        free(p->recv_buf);
+        free(p);
+        return NULL;
+    }
+    p->hd = hd;
+    pthread_mutex_lock(&privs_lock);
+    p->next = privs;
+    privs = p;
+    pthread_mutex_unlock(&privs_lock);
+    return p;
+}
+
+/* Unlinks the one of `hd` and returns it, for the caller to free */
+static struct sh2lib_priv *priv_remove(struct sh2lib_handle *hd)
+{
+    struct sh2lib_priv **pp, *p = NULL;
+    pthread_mutex_lock(&privs_lock);
+    for (pp = &privs; *pp; pp = &(*pp)->next) {
+        if ((*pp)->hd == hd) {
+            p = *pp;
+            *pp = p->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&privs_lock);
+    return p;
+}
+
+static struct sh2lib_download *download_find(struct sh2lib_priv *p, int32_t stream_id)
+{
+    struct sh2lib_download *d;
+    for (d = p->downloads; d; d = d->next) {
+        if (d->stream_id == stream_id) {
+            break;
+        }
+    }
+    return d;
+}
+
+static struct sh2lib_window *window_find(struct sh2lib_priv *p, int32_t stream_id)
+{
+    struct sh2lib_window *w;
+    for (w = p->windows; w; w = w->next) {
+        if (w->stream_id == stream_id) {
+            break;
+        }
+    }
+    return w;
+}
+
+static void download_finish(struct sh2lib_handle *hd, struct sh2lib_download *d, uint32_t error_code)
+{
+    arb_signal_writer_finished(d->rb);
+    if (d->done_cb) {
+        d->done_cb(hd, d->stream_id, d->status, error_code, d->arg);
+    }
+    free(d);
+}
+
+/* Give the servers back the credit the readers of the ring buffers freed */
+static void downloads_give_credit(struct sh2lib_priv *p)
+{
+    struct sh2lib_download *d;
+    for (d = p->downloads; d; d = d->next) {
+        int filled = arb_get_filled(d->rb);
+        /* The reader takes the oldest bytes first: ours are the last ones */
+        int left = filled < d->in_rb ? filled : d->in_rb;
+        if (left >= 0 && left < d->in_rb) {
+            nghttp2_session_consume_stream(p->hd->http2_sess, d->stream_id, d->in_rb - left);
+            d->in_rb = left;
+        }
+    }
+}
+
+/* Resume the uploads which have something to send again: data, or their end */
+static bool upload_ready(struct sh2lib_upload *u)
+{
+    return u->deferred && (arb_get_filled(u->rb) > 0 || arb_is_writer_finished(u->rb) == 1);
+}
+
+/* Whether an upload waits for its ring buffer, which has data by now */
+static bool uploads_ready(struct sh2lib_priv *p)
+{
+    struct sh2lib_upload *u;
+    for (u = p->uploads; u; u = u->next) {
+        if (upload_ready(u)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void uploads_resume(struct sh2lib_priv *p)
+{
+    struct sh2lib_upload *u;
+    for (u = p->uploads; u; u = u->next) {
+        if (upload_ready(u)) {
+            u->deferred = false;
+            nghttp2_session_resume_data(p->hd->http2_sess, u->stream_id);
+        }
+    }
+}
+
+/*
+ * Our SETTINGS make the initial window of the streams 0, so that a download
+ * never gets more credit than its ring buffer has room. Once they apply, each
+ * stream gets its own: that of the connection's config, unless it is a
+ * download or was given one.
+ */
+static void stream_open_window(struct sh2lib_priv *p, int32_t stream_id)
+{
+    struct sh2lib_download *d = download_find(p, stream_id);
+    struct sh2lib_window *w = d ? NULL : window_find(p, stream_id);
+    int32_t window = d ? d->window : w ? w->window : p->stream_window;
+    nghttp2_session_set_local_window_size(p->hd->http2_sess, NGHTTP2_FLAG_NONE, stream_id, window);
+}
+
 /*
  * The implementation of nghttp2_send_callback type. Here we write
  * |data| with size |length| to the network and return the number of
  * bytes actually written. See the documentation of
  * nghttp2_send_callback for the details.
  */
-static ssize_t callback_send_inner(struct sh2lib_handle *hd, const uint8_t *data,
+static ssize_t callback_send_inner(struct sh2lib_priv *p, const uint8_t *data,
                                    size_t length)
 {
-    int rv = esp_tls_conn_write(hd->http2_tls, data, length);
+    p->stats.writes++;
+    int rv = esp_tls_conn_write(p->hd->http2_tls, data, length);
     if (rv <= 0) {
         if (rv == MBEDTLS_ERR_SSL_WANT_WRITE || rv == MBEDTLS_ERR_SSL_WANT_READ || errno == EAGAIN) {
             rv = NGHTTP2_ERR_WOULDBLOCK;
@@ -50,58 +290,278 @@ static ssize_t callback_send_inner(struct sh2lib_handle *hd, const uint8_t *data
     return rv;
 }
 
+/* Write out the frames gathered by callback_send(). 0 once they all are, else an nghttp2 error code. */
+static int send_flush(struct sh2lib_priv *p)
+{
+    while (p->send_off < p->send_len) {
+        ssize_t ret = callback_send_inner(p, p->send_buf + p->send_off, p->send_len - p->send_off);
+        if (ret < 0) {
+            return ret;
+        }
+        p->send_off += ret;
+    }
+    p->send_off = p->send_len = 0;
+    return 0;
+}
+
+/*
+ * The frames are only gathered here, and written by send_flush() once the
+ * buffer is full, or sh2lib_execute() has nothing more to send: the HEADERS,
+ * WINDOW_UPDATE and small DATA frames of a run go out in one write. What is
+ * larger than the buffer is written as is, after what was gathered.
+ */
 static ssize_t callback_send(nghttp2_session *session, const uint8_t *data,
                              size_t length, int flags, void *user_data)
 {
-    int rv = 0;
     struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
+    if (length > SH2LIB_SEND_BUF_SIZE - p->send_len) {
+        int ret = send_flush(p);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    if (length > SH2LIB_SEND_BUF_SIZE) {
+        return callback_send_inner(p, data, length);
+    }
+    memcpy(p->send_buf + p->send_len, data, length);
+    p->send_len += length;
+    return length;
+}
 
-    int copy_offset = 0;
-    int pending_data = length;
-
-    //    printf("len %d\n", length);
-    /* Send data in 1000 byte chunks */
-    while (copy_offset != length) {
-        //  printf("copy offset %d\n", copy_offset);
-        int chunk_len = pending_data > 1000 ? 1000 : pending_data;
-        int subrv = callback_send_inner(hd, data + copy_offset, chunk_len);
-        if (subrv <= 0) {
-            if (copy_offset == 0) {
-                /* If no data is transferred, send the error code */
-                rv = subrv;
+/*
+ * Read what the connection has, a buffer at a time, and process it. Over
+ * TCP, a read which doesn't fill the buffer took all there was: there is no
+ * need for one more to find the socket empty. A TLS read only returns a
+ * record, so TLS is read until it would block.
+ */
+static int session_recv(struct sh2lib_priv *p)
+{
+    struct sh2lib_handle *hd = p->hd;
+    while (1) {
+        p->stats.reads++;
+        ssize_t ret = esp_tls_conn_read(hd->http2_tls, p->recv_buf, SH2LIB_RECV_BUF_SIZE);
+        if (ret < 0 && (ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ || errno == EAGAIN)) {
+            return 0;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "[sh2-execute] %s", ret == 0 ? "Connection closed" : "Connection read failed");
+            return -1;
+        }
+        ssize_t used = nghttp2_session_mem_recv(hd->http2_sess, p->recv_buf, ret);
+        if (used < 0) {
+            ESP_LOGE(TAG, "[sh2-execute] HTTP2 session recv failed %d", (int) used);
+            return -1;
+        }
+        if (p->h2c && ret < SH2LIB_RECV_BUF_SIZE) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * The data provider of the uploads. It only says how much of the ring buffer
+ * goes into the next DATA frame: callback_send_data() writes it from there.
+ */
+static ssize_t upload_read_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                              uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    struct sh2lib_upload *u = source->ptr;
+    /* In this order: whatever was written before the writer finished is seen */
+    int finished = arb_is_writer_finished(u->rb);
+    int filled = arb_get_filled(u->rb);
+    if (filled > 0) {
+        *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+        return (size_t) filled < length ? filled : length;
+    }
+    if (finished == 1) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return 0;
+    }
+    u->deferred = true;
+    return NGHTTP2_ERR_DEFERRED;
+}
+
+static ssize_t conn_writev(struct sh2lib_priv *p, const struct iovec *iov, int iovcnt)
+{
+    p->stats.writes++;
+    if (p->h2c) {
+        struct msghdr msg = {
+            .msg_iov = (struct iovec *) iov,
+            .msg_iovlen = iovcnt,
+        };
+        return sendmsg(p->hd->http2_tls->sockfd, &msg, 0);
+    }
+    /* TLS has no gather write: a record per buffer */
+    return esp_tls_conn_write(p->hd->http2_tls, iov[0].iov_base, iov[0].iov_len);
+}
+
+/*
+ * Write the buffers whole. If nothing of the frame has been written yet,
+ * `*started` is false and a full socket gives NGHTTP2_ERR_WOULDBLOCK. Once the
+ * frame is started, it must be finished: wait for the socket.
+ */
+static int conn_write_all(struct sh2lib_priv *p, struct iovec *iov, int iovcnt, bool *started)
+{
+    while (iovcnt) {
+        ssize_t ret = conn_writev(p, iov, iovcnt);
+        if (ret <= 0 && (ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ || errno == EAGAIN)) {
+            if (!*started) {
+                return NGHTTP2_ERR_WOULDBLOCK;
             }
-            break;
+            int fd = p->hd->http2_tls->sockfd;
+            fd_set write_fds;
+            FD_ZERO(&write_fds);
+            FD_SET(fd, &write_fds);
+            struct timeval tv = {
+                .tv_sec = SH2LIB_SEND_DATA_TIMEOUT_MS / 1000,
+                .tv_usec = (SH2LIB_SEND_DATA_TIMEOUT_MS % 1000) * 1000,
+            };
+            if (select(fd + 1, NULL, &write_fds, NULL, &tv) <= 0) {
+                ESP_LOGE(TAG, "[sh2-upload] Timed out in the middle of a DATA frame");
+                return NGHTTP2_ERR_CALLBACK_FAILURE;
+            }
+            continue;
+        }
+        if (ret <= 0) {
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+        *started = true;
+        while (iovcnt && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (uint8_t *) iov->iov_base + ret;
+            iov->iov_len -= ret;
         }
-        copy_offset += subrv;
-        pending_data -= subrv;
-        rv += subrv;
     }
-    //    printf("ret %d\n", rv);
-    return rv;
+    return 0;
 }
 
 /*
- * The implementation of nghttp2_recv_callback type. Here we read data
- * from the network and write them in |buf|. The capacity of |buf| is
- * |length| bytes. Returns the number of bytes stored in |buf|. See
- * the documentation of nghttp2_recv_callback for the details.
+ * The DATA frames of the uploads: the frame header, gathered after the frames
+ * not written yet, then the payload straight from the ring buffer, a
+ * contiguous window of it at a time. Over h2c the frames and the first window
+ * go out in one sendmsg().
  */
-static ssize_t callback_recv(nghttp2_session *session, uint8_t *buf,
-                             size_t length, int flags, void *user_data)
+static int callback_send_data(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd,
+                              size_t length, nghttp2_data_source *source, void *user_data)
 {
     struct sh2lib_handle *hd = user_data;
-    int rv;
-    rv = esp_tls_conn_read(hd->http2_tls, buf, (int)length);
-    if (rv < 0) {
-        if (rv == MBEDTLS_ERR_SSL_WANT_WRITE || rv == MBEDTLS_ERR_SSL_WANT_READ || errno == EAGAIN) {
-            rv = NGHTTP2_ERR_WOULDBLOCK;
+    struct sh2lib_priv *p = priv_get(hd);
+    struct sh2lib_upload *u = source->ptr;
+    if (SH2LIB_SEND_BUF_SIZE - p->send_len < SH2LIB_FRAME_HDLEN) {
+        int ret = send_flush(p);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    memcpy(p->send_buf + p->send_len, framehd, SH2LIB_FRAME_HDLEN);
+    p->send_len += SH2LIB_FRAME_HDLEN;
+    struct iovec iov[2] = {
+        { .iov_base = p->send_buf + p->send_off, .iov_len = p->send_len - p->send_off },
+    };
+    int iovcnt = 1;
+    bool started = false;
+    while (length) {
+        uint8_t *ptr;
+        int contig_len;
+        int ret = arb_read_peek(u->rb, &ptr, &contig_len, 0);
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "[sh2-upload][sid: %d] Ring buffer read failed %d", frame->hd.stream_id, ret);
+            ret = started ? NGHTTP2_ERR_CALLBACK_FAILURE : NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
         } else {
-            rv = NGHTTP2_ERR_CALLBACK_FAILURE;
+            size_t n = (size_t) contig_len < length ? contig_len : length;
+            iov[iovcnt].iov_base = ptr;
+            iov[iovcnt].iov_len = n;
+            ret = conn_write_all(p, iov, iovcnt + 1, &started);
+            if (ret == 0) {
+                arb_read_release(u->rb, n);
+                length -= n;
+                iovcnt = 0;
+            }
+        }
+        if (ret != 0) {
+            /* Not a byte of it written: the header goes, the frame will be sent again */
+            if (!started) {
+                p->send_len -= SH2LIB_FRAME_HDLEN;
+            }
+            return ret;
         }
-    } else if (rv == 0) {
-        rv = NGHTTP2_ERR_EOF;
     }
-    return rv;
+    p->send_off = p->send_len = 0;
+    return 0;
+}
+
+/* When keepalive_run() has something to do next */
+static int64_t keepalive_next_us(struct sh2lib_priv *p)
+{
+    return p->ping_sent_us ? p->ping_sent_us + p->keepalive_cfg.timeout_ms * 1000LL : p->ping_due_us;
+}
+
+/*
+ * Count the PING whose ACK is late as missed, and send the next one when it
+ * is due. Returns -1 once too many were missed in a row.
+ */
+static int keepalive_run(struct sh2lib_priv *p)
+{
+    if (!p->keepalive) {
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+    if (p->ping_sent_us && now >= keepalive_next_us(p)) {
+        p->ping_sent_us = 0;
+        pthread_mutex_lock(&privs_lock);
+        p->rtt.missed++;
+        p->rtt.dead = p->rtt.missed >= p->keepalive_cfg.max_missed;
+        pthread_mutex_unlock(&privs_lock);
+        ESP_LOGW(TAG, "[sh2-keepalive] No PING ACK in %u ms, %u in a row", p->keepalive_cfg.timeout_ms,
+                 p->rtt.missed);
+        if (p->rtt.dead) {
+            ESP_LOGE(TAG, "[sh2-keepalive] Connection dead");
+            if (p->keepalive_cfg.dead_cb) {
+                p->keepalive_cfg.dead_cb(p->hd, p->keepalive_cfg.arg);
+            }
+            return -1;
+        }
+    }
+    if (!p->ping_sent_us && now >= p->ping_due_us) {
+        /* The ACK brings back when it was sent */
+        uint8_t opaque_data[8];
+        memcpy(opaque_data, &now, sizeof(opaque_data));
+        if (nghttp2_submit_ping(p->hd->http2_sess, NGHTTP2_FLAG_NONE, opaque_data) != 0) {
+            ESP_LOGE(TAG, "[sh2-keepalive] PING failed");
+            return -1;
+        }
+        p->ping_sent_us = now;
+        p->ping_due_us = now + p->keepalive_cfg.interval_ms * 1000LL;
+        pthread_mutex_lock(&privs_lock);
+        p->rtt.pings++;
+        pthread_mutex_unlock(&privs_lock);
+    }
+    return 0;
+}
+
+static void keepalive_ack(struct sh2lib_priv *p, const uint8_t *opaque_data)
+{
+    int64_t sent_us;
+    memcpy(&sent_us, opaque_data, sizeof(sent_us));
+    /* Too late: it was counted as missed already */
+    if (!p->ping_sent_us || sent_us != p->ping_sent_us) {
+        return;
+    }
+    p->ping_sent_us = 0;
+    uint32_t rtt = esp_timer_get_time() - sent_us;
+    pthread_mutex_lock(&privs_lock);
+    p->rtt.last_us = rtt;
+    p->rtt.srtt_us = p->rtt.acks ? ((uint64_t) p->rtt.srtt_us * 7 + rtt) / 8 : rtt;
+    p->rtt.acks++;
+    p->rtt.missed = 0;
+    p->rtt_samples[p->rtt_sample_count++ % SH2LIB_RTT_SAMPLES] = rtt;
+    pthread_mutex_unlock(&privs_lock);
+    ESP_LOGD(TAG, "[sh2-keepalive] RTT %u us, smoothed %u us", rtt, p->rtt.srtt_us);
 }
 
 char *sh2lib_frame_type_str(int type)
@@ -137,9 +597,15 @@ char *sh2lib_frame_type_str(int type)
 static int callback_on_frame_send(nghttp2_session *session,
                                   const nghttp2_frame *frame, void *user_data)
 {
+    struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
     ESP_LOGD(TAG, "[frame-send] frame type %s", sh2lib_frame_type_str(frame->hd.type));
+    p->stats.frames_sent++;
     switch (frame->hd.type) {
     case NGHTTP2_HEADERS:
+        if (frame->headers.cat == NGHTTP2_HCAT_REQUEST && p->settings_acked) {
+            stream_open_window(p, frame->hd.stream_id);
+        }
         if (nghttp2_session_get_stream_user_data(session, frame->hd.stream_id)) {
             ESP_LOGD(TAG, "[frame-send] C ----------------------------> S (HEADERS)");
 #if DBG_FRAME_SEND
@@ -160,13 +626,28 @@ static int callback_on_frame_recv(nghttp2_session *session,
                                   const nghttp2_frame *frame, void *user_data)
 {
     ESP_LOGD(TAG, "[frame-recv][sid: %d] frame type  %s", frame->hd.stream_id, sh2lib_frame_type_str(frame->hd.type));
+    struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
+    p->stats.frames_received++;
+    if (frame->hd.type == NGHTTP2_PING && (frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+        keepalive_ack(p, frame->ping.opaque_data);
+    }
     if (frame->hd.type == NGHTTP2_GOAWAY) {
-        struct sh2lib_handle *hd = (struct sh2lib_handle *)user_data;
         if (hd->go_away_cb) {
             printf("%s: goaway received: Invoking application's callback", TAG);
             hd->go_away_cb(hd);
         }
     }
+    if (frame->hd.type == NGHTTP2_SETTINGS && (frame->hd.flags & NGHTTP2_FLAG_ACK) && !p->settings_acked) {
+        /* The streams opened until now had the default window, 0 from now on */
+        p->settings_acked = true;
+        int32_t next_stream_id = nghttp2_session_get_next_stream_id(session);
+        for (int32_t stream_id = 1; stream_id < next_stream_id; stream_id += 2) {
+            if (nghttp2_session_get_stream_local_window_size(session, stream_id) >= 0) {
+                stream_open_window(p, stream_id);
+            }
+        }
+    }
 #if 0
     if (frame->hd.type != NGHTTP2_DATA) {
         return 0;
@@ -174,43 +655,151 @@ static int callback_on_frame_recv(nghttp2_session *session,
     /* Subsequent processing only for data frame */
     sh2lib_frame_data_recv_cb_t data_recv_cb = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
     if (data_recv_cb) {
-        struct sh2lib_handle *h2 = user_data;
+        struct sh2lib_handle *h2 = hd;
         (*data_recv_cb)(h2, NULL, 0, DATA_RECV_FRAME_COMPLETE);
     }
 #endif
     return 0;
 }
 
-static int do_http2_connect(struct sh2lib_handle *hd,
+static int callback_on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                              const uint8_t *name, size_t namelen, const uint8_t *value,
+                              size_t valuelen, uint8_t flags, void *user_data)
+{
+    struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
+    struct sh2lib_download *d = download_find(p, frame->hd.stream_id);
+    if (!d) {
+        return p->hdr_cb ? p->hdr_cb(session, frame, name, namelen, value, valuelen, flags, hd) : 0;
+    }
+    if (namelen == 7 && memcmp(name, ":status", 7) == 0) {
+        d->status = atoi((const char *) value);
+    }
+    return 0;
+}
+
+static int callback_on_data_chunk_recv(nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                                       const uint8_t *data, size_t len, void *user_data)
+{
+    struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
+    struct sh2lib_download *d = download_find(p, stream_id);
+    if (!d) {
+        int ret = p->data_chunk_recv_cb ? p->data_chunk_recv_cb(session, flags, stream_id, data, len, hd) : 0;
+        if (window_find(p, stream_id)) {
+            /* The stream's credit is up to the application */
+            nghttp2_session_consume_connection(session, len);
+        } else {
+            /* As automatic WINDOW_UPDATE would */
+            nghttp2_session_consume(session, stream_id, len);
+        }
+        return ret;
+    }
+    nghttp2_session_consume_connection(session, len);
+    if (d->status < 200 || d->status > 299) {
+        nghttp2_session_consume_stream(session, stream_id, len);
+        return 0;
+    }
+    int written = arb_write(d->rb, (uint8_t *) data, len, 0);
+    if (written > 0) {
+        d->in_rb += written;
+    }
+    if (written != len) {
+        ESP_LOGE(TAG, "[sh2-download][sid: %d] No room in the ring buffer for %d bytes", stream_id, len);
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id,
+                                  written < 0 ? NGHTTP2_CANCEL : NGHTTP2_FLOW_CONTROL_ERROR);
+    }
+    return 0;
+}
+
+static int callback_on_stream_close(nghttp2_session *session, int32_t stream_id,
+                                    uint32_t error_code, void *user_data)
+{
+    struct sh2lib_handle *hd = user_data;
+    struct sh2lib_priv *p = priv_get(hd);
+    struct sh2lib_upload **pu;
+    for (pu = &p->uploads; *pu; pu = &(*pu)->next) {
+        if ((*pu)->stream_id == stream_id) {
+            struct sh2lib_upload *u = *pu;
+            *pu = u->next;
+            free(u);
+            break;
+        }
+    }
+    struct sh2lib_window **pw;
+    for (pw = &p->windows; *pw; pw = &(*pw)->next) {
+        if ((*pw)->stream_id == stream_id) {
+            struct sh2lib_window *w = *pw;
+            *pw = w->next;
+            free(w);
+            break;
+        }
+    }
+    struct sh2lib_download **pd;
+    for (pd = &p->downloads; *pd; pd = &(*pd)->next) {
+        if ((*pd)->stream_id == stream_id) {
+            struct sh2lib_download *d = *pd;
+            *pd = d->next;
+            ESP_LOGD(TAG, "[sh2-download][sid: %d] Closed, status %d, error %u", stream_id, d->status, error_code);
+            download_finish(hd, d, error_code);
+            return 0;
+        }
+    }
+    return p->stream_close_cb ? p->stream_close_cb(session, stream_id, error_code, hd) : 0;
+}
+
+static int do_http2_connect(struct sh2lib_handle *hd, struct sh2lib_priv *p,
                             nghttp2_on_header_callback hdr_cb,
                             nghttp2_on_data_chunk_recv_callback data_chunk_recv_cb,
                             nghttp2_on_stream_close_callback stream_close_cb,
-                            sh2lib_on_goaway_receive_callback goaway_handle_cb)
+                            sh2lib_on_goaway_receive_callback goaway_handle_cb,
+                            const sh2lib_config_t *cfg)
 {
     int ret;
+    p->stream_window = cfg->stream_window ? cfg->stream_window : NGHTTP2_INITIAL_WINDOW_SIZE;
+
+    /* Frames of the downloads are handled here, the others passed on to these */
+    p->hdr_cb = hdr_cb;
+    p->data_chunk_recv_cb = data_chunk_recv_cb;
+    p->stream_close_cb = stream_close_cb;
+
     nghttp2_session_callbacks *callbacks;
     nghttp2_session_callbacks_new(&callbacks);
     nghttp2_session_callbacks_set_send_callback(callbacks, callback_send);
-    nghttp2_session_callbacks_set_recv_callback(callbacks, callback_recv);
     nghttp2_session_callbacks_set_on_frame_send_callback(callbacks, callback_on_frame_send);
     nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, callback_on_frame_recv);
-    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, stream_close_cb);
-    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, data_chunk_recv_cb);
-    nghttp2_session_callbacks_set_on_header_callback(callbacks, hdr_cb);
-    ret = nghttp2_session_client_new(&hd->http2_sess, callbacks, hd);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, callback_on_stream_close);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, callback_on_data_chunk_recv);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, callback_on_header);
+    nghttp2_session_callbacks_set_send_data_callback(callbacks, callback_send_data);
+    /* The credit of a download follows its ring buffer */
+    nghttp2_option *option;
+    nghttp2_option_new(&option);
+    nghttp2_option_set_no_auto_window_update(option, 1);
+    ret = nghttp2_session_client_new2(&hd->http2_sess, callbacks, hd, option);
+    nghttp2_option_del(option);
+    nghttp2_session_callbacks_del(callbacks);
     if (ret != 0) {
         ESP_LOGE(TAG, "[sh2-connect] New http2 session failed");
-        nghttp2_session_callbacks_del(callbacks);
         return -1;
     }
-    nghttp2_session_callbacks_del(callbacks);
 
     /* Create the SETTINGS frame */
-    ret = nghttp2_submit_settings(hd->http2_sess, NGHTTP2_FLAG_NONE, NULL, 0);
+    nghttp2_settings_entry iv[] = {
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 0 },
+        { NGHTTP2_SETTINGS_MAX_FRAME_SIZE, cfg->max_frame_size },
+    };
+    ret = nghttp2_submit_settings(hd->http2_sess, NGHTTP2_FLAG_NONE, iv, cfg->max_frame_size ? 2 : 1);
     if (ret != 0) {
         ESP_LOGE(TAG, "[sh2-connect] Submit settings failed");
         return -1;
     }
+    ret = nghttp2_session_set_local_window_size(hd->http2_sess, NGHTTP2_FLAG_NONE, 0,
+            cfg->connection_window ? cfg->connection_window : SH2LIB_CONNECTION_WINDOW_SIZE);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "[sh2-connect] Connection window update failed");
+        return -1;
+    }
 
     if (goaway_handle_cb) {
         hd->go_away_cb = goaway_handle_cb;
@@ -219,31 +808,123 @@ static int do_http2_connect(struct sh2lib_handle *hd,
     return 0;
 }
 
+static ssize_t tcp_read(struct esp_tls *tls, char *data, size_t datalen)
+{
+    return recv(tls->sockfd, data, datalen, 0);
+}
+
+static ssize_t tcp_write(struct esp_tls *tls, const char *data, size_t datalen)
+{
+    return send(tls->sockfd, data, datalen, 0);
+}
+
+/* For h2c: esp-tls only needs read() and write() for plain TCP */
+static struct esp_tls *tcp_connect(const char *host, int port, const esp_tls_cfg_t *cfg)
+{
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res, *ai;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0) {
+        ESP_LOGE(TAG, "[sh2-connect] Could not resolve %s", host);
+        return NULL;
+    }
+    int fd = -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "[sh2-connect] Could not connect to %s:%d", host, port);
+        return NULL;
+    }
+    if (cfg->non_block) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+    struct esp_tls *tls = calloc(1, sizeof(struct esp_tls));
+    if (!tls) {
+        close(fd);
+        return NULL;
+    }
+    tls->sockfd = fd;
+    tls->read = tcp_read;
+    tls->write = tcp_write;
+    tls->conn_state = ESP_TLS_DONE;
+    return tls;
+}
+
 int sh2lib_connect(struct sh2lib_handle *hd, const char *uri,
                    nghttp2_on_header_callback hdr_cb,
                    nghttp2_on_data_chunk_recv_callback data_chunk_recv_cb,
                    nghttp2_on_stream_close_callback stream_close_cb,
                    sh2lib_on_goaway_receive_callback goaway_handle_cb,
                    esp_tls_cfg_t *tls_cfg)
+{
+    return sh2lib_connect_with_config(hd, uri, hdr_cb, data_chunk_recv_cb, stream_close_cb, goaway_handle_cb,
+                                      tls_cfg, NULL);
+}
+
+int sh2lib_connect_with_config(struct sh2lib_handle *hd, const char *uri,
+                               nghttp2_on_header_callback hdr_cb,
+                               nghttp2_on_data_chunk_recv_callback data_chunk_recv_cb,
+                               nghttp2_on_stream_close_callback stream_close_cb,
+                               sh2lib_on_goaway_receive_callback goaway_handle_cb,
+                               esp_tls_cfg_t *tls_cfg, const sh2lib_config_t *cfg)
 {
     memset(hd, 0, sizeof(*hd));
+    const sh2lib_config_t default_cfg = { 0 };
+    if (!cfg) {
+        cfg = &default_cfg;
+    }
+    if (cfg->stream_window < 0 || cfg->connection_window < 0) {
+        ESP_LOGE(TAG, "[sh2-connect] Invalid window size");
+        return -1;
+    }
+    struct sh2lib_priv *p = priv_new(hd);
+    if (!p) {
+        return -1;
+    }
     const char *proto[] = {"h2", NULL};
     if (tls_cfg->alpn_protos == NULL) {
         ESP_LOGI(TAG, "[sh2-connect] Setting default tls_cfg parameter for alpn_proto.");
         tls_cfg->alpn_protos = proto;
         tls_cfg->non_block = true;
     }
-    if ((hd->http2_tls = esp_tls_conn_http_new(uri, tls_cfg)) == NULL) {
-        ESP_LOGE(TAG, "[sh2-connect] esp-tls connection failed");
-        goto error;
-    }
     struct http_parser_url u;
     http_parser_url_init(&u);
     http_parser_parse_url(uri, strlen(uri), 0, &u);
     hd->hostname = strndup(&uri[u.field_data[UF_HOST].off], u.field_data[UF_HOST].len);
+    if (!hd->hostname) {
+        goto error;
+    }
+
+    p->h2c = u.field_data[UF_SCHEMA].len == 4 && strncasecmp(&uri[u.field_data[UF_SCHEMA].off], "http", 4) == 0;
+    if (p->h2c) {
+        hd->http2_tls = tcp_connect(hd->hostname, (u.field_set & (1 << UF_PORT)) ? u.port : 80, tls_cfg);
+    } else {
+        tls_handshake_t hs;
+        tls_handshake_start(&hs, hd->hostname, strlen(hd->hostname));
+        hd->http2_tls = esp_tls_conn_http_new(uri, tls_cfg);
+        tls_handshake_done(&hs, hd->http2_tls);
+    }
+    if (hd->http2_tls == NULL) {
+        ESP_LOGE(TAG, "[sh2-connect] esp-tls connection failed");
+        goto error;
+    }
 
     /* HTTP/2 Connection */
-    if (do_http2_connect(hd, hdr_cb, data_chunk_recv_cb, stream_close_cb, goaway_handle_cb) != 0) {
+    if (do_http2_connect(hd, p, hdr_cb, data_chunk_recv_cb, stream_close_cb, goaway_handle_cb, cfg) != 0) {
         ESP_LOGE(TAG, "[sh2-connect] HTTP2 Connection failed with %s", uri);
         goto error;
     }
@@ -256,6 +937,7 @@ error:
 
 void sh2lib_free(struct sh2lib_handle *hd)
 {
+    struct sh2lib_priv *p = priv_remove(hd);
     if (hd->http2_sess) {
         nghttp2_session_del(hd->http2_sess);
         hd->http2_sess = NULL;
@@ -268,10 +950,38 @@ void sh2lib_free(struct sh2lib_handle *hd)
         free(hd->hostname);
         hd->hostname = NULL;
     }
+    if (p) {
+        while (p->downloads) {
+            struct sh2lib_download *d = p->downloads;
+            p->downloads = d->next;
+            download_finish(hd, d, NGHTTP2_CANCEL);
+        }
+        while (p->uploads) {
+            struct sh2lib_upload *u = p->uploads;
+            p->uploads = u->next;
+            free(u);
+        }
+        while (p->windows) {
+            struct sh2lib_window *w = p->windows;
+            p->windows = w->next;
+            free(w);
+        }
+        free(p->send_buf);
+        free(p->recv_buf);
+        free(p);
+    }
 }
 
 int sh2lib_wait_for_io(struct sh2lib_handle *hd, int timeout_s, int timeout_ms)
 {
+    struct sh2lib_priv *p = priv_get(hd);
+    /* Nothing to wait for: TLS already decrypted data, or an upload can go on */
+    if (p && !p->h2c && mbedtls_ssl_get_bytes_avail(&hd->http2_tls->ssl) > 0) {
+        return 1;
+    }
+    if (p && uploads_ready(p)) {
+        return 1;
+    }
     struct timeval tv = {
         .tv_sec = timeout_s,
         .tv_usec = timeout_ms * 1000,
@@ -281,6 +991,18 @@ int sh2lib_wait_for_io(struct sh2lib_handle *hd, int timeout_s, int timeout_ms)
     if (timeout_s == -1) {
         tv_ptr = NULL;
     }
+    /* ... until the next PING is due, or the ACK of the last one */
+    if (p && p->keepalive) {
+        int64_t wait_us = keepalive_next_us(p) - esp_timer_get_time();
+        if (wait_us < 0) {
+            wait_us = 0;
+        }
+        if (!tv_ptr || wait_us < (int64_t) tv.tv_sec * 1000000 + tv.tv_usec) {
+            tv.tv_sec = wait_us / 1000000;
+            tv.tv_usec = wait_us % 1000000;
+            tv_ptr = &tv;
+        }
+    }
 
     fd_set read_fds, write_fds;
     FD_ZERO(&read_fds);
@@ -289,7 +1011,7 @@ int sh2lib_wait_for_io(struct sh2lib_handle *hd, int timeout_s, int timeout_ms)
     /* read_fds is always set, because we always want to check if a socket is
      * ready to read. The other end could send read data anytime
      */
-    if (nghttp2_session_want_write(hd->http2_sess)) {
+    if (nghttp2_session_want_write(hd->http2_sess) || (p && p->send_len > p->send_off)) {
         /* We want to check if the sockfd is writeable, only and only
          * when the nghttp2 wants to write. Otherwise, the fd is pretty
          * much always writeable, and select() will keep returning
@@ -310,23 +1032,47 @@ int sh2lib_resume_deferred_data(struct sh2lib_handle *hd, int32_t sid)
 int sh2lib_execute(struct sh2lib_handle *hd)
 {
     int ret;
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p || p->rtt.dead || keepalive_run(p) != 0) {
+        return -1;
+    }
+    downloads_give_credit(p);
+    uploads_resume(p);
+    /*
+     * What was queued since the last run, then what the server sent, then
+     * what it called for: acks, WINDOW_UPDATEs, the requests made from the
+     * callbacks. The frames are written together at the end.
+     */
     ret = nghttp2_session_send(hd->http2_sess);
+    if (ret == 0) {
+        if (session_recv(p) != 0) {
+            return -1;
+        }
+        ret = nghttp2_session_send(hd->http2_sess);
+    }
     if (ret != 0) {
         ESP_LOGE(TAG, "[sh2-execute] HTTP2 session send failed %d", ret);
         return -1;
     }
-    ret = nghttp2_session_recv(hd->http2_sess);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "[sh2-execute] HTTP2 session recv failed %d", ret);
+    ret = send_flush(p);
+    if (ret != 0 && ret != NGHTTP2_ERR_WOULDBLOCK) {
+        ESP_LOGE(TAG, "[sh2-execute] Connection write failed %d", ret);
         return -1;
     }
-
     return 0;
 }
 
 int sh2lib_do_get_with_nv(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen, void *arg)
 {
-    int ret = nghttp2_submit_request(hd->http2_sess, NULL, nva, nvlen, NULL, arg);
+    return sh2lib_do_get_with_nv_prio(hd, nva, nvlen, SH2LIB_DEFAULT_WEIGHT, arg);
+}
+
+int sh2lib_do_get_with_nv_prio(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen,
+                               int32_t weight, void *arg)
+{
+    nghttp2_priority_spec pri_spec;
+    nghttp2_priority_spec_init(&pri_spec, 0, weight, 0);
+    int ret = nghttp2_submit_request(hd->http2_sess, &pri_spec, nva, nvlen, NULL, arg);
     if (ret < 0) {
         ESP_LOGE(TAG, "[sh2-do-get] HEADERS call failed");
         return -1;
@@ -348,11 +1094,20 @@ int sh2lib_do_putpost_with_nv(struct sh2lib_handle *hd, const nghttp2_nv *nva, s
                               nghttp2_data_source_read_callback data_prd,
                               void *arg)
 {
+    return sh2lib_do_putpost_with_nv_prio(hd, nva, nvlen, data_prd, SH2LIB_DEFAULT_WEIGHT, arg);
+}
+
+int sh2lib_do_putpost_with_nv_prio(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen,
+                                   nghttp2_data_source_read_callback data_prd,
+                                   int32_t weight, void *arg)
+{
 
     nghttp2_data_provider sh2lib_data_provider;
     sh2lib_data_provider.read_callback = data_prd;
     sh2lib_data_provider.source.ptr = NULL;
-    int ret = nghttp2_submit_request(hd->http2_sess, NULL, nva, nvlen, &sh2lib_data_provider, arg);
+    nghttp2_priority_spec pri_spec;
+    nghttp2_priority_spec_init(&pri_spec, 0, weight, 0);
+    int ret = nghttp2_submit_request(hd->http2_sess, &pri_spec, nva, nvlen, &sh2lib_data_provider, arg);
     if (ret < 0) {
         ESP_LOGE(TAG, "[sh2-do-putpost] HEADERS call failed");
         return -1;
@@ -373,6 +1128,128 @@ int sh2lib_do_post(struct sh2lib_handle *hd, const char *path, const char *token
     return sh2lib_do_putpost_with_nv(hd, nva, sizeof(nva) / sizeof(nva[0]), data_prd, arg);
 }
 
+int sh2lib_download(struct sh2lib_handle *hd, const char *path, rb_handle_t rb,
+                    sh2lib_download_done_cb_t done_cb, void *arg)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p) {
+        return -1;
+    }
+    int available = arb_get_available(rb);
+    if (available <= 0) {
+        ESP_LOGE(TAG, "[sh2-download] No room in the ring buffer for %s", path);
+        return -1;
+    }
+    struct sh2lib_download *d = calloc(1, sizeof(struct sh2lib_download));
+    if (!d) {
+        return -1;
+    }
+    d->rb = rb;
+    d->window = available;
+    d->done_cb = done_cb;
+    d->arg = arg;
+
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", p->h2c ? "http" : "https"),
+                               SH2LIB_MAKE_NV(":path", path),
+                               SH2LIB_MAKE_NV(":authority", hd->hostname),
+                             };
+    int32_t stream_id = nghttp2_submit_request(hd->http2_sess, NULL, nva, sizeof(nva) / sizeof(nva[0]), NULL, NULL);
+    if (stream_id < 0) {
+        ESP_LOGE(TAG, "[sh2-download] HEADERS call failed");
+        free(d);
+        return -1;
+    }
+    d->stream_id = stream_id;
+    d->next = p->downloads;
+    p->downloads = d;
+    return stream_id;
+}
+
+int sh2lib_download_cancel(struct sh2lib_handle *hd, int32_t stream_id)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p || !download_find(p, stream_id)) {
+        return -1;
+    }
+    return nghttp2_submit_rst_stream(hd->http2_sess, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL) == 0 ? 0 : -1;
+}
+
+int sh2lib_do_putpost_with_rb(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen, rb_handle_t rb,
+                              int32_t weight, void *arg)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p || arb_is_writer_finished(rb) < 0) {
+        ESP_LOGE(TAG, "[sh2-upload] The ring buffer can't tell when its writer is finished");
+        return -1;
+    }
+    struct sh2lib_upload *u = calloc(1, sizeof(struct sh2lib_upload));
+    if (!u) {
+        return -1;
+    }
+    u->rb = rb;
+    nghttp2_data_provider data_provider = {
+        .source.ptr = u,
+        .read_callback = upload_read_cb,
+    };
+    nghttp2_priority_spec pri_spec;
+    nghttp2_priority_spec_init(&pri_spec, 0, weight, 0);
+    int32_t stream_id = nghttp2_submit_request(hd->http2_sess, &pri_spec, nva, nvlen, &data_provider, arg);
+    if (stream_id < 0) {
+        ESP_LOGE(TAG, "[sh2-upload] HEADERS call failed");
+        free(u);
+        return -1;
+    }
+    u->stream_id = stream_id;
+    u->next = p->uploads;
+    p->uploads = u;
+    return stream_id;
+}
+
+int sh2lib_set_stream_weight(struct sh2lib_handle *hd, int32_t stream_id, int32_t weight)
+{
+    nghttp2_priority_spec pri_spec;
+    nghttp2_priority_spec_init(&pri_spec, 0, weight, 0);
+    if (nghttp2_submit_priority(hd->http2_sess, NGHTTP2_FLAG_NONE, stream_id, &pri_spec) != 0) {
+        ESP_LOGE(TAG, "[sh2-priority][sid: %d] PRIORITY call failed", stream_id);
+        return -1;
+    }
+    return 0;
+}
+
+int sh2lib_stream_set_window(struct sh2lib_handle *hd, int32_t stream_id, int32_t window)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p || window <= 0 || download_find(p, stream_id)) {
+        return -1;
+    }
+    struct sh2lib_window *w = window_find(p, stream_id);
+    if (!w) {
+        w = calloc(1, sizeof(struct sh2lib_window));
+        if (!w) {
+            return -1;
+        }
+        w->stream_id = stream_id;
+        w->next = p->windows;
+        p->windows = w;
+    }
+    w->window = window;
+    /* Else it is opened with it when the request is sent, or our SETTINGS apply */
+    if (p->settings_acked && nghttp2_session_get_stream_local_window_size(hd->http2_sess, stream_id) >= 0) {
+        stream_open_window(p, stream_id);
+    }
+    return 0;
+}
+
+int sh2lib_stream_consume(struct sh2lib_handle *hd, int32_t stream_id, size_t len)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p || !window_find(p, stream_id)) {
+        return -1;
+    }
+    return nghttp2_session_consume_stream(hd->http2_sess, stream_id, len) == 0 ? 0 : -1;
+}
+
 int sh2lib_set_qos_vo(struct sh2lib_handle *hd)
 {
     const int ip_precedence_vo = 4;
@@ -380,3 +1257,80 @@ int sh2lib_set_qos_vo(struct sh2lib_handle *hd)
     int priority = (ip_precedence_vo << ip_precedence_offset);
     return setsockopt(hd->http2_tls->sockfd, IPPROTO_IP, IP_TOS, &priority, sizeof(priority));
 }
+
+int sh2lib_get_stats(struct sh2lib_handle *hd, sh2lib_stats_t *stats)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p) {
+        return -1;
+    }
+    *stats = p->stats;
+    return 0;
+}
+
+int sh2lib_keepalive_start(struct sh2lib_handle *hd, const sh2lib_keepalive_cfg_t *cfg)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p) {
+        return -1;
+    }
+    const sh2lib_keepalive_cfg_t default_cfg = { 0 };
+    p->keepalive_cfg = cfg ? *cfg : default_cfg;
+    if (!p->keepalive_cfg.interval_ms) {
+        p->keepalive_cfg.interval_ms = SH2LIB_KEEPALIVE_INTERVAL_MS;
+    }
+    if (!p->keepalive_cfg.timeout_ms) {
+        p->keepalive_cfg.timeout_ms = SH2LIB_KEEPALIVE_TIMEOUT_MS;
+    }
+    if (p->keepalive_cfg.max_missed <= 0) {
+        p->keepalive_cfg.max_missed = SH2LIB_KEEPALIVE_MAX_MISSED;
+    }
+    p->keepalive = true;
+    p->ping_sent_us = 0;
+    p->ping_due_us = esp_timer_get_time();
+    return 0;
+}
+
+int sh2lib_keepalive_stop(struct sh2lib_handle *hd)
+{
+    struct sh2lib_priv *p = priv_get(hd);
+    if (!p) {
+        return -1;
+    }
+    p->keepalive = false;
+    p->ping_sent_us = 0;
+    return 0;
+}
+
+static int cmp_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int sh2lib_get_rtt(struct sh2lib_handle *hd, sh2lib_rtt_t *rtt)
+{
+    uint32_t samples[SH2LIB_RTT_SAMPLES];
+    int count = 0;
+    struct sh2lib_priv *p;
+    pthread_mutex_lock(&privs_lock);
+    for (p = privs; p; p = p->next) {
+        if (p->hd == hd) {
+            *rtt = p->rtt;
+            count = p->rtt_sample_count < SH2LIB_RTT_SAMPLES ? p->rtt_sample_count : SH2LIB_RTT_SAMPLES;
+            memcpy(samples, p->rtt_samples, count * sizeof(samples[0]));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&privs_lock);
+    if (!p) {
+        return -1;
+    }
+    if (count) {
+        qsort(samples, count, sizeof(samples[0]), cmp_uint32);
+        rtt->p50_us = samples[count * 50 / 100];
+        rtt->p90_us = samples[count * 90 / 100];
+        rtt->p99_us = samples[count * 99 / 100];
+    }
+    return 0;
+}
@@ -17,6 +17,7 @@
 
 #include <esp_tls.h>
 #include <nghttp2/nghttp2.h>
+#include <common_rb.h>
 
 struct sh2lib_handle;
 /**
@@ -49,6 +50,9 @@ struct sh2lib_handle {
     char            *hostname;     /*!< The hostname we are connected to */
     struct esp_tls  *http2_tls;    /*!< Pointer to the TLS session handle */
     sh2lib_on_goaway_receive_callback go_away_cb;
+    /* Libraries built against this layout allocate it: anything else sh2lib
+     * keeps on a connection is in sh2lib.c
+     */
 };
 
 /** Flag indicating receive stream is reset */
@@ -93,13 +97,95 @@ typedef int (*sh2lib_frame_data_recv_cb_t)(struct sh2lib_handle *handle, const c
  */
 typedef int (*sh2lib_putpost_data_cb_t)(struct sh2lib_handle *handle, char *data, size_t len, uint32_t *data_flags);
 
+/**
+ * @brief Function Prototype for the callback of a download
+ *
+ * This function gets called once, when the stream of a download started with
+ * sh2lib_download() is closed, or when the handle is freed first. The writer
+ * of the ring buffer has been signalled finished by then.
+ *
+ * @param[in] handle      Pointer to the sh2lib handle.
+ * @param[in] stream_id   The stream ID sh2lib_download() returned.
+ * @param[in] status      The HTTP status code of the response, 0 if none was received.
+ * @param[in] error_code  NGHTTP2_NO_ERROR if the whole body was received, else the
+ *                        HTTP/2 error code the stream was closed with.
+ * @param[in] arg         The argument given to sh2lib_download().
+ */
+typedef void (*sh2lib_download_done_cb_t)(struct sh2lib_handle *handle, int32_t stream_id, int status,
+                                          uint32_t error_code, void *arg);
+
+/**
+ * @brief Flow-control settings of a connection, see sh2lib_connect_with_config()
+ *
+ * The receive windows bound what the server may send before sh2lib gives it
+ * credit back, i.e. what may have to be held in RAM at once.
+ */
+typedef struct {
+    int32_t stream_window;      /*!< Receive window of each stream, 0 for the HTTP/2 default of 65535 bytes.
+                                     Downloads and sh2lib_stream_set_window() override it. */
+    int32_t connection_window;  /*!< Receive window of the whole connection, 0 for 1 MB */
+    uint32_t max_frame_size;    /*!< Largest frame payload the server may send, 0 for the HTTP/2 default
+                                     of 16384 bytes, which is also the minimum */
+} sh2lib_config_t;
+
+/**
+ * @brief I/O counters of a connection, see sh2lib_get_stats()
+ */
+typedef struct {
+    uint32_t writes;            /*!< Writes to the connection: a TLS record each, or a send() over h2c */
+    uint32_t reads;             /*!< Reads from the connection, those which found nothing included */
+    uint32_t frames_sent;
+    uint32_t frames_received;
+} sh2lib_stats_t;
+
+/**
+ * @brief Function Prototype for the callback of a connection found dead by its keepalive
+ *
+ * @param[in] handle    Pointer to the sh2lib handle.
+ * @param[in] arg       The 'arg' of the sh2lib_keepalive_cfg_t.
+ */
+typedef void (*sh2lib_dead_cb_t)(struct sh2lib_handle *handle, void *arg);
+
+/**
+ * @brief Keepalive of a connection, see sh2lib_keepalive_start()
+ */
+typedef struct {
+    uint32_t interval_ms;       /*!< From a PING to the next one, 0 for 10 s */
+    uint32_t timeout_ms;        /*!< For the ACK of a PING, after which it is missed, 0 for 3 s */
+    int max_missed;             /*!< PINGs missed in a row for the connection to be dead, 0 for 2 */
+    sh2lib_dead_cb_t dead_cb;   /*!< Called when it is, may be NULL */
+    void *arg;                  /*!< For 'dead_cb' */
+} sh2lib_keepalive_cfg_t;
+
+/** The RTT percentiles are of the last SH2LIB_RTT_SAMPLES PINGs */
+#define SH2LIB_RTT_SAMPLES 32
+
+/**
+ * @brief Round-trip time of a connection, as its PINGs measured it, see sh2lib_get_rtt()
+ */
+typedef struct {
+    uint32_t srtt_us;           /*!< Smoothed: each sample weighs 1/8, as in TCP. 0 until the first ACK. */
+    uint32_t last_us;           /*!< Of the last PING answered */
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t pings;             /*!< Sent */
+    uint32_t acks;              /*!< Received in time */
+    uint32_t missed;            /*!< In a row, up to now */
+    bool dead;                  /*!< Too many were: sh2lib_execute() fails from then on */
+} sh2lib_rtt_t;
+
+/** The weight of a stream opened without one, for sh2lib_do_get_with_nv_prio() and co. */
+#define SH2LIB_DEFAULT_WEIGHT NGHTTP2_DEFAULT_WEIGHT
+
 /**
  * @brief Connect to a URI using HTTP/2
  *
  * This API opens an HTTP/2 connection with the provided URI. If successful, the
  * hd pointer is populated with a valid handle for subsequent communication.
  *
- * Only 'https' URIs are supported.
+ * 'https' URIs are negotiated with ALPN. 'http' URIs use HTTP/2 over plain TCP
+ * with prior knowledge (h2c), e.g. for a server on the local network.
  *
  * @param[out] hd       Pointer to a variable of the type 'struct sh2lib_handle'.
  * @param[in]  uri      Pointer to the URI that should be connected to.
@@ -121,6 +207,20 @@ int sh2lib_connect(struct sh2lib_handle *hd, const char *uri,
                    sh2lib_on_goaway_receive_callback goaway_handle_cb,
                    esp_tls_cfg_t *tls_cfg);
 
+/**
+ * @brief Connect to a URI using HTTP/2, with flow-control settings
+ *
+ * As sh2lib_connect(), which uses the defaults of sh2lib_config_t.
+ *
+ * @param[in]  cfg      The flow-control settings of the connection, NULL for the defaults.
+ */
+int sh2lib_connect_with_config(struct sh2lib_handle *hd, const char *uri,
+                               nghttp2_on_header_callback hdr_cb,
+                               nghttp2_on_data_chunk_recv_callback data_chunk_recv_cb,
+                               nghttp2_on_stream_close_callback stream_close_cb,
+                               sh2lib_on_goaway_receive_callback goaway_handle_cb,
+                               esp_tls_cfg_t *tls_cfg, const sh2lib_config_t *cfg);
+
 /**
  * @brief Free a sh2lib handle
  *
@@ -191,6 +291,11 @@ int sh2lib_do_put(struct sh2lib_handle *hd, const char *path,
  * operations on the HTTP/2 connection. The callback functions are accordingly
  * called during the processing of these requests.
  *
+ * It sends what was queued, processes all the connection has to read, and
+ * sends what that called for, e.g. the requests made from the callbacks. The
+ * frames are gathered and written together: a single TLS record for the
+ * small ones.
+ *
  * @param[in] hd      Pointer to a variable of the type 'struct sh2lib_handle'
  *
  * @return
@@ -198,6 +303,24 @@ int sh2lib_do_put(struct sh2lib_handle *hd, const char *path,
  *             - ESP_FAIL if the connection fails
  */
 int sh2lib_execute(struct sh2lib_handle *hd);
+
+/**
+ * @brief Wait until there is something for sh2lib_execute() to do
+ *
+ * It blocks until the connection can be read, or written if there is
+ * something to send, or an upload's ring buffer has data for it. The credit
+ * of the downloads is only given back by sh2lib_execute() though: with
+ * downloads in progress, the timeout bounds how late.
+ *
+ * @param[in] hd          Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] timeout_s   Seconds to wait for, -1 to wait for as long as it takes
+ * @param[in] timeout_ms  Milliseconds to wait for, on top of 'timeout_s'
+ *
+ * @return
+ *             - More than 0 if there is something to do
+ *             - 0 on timeout
+ *             - -1 on error
+ */
 int sh2lib_wait_for_io(struct sh2lib_handle *hd, int timeout_s, int timeout_ms);
 
 #define SH2LIB_MAKE_NV(NAME, VALUE)                                    \
@@ -234,6 +357,21 @@ int sh2lib_wait_for_io(struct sh2lib_handle *hd, int timeout_s, int timeout_ms);
  */
 int sh2lib_do_get_with_nv(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen, void *arg);
 
+/**
+ * @brief Setup an HTTP GET request stream with custom name-value pairs and a weight
+ *
+ * As sh2lib_do_get_with_nv(), with the stream weighted against the other
+ * streams of the connection: a stream of weight 2 * w gets twice the bandwidth
+ * of one of weight w while both have data to send, on the server for the
+ * responses as here for the requests. E.g. 256 for the directives and 1 for a
+ * media download.
+ *
+ * @param[in] weight    Between NGHTTP2_MIN_WEIGHT (1) and NGHTTP2_MAX_WEIGHT (256),
+ *                      SH2LIB_DEFAULT_WEIGHT for that of the other functions.
+ */
+int sh2lib_do_get_with_nv_prio(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen,
+                               int32_t weight, void *arg);
+
 /**
  * @brief Setup an HTTP PUT/POST request stream with custom name-value pairs
  *
@@ -267,6 +405,51 @@ int sh2lib_do_putpost_with_nv(struct sh2lib_handle *hd, const nghttp2_nv *nva, s
                               nghttp2_data_source_read_callback data_prd,
                               void *arg);
 
+/**
+ * @brief Setup an HTTP PUT/POST request stream with custom name-value pairs and a weight
+ *
+ * As sh2lib_do_putpost_with_nv(), with the stream weighted as by
+ * sh2lib_do_get_with_nv_prio(): e.g. a speech upload below the directives.
+ */
+int sh2lib_do_putpost_with_nv_prio(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen,
+                                   nghttp2_data_source_read_callback data_prd,
+                                   int32_t weight, void *arg);
+
+/**
+ * @brief Setup an HTTP PUT/POST request stream whose body is read from a ring buffer
+ *
+ * As sh2lib_do_putpost_with_nv_prio(), with the body taken from 'rb' as it is
+ * written, e.g. the speech captured from the microphone, until its writer is
+ * signalled finished and it is empty. The data is not copied on the way: each
+ * DATA frame is written to the connection straight from 'rb', its header
+ * included.
+ *
+ * sh2lib_execute() sends what is in 'rb' and checks for more, so the task
+ * calling it should not wait long in sh2lib_wait_for_io() while the upload
+ * goes on. 'rb' must only be read by the upload, and its type must implement
+ * is_writer_finished() and the zero-copy read_peek().
+ *
+ * @param[in] rb        The ring buffer to read the request body from.
+ *
+ * @return
+ *             - The stream ID if the request setup is successful
+ *             - ESP_FAIL if the request setup fails
+ */
+int sh2lib_do_putpost_with_rb(struct sh2lib_handle *hd, const nghttp2_nv *nva, size_t nvlen, rb_handle_t rb,
+                              int32_t weight, void *arg);
+
+/**
+ * @brief Change the weight of a stream
+ *
+ * Sends a PRIORITY frame, e.g. to lower a download while the answer to the
+ * user is played. See sh2lib_do_get_with_nv_prio().
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] stream_id A stream whose request was sent
+ * @param[in] weight    Between NGHTTP2_MIN_WEIGHT (1) and NGHTTP2_MAX_WEIGHT (256)
+ */
+int sh2lib_set_stream_weight(struct sh2lib_handle *hd, int32_t stream_id, int32_t weight);
+
 /**
  * @brief Resume any deferred POST data
  *
@@ -277,6 +460,89 @@ int sh2lib_do_putpost_with_nv(struct sh2lib_handle *hd, const nghttp2_nv *nva, s
  */
 int sh2lib_resume_deferred_data(struct sh2lib_handle *hd, int32_t stream_id);
 
+/**
+ * @brief Download a resource into a ring buffer, on its own stream
+ *
+ * This API sets up an HTTP GET request whose response body is written into
+ * 'rb' as its DATA frames are received, from sh2lib_execute(). Any number of
+ * downloads can share the connection with the other streams, e.g. media,
+ * playlists and images from the same origin.
+ *
+ * The stream is granted as much flow-control credit as 'rb' has free space
+ * when the download starts, and given back what the reader of 'rb' takes out
+ * of it, on the next sh2lib_execute(): the server can never send more than
+ * fits. 'rb' must only be written to by the download, and its type must
+ * implement get_available().
+ *
+ * The body of a response other than 2xx is dropped. When the stream is
+ * closed, the writer of 'rb' is signalled finished and 'done_cb' is called.
+ *
+ * @param[in] hd       Pointer to a variable of the type 'struct sh2lib_handle'.
+ * @param[in] path     Pointer to the string that contains the resource to
+ *                     download (for example, /media/segment1.ts).
+ * @param[in] rb       The ring buffer to write the response body to.
+ * @param[in] done_cb  The callback function that should be called when the download ends.
+ * @param[in] arg      The argument for 'done_cb'.
+ *
+ * @return
+ *             - The stream ID if the request setup is successful
+ *             - ESP_FAIL if the request setup fails
+ */
+int sh2lib_download(struct sh2lib_handle *hd, const char *path, rb_handle_t rb,
+                    sh2lib_download_done_cb_t done_cb, void *arg);
+
+/**
+ * @brief Stop a download
+ *
+ * The stream is reset; 'done_cb' is called with NGHTTP2_CANCEL once it is
+ * closed, from sh2lib_execute().
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] stream_id The stream ID sh2lib_download() returned
+ */
+int sh2lib_download_cancel(struct sh2lib_handle *hd, int32_t stream_id);
+
+/**
+ * @brief Give a stream its own receive window, credited as the application drains it
+ *
+ * By default the data of a stream is credited back to the server as soon as
+ * data_chunk_recv_cb returns, so the server sends as fast as the application
+ * is called. After this API, the server may only have 'window' bytes in
+ * flight on the stream beyond what the application reported consumed with
+ * sh2lib_stream_consume(): it sends at the pace the consumer of the data,
+ * e.g. an audio player, takes it.
+ *
+ * It may be called as soon as sh2lib_do_get_with_nv() and co. returned the
+ * stream ID, before sh2lib_execute() sends the request. Not for downloads.
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] stream_id The stream ID
+ * @param[in] window    The receive window of the stream, more than 0
+ *
+ * @return
+ *             - ESP_OK on success
+ *             - ESP_FAIL if the stream is a download or the window is invalid
+ */
+int sh2lib_stream_set_window(struct sh2lib_handle *hd, int32_t stream_id, int32_t window);
+
+/**
+ * @brief Report data of a stream consumed, for its server to send more
+ *
+ * For a stream given its window with sh2lib_stream_set_window(). The credit
+ * goes out with the next sh2lib_execute(), once it is worth a WINDOW_UPDATE.
+ * It must be called from the task that calls sh2lib_execute(), e.g. from
+ * data_chunk_recv_cb.
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] stream_id The stream ID
+ * @param[in] len       The bytes of the stream's DATA consumed since the last call
+ *
+ * @return
+ *             - ESP_OK on success
+ *             - ESP_FAIL if the stream has no window of its own, e.g. it was closed
+ */
+int sh2lib_stream_consume(struct sh2lib_handle *hd, int32_t stream_id, size_t len);
+
 /**
  * @brief Sets packet priority to Voice access category
  *
@@ -284,4 +550,64 @@ int sh2lib_resume_deferred_data(struct sh2lib_handle *hd, int32_t stream_id);
  *
  */
 int sh2lib_set_qos_vo(struct sh2lib_handle *hd);
+
+/**
+ * @brief Get the I/O counters of a connection since it was opened
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[out] stats    The counters
+ *
+ * @return
+ *             - ESP_OK on success
+ *             - ESP_FAIL if the handle is not connected
+ */
+int sh2lib_get_stats(struct sh2lib_handle *hd, sh2lib_stats_t *stats);
+
+/**
+ * @brief Check that the connection is alive with PINGs, and measure its RTT
+ *
+ * A connection may die without a GOAWAY or a failed write, e.g. when the
+ * access point or a NAT on the way loses it. The keepalive sends a PING every
+ * 'interval_ms', from sh2lib_execute(), and sh2lib_wait_for_io() returns in
+ * time for it. Once 'max_missed' PINGs in a row got no ACK within
+ * 'timeout_ms', the connection is dead: 'dead_cb' is called and
+ * sh2lib_execute() fails, for the application to reconnect before it has
+ * something to send, rather than after.
+ *
+ * The first PING is sent on the next sh2lib_execute(). It must be called from
+ * the task that calls sh2lib_execute().
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[in] cfg       The keepalive settings, NULL for the defaults
+ *
+ * @return
+ *             - ESP_OK on success
+ *             - ESP_FAIL if the handle is not connected
+ */
+int sh2lib_keepalive_start(struct sh2lib_handle *hd, const sh2lib_keepalive_cfg_t *cfg);
+
+/**
+ * @brief Stop sending PINGs
+ *
+ * The RTT measured so far is kept. It must be called from the task that calls
+ * sh2lib_execute().
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ */
+int sh2lib_keepalive_stop(struct sh2lib_handle *hd);
+
+/**
+ * @brief Get the round-trip time of a connection, as its keepalive measured it
+ *
+ * It may be called from any task, e.g. to size a jitter buffer or a timeout
+ * after the network.
+ *
+ * @param[in] hd        Pointer to a variable of the type 'struct sh2lib_handle'
+ * @param[out] rtt      The RTT and the PINGs sent so far
+ *
+ * @return
+ *             - ESP_OK on success
+ *             - ESP_FAIL if the handle is not connected
+ */
+int sh2lib_get_rtt(struct sh2lib_handle *hd, sh2lib_rtt_t *rtt);
 #endif /* ! __ESP_EXAMPLE_SH2_LIB_H_ */
@@ -0,0 +1,434 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <nghttp2/nghttp2.h>
+
+#include "local_h2_server.h"
+
+#define MAKE_NV(NAME, VALUE) \
+    { (uint8_t *) NAME, (uint8_t *) VALUE, strlen(NAME), strlen(VALUE), NGHTTP2_NV_FLAG_NONE }
+
+typedef struct h2_stream {
+    int32_t stream_id;
+    char path[256];
+    bool responded;
+    size_t len;
+    size_t offset;
+    size_t received;            /* Of the request body */
+    char content_length[24];
+    /* For /directives */
+    int directives;             /* Left to send */
+    int interval_ms;
+    int64_t due_us;             /* Of the next one */
+    bool deferred;              /* Until then */
+    struct h2_stream *next;
+} h2_stream_t;
+
+#define PING_ACKS_MAX 4
+
+typedef struct {
+    local_h2_server_t *server;
+    int fd;
+    h2_stream_t *streams;       /* Freed when closed, or with the connection */
+    /* PINGs whose ACK is delayed */
+    struct {
+        uint8_t opaque_data[8];
+        int64_t due_us;
+    } ping_acks[PING_ACKS_MAX];
+    int ping_ack_count;
+} h2_conn_t;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static ssize_t send_cb(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t ret = send(conn->fd, data + sent, length - sent, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+        sent += ret;
+    }
+    return length;
+}
+
+static ssize_t data_read_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                            uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    h2_stream_t *st = source->ptr;
+    int32_t window = nghttp2_session_get_stream_remote_window_size(session, stream_id);
+    if (window > conn->server->max_stream_window) {
+        conn->server->max_stream_window = window;
+    }
+    size_t n = st->len - st->offset < length ? st->len - st->offset : length;
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = (st->offset + i) % LOCAL_H2_PATTERN_PERIOD;
+    }
+    st->offset += n;
+    if (st->offset == st->len) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        __sync_fetch_and_add(&conn->server->responses, 1);
+    }
+    return n;
+}
+
+static ssize_t directive_read_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                                 uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    h2_stream_t *st = source->ptr;
+    /* Resumed by the connection's task when the next one is due */
+    if (now_us() < st->due_us) {
+        st->deferred = true;
+        return NGHTTP2_ERR_DEFERRED;
+    }
+    memcpy(buf, &st->due_us, sizeof(st->due_us));
+    st->due_us += st->interval_ms * 1000;
+    if (--st->directives == 0) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        __sync_fetch_and_add(&conn->server->responses, 1);
+    }
+    return sizeof(st->due_us);
+}
+
+static int respond(nghttp2_session *session, h2_conn_t *conn, int32_t stream_id, h2_stream_t *st)
+{
+    conn->server->max_frame_size = nghttp2_session_get_remote_settings(session, NGHTTP2_SETTINGS_MAX_FRAME_SIZE);
+    st->responded = true;
+    nghttp2_data_provider prd = {
+        .source.ptr = st,
+        .read_callback = data_read_cb,
+    };
+    if (sscanf(st->path, "/directives/%d/%d", &st->directives, &st->interval_ms) == 2 && st->directives > 0) {
+        st->due_us = now_us() + st->interval_ms * 1000;
+        prd.read_callback = directive_read_cb;
+        const nghttp2_nv nva[] = { MAKE_NV(":status", "200") };
+        return nghttp2_submit_response(session, stream_id, nva, 1, &prd);
+    }
+    if (strncmp(st->path, "/data/", 6) == 0 || strncmp(st->path, "/speech/", 8) == 0) {
+        st->len = strtoul(strchr(st->path + 1, '/') + 1, NULL, 10);
+        snprintf(st->content_length, sizeof(st->content_length), "%zu", st->len);
+        const nghttp2_nv nva[] = { MAKE_NV(":status", "200"), MAKE_NV("content-length", st->content_length) };
+        return nghttp2_submit_response(session, stream_id, nva, 2, &prd);
+    }
+    if (strcmp(st->path, "/upload") == 0) {
+        const nghttp2_nv nva[] = { MAKE_NV(":status", "200"), MAKE_NV("content-length", "0") };
+        return nghttp2_submit_response(session, stream_id, nva, 2, NULL);
+    }
+    /* With a body, for the client to drop */
+    st->len = 64;
+    snprintf(st->content_length, sizeof(st->content_length), "%zu", st->len);
+    const nghttp2_nv nva[] = { MAKE_NV(":status", "404"), MAKE_NV("content-length", st->content_length) };
+    return nghttp2_submit_response(session, stream_id, nva, 2, &prd);
+}
+
+static int begin_headers_cb(nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+        h2_conn_t *conn = user_data;
+        h2_stream_t *st = calloc(1, sizeof(*st));
+        if (!st) {
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+        st->stream_id = frame->hd.stream_id;
+        st->next = conn->streams;
+        conn->streams = st;
+        nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, st);
+    }
+    return 0;
+}
+
+static int header_cb(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+                     const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+    h2_stream_t *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (st && namelen == 5 && memcmp(name, ":path", 5) == 0) {
+        snprintf(st->path, sizeof(st->path), "%.*s", (int) valuelen, value);
+    }
+    return 0;
+}
+
+static int frame_recv_cb(nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    local_h2_server_t *s = conn->server;
+    if (frame->hd.type == NGHTTP2_PING && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+        __sync_fetch_and_add(&s->pings, 1);
+        if (s->ping_ack_drop || conn->ping_ack_count == PING_ACKS_MAX) {
+            return 0;
+        }
+        if (!s->ping_ack_delay_ms) {
+            return nghttp2_submit_ping(session, NGHTTP2_FLAG_ACK, frame->ping.opaque_data);
+        }
+        memcpy(conn->ping_acks[conn->ping_ack_count].opaque_data, frame->ping.opaque_data, 8);
+        conn->ping_acks[conn->ping_ack_count++].due_us = now_us() + s->ping_ack_delay_ms * 1000;
+        return 0;
+    }
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+        conn->server->weight = frame->headers.pri_spec.weight;
+    } else if (frame->hd.type == NGHTTP2_PRIORITY) {
+        conn->server->weight = frame->priority.pri_spec.weight;
+    }
+    if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) {
+        return 0;
+    }
+    h2_stream_t *st = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!st || st->responded) {
+        return 0;
+    }
+    /* The answer to speech starts before the end of the upload */
+    if (((frame->hd.flags & NGHTTP2_FLAG_END_STREAM) || strncmp(st->path, "/speech/", 8) == 0) &&
+            respond(session, conn, frame->hd.stream_id, st) != 0) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
+static int data_chunk_recv_cb(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data,
+                              size_t len, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    __sync_fetch_and_add(&conn->server->uploaded, len);
+    h2_stream_t *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (st && strcmp(st->path, "/upload") == 0) {
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] != (st->received + i) % LOCAL_H2_PATTERN_PERIOD) {
+                __sync_fetch_and_add(&conn->server->upload_errors, 1);
+                break;
+            }
+        }
+    }
+    if (st) {
+        st->received += len;
+    }
+    return 0;
+}
+
+/* Resume the directives which are due. Returns the ms until one is to be sent, or -1. */
+static int resume_directives(nghttp2_session *session, h2_conn_t *conn)
+{
+    int64_t now = now_us();
+    int timeout_ms = -1;
+    for (h2_stream_t *st = conn->streams; st; st = st->next) {
+        if (!st->deferred) {
+            continue;
+        }
+        if (st->due_us <= now) {
+            st->deferred = false;
+            nghttp2_session_resume_data(session, st->stream_id);
+            timeout_ms = 0;
+            continue;
+        }
+        int ms = (st->due_us - now + 999) / 1000;
+        if (timeout_ms < 0 || ms < timeout_ms) {
+            timeout_ms = ms;
+        }
+    }
+    return timeout_ms;
+}
+
+/* Send the PING ACKs which are due. Returns the ms until one is to be sent, or -1. */
+static int send_ping_acks(nghttp2_session *session, h2_conn_t *conn)
+{
+    int64_t now = now_us();
+    int timeout_ms = -1;
+    for (int i = 0; i < conn->ping_ack_count;) {
+        if (conn->ping_acks[i].due_us <= now) {
+            nghttp2_submit_ping(session, NGHTTP2_FLAG_ACK, conn->ping_acks[i].opaque_data);
+            conn->ping_acks[i] = conn->ping_acks[--conn->ping_ack_count];
+            timeout_ms = 0;
+            continue;
+        }
+        int ms = (conn->ping_acks[i].due_us - now + 999) / 1000;
+        if (timeout_ms < 0 || ms < timeout_ms) {
+            timeout_ms = ms;
+        }
+        i++;
+    }
+    return timeout_ms;
+}
+
+static int stream_close_cb(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    h2_conn_t *conn = user_data;
+    h2_stream_t *st = nghttp2_session_get_stream_user_data(session, stream_id);
+    for (h2_stream_t **p = &conn->streams; *p; p = &(*p)->next) {
+        if (*p == st) {
+            *p = st->next;
+            free(st);
+            break;
+        }
+    }
+    return 0;
+}
+
+static void *h2_conn_task(void *arg)
+{
+    h2_conn_t *conn = arg;
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_send_callback(callbacks, send_cb);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, begin_headers_cb);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, header_cb);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, frame_recv_cb);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, stream_close_cb);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, data_chunk_recv_cb);
+    /* For the PING ACKs to be delayed, or dropped */
+    nghttp2_option *option;
+    nghttp2_option_new(&option);
+    nghttp2_option_set_no_auto_ping_ack(option, 1);
+    nghttp2_session *session;
+    int rv = nghttp2_session_server_new2(&session, callbacks, conn, option);
+    nghttp2_option_del(option);
+    if (rv == 0) {
+        const nghttp2_settings_entry iv[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100 } };
+        nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, iv, 1);
+        uint8_t buf[16384];
+        /* Blocking: whatever can be sent is, then wait for the client or the next directive */
+        while (nghttp2_session_want_read(session) || nghttp2_session_want_write(session)) {
+            if (nghttp2_session_send(session) != 0) {
+                break;
+            }
+            int timeout_ms = resume_directives(session, conn);
+            int ping_timeout_ms = send_ping_acks(session, conn);
+            if (timeout_ms < 0 || (ping_timeout_ms >= 0 && ping_timeout_ms < timeout_ms)) {
+                timeout_ms = ping_timeout_ms;
+            }
+            struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0 && errno != EINTR) {
+                break;
+            }
+            if (ready <= 0) {
+                continue;
+            }
+            ssize_t ret = recv(conn->fd, buf, sizeof(buf), 0);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0 || nghttp2_session_mem_recv(session, buf, ret) < 0) {
+                break;
+            }
+        }
+        nghttp2_session_del(session);
+    }
+    while (conn->streams) {
+        h2_stream_t *st = conn->streams;
+        conn->streams = st->next;
+        free(st);
+    }
+    nghttp2_session_callbacks_del(callbacks);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static void *local_h2_accept_task(void *arg)
+{
+    local_h2_server_t *s = arg;
+    while (1) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        h2_conn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->server = s;
+        conn->fd = fd;
+        __sync_fetch_and_add(&s->connections, 1);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, h2_conn_task, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int local_h2_server_start(local_h2_server_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    /* A client closing on us must not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->listen_fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = 0,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(s->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(s->listen_fd, 16) != 0 ||
+            getsockname(s->listen_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+        close(s->listen_fd);
+        return -1;
+    }
+    s->port = ntohs(addr.sin_port);
+    if (pthread_create(&s->thread, NULL, local_h2_accept_task, s) != 0) {
+        close(s->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void local_h2_server_stop(local_h2_server_t *s)
+{
+    shutdown(s->listen_fd, SHUT_RDWR);
+    close(s->listen_fd);
+    pthread_join(s->thread, NULL);
+}
+
+void local_h2_server_url(local_h2_server_t *s, const char *path, char *url, size_t url_len)
+{
+    snprintf(url, url_len, "http://127.0.0.1:%d%s", s->port, path);
+}
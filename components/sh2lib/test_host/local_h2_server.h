@@ -0,0 +1,66 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* A minimal in-process HTTP/2 server on 127.0.0.1 for the offline sh2lib
+ * tests, on top of nghttp2. It speaks h2c with prior knowledge, so that no
+ * TLS is needed, and every connection is served by its own thread.
+ *
+ *     GET /data/<n>    200, a body of <n> bytes: the byte at offset `i` is `i % 251`
+ *     POST /speech/<n> 200 as soon as the request starts, with a body of <n> bytes
+ *                      of the same pattern, sent while the request body is still
+ *                      coming in; that is dropped
+ *     GET /directives/<count>/<interval_ms>
+ *                      200, then <count> directives of 8 bytes, one every
+ *                      <interval_ms>: the CLOCK_MONOTONIC time it was due at, in
+ *                      microseconds, in host byte order
+ *     POST /upload     200 with an empty body at the end of the request, whose body
+ *                      is checked against the pattern
+ *     anything else    404, with a body of 64 bytes of the same pattern
+ *
+ * PINGs are answered after `ping_ack_delay_ms`, or not at all with `ping_ack_drop`.
+ */
+
+#define LOCAL_H2_PATTERN_PERIOD 251
+
+typedef struct {
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    volatile int connections;       /* Accepted so far */
+    volatile int responses;         /* Responses whose body was sent whole */
+    volatile int max_stream_window; /* Largest stream window a client granted, when sending DATA */
+    volatile int weight;            /* Of the last request HEADERS or PRIORITY frame received */
+    volatile int max_frame_size;    /* The SETTINGS_MAX_FRAME_SIZE of the last client to get a response */
+    volatile size_t uploaded;       /* Request body bytes received */
+    volatile int upload_errors;     /* /upload DATA frames which were not the pattern */
+    volatile int pings;             /* PINGs received */
+    volatile int ping_ack_delay_ms;
+    volatile bool ping_ack_drop;
+} local_h2_server_t;
+
+/* Listen on an ephemeral port of 127.0.0.1. Returns 0 on success. */
+int local_h2_server_start(local_h2_server_t *s);
+
+/* Stop accepting. Connections which are still open finish on their own. */
+void local_h2_server_stop(local_h2_server_t *s);
+
+/* Writes the "http://127.0.0.1:<port><path>" URL of the server */
+void local_h2_server_url(local_h2_server_t *s, const char *path, char *url, size_t url_len);
@@ -0,0 +1,1047 @@
+// Copyright 2017-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/* sh2lib tests which need no network: the HTTP/2 server is a thread of this
+ * process, listening on 127.0.0.1, and spoken to over h2c.
+ *
+ *     test_sh2lib_local         run the tests
+ *     test_sh2lib_local BENCH   run the benchmarks instead
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sh2lib.h>
+#include <abstract_rb.h>
+#include "local_h2_server.h"
+
+static local_h2_server_t server;
+static int failures;
+
+/* What the application callbacks saw: the streams other than downloads */
+static struct {
+    size_t bytes;
+    int closed;
+    void *user_data;
+    void *read_user_data;       /* What the read callback of a POST got */
+    int32_t consume_sid;        /* Credited by the callback, see sh2lib_stream_set_window() */
+} app;
+
+typedef struct {
+    rb_handle_t rb;
+    int32_t stream_id;
+    bool reader;
+    pthread_t thread;
+    unsigned delay_us;          /* After each read, for a slow reader */
+    size_t received;
+    bool corrupt;
+    /* From the done callback */
+    bool done;
+    int status;
+    uint32_t error_code;
+} download_t;
+
+static int check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("Fail\n");
+        printf("Expected %s\n", what);
+        failures++;
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int app_header_cb(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+                         const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+    return 0;
+}
+
+static int app_data_cb(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len,
+                       void *user_data)
+{
+    app.bytes += len;
+    app.user_data = user_data;
+    if (stream_id == app.consume_sid) {
+        sh2lib_stream_consume(user_data, stream_id, len);
+    }
+    return 0;
+}
+
+/* A body of 1000 bytes of the pattern, as the prebuilt libraries post through sh2lib_do_post() */
+static ssize_t app_post_read_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                                uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    size_t n = length < 1000 ? length : 1000;
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = i % LOCAL_H2_PATTERN_PERIOD;
+    }
+    app.read_user_data = user_data;
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return n;
+}
+
+static int app_stream_close_cb(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    app.closed++;
+    return 0;
+}
+
+static int connect_local_cfg(struct sh2lib_handle *hd, const sh2lib_config_t *cfg)
+{
+    char url[64];
+    local_h2_server_url(&server, "", url, sizeof(url));
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    memset(&app, 0, sizeof(app));
+    return sh2lib_connect_with_config(hd, url, app_header_cb, app_data_cb, app_stream_close_cb, NULL, &tls_cfg, cfg);
+}
+
+static int connect_local(struct sh2lib_handle *hd)
+{
+    return connect_local_cfg(hd, NULL);
+}
+
+static void *reader_task(void *arg)
+{
+    download_t *dl = arg;
+    uint8_t buf[1024];
+    int ret;
+    while ((ret = arb_read(dl->rb, buf, sizeof(buf), portMAX_DELAY)) > 0) {
+        for (int i = 0; i < ret; i++) {
+            if (buf[i] != (dl->received + i) % LOCAL_H2_PATTERN_PERIOD) {
+                dl->corrupt = true;
+            }
+        }
+        dl->received += ret;
+        if (dl->delay_us) {
+            usleep(dl->delay_us);
+        }
+    }
+    return NULL;
+}
+
+static void download_done_cb(struct sh2lib_handle *hd, int32_t stream_id, int status, uint32_t error_code, void *arg)
+{
+    download_t *dl = arg;
+    dl->status = status;
+    dl->error_code = error_code;
+    dl->done = true;
+}
+
+/* Download `path` into a ring buffer of `rb_size`, read by a thread unless `delay_us` is -1 */
+static int download_start(struct sh2lib_handle *hd, download_t *dl, const char *path, int rb_size, int delay_us)
+{
+    memset(dl, 0, sizeof(*dl));
+    abstract_rb_cfg_t cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    dl->rb = arb_init("download", rb_size, cfg);
+    if (!dl->rb) {
+        return -1;
+    }
+    dl->stream_id = sh2lib_download(hd, path, dl->rb, download_done_cb, dl);
+    if (dl->stream_id < 0) {
+        return -1;
+    }
+    if (delay_us >= 0) {
+        dl->delay_us = delay_us;
+        dl->reader = pthread_create(&dl->thread, NULL, reader_task, dl) == 0;
+    }
+    return 0;
+}
+
+static void download_end(download_t *dl)
+{
+    if (!dl->done) {
+        arb_abort(dl->rb);
+    }
+    if (dl->reader) {
+        pthread_join(dl->thread, NULL);
+    }
+    arb_deinit(dl->rb);
+}
+
+/* Run the session until the downloads are done and `app_closed` other streams closed */
+static int run(struct sh2lib_handle *hd, download_t *dls, int count, int app_closed)
+{
+    int64_t deadline = now_ms() + 10000;
+    while (1) {
+        bool done = app.closed >= app_closed;
+        for (int i = 0; i < count; i++) {
+            done = done && dls[i].done;
+        }
+        if (done) {
+            return 0;
+        }
+        if (now_ms() > deadline) {
+            return -1;
+        }
+        sh2lib_wait_for_io(hd, 0, 10);
+        if (sh2lib_execute(hd) != 0) {
+            return -1;
+        }
+    }
+}
+
+static void test_download(void)
+{
+    printf("test: download into a ring buffer smaller than the body ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    server.max_stream_window = 0;
+    download_t dl;
+    if (check(download_start(&hd, &dl, "/data/300000", 16384, 200) == 0, "sh2lib_download() to succeed")) {
+        goto out;
+    }
+    int ret = run(&hd, &dl, 1, 0);
+    download_end(&dl);
+    if (check(ret == 0 && dl.status == 200 && dl.error_code == NGHTTP2_NO_ERROR, "status 200, no error") ||
+            check(dl.received == 300000 && !dl.corrupt, "the whole body") ||
+            check(server.max_stream_window > 0 && server.max_stream_window <= 16384,
+                  "no more credit than the ring buffer has room")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_multiplex(void)
+{
+    static const struct {
+        const char *path;
+        size_t len;
+        int rb_size;
+        int delay_us;
+    } d[] = {
+        {"/data/100000", 100000, 32768, 0},
+        {"/data/50000", 50000, 8192, 100},
+        {"/data/200000", 200000, 65536, 0},
+    };
+    const int count = sizeof(d) / sizeof(d[0]);
+
+    printf("test: downloads and another stream on one connection ....");
+    int conns = server.connections;
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    download_t dls[count];
+    int started = 0;
+    for (; started < count; started++) {
+        if (download_start(&hd, &dls[started], d[started].path, d[started].rb_size, d[started].delay_us) != 0) {
+            break;
+        }
+    }
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/data/30000"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    const nghttp2_nv post_nva[] = { SH2LIB_MAKE_NV(":method", "POST"),
+                                    SH2LIB_MAKE_NV(":scheme", "http"),
+                                    SH2LIB_MAKE_NV(":path", "/upload"),
+                                    SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                                  };
+    int upload_errors = server.upload_errors;
+    if (check(started == count, "sh2lib_download() to succeed") ||
+            check(sh2lib_do_get_with_nv(&hd, nva, 4, NULL) > 0, "sh2lib_do_get_with_nv() to succeed") ||
+            check(sh2lib_do_putpost_with_nv(&hd, post_nva, 4, app_post_read_cb, NULL) > 0,
+                  "sh2lib_do_putpost_with_nv() to succeed") ||
+            check(run(&hd, dls, count, 2) == 0, "all the streams to end")) {
+        goto out;
+    }
+    for (int i = 0; i < count; i++) {
+        download_end(&dls[i]);
+    }
+    started = 0;
+    for (int i = 0; i < count; i++) {
+        if (check(dls[i].status == 200 && dls[i].received == d[i].len && !dls[i].corrupt, "every body whole")) {
+            goto out;
+        }
+    }
+    if (check(app.bytes == 30000, "the other stream to the application's callbacks") ||
+            check(app.user_data == &hd, "the handle as the user data of the application's callbacks") ||
+            check(app.read_user_data == &hd, "the handle as the user data of the read callback of a POST") ||
+            check(server.upload_errors == upload_errors, "the POST body intact") ||
+            check(server.connections == conns + 1, "a single connection")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    for (int i = 0; i < started; i++) {
+        download_end(&dls[i]);
+    }
+    sh2lib_free(&hd);
+}
+
+static void test_download_not_found(void)
+{
+    printf("test: download, 404 ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    download_t dl;
+    if (check(download_start(&hd, &dl, "/missing", 4096, 0) == 0, "sh2lib_download() to succeed")) {
+        goto out;
+    }
+    int ret = run(&hd, &dl, 1, 0);
+    download_end(&dl);
+    if (check(ret == 0 && dl.status == 404, "status 404") ||
+            check(dl.received == 0, "the body dropped")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_download_cancel(void)
+{
+    printf("test: download, cancelled ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    /* Nobody reads: it stops when the ring buffer is full */
+    download_t dl;
+    if (check(download_start(&hd, &dl, "/data/1000000", 8192, -1) == 0, "sh2lib_download() to succeed")) {
+        goto out;
+    }
+    int64_t deadline = now_ms() + 5000;
+    while (arb_get_filled(dl.rb) < 8192 && now_ms() < deadline) {
+        sh2lib_wait_for_io(&hd, 0, 10);
+        sh2lib_execute(&hd);
+    }
+    if (check(arb_get_filled(dl.rb) == 8192 && !dl.done, "a full ring buffer") ||
+            check(sh2lib_download_cancel(&hd, dl.stream_id) == 0, "sh2lib_download_cancel() to succeed") ||
+            check(run(&hd, &dl, 1, 0) == 0 && dl.error_code == NGHTTP2_CANCEL, "NGHTTP2_CANCEL") ||
+            check(sh2lib_download_cancel(&hd, dl.stream_id) != 0, "no download to cancel any more")) {
+        download_end(&dl);
+        goto out;
+    }
+    download_end(&dl);
+
+    /* The session goes on */
+    if (check(download_start(&hd, &dl, "/data/20000", 8192, 0) == 0, "sh2lib_download() to succeed")) {
+        goto out;
+    }
+    int ret = run(&hd, &dl, 1, 0);
+    download_end(&dl);
+    if (check(ret == 0 && dl.received == 20000 && !dl.corrupt, "the next download whole")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_free_with_downloads(void)
+{
+    printf("test: download, handle freed first ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    download_t dl;
+    if (check(download_start(&hd, &dl, "/data/1000000", 8192, -1) == 0, "sh2lib_download() to succeed")) {
+        sh2lib_free(&hd);
+        return;
+    }
+    for (int i = 0; i < 5; i++) {
+        sh2lib_wait_for_io(&hd, 0, 10);
+        sh2lib_execute(&hd);
+    }
+    sh2lib_free(&hd);
+    download_end(&dl);
+    if (check(dl.done && dl.error_code == NGHTTP2_CANCEL, "NGHTTP2_CANCEL")) {
+        return;
+    }
+    printf("Success\n");
+}
+
+static void test_config(void)
+{
+    printf("test: stream window and max frame size of the config ....");
+    struct sh2lib_handle hd;
+    const sh2lib_config_t bad_cfg = { .stream_window = -1 };
+    if (check(connect_local_cfg(&hd, &bad_cfg) != 0, "a negative window refused")) {
+        sh2lib_free(&hd);
+        return;
+    }
+    const sh2lib_config_t cfg = { .stream_window = 8192, .max_frame_size = 32768 };
+    if (check(connect_local_cfg(&hd, &cfg) == 0, "a connection")) {
+        return;
+    }
+    server.max_stream_window = 0;
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/data/100000"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    if (check(sh2lib_do_get_with_nv(&hd, nva, 4, NULL) > 0, "sh2lib_do_get_with_nv() to succeed") ||
+            check(run(&hd, NULL, 0, 1) == 0, "the stream to end") ||
+            check(app.bytes == 100000, "the whole body") ||
+            check(server.max_stream_window > 0 && server.max_stream_window <= 8192, "at most 8192 bytes of credit") ||
+            check(server.max_frame_size == 32768, "the max frame size in the SETTINGS")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_stream_window(void)
+{
+    printf("test: stream credited as the application consumes it ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    server.max_stream_window = 0;
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/data/200000"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    int32_t stream_id = sh2lib_do_get_with_nv(&hd, nva, 4, NULL);
+    if (check(stream_id > 0, "sh2lib_do_get_with_nv() to succeed") ||
+            check(sh2lib_stream_set_window(&hd, stream_id, 4096) == 0, "sh2lib_stream_set_window() to succeed")) {
+        goto out;
+    }
+    /* Nothing consumed yet: the server stops at the window */
+    int64_t deadline = now_ms() + 200;
+    while (now_ms() < deadline) {
+        sh2lib_wait_for_io(&hd, 0, 10);
+        sh2lib_execute(&hd);
+    }
+    if (check(app.bytes == 4096, "the server to stop at the window")) {
+        goto out;
+    }
+    app.consume_sid = stream_id;
+    if (check(sh2lib_stream_consume(&hd, stream_id, app.bytes) == 0, "sh2lib_stream_consume() to succeed") ||
+            check(run(&hd, NULL, 0, 1) == 0, "the stream to end") ||
+            check(app.bytes == 200000, "the whole body") ||
+            check(server.max_stream_window <= 4096, "at most 4096 bytes of credit") ||
+            check(sh2lib_stream_consume(&hd, stream_id, 1) != 0, "no window once the stream is closed")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_priority(void)
+{
+    printf("test: stream weights ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    server.weight = 0;
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/directives/3/50"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    int32_t stream_id = sh2lib_do_get_with_nv_prio(&hd, nva, 4, 200, NULL);
+    if (check(stream_id > 0, "sh2lib_do_get_with_nv_prio() to succeed")) {
+        goto out;
+    }
+    int64_t deadline = now_ms() + 1000;
+    while (server.weight != 200 && now_ms() < deadline) {
+        sh2lib_wait_for_io(&hd, 0, 10);
+        sh2lib_execute(&hd);
+    }
+    if (check(server.weight == 200, "the weight in the HEADERS") ||
+            check(sh2lib_set_stream_weight(&hd, stream_id, 7) == 0, "sh2lib_set_stream_weight() to succeed") ||
+            check(run(&hd, NULL, 0, 1) == 0, "the stream to end") ||
+            check(server.weight == 7, "the weight in a PRIORITY frame") ||
+            check(app.bytes == 3 * sizeof(int64_t), "3 directives")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_send_coalesced(void)
+{
+    printf("test: frames of one run written together ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection") ||
+            check(sh2lib_execute(&hd) == 0, "the connection preface sent")) {
+        goto out;
+    }
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/data/10"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    sh2lib_stats_t start, end;
+    sh2lib_get_stats(&hd, &start);
+    for (int i = 0; i < 3; i++) {
+        sh2lib_do_get_with_nv(&hd, nva, 4, NULL);
+    }
+    if (check(sh2lib_execute(&hd) == 0, "sh2lib_execute() to succeed")) {
+        goto out;
+    }
+    sh2lib_get_stats(&hd, &end);
+    if (check(end.frames_sent - start.frames_sent >= 3, "3 HEADERS sent") ||
+            check(end.writes - start.writes == 1, "a single write") ||
+            check(run(&hd, NULL, 0, 3) == 0, "the streams to end") ||
+            check(app.bytes == 30, "the bodies")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    sh2lib_free(&hd);
+}
+
+static void test_keepalive_rtt(void)
+{
+    printf("test: keepalive RTT ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    server.ping_ack_delay_ms = 20;
+    const sh2lib_keepalive_cfg_t cfg = { .interval_ms = 50, .timeout_ms = 500 };
+    sh2lib_rtt_t rtt;
+    if (check(sh2lib_keepalive_start(&hd, &cfg) == 0, "sh2lib_keepalive_start() to succeed")) {
+        goto out;
+    }
+    /* Woken up for the PINGs, though there is nothing else to do */
+    int64_t deadline = now_ms() + 500;
+    while (now_ms() < deadline && sh2lib_wait_for_io(&hd, 5, 0) >= 0 && sh2lib_execute(&hd) == 0) {
+    }
+    if (check(sh2lib_get_rtt(&hd, &rtt) == 0, "sh2lib_get_rtt() to succeed") ||
+            check(rtt.acks >= 5 && rtt.acks <= rtt.pings, "a PING every 50 ms answered") ||
+            check(rtt.srtt_us >= 20000 && rtt.srtt_us < 200000, "the smoothed RTT of the delay") ||
+            check(rtt.p50_us >= 20000 && rtt.p50_us <= rtt.p90_us && rtt.p90_us <= rtt.p99_us, "the percentiles") ||
+            check(!rtt.dead && rtt.missed == 0, "the connection alive")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    server.ping_ack_delay_ms = 0;
+    sh2lib_free(&hd);
+}
+
+static void dead_cb(struct sh2lib_handle *hd, void *arg)
+{
+    (*(int *) arg)++;
+}
+
+static void test_keepalive_dead(void)
+{
+    printf("test: keepalive, PING ACKs lost ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    int dead = 0;
+    const sh2lib_keepalive_cfg_t cfg = { .interval_ms = 50, .timeout_ms = 100, .max_missed = 3,
+                                         .dead_cb = dead_cb, .arg = &dead
+                                       };
+    sh2lib_rtt_t rtt;
+    if (check(sh2lib_keepalive_start(&hd, &cfg) == 0, "sh2lib_keepalive_start() to succeed")) {
+        goto out;
+    }
+    int64_t deadline = now_ms() + 1000;
+    while (now_ms() < deadline && sh2lib_get_rtt(&hd, &rtt) == 0 && rtt.acks == 0 &&
+            sh2lib_wait_for_io(&hd, 5, 0) >= 0 && sh2lib_execute(&hd) == 0) {
+    }
+    if (check(rtt.acks == 1, "the first PING answered")) {
+        goto out;
+    }
+    server.ping_ack_drop = true;
+    int64_t start = now_ms();
+    while (now_ms() < start + 2000 && sh2lib_wait_for_io(&hd, 5, 0) >= 0 && sh2lib_execute(&hd) == 0) {
+    }
+    int64_t elapsed = now_ms() - start;
+    if (check(dead == 1, "the dead callback called once") ||
+            check(sh2lib_execute(&hd) != 0, "sh2lib_execute() to fail from then on") ||
+            check(dead == 1, "the dead callback not called again") ||
+            check(sh2lib_get_rtt(&hd, &rtt) == 0 && rtt.dead && rtt.missed == 3, "3 PINGs missed") ||
+            check(elapsed >= 300 && elapsed < 1000, "the connection dead after 3 timeouts")) {
+        goto out;
+    }
+    printf("Success\n");
+out:
+    server.ping_ack_drop = false;
+    sh2lib_free(&hd);
+}
+
+typedef struct {
+    rb_handle_t rb;
+    size_t len;
+    size_t frame;               /* Written at a time */
+    unsigned delay_us;          /* After each */
+} writer_t;
+
+/* Writes `len` bytes of the pattern, then signals it is done */
+static void *writer_task(void *arg)
+{
+    writer_t *w = arg;
+    uint8_t buf[1024];
+    size_t written = 0;
+    while (written < w->len) {
+        size_t n = w->len - written < w->frame ? w->len - written : w->frame;
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = (written + i) % LOCAL_H2_PATTERN_PERIOD;
+        }
+        if (arb_write(w->rb, buf, n, portMAX_DELAY) != n) {
+            break;
+        }
+        written += n;
+        if (w->delay_us) {
+            usleep(w->delay_us);
+        }
+    }
+    arb_signal_writer_finished(w->rb);
+    return NULL;
+}
+
+static void test_upload(void)
+{
+    printf("test: upload from a ring buffer smaller than the body ....");
+    struct sh2lib_handle hd;
+    if (check(connect_local(&hd) == 0, "a connection")) {
+        return;
+    }
+    abstract_rb_cfg_t cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    writer_t w = { .rb = arb_init("upload", 4096, cfg), .len = 100000, .frame = 1000, .delay_us = 1000 };
+    pthread_t thread;
+    if (check(w.rb != NULL, "a ring buffer")) {
+        goto out;
+    }
+    if (check(pthread_create(&thread, NULL, writer_task, &w) == 0, "a writer")) {
+        arb_deinit(w.rb);
+        goto out;
+    }
+    server.upload_errors = 0;
+    size_t uploaded = server.uploaded;
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "POST"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/upload"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    bool ok = !check(sh2lib_do_putpost_with_rb(&hd, nva, 4, w.rb, SH2LIB_DEFAULT_WEIGHT, NULL) > 0,
+                     "sh2lib_do_putpost_with_rb() to succeed") &&
+              !check(run(&hd, NULL, 0, 1) == 0, "the stream to end") &&
+              !check(server.uploaded - uploaded == w.len, "the whole body uploaded") &&
+              !check(server.upload_errors == 0, "the body uploaded as written");
+    pthread_join(thread, NULL);
+    arb_deinit(w.rb);
+    if (ok) {
+        printf("Success\n");
+    }
+out:
+    sh2lib_free(&hd);
+}
+
+/* What the callbacks of the bench saw */
+static struct {
+    int32_t speech_sid;
+    int32_t directives_sid;
+    bool consume;               /* The answer has a window of its own, credited as it is played */
+    unsigned us_per_kb;         /* To decode and play the answer */
+    size_t upload_left;
+    bool events;                /* Answer each directive with an event */
+    rb_handle_t upload_rb;
+    bool upload_deferred;
+    size_t answer;
+    uint8_t directive[sizeof(int64_t)];
+    size_t directive_len;
+    int64_t latencies_us[256];
+    int count;
+    int closed;
+} b;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* The body of an event: 64 bytes of the pattern */
+static ssize_t bench_event_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                              uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    size_t n = length < 64 ? length : 64;
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = i % LOCAL_H2_PATTERN_PERIOD;
+    }
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return n;
+}
+
+static int bench_data_cb(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len,
+                         void *user_data)
+{
+    if (stream_id == b.speech_sid) {
+        usleep(len * b.us_per_kb / 1024);
+        b.answer += len;
+        if (b.consume) {
+            sh2lib_stream_consume(user_data, stream_id, len);
+        }
+        return 0;
+    }
+    /* A directive holds the time it was due at */
+    while (stream_id == b.directives_sid && len) {
+        size_t n = sizeof(b.directive) - b.directive_len < len ? sizeof(b.directive) - b.directive_len : len;
+        memcpy(b.directive + b.directive_len, data, n);
+        b.directive_len += n;
+        data += n;
+        len -= n;
+        if (b.directive_len == sizeof(b.directive)) {
+            int64_t due_us;
+            memcpy(&due_us, b.directive, sizeof(due_us));
+            if (b.count < sizeof(b.latencies_us) / sizeof(b.latencies_us[0])) {
+                b.latencies_us[b.count++] = now_us() - due_us;
+            }
+            b.directive_len = 0;
+            if (b.events) {
+                static const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "POST"),
+                                                  SH2LIB_MAKE_NV(":scheme", "http"),
+                                                  SH2LIB_MAKE_NV(":path", "/upload"),
+                                                  SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                                                };
+                sh2lib_do_putpost_with_nv(user_data, nva, 4, bench_event_cb, NULL);
+            }
+        }
+    }
+    return 0;
+}
+
+static int bench_stream_close_cb(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    b.closed++;
+    return 0;
+}
+
+static ssize_t bench_upload_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                               uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    size_t n = b.upload_left < length ? b.upload_left : length;
+    memset(buf, 0x55, n);
+    b.upload_left -= n;
+    if (!b.upload_left) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return n;
+}
+
+/* The copying way to upload from a ring buffer, for bench_upload() */
+static ssize_t bench_upload_rb_cb(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                                  uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    bool finished = arb_is_writer_finished(b.upload_rb) == 1;
+    if (arb_get_filled(b.upload_rb) > 0) {
+        return arb_read(b.upload_rb, buf, length, 0);
+    }
+    if (finished) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return 0;
+    }
+    b.upload_deferred = true;
+    return NGHTTP2_ERR_DEFERRED;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Directives, one every 20 ms, while speech is uploaded and its answer
+ * streamed back, on one connection. The answer is played at about 1 MB/s:
+ * the directives queued behind it wait for it.
+ */
+static void bench_directives(bool window, bool weights)
+{
+    const int count = 50, interval_ms = 20;
+    const size_t upload_len = 512 * 1024, answer_len = 2 * 1024 * 1024;
+    memset(&b, 0, sizeof(b));
+    b.consume = window;
+    b.us_per_kb = 1000;
+    b.upload_left = upload_len;
+
+    struct sh2lib_handle hd;
+    char url[64], directives_path[64], speech_path[64];
+    local_h2_server_url(&server, "", url, sizeof(url));
+    snprintf(directives_path, sizeof(directives_path), "/directives/%d/%d", count, interval_ms);
+    snprintf(speech_path, sizeof(speech_path), "/speech/%zu", answer_len);
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    if (sh2lib_connect(&hd, url, app_header_cb, bench_data_cb, bench_stream_close_cb, NULL, &tls_cfg) != 0) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    const nghttp2_nv directives_nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                                          SH2LIB_MAKE_NV(":scheme", "http"),
+                                          SH2LIB_MAKE_NV(":path", directives_path),
+                                          SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                                        };
+    const nghttp2_nv speech_nva[] = { SH2LIB_MAKE_NV(":method", "POST"),
+                                      SH2LIB_MAKE_NV(":scheme", "http"),
+                                      SH2LIB_MAKE_NV(":path", speech_path),
+                                      SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                                    };
+    b.directives_sid = sh2lib_do_get_with_nv_prio(&hd, directives_nva, 4,
+                       weights ? NGHTTP2_MAX_WEIGHT : SH2LIB_DEFAULT_WEIGHT, NULL);
+    b.speech_sid = sh2lib_do_putpost_with_nv_prio(&hd, speech_nva, 4, bench_upload_cb,
+                   weights ? NGHTTP2_MIN_WEIGHT : SH2LIB_DEFAULT_WEIGHT, NULL);
+    if (window) {
+        sh2lib_stream_set_window(&hd, b.speech_sid, 8192);
+    }
+    int64_t start = now_us();
+    int64_t deadline = now_ms() + 30000;
+    while (b.closed < 2 && now_ms() < deadline) {
+        sh2lib_wait_for_io(&hd, 0, 10);
+        if (sh2lib_execute(&hd) != 0) {
+            break;
+        }
+    }
+    int64_t elapsed = now_us() - start;
+    sh2lib_free(&hd);
+    if (b.count != count || b.answer != answer_len || b.upload_left) {
+        printf("Failed: %d directives, %zu bytes of answer\n", b.count, b.answer);
+        return;
+    }
+    qsort(b.latencies_us, b.count, sizeof(b.latencies_us[0]), cmp_int64);
+    printf("Directives during a %zu KB upload, %s window, %s weights: p50 %6lld us, p90 %6lld us, max %6lld us, "
+           "answer in %5lld ms\n", upload_len / 1024, window ? "8 KB" : "64 KB", weights ? "1/256" : "equal",
+           (long long) b.latencies_us[count / 2], (long long) b.latencies_us[count * 9 / 10],
+           (long long) b.latencies_us[count - 1], (long long) elapsed / 1000);
+}
+
+static int64_t thread_cpu_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Directives, one every 2 ms, each answered with a small event (HEADERS and
+ * DATA) whose response closes the round trip. The task waits for the socket
+ * in between. The counters are per round trip.
+ */
+static void bench_round_trips(void)
+{
+    const int count = 200, interval_ms = 2;
+    memset(&b, 0, sizeof(b));
+    b.events = true;
+    struct sh2lib_handle hd;
+    char url[64], path[64];
+    local_h2_server_url(&server, "", url, sizeof(url));
+    snprintf(path, sizeof(path), "/directives/%d/%d", count, interval_ms);
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    if (sh2lib_connect(&hd, url, app_header_cb, bench_data_cb, bench_stream_close_cb, NULL, &tls_cfg) != 0) {
+        printf("Couldn't connect\n");
+        return;
+    }
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "GET"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", path),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    b.directives_sid = sh2lib_do_get_with_nv(&hd, nva, 4, NULL);
+    /* The connection preface and SETTINGS are not part of it */
+    while (sh2lib_execute(&hd) == 0 && b.count == 0 && sh2lib_wait_for_io(&hd, 0, 100) >= 0) {
+    }
+    sh2lib_stats_t start, end;
+    sh2lib_get_stats(&hd, &start);
+    int wakeups = 0;
+    int64_t cpu_start = thread_cpu_us();
+    int64_t deadline = now_ms() + 10000;
+    while (b.closed < count + 1 && now_ms() < deadline) {
+        sh2lib_wait_for_io(&hd, 0, 100);
+        wakeups++;
+        if (sh2lib_execute(&hd) != 0) {
+            break;
+        }
+    }
+    int64_t cpu_us = thread_cpu_us() - cpu_start;
+    sh2lib_get_stats(&hd, &end);
+    sh2lib_free(&hd);
+    if (b.closed != count + 1) {
+        printf("Failed: %d directives, %d streams closed\n", b.count, b.closed);
+        return;
+    }
+    printf("Directive round trips: %.2f writes, %.2f reads, %.2f wakeups, %.2f frames sent, %5lld us of CPU each\n",
+           (double) (end.writes - start.writes) / count, (double) (end.reads - start.reads) / count,
+           (double) wakeups / count, (double) (end.frames_sent - start.frames_sent) / count,
+           (long long) cpu_us / count);
+}
+
+#define SPEECH_SECONDS 60
+
+/*
+ * 60 s of 16 kHz 16-bit speech uploaded from a ring buffer: copied into the
+ * DATA frames by a data provider, or sent from the ring buffer with
+ * sh2lib_do_putpost_with_rb(). It is captured in frames of 20 ms, `frames` of
+ * them between two runs of the session: 1 keeps up as it is spoken, more
+ * catch up with speech buffered before the connection was ready.
+ *
+ * The capture is done by the same task, for the runs not to depend on how the
+ * threads are scheduled. Returns the CPU time of the session, -1 on failure.
+ */
+static int64_t bench_upload_once(bool zero_copy, int frames)
+{
+    const size_t frame_len = 640, len = 16000 * 2 * SPEECH_SECONDS;
+    memset(&b, 0, sizeof(b));
+    abstract_rb_cfg_t cfg = DEFAULT_RB_TYPE_BASIC_FUNC();
+    b.upload_rb = arb_init("speech", 32 * 1024, cfg);
+    struct sh2lib_handle hd;
+    char url[64];
+    local_h2_server_url(&server, "", url, sizeof(url));
+    esp_tls_cfg_t tls_cfg;
+    memset(&tls_cfg, 0, sizeof(tls_cfg));
+    if (!b.upload_rb ||
+            sh2lib_connect(&hd, url, app_header_cb, bench_data_cb, bench_stream_close_cb, NULL, &tls_cfg) != 0) {
+        printf("Couldn't connect\n");
+        arb_deinit(b.upload_rb);
+        return -1;
+    }
+    const nghttp2_nv nva[] = { SH2LIB_MAKE_NV(":method", "POST"),
+                               SH2LIB_MAKE_NV(":scheme", "http"),
+                               SH2LIB_MAKE_NV(":path", "/upload"),
+                               SH2LIB_MAKE_NV(":authority", "127.0.0.1"),
+                             };
+    server.upload_errors = 0;
+    size_t uploaded = server.uploaded;
+    int64_t cpu_us = 0;
+    int64_t cpu_start = thread_cpu_us();
+    int32_t stream_id = zero_copy ? sh2lib_do_putpost_with_rb(&hd, nva, 4, b.upload_rb, SH2LIB_DEFAULT_WEIGHT, NULL) :
+                        sh2lib_do_putpost_with_nv(&hd, nva, 4, bench_upload_rb_cb, NULL);
+    cpu_us += thread_cpu_us() - cpu_start;
+    uint8_t frame[640];
+    size_t written = 0;
+    int64_t deadline = now_ms() + 30000;
+    while (stream_id > 0 && b.closed < 1 && now_ms() < deadline) {
+        for (int i = 0; i < frames && written < len && arb_get_available(b.upload_rb) >= frame_len; i++) {
+            for (size_t j = 0; j < frame_len; j++) {
+                frame[j] = (written + j) % LOCAL_H2_PATTERN_PERIOD;
+            }
+            arb_write(b.upload_rb, frame, frame_len, 0);
+            written += frame_len;
+            if (written == len) {
+                arb_signal_writer_finished(b.upload_rb);
+            }
+        }
+        /* Until the server reads, or opens the window */
+        sh2lib_wait_for_io(&hd, 0, 1);
+        cpu_start = thread_cpu_us();
+        if (b.upload_deferred && (arb_get_filled(b.upload_rb) > 0 || arb_is_writer_finished(b.upload_rb) == 1)) {
+            b.upload_deferred = false;
+            sh2lib_resume_deferred_data(&hd, stream_id);
+        }
+        int ret = sh2lib_execute(&hd);
+        cpu_us += thread_cpu_us() - cpu_start;
+        if (ret != 0) {
+            break;
+        }
+    }
+    sh2lib_free(&hd);
+    arb_deinit(b.upload_rb);
+    if (server.uploaded - uploaded != len || server.upload_errors) {
+        printf("Failed: %zu bytes uploaded\n", server.uploaded - uploaded);
+        return -1;
+    }
+    return cpu_us;
+}
+
+/* The best of a few runs: the others share the CPU with whatever else runs */
+static void bench_upload(bool zero_copy, int frames)
+{
+    const int runs = 5;
+    int64_t best_us = -1;
+    for (int i = 0; i < runs; i++) {
+        int64_t cpu_us = bench_upload_once(zero_copy, frames);
+        if (cpu_us < 0) {
+            return;
+        }
+        if (best_us < 0 || cpu_us < best_us) {
+            best_us = cpu_us;
+        }
+    }
+    printf("Upload of %d s of speech, %2d frames at a time, %-9s: %5lld us of CPU per second of audio\n",
+           SPEECH_SECONDS, frames, zero_copy ? "zero-copy" : "copied", (long long) best_us / SPEECH_SECONDS);
+}
+
+static int bench(void)
+{
+    bench_round_trips();
+    bench_upload(false, 1);
+    bench_upload(true, 1);
+    bench_upload(false, 25);
+    bench_upload(true, 25);
+    bench_directives(false, false);
+    bench_directives(false, true);
+    bench_directives(true, false);
+    bench_directives(true, true);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (local_h2_server_start(&server) != 0) {
+        printf("Couldn't start the local server\n");
+        return 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "BENCH") == 0) {
+        return bench();
+    }
+    /* A hung test fails the whole run, instead of blocking it */
+    alarm(60);
+
+    test_download();
+    test_multiplex();
+    test_download_not_found();
+    test_download_cancel();
+    test_free_with_downloads();
+    test_config();
+    test_stream_window();
+    test_priority();
+    test_upload();
+    test_send_coalesced();
+    test_keepalive_rtt();
+    test_keepalive_dead();
+
+    local_h2_server_stop(&server);
+    printf("%d responses sent, %d failures\n", server.responses, failures);
+    return failures ? 1 : 0;
+}
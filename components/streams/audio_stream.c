@@ -71,6 +71,19 @@ static inline void audio_stream_generate_event(audio_stream_t *stream, audio_str
     return;
 }
 
+/* The stream stopped running: signal the end of stream and clean up */
+static void audio_stream_run_done(audio_stream_t *stream)
+{
+    if (stream->_run == 0 && stream->type == STREAM_TYPE_READER) {
+        stream->op.stream_output.func(stream->op.stream_output.arg, NULL, 0, stream->cfg.w.output_wait);
+    }
+    if (stream->cfg.derived_context_cleanup) {
+        stream->cfg.derived_context_cleanup(stream);
+    }
+    audio_stream_generate_event(stream, STREAM_EVENT_STOPPED);
+    ESP_LOGI(ASTAG, "Generated stopped event for stream %s", stream->label);
+}
+
 static void audio_stream_task(void *arg)
 {
     int ret;
@@ -120,6 +133,15 @@ static void audio_stream_task(void *arg)
                     // printf("%s: stream: writing %d to write function\n", ASTAG, r_len);
                     w_len = stream->cfg.derived_write((void *)stream, stream->buf, r_len);
                 }
+            } else if (stream->stream_output_window.acquire) { /* STREAM_TYPE_READER, zero-copy */
+                void *window = NULL;
+                r_len = 0;
+                w_len = stream->stream_output_window.acquire(stream->stream_output_window.arg, &window, stream->cfg.buf_size, stream->cfg.w.output_wait);
+                if (w_len > 0) {
+                    r_len = stream->cfg.derived_read((void *)stream, window, w_len);
+                    /* Always commit, so that a failed read gives the window back */
+                    w_len = stream->stream_output_window.commit(stream->stream_output_window.arg, r_len > 0 ? r_len : 0);
+                }
             } else { /* STREAM_TYPE_READER */
                 r_len = stream->cfg.derived_read((void *)stream, stream->buf, stream->cfg.buf_size);
                 if (r_len > 0) {
@@ -137,7 +159,7 @@ static void audio_stream_task(void *arg)
                     /* We got a reader wakeup from outside */
                     continue;
                 }
-		        ESP_LOGI(ASTAG, "r_len = %d w_len = %d, stopping stream [%s]", r_len, w_len, stream->label);
+		        ESP_LOGI(ASTAG, "r_len = %d w_len = %d, stopping stream [%s]", (int) r_len, (int) w_len, stream->label);
                 stream->_run = 0;
             }
             if (stream->_pause || stream->_destroy) {
@@ -153,14 +175,7 @@ static void audio_stream_task(void *arg)
             stream->state = STREAM_STATE_PAUSED;
         } else {
             ESP_LOGD(ASTAG, "Stack remaining is %d bytes", uxTaskGetStackHighWaterMark(NULL));
-            if (stream->_run == 0 && stream->type == STREAM_TYPE_READER) {
-                stream->op.stream_output.func(stream->op.stream_output.arg, NULL, 0, stream->cfg.w.output_wait);
-            }
-            if (stream->cfg.derived_context_cleanup) {
-                stream->cfg.derived_context_cleanup(stream);
-            }
-            audio_stream_generate_event(stream, STREAM_EVENT_STOPPED);
-	    ESP_LOGI(ASTAG, "Generated stopped event for stream %s", stream->label);
+            audio_stream_run_done(stream);
         }
     }
     ESP_LOGI(ASTAG, "Destroying stream %s", stream->label);
@@ -195,7 +210,8 @@ static void audio_stream_cleanup(audio_stream_t *stream)
     return;
 }
 
-esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func)
+static esp_err_t _audio_stream_init(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io,
+                                    audio_event_fn_arg_t *event_func, bool cooperative)
 {
     int ret;
 
@@ -217,6 +233,7 @@ esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_
     stream->_run = 0;
     stream->_pause = 0;
     stream->_destroy = 0;
+    stream->_cooperative = cooperative;
 
     stream->buf = calloc(1, stream->cfg.buf_size);
     if (stream->buf == NULL) {
@@ -231,7 +248,9 @@ esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_
         memcpy(&stream->op.stream_input, stream_io, sizeof(audio_io_fn_arg_t));
     }
 
-    if(stream->identifier == STREAM_TYPE_HTTP) {
+    if (cooperative) {
+        stream->state = STREAM_STATE_STOPPED;
+    } else if(stream->identifier == STREAM_TYPE_HTTP) {
         TaskHandle_t stream_thread;
         StackType_t *stream_task_stack = (StackType_t *)esp_audio_mem_calloc(1, stream->cfg.task_stack_size);
         if(stream_task_stack == NULL) {
@@ -265,6 +284,105 @@ esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_
     return ESP_OK;
 }
 
+esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func)
+{
+    return _audio_stream_init(stream, label, stream_io, event_func, false);
+}
+
+esp_err_t audio_stream_init_cooperative(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func)
+{
+    return _audio_stream_init(stream, label, stream_io, event_func, true);
+}
+
+/* Same state machine as audio_stream_task(), one loop iteration at a time */
+audio_step_status_t audio_stream_step(audio_stream_t *stream)
+{
+    ssize_t r_len, w_len = 0;
+
+    if (stream == NULL || !stream->_cooperative || stream->_destroy) {
+        return AUDIO_STEP_DONE;
+    }
+
+    if (stream->state != STREAM_STATE_RUNNING) {
+        if (!stream->_run) {
+            if (stream->state == STREAM_STATE_PAUSED) {
+                /* Stopped while paused */
+                if (stream->cfg.derived_context_cleanup) {
+                    stream->cfg.derived_context_cleanup(stream);
+                }
+                stream->state = STREAM_STATE_STOPPED;
+            }
+            return AUDIO_STEP_DONE;
+        }
+        if (stream->_pause) {
+            return AUDIO_STEP_IDLE;
+        }
+        if (stream->state != STREAM_STATE_PAUSED && stream->cfg.derived_context_init) {
+            if (stream->cfg.derived_context_init(stream) != ESP_OK) {
+                stream->_run = 0;
+                audio_stream_generate_event(stream, STREAM_EVENT_FAILED);
+                return AUDIO_STEP_DONE;
+            }
+        }
+        stream->state = STREAM_STATE_RUNNING;
+        audio_stream_generate_event(stream, STREAM_EVENT_STARTED);
+    }
+
+    if (stream->_pause) {
+        stream->state = STREAM_STATE_PAUSED;
+        audio_stream_generate_event(stream, STREAM_EVENT_PAUSED);
+        return AUDIO_STEP_IDLE;
+    }
+
+    if (stream->_run) {
+        if (stream->type == STREAM_TYPE_WRITER) {
+            r_len = stream->op.stream_input.func(stream->op.stream_input.arg, stream->buf, stream->cfg.buf_size, 0);
+            if (r_len == 0) {
+                return AUDIO_STEP_NEEDS_INPUT;
+            }
+            if (r_len > 0) {
+                w_len = stream->cfg.derived_write((void *)stream, stream->buf, r_len);
+            }
+        } else if (stream->stream_output_window.acquire) {
+            void *window = NULL;
+            r_len = 0;
+            w_len = stream->stream_output_window.acquire(stream->stream_output_window.arg, &window, stream->cfg.buf_size, 0);
+            if (w_len == 0) {
+                return AUDIO_STEP_OUTPUT_FULL;
+            }
+            if (w_len > 0) {
+                r_len = stream->cfg.derived_read((void *)stream, window, w_len);
+                w_len = stream->stream_output_window.commit(stream->stream_output_window.arg, r_len > 0 ? r_len : 0);
+                if (r_len == 0 && w_len >= 0) {
+                    return AUDIO_STEP_NEEDS_INPUT;
+                }
+            }
+        } else {
+            r_len = stream->cfg.derived_read((void *)stream, stream->buf, stream->cfg.buf_size);
+            if (r_len == 0) {
+                return AUDIO_STEP_NEEDS_INPUT;
+            }
+            if (r_len > 0) {
+                w_len = stream->op.stream_output.func(stream->op.stream_output.arg, stream->buf, r_len, stream->cfg.w.output_wait);
+            }
+        }
+        if (r_len == -3) {
+            /* We got a reader wakeup from outside */
+            return AUDIO_STEP_NEEDS_INPUT;
+        }
+        if (r_len < 0 || w_len < 0) {
+            ESP_LOGI(ASTAG, "r_len = %d w_len = %d, stopping stream [%s]", (int) r_len, (int) w_len, stream->label);
+            stream->_run = 0;
+        } else {
+            return AUDIO_STEP_PROGRESS;
+        }
+    }
+
+    stream->state = STREAM_STATE_STOPPED;
+    audio_stream_run_done(stream);
+    return AUDIO_STEP_DONE;
+}
+
 audio_stream_identifier_t audio_stream_get_identifier(audio_stream_t *stream)
 {
     if (stream == NULL) {
@@ -273,6 +391,21 @@ audio_stream_identifier_t audio_stream_get_identifier(audio_stream_t *stream)
     return stream->identifier;
 }
 
+esp_err_t audio_stream_set_output_window(audio_stream_t *stream, audio_io_window_fn_arg_t *window_fn)
+{
+    if (stream == NULL || window_fn == NULL || stream->type != STREAM_TYPE_READER) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->state == STREAM_STATE_RUNNING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if ((window_fn->acquire == NULL) != (window_fn->commit == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(&stream->stream_output_window, window_fn, sizeof(audio_io_window_fn_arg_t));
+    return ESP_OK;
+}
+
 audio_stream_state_t audio_stream_get_state(audio_stream_t *stream)
 {
     if (stream == NULL) {
@@ -323,7 +456,15 @@ esp_err_t audio_stream_destroy(audio_stream_t *stream)
     }
 
     stream->_destroy = 1;
-    xSemaphoreGive(stream->ctrl_sem);
+    if (stream->_cooperative) {
+        audio_stream_generate_event(stream, STREAM_EVENT_DESTROYED);
+        if (stream->cfg.derived_context_cleanup) {
+            stream->cfg.derived_context_cleanup(stream);
+        }
+        stream->state = STREAM_STATE_DESTROYED;
+    } else {
+        xSemaphoreGive(stream->ctrl_sem);
+    }
     while (stream->state != STREAM_STATE_DESTROYED) {
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
@@ -103,6 +103,11 @@ typedef struct audio_stream {
         audio_io_fn_arg_t stream_output;
     } op;
 
+    /* Optional, STREAM_TYPE_READER only: if set, derived_read fills the output's memory directly
+     * instead of `buf`, and stream_output is only used to signal the end of stream.
+     */
+    audio_io_window_fn_arg_t stream_output_window;
+
     TaskHandle_t thread;
     void *buf;
     SemaphoreHandle_t ctrl_sem;
@@ -112,13 +117,39 @@ typedef struct audio_stream {
     uint8_t _run: 1;
     uint8_t _pause: 1;
     uint8_t _destroy: 1;
+    /* No task: the stream is driven with audio_stream_step() */
+    uint8_t _cooperative: 1;
 
 } audio_stream_t;
 
 esp_err_t audio_stream_init(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func);
 
+/**
+ * @brief   Same as audio_stream_init(), but without a task of its own
+ *
+ * The stream then has to be driven by calling audio_stream_step() (e.g. by a cooperative
+ * audio_pipe). The control APIs (start, stop, pause...) take effect on the next step.
+ */
+esp_err_t audio_stream_init_cooperative(audio_stream_t *stream, const char *label, audio_io_fn_arg_t *stream_io, audio_event_fn_arg_t *event_func);
+
+/**
+ * @brief   Run one iteration of a cooperative stream
+ *
+ * Processes at most one buffer. I/O is done with a wait of 0, so a step only blocks if the
+ * derived read/write does. A reader stream should have an output window
+ * (audio_stream_set_output_window()), otherwise it writes to stream_output with its usual wait.
+ */
+audio_step_status_t audio_stream_step(audio_stream_t *stream);
+
 audio_stream_identifier_t audio_stream_get_identifier(audio_stream_t *stream);
 
+/**
+ * @brief   Let a reader stream read straight into the memory of its output (e.g. a ring buffer)
+ *
+ * @note    Must be called while the stream is not running.
+ */
+esp_err_t audio_stream_set_output_window(audio_stream_t *stream, audio_io_window_fn_arg_t *window_fn);
+
 esp_err_t audio_stream_start(audio_stream_t *stream);
 esp_err_t audio_stream_stop(audio_stream_t *stream);
 esp_err_t audio_stream_pause(audio_stream_t *stream);
@@ -37,21 +37,28 @@ static const char *TAG = "HOLLOW_STREAM";
 
 static esp_err_t hollow_stream_parse_config(void *base_stream)
 {
+    (void) base_stream;
     return ESP_OK;
 }
 
 static void hollow_stream_reset_config(void *base_stream)
 {
+    (void) base_stream;
     return;
 }
 
 static ssize_t hollow_stream_read(void *s, void *buf, ssize_t len)
 {
+    (void) s;
+    (void) buf;
+    (void) len;
     return ESP_OK;
 }
 
 static void hollow_stream_on_event(void *base_stream, audio_stream_event_t event)
 {
+    (void) base_stream;
+    (void) event;
     return;
 }
 
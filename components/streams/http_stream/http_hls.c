@@ -149,7 +149,7 @@ http_hls_mime_type_t http_hls_connect_new_variant(void *stream)
         playlist_free(hls_cfg->variant_playlist);
         hls_cfg->variant_playlist = NULL;
         http_request_delete(hstream->handle);
-        http_connection_delete(hstream->handle);
+        http_connection_release(hstream->handle);
         hstream->handle = NULL;
         return NO_URL;
     }
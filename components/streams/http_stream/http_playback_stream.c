@@ -106,7 +106,7 @@ static void reset_http_config(void *base_stream)
     http_playback_stream_t *stream = (http_playback_stream_t *) base_stream;
     if (stream->handle) {
         http_request_delete(stream->handle);
-        http_connection_delete(stream->handle);
+        http_connection_release(stream->handle);
         stream->handle = NULL;
     }
 }
@@ -129,11 +129,8 @@ static esp_err_t http_connect_async_and_set_keep_alive(http_playback_stream_t *h
         } else if (ret) {
             break;
         }
-        /**
-         * First attempt is half way through.
-         * Retry after some time delay to avoid watachdog trigger in case it keeps failing
-         */
-        vTaskDelay(10);
+        /* The connect is in progress: wait for it, but check _run now and then */
+        http_connection_wait_async(hstream->handle, 100);
     };
     http_connection_set_keepalive_and_recv_timeout(hstream->handle);
 
@@ -166,6 +163,8 @@ ssize_t http_refresh_connection(http_playback_stream_t *hstream)
         return ESP_FAIL;
     }
 
+    /* Only Content-Type and Location are used */
+    http_response_set_header_interest(hstream->handle, NULL, 0);
     hstream->handle->request.offset = offset;
     if ((http_request_send(hstream->handle, NULL, 0) < 0) ||
             (http_header_fetch(hstream->handle) < 0)) {
@@ -307,7 +306,7 @@ esp_err_t http_playback_stream_create_or_renew_session(http_playback_stream_t *h
     do {
         http_request_delete(hstream->handle); /* Delete old request */
         if (http_connection_new_needed(hstream->handle, hstream->cfg.url)) {
-            http_connection_delete(hstream->handle); /* Delete old connection */
+            http_connection_release(hstream->handle); /* Old connection may be reused later */
             hstream->handle = NULL;
             if (http_connect_async_and_set_keep_alive(hstream) != ESP_OK) {
                 return ESP_FAIL;
@@ -319,6 +318,7 @@ esp_err_t http_playback_stream_create_or_renew_session(http_playback_stream_t *h
             hstream->handle = NULL;
             return ESP_FAIL;
         }
+        http_response_set_header_interest(hstream->handle, NULL, 0);
 
         if ((http_request_send(hstream->handle, NULL, 0) < 0) ||
                 (http_header_fetch(hstream->handle) < 0)) {
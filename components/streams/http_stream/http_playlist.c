@@ -35,10 +35,13 @@
 #include <http_playlist.h>
 #include <esp_audio_mem.h>
 #include <string.h>
+#include <errno.h>
 #include <m3u8_parser.h>
 
 #define TAG   "HTTP_PLAYLIST"
 #define MAX_PLAYLIST_KEEP_TRACKS 8
+/* Segment requests sent ahead of the one playing, to hide the round trip between segments */
+#define HTTP_PLAYLIST_PIPELINE_DEPTH 2
 
 esp_err_t playlist_add_entry(http_playlist_t *playlist, char *line, const char *host_url)
 {
@@ -149,6 +152,45 @@ char *playlist_get_next_entry(http_playlist_t *playlist)
     return uri;
 }
 
+/* Send the requests for the next segments on the same connection, not waiting for the current one to be read */
+static void playlist_pipeline_fill(http_playback_stream_t *bstream, http_playlist_t *playlist)
+{
+    int queued = http_request_pipeline_count(bstream->handle);
+    int skip = queued;
+    playlist_entry_t *entry;
+    STAILQ_FOREACH(entry, &playlist->head, entries) {
+        if (queued == HTTP_PLAYLIST_PIPELINE_DEPTH) {
+            break;
+        }
+        if (entry->is_played) {
+            continue;
+        }
+        if (skip) { /* Already sent */
+            skip--;
+            continue;
+        }
+        if (http_connection_new_needed(bstream->handle, entry->uri) ||
+                http_request_pipeline(bstream->handle, entry->uri) != 0) {
+            break;
+        }
+        queued++;
+    }
+}
+
+/* The server closed the connection with requests sent ahead: request the current segment again on a new one */
+static esp_err_t playlist_reconnect(http_playback_stream_t *bstream)
+{
+    ESP_LOGW(TAG, "Connection closed, reconnecting for %s", bstream->cfg.url);
+    http_request_delete(bstream->handle);
+    http_connection_delete(bstream->handle);
+    bstream->handle = NULL;
+    if (http_playback_stream_create_or_renew_session(bstream) == ESP_FAIL) {
+        ESP_LOGE(TAG, "Failed to create connection to %s. line %d", bstream->cfg.url, __LINE__);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 /* reads http data to buf using url from list */
 int http_playlist_read_data(void *base_stream, void *buf, ssize_t len)
 {
@@ -166,7 +208,7 @@ int http_playlist_read_data(void *base_stream, void *buf, ssize_t len)
                     bstream->cfg.url = playlist->host_uri;
                     playlist->host_uri = NULL;
                     http_request_delete(bstream->handle);
-                    http_connection_delete(bstream->handle);
+                    http_connection_release(bstream->handle); /* Taken back from the pool if same host */
                     bstream->handle = NULL;
                     if (http_playback_stream_create_or_renew_session(bstream) == ESP_FAIL) {
                         ESP_LOGE(TAG, "Failed to create connection to %s. line %d", bstream->cfg.url, __LINE__);
@@ -200,15 +242,32 @@ int http_playlist_read_data(void *base_stream, void *buf, ssize_t len)
             esp_audio_mem_free(bstream->cfg.url); /* free old url */
             bstream->cfg.url = url; /* keep current url in cfg */
 
-            if (ret < 0) {
-                goto error1;
-            }
-            ret = http_request_send(bstream->handle, NULL, 0);
-            if (ret < 0) {
-                goto error2;
+            if (ret == -ENOTCONN) { /* Requests were sent ahead, but the server said it would close */
+                if (playlist_reconnect(bstream) != ESP_OK) {
+                    goto error1;
+                }
+            } else {
+                if (ret < 0) {
+                    goto error1;
+                }
+                http_response_set_header_interest(bstream->handle, NULL, 0);
+                ret = http_request_send(bstream->handle, NULL, 0); /* Nothing to do if sent ahead */
+                if (ret < 0) {
+                    goto error2;
+                }
             }
+            playlist_pipeline_fill(bstream, playlist);
 
             data_read = http_response_recv(bstream->handle, buf, len);
+            if (data_read < 0 && http_request_is_pipelined(bstream->handle) &&
+                    http_response_get_code(bstream->handle) == 0) {
+                /* Closed before answering the request sent ahead */
+                if (playlist_reconnect(bstream) != ESP_OK) {
+                    goto error1;
+                }
+                playlist_pipeline_fill(bstream, playlist);
+                data_read = http_response_recv(bstream->handle, buf, len);
+            }
             continue;
 error2:
             bstream->base.event_func.func(bstream->base.event_func.arg, STREAM_EVENT_FAILED, 0);
@@ -58,11 +58,8 @@ static esp_err_t parse_http_config(void *base_stream)
         } else if (ret) {
             break;
         }
-        /**
-         * First attempt is half way through.
-         * Retry after some time to avoid watachdog trigger in case it keeps failing
-         */
-        vTaskDelay(10);
+        /* The connect is in progress: wait for it, but check _run now and then */
+        http_connection_wait_async(bstream->handle, 100);
     };
     http_connection_set_keepalive_and_recv_timeout(bstream->handle);
 
@@ -72,6 +69,8 @@ static esp_err_t parse_http_config(void *base_stream)
             goto error1;
         }
 
+        /* Only Content-Type is used */
+        http_response_set_header_interest(bstream->handle, NULL, 0);
         http_response_set_header_cb(bstream->handle, http_header_cb, base_stream);
 
         ret = http_request_send(bstream->handle, NULL, 0);
@@ -98,7 +97,7 @@ static void reset_http_config(void *base_stream)
     http_stream_t *stream = (http_stream_t *) base_stream;
     if (stream->handle) {
         http_request_delete(stream->handle);
-        http_connection_delete(stream->handle);
+        http_connection_release(stream->handle);
         stream->handle = NULL;
     }
 }
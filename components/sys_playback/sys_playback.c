@@ -2,6 +2,7 @@
 // All rights reserved.
 
 #include <string.h>
+#include <assert.h>
 #include <esp_log.h>
 #include <basic_rb.h>
 #include <esp_err.h>
@@ -13,6 +14,7 @@
 #include "media_hal_playback.h"
 #include <esp_audio_mem.h>
 #include <esp_downmix.h>
+#include <latency_trace.h>
 
 #define PB_DEFAULT_STACK_SIZE   (3 * 1024)
 #define PB_DOWNMIX_STACK_SIZE   (4 * 1024)
@@ -21,6 +23,7 @@
 #define PB_DEFAULT_BUF_SIZE     512
 #define PB_BUFFER_SIZE          (12 * 512) /* 12x can handle 8k/1 --> 48k/2 */
 #define OUT_SAMPLING_RATE       48000
+#define PB_MAX_REQUESTER_EXTS   8
 
 static const char *TAG = "[sys_playback]";
 
@@ -44,8 +47,63 @@ static struct {
     sys_playback_requester_t dummy;
     bool acquired;
     bool playback_starting_sent;
+    /* Latency tracing, from the requester (or downmix_rb) till played out */
+    lt_point_t downmix_lt;
+    lt_point_t i2s_lt;
+    lt_playout_t i2s_playout;
+    /* Requesters with extras, see sys_playback_requester_set_ext() */
+    struct {
+        sys_playback_requester_t *requester;
+        sys_playback_requester_ext_t ext;
+    } exts[PB_MAX_REQUESTER_EXTS];
 } sp;
 
+int sys_playback_requester_set_ext(sys_playback_requester_t *requester, const sys_playback_requester_ext_t *ext)
+{
+    if (requester == NULL || ext == NULL) {
+        ESP_LOGE(TAG, "Invalid arguments");
+        return -1;
+    }
+    int free_idx = -1;
+    for (int i = 0; i < PB_MAX_REQUESTER_EXTS; i++) {
+        if (sp.exts[i].requester == requester) {
+            sp.exts[i].ext = *ext;
+            return 0;
+        }
+        if (sp.exts[i].requester == NULL && free_idx < 0) {
+            free_idx = i;
+        }
+    }
+    if (free_idx < 0) {
+        ESP_LOGE(TAG, "No room for the extras of another requester");
+        return -1;
+    }
+    sp.exts[free_idx].ext = *ext;
+    sp.exts[free_idx].requester = requester;
+    return 0;
+}
+
+void sys_playback_requester_clear_ext(sys_playback_requester_t *requester)
+{
+    for (int i = 0; i < PB_MAX_REQUESTER_EXTS; i++) {
+        if (requester && sp.exts[i].requester == requester) {
+            sp.exts[i].requester = NULL;
+            memset(&sp.exts[i].ext, 0, sizeof(sp.exts[i].ext));
+        }
+    }
+}
+
+static const sys_playback_requester_ext_t *sys_playback_requester_get_ext(sys_playback_requester_t *requester)
+{
+    static const sys_playback_requester_ext_t no_ext;
+    for (int i = 0; i < PB_MAX_REQUESTER_EXTS; i++) {
+        if (requester && sp.exts[i].requester == requester) {
+            return &sp.exts[i].ext;
+        }
+    }
+    return &no_ext;
+}
+
 static ssize_t sys_playback_dummy_read_cb(void *cb_data, void *data, int len, unsigned int wait)
 {
     rb_handle_t rb = (rb_handle_t)cb_data;
@@ -83,6 +141,62 @@ int sys_playback_play_data(media_hal_audio_info_t *audio_info, void *buf, ssize_
     return sent_len;
 }
 
+/* Play `len` bytes which came out of `from`, and trace them till the I2S DMA has played them out */
+static void sys_playback_play_traced(lt_point_t *from, lt_stage_t from_stage, media_hal_audio_info_t *audio_info,
+                                     void *buf, ssize_t len)
+{
+    lt_point_in(&sp.i2s_lt, len, from, from_stage);
+    sys_playback_play_data(audio_info, buf, len);
+    int bytes_per_sec = audio_info->sample_rate * audio_info->channels * (audio_info->bits_per_sample / 8);
+    int64_t played_out_us = lt_playout_add(&sp.i2s_playout, len, bytes_per_sec);
+    lt_point_out_at(&sp.i2s_lt, sp.i2s_lt.bytes_out + len, played_out_us);
+}
+
+/**
+ * Peek whole frames from a zero-copy requester, into `*main_data`. The peeked window stops at the
+ * end of the requester's ring, which needn't be on a frame: a frame split there is put together in
+ * `carry` over the next peeks, and then returned from there, already released.
+ */
+static int sys_playback_peek_frames(sys_playback_requester_t *active, const sys_playback_requester_ext_t *ext,
+                                    char **main_data, int len, unsigned int wait, char *carry, int *carry_len)
+{
+    /* 16 bit samples, as everywhere in here */
+    const int frame_size = (active->audio_info.channels > 1 ? 2 : 1) * sizeof(short);
+
+    while (1) {
+        char *peeked;
+        int ret = ext->peek_cb(active->cb_data, (void **) &peeked, len, wait);
+        if (ret <= 0) {
+            if (ret != RB_READER_UNBLOCK && ret != RB_FETCH_ANCHOR) {
+                /* The stream is over, along with any partial frame */
+                *carry_len = 0;
+            }
+            return ret;
+        }
+        if (*carry_len) {
+            int copy_len = frame_size - *carry_len < ret ? frame_size - *carry_len : ret;
+            memcpy(carry + *carry_len, peeked, copy_len);
+            ext->release_cb(active->cb_data, copy_len);
+            *carry_len += copy_len;
+            if (*carry_len < frame_size) {
+                continue;
+            }
+            *carry_len = 0;
+            *main_data = carry;
+            return frame_size;
+        }
+        int frames_len = ret - ret % frame_size;
+        if (frames_len == 0) {
+            memcpy(carry, peeked, ret);
+            ext->release_cb(active->cb_data, ret);
+            *carry_len = ret;
+            continue;
+        }
+        *main_data = peeked;
+        return frames_len;
+    }
+}
+
 /**
  * The function keeps reading data from main audio and ducked audio,
  * resamples+mixes it and writes to downmix_rb.
@@ -96,6 +210,9 @@ static void sys_playback_task()
     unsigned char *conv_main_buf = NULL;
     unsigned char *conv_duck_buf = NULL;
     int wait = portMAX_DELAY;
+    /* Partial frame of a zero-copy requester, kept in `data` */
+    sys_playback_requester_t *carry_from = NULL;
+    int carry_len = 0;
 
     if (sp.downmix_support) {
         duck_buffer  = (unsigned char *) esp_audio_mem_calloc(1, PB_BUFFER_SIZE);
@@ -131,7 +248,19 @@ static void sys_playback_task()
         }
 
         /**** Read and Process Main Data ****/
-        data_read = active->read_cb(active->cb_data, data, DATA_BUF_SIZE, wait_main);
+        char *main_data = data;
+        const sys_playback_requester_ext_t *ext = sys_playback_requester_get_ext(active);
+        if (ext->peek_cb && ext->release_cb) {
+            /* Process the data in place, in the requester's buffer */
+            if (active != carry_from) {
+                carry_from = active;
+                carry_len = 0;
+            }
+            data_read = sys_playback_peek_frames(active, ext, &main_data, DATA_BUF_SIZE, wait_main, data, &carry_len);
+        } else {
+            carry_from = NULL;
+            data_read = active->read_cb(active->cb_data, data, DATA_BUF_SIZE, wait_main);
+        }
 
         if (data_read == RB_READER_UNBLOCK) {
             /* Just a wakeup, do nothing and go for duck audio. */
@@ -139,7 +268,7 @@ static void sys_playback_task()
             active->samples_cnt += data_read;
             if (sp.downmix_support) {
                 /* Resample to OUT_SAMPLING_RATE */
-                conv_main_len = audio_resample((short *) data, (short *) conv_main_buf, active->audio_info.sample_rate, OUT_SAMPLING_RATE,
+                conv_main_len = audio_resample((short *) main_data, (short *) conv_main_buf, active->audio_info.sample_rate, OUT_SAMPLING_RATE,
                                                data_read / 2, PB_BUFFER_SIZE, active->audio_info.channels, &resample_main);
 
                 if (active->audio_info.channels == 1) {
@@ -147,7 +276,10 @@ static void sys_playback_task()
                                                               conv_main_len, PB_BUFFER_SIZE, &resample_main);
                 }
             } else {
-                sys_playback_play_data(&active->audio_info, data, data_read);
+                sys_playback_play_traced(ext->lt, LT_STAGE_PLAYBACK_MIX, &active->audio_info, main_data, data_read);
+            }
+            if (main_data != data) {
+                ext->release_cb(active->cb_data, data_read);
             }
         } else if (data_read < 0) {
             /* If this was a tone, it has been completely played out, reset the pointer now */
@@ -211,17 +343,20 @@ static void sys_playback_task()
                 }
                 /* Otherwise we are anyway handling this properly.! */
                 esp_downmix_process(sp.downmix_handle, conv_main_buf, conv_main_len * 2, conv_duck_buf, conv_main_len * 2, duck_buffer, downmix_status);
-                rb_write(sp.downmix_rb, duck_buffer, conv_main_len * 2, wait);
+                ssize_t written = rb_write(sp.downmix_rb, duck_buffer, conv_main_len * 2, wait);
+                lt_point_in(&sp.downmix_lt, written, ext->lt, LT_STAGE_PLAYBACK_MIX);
                 if (conv_duck_len > conv_main_len) {
                     prev_remain = conv_duck_len - conv_main_len;
                     memmove(conv_duck_buf, conv_duck_buf + conv_main_len * 2, prev_remain * 2);
                 }
             } else if (conv_main_len) { /* Just main audio */
-                rb_write(sp.downmix_rb, conv_main_buf, conv_main_len * 2, wait);
+                ssize_t written = rb_write(sp.downmix_rb, conv_main_buf, conv_main_len * 2, wait);
+                lt_point_in(&sp.downmix_lt, written, ext->lt, LT_STAGE_PLAYBACK_MIX);
             } else if (conv_duck_len) { /* Only ducked audio! Downmix this with silence. */
                 bzero(conv_main_buf, conv_duck_len * 2); /* Silence. */
                 esp_downmix_process(sp.downmix_handle, conv_main_buf, conv_duck_len * 2, conv_duck_buf, conv_duck_len * 2, duck_buffer, downmix_status);
-                rb_write(sp.downmix_rb, duck_buffer, conv_duck_len * 2, wait);
+                ssize_t written = rb_write(sp.downmix_rb, duck_buffer, conv_duck_len * 2, wait);
+                lt_point_in(&sp.downmix_lt, written, NULL, LT_STAGE_MAX);
             }
         }
     }
@@ -250,9 +385,10 @@ static void sys_playback_task()
 static void sys_playback_downmix_consumer_task(void *arg)
 {
     int read_size = 512;
-    char data[read_size];
+    uint8_t *data;
+    int data_len;
     /**
-     * Read data from downmixed buffer and call va_app_playback_data
+     * Peek data from downmixed buffer and call va_app_playback_data on it in place
      */
     media_hal_audio_info_t audio_info = {
         .sample_rate = OUT_SAMPLING_RATE,
@@ -260,11 +396,45 @@ static void sys_playback_downmix_consumer_task(void *arg)
         .bits_per_sample = 16,
     };
 
+    /* Only whole frames are played. One split by the end of the ring, or not
+     * written in full yet, is put together here over the next peeks.
+     */
+    const int frame_size = audio_info.channels * (audio_info.bits_per_sample / 8);
+    uint8_t carry[8];
+    int carry_len = 0;
+    assert(frame_size <= (int) sizeof(carry) && read_size % frame_size == 0);
+
     while (1) {
-        int bytes_read = rb_read(sp.downmix_rb, (void *) data, read_size, portMAX_DELAY);
-        if (bytes_read > 0) {
-            sys_playback_play_data(&audio_info, data, bytes_read);
+        int bytes_read = rb_read_peek(sp.downmix_rb, &data, &data_len, portMAX_DELAY);
+        if (bytes_read <= 0) {
+            continue;
         }
+        if (carry_len) {
+            int len = frame_size - carry_len < bytes_read ? frame_size - carry_len : bytes_read;
+            memcpy(carry + carry_len, data, len);
+            rb_read_release(sp.downmix_rb, len);
+            lt_point_out(&sp.downmix_lt, len);
+            carry_len += len;
+            if (carry_len == frame_size) {
+                sys_playback_play_traced(&sp.downmix_lt, LT_STAGE_MAX, &audio_info, carry, frame_size);
+                carry_len = 0;
+            }
+            continue;
+        }
+        if (bytes_read > read_size) {
+            bytes_read = read_size;
+        }
+        int frames_len = bytes_read - bytes_read % frame_size;
+        if (frames_len == 0) {
+            memcpy(carry, data, bytes_read);
+            rb_read_release(sp.downmix_rb, bytes_read);
+            lt_point_out(&sp.downmix_lt, bytes_read);
+            carry_len = bytes_read;
+            continue;
+        }
+        lt_point_out(&sp.downmix_lt, frames_len);
+        sys_playback_play_traced(&sp.downmix_lt, LT_STAGE_MAX, &audio_info, data, frames_len);
+        rb_read_release(sp.downmix_rb, frames_len);
     }
 }
 
@@ -446,6 +616,9 @@ int sys_playback_init(sys_playback_config_t *sys_playback_cfg)
     sp.duck = NULL;
     sp.duck_lock = xSemaphoreCreateMutex();
 
+    lt_point_init(&sp.downmix_lt, LT_STAGE_DOWNMIX_RB, LT_STAGE_MAX, 0);
+    lt_point_init(&sp.i2s_lt, LT_STAGE_I2S_DMA, LT_STAGE_PLAYBACK_TOTAL, 0);
+
     if (sp.downmix_support) {
         /* Initialize and create downmix handle */
         if (sys_playback_downmix_init(sys_playback_cfg) == ESP_FAIL) {
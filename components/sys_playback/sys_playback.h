@@ -7,6 +7,11 @@
 
 typedef int (*read_cb_t)(void *cb_data, void *data, int len, unsigned int wait);
 typedef void (*wakeup_reader_cb_t)(void *cb_data);
+/* Zero-copy variant of read_cb_t: returns a window of at most `len` bytes in `*data`, which
+ * stays valid until release_cb_t is called. Return values are the same as for read_cb_t.
+ */
+typedef int (*peek_cb_t)(void *cb_data, void **data, int len, unsigned int wait);
+typedef int (*release_cb_t)(void *cb_data, int len);
 
 typedef struct {
     uint32_t samples_cnt;
@@ -16,6 +21,31 @@ typedef struct {
     media_hal_audio_info_t audio_info;
 } sys_playback_requester_t;
 
+/**
+ * Optional extras of a requester. Libraries built against the layout above allocate requesters,
+ * so these are kept by sys_playback instead, see `sys_playback_requester_set_ext`.
+ */
+typedef struct {
+    /* If both are set, they are used instead of read_cb */
+    peek_cb_t peek_cb;
+    release_cb_t release_cb;
+    /* Latency trace point the data is read out of (see latency_trace.h) */
+    struct lt_point *lt;
+} sys_playback_requester_ext_t;
+
+/**
+ * @brief   Set the extras of `requester`, replacing any it had
+ *
+ * Set them before handing the requester to sys_playback. Room is kept for a few requesters only:
+ * clear them once the requester is gone.
+ */
+int sys_playback_requester_set_ext(sys_playback_requester_t *requester, const sys_playback_requester_ext_t *ext);
+
+/**
+ * @brief   Forget the extras of `requester`
+ */
+void sys_playback_requester_clear_ext(sys_playback_requester_t *requester);
+
 /**
  * @brief   Put a `requester` in ducked mode
  *
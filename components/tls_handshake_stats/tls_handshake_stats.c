@@ -0,0 +1,83 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "tls_handshake_stats.h"
+
+static const char *TAG = "tls_handshake";
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#include <esp_timer.h>
+#else
+#include "mbedtls/esp_debug.h"
+#endif
+
+static tls_handshake_stats_t stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void tls_handshake_start(tls_handshake_t *hs, const char *host, size_t host_len)
+{
+    hs->host = strndup(host, host_len);
+    hs->start_us = now_us();
+}
+
+void tls_handshake_done(tls_handshake_t *hs, struct esp_tls *tls)
+{
+    int64_t elapsed = now_us() - hs->start_us;
+    pthread_mutex_lock(&stats_lock);
+    if (!tls) {
+        stats.failed++;
+    } else {
+        stats.completed++;
+        stats.completed_us += elapsed;
+        if (elapsed > stats.max_us) {
+            stats.max_us = elapsed;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    ESP_LOGD(TAG, "%s handshake with %s took %lld ms", tls ? "Completed" : "Failed",
+             hs->host ? hs->host : "?", elapsed / 1000);
+    free(hs->host);
+    memset(hs, 0, sizeof(*hs));
+}
+
+void tls_handshake_get_stats(tls_handshake_stats_t *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void tls_handshake_reset_stats(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&stats_lock);
+}
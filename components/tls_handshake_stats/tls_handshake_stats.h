@@ -0,0 +1,70 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _TLS_HANDSHAKE_STATS_H_
+#define _TLS_HANDSHAKE_STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_tls.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * TLS handshake statistics, shared by httpc and sh2lib, for the
+ * "tls-handshakes" diag command.
+ *
+ * A handshake is timed like this:
+ *
+ *     tls_handshake_t hs;
+ *     tls_handshake_start(&hs, host, host_len);
+ *     tls = esp_tls_conn_new(host, host_len, port, cfg);
+ *     tls_handshake_done(&hs, tls);
+ *
+ * For the async API, call done() once esp_tls_conn_new_async() completed or
+ * failed.
+ */
+
+typedef struct {
+    char *host;                         /* NULL when no handshake is in progress */
+    int64_t start_us;
+} tls_handshake_t;
+
+void tls_handshake_start(tls_handshake_t *hs, const char *host, size_t host_len);
+
+/**
+ * Call once the handshake completed, with the connection, or failed, with
+ * NULL. Records the handshake time.
+ */
+void tls_handshake_done(tls_handshake_t *hs, struct esp_tls *tls);
+
+typedef struct {
+    uint32_t completed;
+    uint32_t failed;
+    uint64_t completed_us;      /* Total time of the completed ones */
+    uint32_t max_us;            /* Of the slowest one */
+} tls_handshake_stats_t;
+
+void tls_handshake_get_stats(tls_handshake_stats_t *stats);
+
+/* Clear the statistics */
+void tls_handshake_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _TLS_HANDSHAKE_STATS_H_ */